@@ -24,8 +24,10 @@
 /**@brief Array of structures containing information about the registered application modules. */
 static struct
 {
-    ble_uuid_t                     srv_uuid;     /**< The UUID of the service for which the application module had registered itself.*/
-    ble_db_discovery_evt_handler_t evt_handler;  /**< The event handler of the application module to be called in case there are any events.*/
+    ble_uuid_t                     srv_uuid;         /**< The UUID of the service for which the application module had registered itself.*/
+    ble_db_discovery_evt_handler_t evt_handler;      /**< The event handler of the application module to be called in case there are any events.*/
+    const uint16_t               * p_char_uuids;     /**< Wanted characteristics, NULL to discover all of them. */
+    uint8_t                        char_uuid_count;  /**< Number of wanted characteristics. */
 } m_registered_handlers[DB_DISCOVERY_MAX_USERS];
 
 /**@brief   Array of structures containing pending events to be sent to the application modules.
@@ -81,8 +83,10 @@ static uint32_t registered_handler_set(const ble_uuid_t * const       p_srv_uuid
 {
     if (m_num_of_handlers_reg < DB_DISCOVERY_MAX_USERS)
     {
-        m_registered_handlers[m_num_of_handlers_reg].srv_uuid    = *p_srv_uuid;
-        m_registered_handlers[m_num_of_handlers_reg].evt_handler = p_evt_handler;
+        m_registered_handlers[m_num_of_handlers_reg].srv_uuid        = *p_srv_uuid;
+        m_registered_handlers[m_num_of_handlers_reg].evt_handler     = p_evt_handler;
+        m_registered_handlers[m_num_of_handlers_reg].p_char_uuids    = NULL;
+        m_registered_handlers[m_num_of_handlers_reg].char_uuid_count = 0;
 
         m_num_of_handlers_reg++;
 
@@ -274,6 +278,7 @@ static void on_srv_disc_completion(ble_db_discovery_t * p_db_discovery)
 
             return;
         }
+        p_db_discovery->round_trips++;
     }
     else
     {
@@ -416,6 +421,8 @@ static uint32_t characteristics_discover(ble_db_discovery_t * const p_db_discove
 
     handle_range.end_handle = p_srv_being_discovered->handle_range.end_handle;
 
+    p_db_discovery->round_trips++;
+
     return sd_ble_gattc_characteristics_discover(p_db_discovery->conn_handle,
                                                  &handle_range);
 }
@@ -508,11 +515,256 @@ static uint32_t descriptors_discover(ble_db_discovery_t * const p_db_discovery,
 
     *p_raise_discov_complete = false;
 
+    p_db_discovery->round_trips++;
+
     return sd_ble_gattc_descriptors_discover(p_db_discovery->conn_handle,
                                              &handle_range);
 }
 
 
+/**@brief     Function for finding out if the service being discovered is registered with a list of
+ *            wanted characteristics.
+ *
+ * @param[in] p_db_discovery Pointer to the DB Discovery structure.
+ */
+static bool is_targeted(ble_db_discovery_t * const p_db_discovery)
+{
+    return (m_registered_handlers[p_db_discovery->curr_srv_ind].p_char_uuids != NULL);
+}
+
+
+/**@brief     Function for finding out if a characteristic is wanted and not found yet.
+ *
+ * @param[in] p_db_discovery Pointer to the DB Discovery structure.
+ * @param[in] p_char         Characteristic from a discovery response.
+ */
+static bool is_char_wanted(ble_db_discovery_t * const     p_db_discovery,
+                           const ble_gattc_char_t * const p_char)
+{
+    ble_db_discovery_srv_t * p_srv_being_discovered;
+    uint32_t                 i;
+    bool                     wanted = false;
+
+    p_srv_being_discovered = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
+
+    for (i = 0; i < m_registered_handlers[p_db_discovery->curr_srv_ind].char_uuid_count; i++)
+    {
+        if (m_registered_handlers[p_db_discovery->curr_srv_ind].p_char_uuids[i] == p_char->uuid.uuid)
+        {
+            wanted = true;
+            break;
+        }
+    }
+
+    for (i = 0; wanted && (i < p_srv_being_discovered->char_count); i++)
+    {
+        if (p_srv_being_discovered->charateristics[i].characteristic.uuid.uuid == p_char->uuid.uuid)
+        {
+            // Found already.
+            wanted = false;
+        }
+    }
+
+    return wanted;
+}
+
+
+/**@brief      Function for performing the descriptor discovery of a targeted service.
+ *
+ * @details    Only characteristics that can notify or indicate have their descriptors discovered,
+ *             from start_handle up to the service end. The response handler stops at the CCCD or
+ *             at the next characteristic declaration, so the range needs no next characteristic.
+ *             When no characteristic is left the service discovery is complete.
+ *
+ * @param[in]  p_db_discovery Pointer to the DB Discovery structure.
+ * @param[in]  start_handle   First handle to look at for the current characteristic, or
+ *                            BLE_GATT_HANDLE_INVALID to start after its value.
+ */
+static void targeted_descriptors_discover(ble_db_discovery_t * const p_db_discovery,
+                                          uint16_t                   start_handle)
+{
+    ble_db_discovery_srv_t   * p_srv_being_discovered;
+    ble_gattc_char_t         * p_char;
+    ble_gattc_handle_range_t   handle_range;
+    uint32_t                   err_code;
+
+    p_srv_being_discovered = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
+
+    while (p_db_discovery->curr_char_ind < p_srv_being_discovered->char_count)
+    {
+        p_char = &(p_srv_being_discovered->charateristics[p_db_discovery->curr_char_ind].characteristic);
+
+        if ((start_handle == BLE_GATT_HANDLE_INVALID)
+            && (p_char->handle_value < p_srv_being_discovered->handle_range.end_handle))
+        {
+            start_handle = p_char->handle_value + 1;
+        }
+
+        if ((p_char->char_props.notify || p_char->char_props.indicate)
+            && (start_handle != BLE_GATT_HANDLE_INVALID))
+        {
+            handle_range.start_handle = start_handle;
+            handle_range.end_handle   = p_srv_being_discovered->handle_range.end_handle;
+
+            err_code = sd_ble_gattc_descriptors_discover(p_db_discovery->conn_handle,
+                                                         &handle_range);
+            if (err_code != NRF_SUCCESS)
+            {
+                p_db_discovery->discovery_in_progress = false;
+
+                discovery_error_evt_trigger(p_db_discovery, err_code);
+
+                return;
+            }
+
+            p_db_discovery->round_trips++;
+            return;
+        }
+
+        // No CCCD possible, the characteristic is complete.
+        p_db_discovery->curr_char_ind++;
+        start_handle = BLE_GATT_HANDLE_INVALID;
+    }
+
+    DB_LOG("[DB]: Targeted discovery of service with UUID 0x%x completed for Connection"
+           " handle %d\r\n", p_srv_being_discovered->srv_uuid.uuid,
+           p_db_discovery->conn_handle);
+
+    discovery_complete_evt_trigger(p_db_discovery, true);
+
+    on_srv_disc_completion(p_db_discovery);
+}
+
+
+/**@brief     Function for handling a characteristic discovery response of a targeted service.
+ *
+ * @details   Only wanted characteristics are stored. Discovery continues while some are missing
+ *            and the service has handles left.
+ *
+ * @param[in] p_db_discovery    Pointer to the DB Discovery structure.
+ * @param[in] p_ble_gattc_evt   Pointer to the GATT Client event.
+ */
+static void on_targeted_char_discovery_rsp(ble_db_discovery_t * const    p_db_discovery,
+                                           const ble_gattc_evt_t * const p_ble_gattc_evt)
+{
+    ble_db_discovery_srv_t              * p_srv_being_discovered;
+    const ble_gattc_evt_char_disc_rsp_t * p_char_disc_rsp_evt;
+    const ble_gattc_char_t              * p_last_char;
+    ble_gattc_handle_range_t              handle_range;
+    uint32_t                              err_code;
+    uint32_t                              i;
+
+    p_srv_being_discovered = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
+    p_char_disc_rsp_evt    = &(p_ble_gattc_evt->params.char_disc_rsp);
+
+    if ((p_ble_gattc_evt->gatt_status == BLE_GATT_STATUS_SUCCESS) && (p_char_disc_rsp_evt->count > 0))
+    {
+        for (i = 0; i < p_char_disc_rsp_evt->count; i++)
+        {
+            if (is_char_wanted(p_db_discovery, &(p_char_disc_rsp_evt->chars[i]))
+                && (p_srv_being_discovered->char_count < BLE_DB_DISCOVERY_MAX_CHAR_PER_SRV))
+            {
+                p_srv_being_discovered->charateristics[p_srv_being_discovered->char_count].characteristic =
+                    p_char_disc_rsp_evt->chars[i];
+                p_srv_being_discovered->charateristics[p_srv_being_discovered->char_count].cccd_handle =
+                    BLE_GATT_HANDLE_INVALID;
+                p_srv_being_discovered->char_count++;
+            }
+        }
+
+        p_last_char = &(p_char_disc_rsp_evt->chars[p_char_disc_rsp_evt->count - 1]);
+
+        if ((p_srv_being_discovered->char_count <
+             m_registered_handlers[p_db_discovery->curr_srv_ind].char_uuid_count)
+            && (p_last_char->handle_value < p_srv_being_discovered->handle_range.end_handle))
+        {
+            handle_range.start_handle = p_last_char->handle_value + 1;
+            handle_range.end_handle   = p_srv_being_discovered->handle_range.end_handle;
+
+            err_code = sd_ble_gattc_characteristics_discover(p_db_discovery->conn_handle,
+                                                             &handle_range);
+            if (err_code != NRF_SUCCESS)
+            {
+                p_db_discovery->discovery_in_progress = false;
+
+                discovery_error_evt_trigger(p_db_discovery, err_code);
+
+                return;
+            }
+
+            p_db_discovery->round_trips++;
+            return;
+        }
+    }
+
+    p_db_discovery->curr_char_ind = 0;
+
+    targeted_descriptors_discover(p_db_discovery, BLE_GATT_HANDLE_INVALID);
+}
+
+
+/**@brief     Function for handling a descriptor discovery response of a targeted service.
+ *
+ * @param[in] p_db_discovery    Pointer to the DB Discovery structure.
+ * @param[in] p_ble_gattc_evt   Pointer to the GATT Client event.
+ */
+static void on_targeted_desc_discovery_rsp(ble_db_discovery_t * const    p_db_discovery,
+                                           const ble_gattc_evt_t * const p_ble_gattc_evt)
+{
+    const ble_gattc_evt_desc_disc_rsp_t * p_desc_disc_rsp_evt;
+    ble_db_discovery_srv_t              * p_srv_being_discovered;
+    ble_db_discovery_char_t             * p_char_being_discovered;
+    uint16_t                              next_handle = BLE_GATT_HANDLE_INVALID;
+    uint32_t                              i;
+
+    p_srv_being_discovered  = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
+    p_char_being_discovered = &(p_srv_being_discovered->charateristics[p_db_discovery->curr_char_ind]);
+    p_desc_disc_rsp_evt     = &(p_ble_gattc_evt->params.desc_disc_rsp);
+
+    if ((p_ble_gattc_evt->gatt_status == BLE_GATT_STATUS_SUCCESS) && (p_desc_disc_rsp_evt->count > 0))
+    {
+        for (i = 0; i < p_desc_disc_rsp_evt->count; i++)
+        {
+            const ble_gattc_desc_t * p_desc = &(p_desc_disc_rsp_evt->descs[i]);
+
+            if (p_desc->uuid.type != BLE_UUID_TYPE_BLE)
+            {
+                continue;
+            }
+
+            if (p_desc->uuid.uuid == BLE_UUID_DESCRIPTOR_CLIENT_CHAR_CONFIG)
+            {
+                p_char_being_discovered->cccd_handle = p_desc->handle;
+                break;
+            }
+
+            if ((p_desc->uuid.uuid == BLE_UUID_CHARACTERISTIC)
+                || (p_desc->uuid.uuid == BLE_UUID_SERVICE_PRIMARY)
+                || (p_desc->uuid.uuid == BLE_UUID_SERVICE_SECONDARY))
+            {
+                // Past the characteristic, it has no CCCD.
+                break;
+            }
+        }
+
+        if ((i == p_desc_disc_rsp_evt->count)
+            && (p_desc_disc_rsp_evt->descs[i - 1].handle <
+                p_srv_being_discovered->handle_range.end_handle))
+        {
+            // The response ended inside the characteristic, go on after it.
+            next_handle = p_desc_disc_rsp_evt->descs[i - 1].handle + 1;
+        }
+    }
+
+    if (next_handle == BLE_GATT_HANDLE_INVALID)
+    {
+        p_db_discovery->curr_char_ind++;
+    }
+
+    targeted_descriptors_discover(p_db_discovery, next_handle);
+}
+
+
 /**@brief     Function for handling primary service discovery response.
  *
  * @details   This function will handle the primary service discovery response and start the
@@ -570,6 +822,12 @@ static void on_characteristic_discovery_rsp(ble_db_discovery_t * const    p_db_d
     ble_db_discovery_srv_t * p_srv_being_discovered;
     bool                     perform_desc_discov = false;
 
+    if (is_targeted(p_db_discovery))
+    {
+        on_targeted_char_discovery_rsp(p_db_discovery, p_ble_gattc_evt);
+        return;
+    }
+
     p_srv_being_discovered = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
 
     if (p_ble_gattc_evt->gatt_status == BLE_GATT_STATUS_SUCCESS)
@@ -691,6 +949,12 @@ static void on_descriptor_discovery_rsp(ble_db_discovery_t * const    p_db_disco
     const ble_gattc_evt_desc_disc_rsp_t * p_desc_disc_rsp_evt;
     ble_db_discovery_srv_t              * p_srv_being_discovered;
 
+    if (is_targeted(p_db_discovery))
+    {
+        on_targeted_desc_discovery_rsp(p_db_discovery, p_ble_gattc_evt);
+        return;
+    }
+
     p_srv_being_discovered = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
 
     p_desc_disc_rsp_evt = &(p_ble_gattc_evt->params.desc_disc_rsp);
@@ -808,6 +1072,36 @@ uint32_t ble_db_discovery_evt_register(const ble_uuid_t * const             p_uu
 }
 
 
+uint32_t ble_db_discovery_evt_register_targeted(const ble_uuid_t * const             p_uuid,
+                                                const uint16_t * const               p_char_uuids,
+                                                uint8_t                              char_uuid_count,
+                                                const ble_db_discovery_evt_handler_t evt_handler)
+{
+    uint32_t err_code;
+
+    if (p_char_uuids == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if ((char_uuid_count == 0) || (char_uuid_count > BLE_DB_DISCOVERY_MAX_CHAR_PER_SRV))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    err_code = ble_db_discovery_evt_register(p_uuid, evt_handler);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    m_registered_handlers[m_num_of_handlers_reg - 1].p_char_uuids    = p_char_uuids;
+    m_registered_handlers[m_num_of_handlers_reg - 1].char_uuid_count = char_uuid_count;
+
+    return NRF_SUCCESS;
+}
+
+
 uint32_t ble_db_discovery_start(ble_db_discovery_t * const p_db_discovery,
                                 uint16_t                   conn_handle)
 {
@@ -837,8 +1131,10 @@ uint32_t ble_db_discovery_start(ble_db_discovery_t * const p_db_discovery,
     m_num_of_discoveries_made = 0;
     m_pending_usr_evt_index   = 0;
 
-    p_db_discovery->curr_srv_ind = 0;
-    p_db_discovery->conn_handle  = conn_handle;
+    p_db_discovery->curr_srv_ind  = 0;
+    p_db_discovery->curr_char_ind = 0;
+    p_db_discovery->conn_handle   = conn_handle;
+    p_db_discovery->round_trips   = 0;
 
     p_srv_being_discovered = &(p_db_discovery->services[p_db_discovery->curr_srv_ind]);
 
@@ -856,6 +1152,7 @@ uint32_t ble_db_discovery_start(ble_db_discovery_t * const p_db_discovery,
     {
         return err_code;
     }
+    p_db_discovery->round_trips++;
     p_db_discovery->discovery_in_progress = true;
 
     return NRF_SUCCESS;
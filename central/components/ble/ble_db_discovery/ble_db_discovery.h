@@ -114,6 +114,7 @@ typedef struct
     uint8_t                curr_char_ind;                       /**< Index of the current characteristic being discovered. This is intended for internal use during service discovery.*/
     uint8_t                curr_srv_ind;                        /**< Index of the current service being discovered. This is intended for internal use during service discovery.*/
     bool                   discovery_in_progress;               /**< Variable to indicate if there is a service discovery in progress. */
+    uint8_t                round_trips;                         /**< Number of GATT procedures (request and response) used by the current discovery. */
 } ble_db_discovery_t;
 
 
@@ -196,6 +197,31 @@ uint32_t ble_db_discovery_evt_register(const ble_uuid_t * const             p_uu
                                        const ble_db_discovery_evt_handler_t evt_handler);
 
 
+/**@brief Function for registering with the DB Discovery module for some characteristics only.
+ *
+ * @details   Like @ref ble_db_discovery_evt_register, but only the listed characteristics are
+ *            reported. Characteristic discovery stops once all of them are found, and descriptor
+ *            discovery is only done for those that can notify or indicate and stops at their
+ *            CCCD, so procedures the application has no use for are skipped.
+ *
+ * @param[in] p_uuid             Pointer to the UUID of the service to be discovered at the server.
+ * @param[in] p_char_uuids       16 bit UUIDs of the wanted characteristics, the UUID type is the
+ *                               one of the service. Must stay valid while registered.
+ * @param[in] char_uuid_count    Number of wanted characteristics, at most
+ *                               @ref BLE_DB_DISCOVERY_MAX_CHAR_PER_SRV.
+ * @param[in] evt_handler        Event handler to be called by the DB discovery module when any event
+ *                               related to discovery of the registered service occurs.
+ *
+ * @retval    NRF_SUCCESS               Operation success.
+ * @retval    NRF_ERROR_INVALID_PARAM   No or too many characteristics.
+ * @return    Otherwise the errors of @ref ble_db_discovery_evt_register.
+ */
+uint32_t ble_db_discovery_evt_register_targeted(const ble_uuid_t * const             p_uuid,
+                                                const uint16_t * const               p_char_uuids,
+                                                uint8_t                              char_uuid_count,
+                                                const ble_db_discovery_evt_handler_t evt_handler);
+
+
 /**@brief Function for starting the discovery of the GATT database at the server.
  *
  * @warning p_db_discovery structure must be zero-initialized.
@@ -0,0 +1,217 @@
+#include <stdbool.h>
+
+#include <app_error.h>
+#include <app_timer.h>
+#include <nordic_common.h>
+
+#include "SEGGER_RTT.h"
+
+#include "mhs_c_proxy.h"
+
+#include "conn_policy.h"
+
+#define CONN_POLICY_TICK        APP_TIMER_TICKS(1000, APP_TIMER_PRESCALER)
+
+/**@brief A connected peripheral, all of them follow the same state. */
+typedef struct
+{
+    uint16_t conn_handle;       /**< BLE_CONN_HANDLE_INVALID while unused. */
+    bool     update_pending;    /**< The last update was refused, retry on the next tick. */
+} conn_policy_link_t;
+
+static app_timer_id_t       m_conn_policy_timer_id;
+static conn_policy_link_t   m_links[MHS_C_MAX_LINKS];
+static uint8_t              m_link_count = 0;
+static bool                 m_active = false;
+static uint8_t              m_idle_s = 0;               /**< Seconds since the last button press. */
+
+static const ble_gap_conn_params_t m_active_params =
+{
+    .min_conn_interval = CONN_POLICY_ACTIVE_MIN_INTERVAL,
+    .max_conn_interval = CONN_POLICY_ACTIVE_MAX_INTERVAL,
+    .slave_latency     = CONN_POLICY_ACTIVE_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_POLICY_SUP_TIMEOUT,
+};
+
+static const ble_gap_conn_params_t m_idle_params =
+{
+    .min_conn_interval = CONN_POLICY_IDLE_MIN_INTERVAL,
+    .max_conn_interval = CONN_POLICY_IDLE_MAX_INTERVAL,
+    .slave_latency     = CONN_POLICY_IDLE_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_POLICY_SUP_TIMEOUT,
+};
+
+
+static const ble_gap_conn_params_t * current_params(void)
+{
+    return m_active ? &m_active_params : &m_idle_params;
+}
+
+
+static conn_policy_link_t * link_get(uint16_t conn_handle)
+{
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (m_links[i].conn_handle == conn_handle)
+        {
+            return &m_links[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+static void conn_params_update(conn_policy_link_t * p_link)
+{
+    uint32_t err_code;
+
+    err_code = sd_ble_gap_conn_param_update(p_link->conn_handle, current_params());
+
+    // NRF_ERROR_BUSY while another procedure runs on the link.
+    p_link->update_pending = (err_code != NRF_SUCCESS);
+    if (p_link->update_pending)
+    {
+        SEGGER_RTT_printf(0, "conn params update failed %d\r\n", err_code);
+    }
+}
+
+
+static void conn_params_select(bool active)
+{
+    m_active = active;
+    SEGGER_RTT_printf(0, "conn policy %s\r\n", active ? "active" : "idle");
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID)
+        {
+            conn_params_update(&m_links[i]);
+        }
+    }
+}
+
+
+static void conn_policy_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (m_idle_s < UINT8_MAX)
+    {
+        m_idle_s++;
+    }
+
+    if (m_active && (m_idle_s >= CONN_POLICY_IDLE_TIMEOUT_S))
+    {
+        conn_params_select(false);
+        return;
+    }
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if ((m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID) && m_links[i].update_pending)
+        {
+            conn_params_update(&m_links[i]);
+        }
+    }
+}
+
+
+void conn_policy_init(void)
+{
+    uint32_t err_code;
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        m_links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+    }
+
+    err_code = app_timer_create(&m_conn_policy_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                conn_policy_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+const ble_gap_conn_params_t * conn_policy_connect_params(void)
+{
+    return &m_active_params;
+}
+
+
+void conn_policy_activity(void)
+{
+    m_idle_s = 0;
+
+    if ((m_link_count != 0) && !m_active)
+    {
+        conn_params_select(true);
+    }
+}
+
+
+void conn_policy_on_ble_evt(ble_evt_t * p_ble_evt)
+{
+    uint32_t              err_code;
+    const ble_gap_evt_t * p_gap_evt = &p_ble_evt->evt.gap_evt;
+    conn_policy_link_t  * p_link;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            // Connected with the active parameters, the others follow. Setting up a new
+            // peripheral counts as activity.
+            p_link = link_get(BLE_CONN_HANDLE_INVALID);
+            if (p_link == NULL)
+            {
+                break;
+            }
+            p_link->conn_handle    = p_gap_evt->conn_handle;
+            p_link->update_pending = false;
+            m_idle_s               = 0;
+            if (m_link_count++ == 0)
+            {
+                m_active = true;
+                err_code = app_timer_start(m_conn_policy_timer_id, CONN_POLICY_TICK, NULL);
+                APP_ERROR_CHECK(err_code);
+            }
+            else if (!m_active)
+            {
+                conn_params_select(true);
+            }
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            p_link = link_get(p_gap_evt->conn_handle);
+            if (p_link == NULL)
+            {
+                break;
+            }
+            p_link->conn_handle = BLE_CONN_HANDLE_INVALID;
+            if (--m_link_count == 0)
+            {
+                err_code = app_timer_stop(m_conn_policy_timer_id);
+                APP_ERROR_CHECK(err_code);
+            }
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE_REQUEST:
+            // The central knows when the user is busy, answer with the parameters of the
+            // current state instead of the requested ones.
+            p_link = link_get(p_gap_evt->conn_handle);
+            if (p_link != NULL)
+            {
+                conn_params_update(p_link);
+            }
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+            SEGGER_RTT_printf(0, "conn params interval %d x1.25 ms latency %d\r\n",
+                              p_gap_evt->params.conn_param_update.conn_params.max_conn_interval,
+                              p_gap_evt->params.conn_param_update.conn_params.slave_latency);
+            break;
+
+        default:
+            break;
+    }
+}
@@ -19,6 +19,7 @@
  */
 #include <stdlib.h>
 #include <app_error.h>
+#include <app_scheduler.h>
 #include <nrf_soc.h>
 #include "nrf_delay.h"
 
@@ -29,6 +30,12 @@
 
 #include "SEGGER_RTT.h"
 
+#ifdef CPU_DUTY_PROFILE
+#include "app_timer.h"
+
+#define CPU_DUTY_REPORT_TICKS   APP_TIMER_TICKS(10000, APP_TIMER_PRESCALER)  /**< Window of one report. */
+#endif
+
 /**@brief Function for the Power manager.
  */
 static void power_manage(void)
@@ -37,6 +44,43 @@ static void power_manage(void)
     APP_ERROR_CHECK(err_code);
 }
 
+#ifdef CPU_DUTY_PROFILE
+/**@brief Sleep like power_manage() and report over RTT which share of each window the CPU
+ *        was awake. Short interrupts that do not wake the main loop count as asleep.
+ */
+static void power_manage_profiled(void)
+{
+    static bool     started = false;
+    static uint32_t window_start;
+    static uint32_t asleep_ticks = 0;
+    uint32_t before;
+    uint32_t after;
+    uint32_t ticks;
+
+    (void)app_timer_cnt_get(&before);
+    if (!started)
+    {
+        window_start = before;
+        started      = true;
+    }
+
+    power_manage();
+
+    (void)app_timer_cnt_get(&after);
+    (void)app_timer_cnt_diff_compute(after, before, &ticks);
+    asleep_ticks += ticks;
+
+    (void)app_timer_cnt_diff_compute(after, window_start, &ticks);
+    if (ticks >= CPU_DUTY_REPORT_TICKS)
+    {
+        SEGGER_RTT_printf(0, "awake %d/1000 over %d ms\r\n",
+                          ((ticks - asleep_ticks) * 1000) / ticks, (ticks * 1000) / 32768);
+        window_start = after;
+        asleep_ticks = 0;
+    }
+}
+#endif // CPU_DUTY_PROFILE
+
 /**@brief Function for application main entry.
  */
 int main(void)
@@ -51,10 +95,15 @@ int main(void)
 
     system_init();
 
-    // Enter main loop.
+    // Enter main loop, all work is done from the scheduler between two sleeps.
     for (;;)
     {
-        //power_manage();
+        app_sched_execute();
+#ifdef CPU_DUTY_PROFILE
+        power_manage_profiled();
+#else
+        power_manage();
+#endif
     }
 }
 
@@ -13,18 +13,23 @@
 #include "nrf_gpio.h"
 #include "app_timer.h"
 #include "ble_hci.h"
-#include "app_timer.h"
+#include "app_scheduler.h"
+#include "app_timer_appsh.h"
 #include "app_gpiote.h"
 #include "ble_db_discovery.h"
 #include "device_manager.h"
 #include "nrf_gpio.h"
 #include "pstorage.h"
 #include "softdevice_handler.h"
+#include "softdevice_handler_appsh.h"
 #include "nrf_delay.h"
 
 #include "button.h"
+#include "conn_policy.h"
 #include "ble_mhs_c.h"
 #include "oled.h"
+#include "mhs_c_bcast.h"
+#include "mhs_c_esb.h"
 #include "mhs_c_proxy.h"
 
 #include "system_init.h"
@@ -38,6 +43,9 @@
 #define APP_TIMER_MAX_TIMERS             6                  /**< Maximum number of simultaneously created timers. */
 #define APP_TIMER_OP_QUEUE_SIZE          4                                          /**< Size of timer operation queues. */
 
+#define SCHED_MAX_EVENT_DATA_SIZE        APP_TIMER_SCHED_EVT_SIZE                   /**< Largest event passed through the scheduler, SoftDevice events are fetched in the main loop and take no space. */
+#define SCHED_QUEUE_SIZE                 10                                         /**< Events waiting for the main loop. */
+
 #define DEVICE_NAME                      "Marsh"
 #define APP_ADV_INTERVAL                 300                                         /**< The advertising interval (in units of 0.625 ms. This value corresponds to 25 ms). */
 #define APP_ADV_TIMEOUT_IN_SECONDS       600                                        /**< The advertising timeout in units of seconds. */
@@ -47,7 +55,7 @@
 #define MAX_CONN_PARAMS_UPDATE_COUNT     3                                          /**< Number of attempts before giving up the connection parameter negotiation. */
 
 #define SEC_PARAM_BOND             1                                  /**< Perform bonding. */
-#define SEC_PARAM_MITM             1                                  /**< Man In The Middle protection not required. */
+#define SEC_PARAM_MITM             0                                  /**< Man In The Middle protection not required. */
 #define SEC_PARAM_IO_CAPABILITIES  BLE_GAP_IO_CAPS_NONE               /**< No I/O capabilities. */
 #define SEC_PARAM_OOB              0                                  /**< Out Of Band data not available. */
 #define SEC_PARAM_MIN_KEY_SIZE     7                                  /**< Minimum encryption key size. */
@@ -55,11 +63,8 @@
 
 #define SCAN_INTERVAL              0x00A0                             /**< Determines scan interval in units of 0.625 millisecond. */
 #define SCAN_WINDOW                0x0050                             /**< Determines scan window in units of 0.625 millisecond. */
-
-#define MIN_CONNECTION_INTERVAL    MSEC_TO_UNITS(70, UNIT_1_25_MS)   /**< Determines minimum connection interval in millisecond. */
-#define MAX_CONNECTION_INTERVAL    MSEC_TO_UNITS(100, UNIT_1_25_MS)    /**< Determines maximum connection interval in millisecond. */
-#define SLAVE_LATENCY              0                                  /**< Determines slave latency in counts of connection events. */
-#define SUPERVISION_TIMEOUT        MSEC_TO_UNITS(4000, UNIT_10_MS)    /**< Determines supervision time-out in units of 10 millisecond. */
+#define WHITELIST_SCAN_WINDOW      SCAN_INTERVAL                      /**< Listen all the time while reconnecting to a bonded peripheral. */
+#define WHITELIST_SCAN_TIMEOUT     0x0005                             /**< Seconds to reconnect to a bonded peripheral before scanning for any. */
 
 
 #define UUID16_SIZE                2                                  /**< Size of 16 bit UUID */
@@ -97,21 +102,11 @@ typedef struct
 
 static bool                         m_memory_access_in_progress = false; /**< Flag to keep track of ongoing operations on persistent memory. */
 static ble_gap_scan_params_t        m_scan_param;                        /**< Scan parameters requested for scanning and connection. */
-//static dm_application_instance_t    m_dm_app_id;                         /**< Application identifier. */
-static uint8_t                      m_scan_mode;
-
-static ble_db_discovery_t           m_ble_db_discovery;
-
-/**
- * @brief Connection parameters requested for connection.
- */
-static const ble_gap_conn_params_t m_connection_param =
-{
-    (uint16_t)MIN_CONNECTION_INTERVAL,   // Minimum connection
-    (uint16_t)MAX_CONNECTION_INTERVAL,   // Maximum connection
-    0,                                   // Slave latency
-    (uint16_t)SUPERVISION_TIMEOUT        // Supervision time-out
-};
+static dm_application_instance_t    m_dm_app_id;                         /**< Application identifier. */
+static uint8_t                      m_scan_mode = BLE_WHITELIST_SCAN;
+static bool                         m_scanning = false;                  /**< Scanning or connecting, until connected or timed out. */
+static bool                         m_connecting = false;                /**< A connection to a found peripheral is being set up. */
+static uint32_t                     m_disconnect_ticks;                  /**< RTC1 counter at the last disconnection. */
 
 /**
  * @brief Parses advertisement data, providing length and location of the field in case
@@ -149,7 +144,50 @@ static uint32_t adv_report_parse(uint8_t type, data_t * p_advdata, data_t * p_ty
 }
 
 
+/**@brief Log the status a peripheral advertises, see ble_mhs_c.h. Units out of reach of a
+ *        connection, or beyond MHS_C_MAX_LINKS, are monitored this way while scanning.
+ */
+static void adv_status_report(data_t * p_advdata, ble_gap_addr_t const * p_addr)
+{
+    data_t    manuf_data;
+    uint8_t * p_record;
+    int16_t   temperature;
+
+    if (adv_report_parse(BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA, p_advdata, &manuf_data)
+            != NRF_SUCCESS)
+    {
+        return;
+    }
+
+    // Broadcast commands use the same company identifier, the length tells them apart.
+    if ((manuf_data.data_len != (2 + MHS_ADV_STATUS_LEN))
+            || (uint16_decode(manuf_data.p_data) != MHS_ADV_STATUS_COMPANY_ID))
+    {
+        return;
+    }
+
+    p_record    = &manuf_data.p_data[2];
+    temperature = (int16_t)uint16_decode(&p_record[0]);
+
+    if (temperature == MHS_ADV_STATUS_NO_TEMPERATURE)
+    {
+        SEGGER_RTT_printf(0, "status %x: no temperature", p_addr->addr[0]);
+    }
+    else
+    {
+        SEGGER_RTT_printf(0, "status %x: %d/16 C", p_addr->addr[0], temperature);
+    }
+    SEGGER_RTT_printf(0, " heat %d motors %x duty %d\r\n",
+                      (p_record[2] & MHS_ADV_STATUS_FLAG_HEAT_ON) != 0,
+                      p_record[3],
+                      p_record[4]);
+}
+
+
 /**@breif Function to start scanning.
+ *
+ * @details Scanning goes on after a connection until MHS_C_MAX_LINKS peripherals are
+ *          connected. Nothing is done while a scan or connection is running.
  */
 static void scan_start(void)
 {
@@ -159,6 +197,11 @@ static void scan_start(void)
     uint32_t              err_code;
     uint32_t              count;
 
+    if (m_scanning || (mhs_c_link_count() >= MHS_C_MAX_LINKS))
+    {
+        return;
+    }
+
     // Verify if there is any flash access pending, if yes delay starting scanning until
     // it's complete.
     err_code = pstorage_access_status_get(&count);
@@ -177,8 +220,8 @@ static void scan_start(void)
     whitelist.pp_irks    = p_whitelist_irk;
 
     // Request creating of whitelist.
-    //err_code = dm_whitelist_create(&m_dm_app_id,&whitelist);
-    //APP_ERROR_CHECK(err_code);
+    err_code = dm_whitelist_create(&m_dm_app_id, &whitelist);
+    APP_ERROR_CHECK(err_code);
 
     if (((whitelist.addr_count == 0) && (whitelist.irk_count == 0)) ||
          (m_scan_mode != BLE_WHITELIST_SCAN))
@@ -193,20 +236,74 @@ static void scan_start(void)
     }
     else
     {
-        // Selective scanning based on whitelist first.
-        m_scan_param.active       = 0;            // Active scanning set.
-        m_scan_param.selective    = 1;            // Selective scanning not set.
-        m_scan_param.interval     = SCAN_INTERVAL;// Scan interval.
-        m_scan_param.window       = SCAN_WINDOW;  // Scan window.
-        m_scan_param.p_whitelist  = &whitelist;   // Provide whitelist.
-        m_scan_param.timeout      = 0x001E;       // 30 seconds timeout.
-
-        // Set whitelist scanning state.
-        m_scan_mode = BLE_WHITELIST_SCAN;
+        // Connect to a bonded peripheral directly, the initiator takes the first whitelisted
+        // advertiser, directed advertising included, and listens all the time.
+        m_scan_param.active       = 0;
+        m_scan_param.selective    = 1;
+        m_scan_param.interval     = SCAN_INTERVAL;
+        m_scan_param.window       = WHITELIST_SCAN_WINDOW;
+        m_scan_param.p_whitelist  = &whitelist;
+        m_scan_param.timeout      = WHITELIST_SCAN_TIMEOUT;
+
+        err_code = sd_ble_gap_connect(NULL, &m_scan_param, conn_policy_connect_params());
+        APP_ERROR_CHECK(err_code);
+        m_scanning   = true;
+        m_connecting = true;
+        return;
     }
 
     err_code = sd_ble_gap_scan_start(&m_scan_param);
     APP_ERROR_CHECK(err_code);
+    m_scanning = true;
+}
+
+
+/**@brief Function for handling the Device Manager events.
+ *
+ * @param[in] p_handle      Identifies the peer the event is about.
+ * @param[in] p_event       Event.
+ * @param[in] event_result  Result of the operation the event reports.
+ */
+static uint32_t device_manager_event_handler(dm_handle_t const    * p_handle,
+                                             dm_event_t const     * p_event,
+                                             ret_code_t             event_result)
+{
+    uint32_t    err_code;
+    dm_handle_t handle = (*p_handle);
+
+    mhs_c_on_dm_evt(p_handle, p_event);
+
+    switch (p_event->event_id)
+    {
+        case DM_EVT_CONNECTION:
+            // Pairs a new peripheral, or encrypts with the stored keys of a bonded one.
+            err_code = dm_security_setup_req(&handle);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case DM_EVT_LINK_SECURED:
+        {
+            uint32_t ticks;
+
+            // Time to reconnect, commands can be sent from here on.
+            err_code = app_timer_cnt_get(&ticks);
+            APP_ERROR_CHECK(err_code);
+            err_code = app_timer_cnt_diff_compute(ticks, m_disconnect_ticks, &ticks);
+            APP_ERROR_CHECK(err_code);
+            SEGGER_RTT_printf(0, "link secured %d ms after disconnection\r\n",
+                              ticks * 1000 / APP_TIMER_CLOCK_FREQ);
+            break;
+        }
+
+        case DM_EVT_DEVICE_CONTEXT_LOADED:
+            APP_ERROR_CHECK(event_result);
+            break;
+
+        default:
+            break;
+    }
+
+    return NRF_SUCCESS;
 }
 
 
@@ -223,15 +320,29 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
     {
         case BLE_GAP_EVT_CONNECTED:
         {
+            // MHS setup follows from the device manager connection event. Look for more
+            // peripherals, bonded ones first.
             oled_show_connect_status(true);
-            err_code = ble_db_discovery_start(&m_ble_db_discovery,
-                                              p_ble_evt->evt.gap_evt.conn_handle);
-            APP_ERROR_CHECK(err_code);
+            m_scanning   = false;
+            m_connecting = false;
+            m_scan_mode  = BLE_WHITELIST_SCAN;
+            scan_start();
             break;
         }
         case BLE_GAP_EVT_DISCONNECTED:
         {
-            oled_show_connect_status(false);
+            err_code = app_timer_cnt_get(&m_disconnect_ticks);
+            APP_ERROR_CHECK(err_code);
+            oled_show_connect_status(mhs_c_link_count() != 0);
+
+            // The peripheral advertises directed to us, which only the whitelist connect
+            // picks up. A connection being set up finishes first.
+            if (m_scanning && !m_connecting)
+            {
+                (void)sd_ble_gap_scan_stop();
+                m_scanning = false;
+            }
+            m_scan_mode = BLE_WHITELIST_SCAN;
             scan_start();
             break;
         }
@@ -240,10 +351,18 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
             data_t adv_data;
             data_t type_data;
 
+            if (m_connecting)
+            {
+                // Reports still queued from before the scan was stopped.
+                break;
+            }
+
             // Initialize advertisement report for parsing.
             adv_data.p_data = (uint8_t *)p_gap_evt->params.adv_report.data;
             adv_data.data_len = p_gap_evt->params.adv_report.dlen;
 
+            adv_status_report(&adv_data, &p_gap_evt->params.adv_report.peer_addr);
+
             err_code = adv_report_parse(BLE_GAP_AD_TYPE_16BIT_SERVICE_UUID_MORE_AVAILABLE,
                                         &adv_data,
                                         &type_data);
@@ -284,11 +403,17 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
                         err_code = sd_ble_gap_connect(&p_gap_evt->params.adv_report.\
                                                        peer_addr,
                                                        &m_scan_param,
-                                                       &m_connection_param);
+                                                       conn_policy_connect_params());
 
                         if (err_code != NRF_SUCCESS)
                         {
                             //APPL_LOG("[APPL]: Connection Request Failed, reason %d\r\n", err_code);
+                            m_scanning = false;
+                            scan_start();
+                        }
+                        else
+                        {
+                            m_connecting = true;
                         }
                         break;
                     }
@@ -298,6 +423,13 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
         }
 
         case BLE_GAP_EVT_TIMEOUT:
+            if ((p_gap_evt->params.timeout.src == BLE_GAP_TIMEOUT_SRC_SCAN)
+                    || (p_gap_evt->params.timeout.src == BLE_GAP_TIMEOUT_SRC_CONN))
+            {
+                m_scanning   = false;
+                m_connecting = false;
+            }
+
             if (p_gap_evt->params.timeout.src == BLE_GAP_TIMEOUT_SRC_SCAN)
             {
                 //APPL_LOG("[APPL]: Scan timed out.\r\n");
@@ -311,17 +443,15 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
             }
             else if (p_gap_evt->params.timeout.src == BLE_GAP_TIMEOUT_SRC_CONN)
             {
-                //APPL_LOG("[APPL]: Connection Request timed out.\r\n");
+                // The bonded peripheral did not show up, look for any.
+                if (m_scan_mode == BLE_WHITELIST_SCAN)
+                {
+                    m_scan_mode = BLE_FAST_SCAN;
+                    scan_start();
+                }
             }
             break;
 
-        case BLE_GAP_EVT_CONN_PARAM_UPDATE_REQUEST:
-            // Accepting parameters requested by peer.
-            err_code = sd_ble_gap_conn_param_update(p_gap_evt->conn_handle,
-                                                    &p_gap_evt->params.conn_param_update_request.conn_params);
-            APP_ERROR_CHECK(err_code);
-            break;
-
         default:
             break;
     }
@@ -329,22 +459,23 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
 
 /**@brief Function for dispatching a BLE stack event to all modules with a BLE stack event handler.
  *
- * @details This function is called from the BLE Stack event interrupt handler after a BLE stack
+ * @details This function is called from the main loop through the scheduler after a BLE stack
  *          event has been received.
  *
  * @param[in] p_ble_evt  Bluetooth stack event.
  */
 static void ble_evt_dispatch(ble_evt_t * p_ble_evt)
 {
-    ble_db_discovery_on_ble_evt(&m_ble_db_discovery, p_ble_evt);
-    ble_mhs_c_on_ble_evt(get_mhs_obj(), p_ble_evt);
+    dm_ble_evt_handler(p_ble_evt);
+    mhs_c_on_ble_evt(p_ble_evt);
+    conn_policy_on_ble_evt(p_ble_evt);
     on_ble_evt(p_ble_evt);
 }
 
 
 /**@brief Function for dispatching a system event to interested modules.
  *
- * @details This function is called from the System event interrupt handler after a system
+ * @details This function is called from the main loop through the scheduler after a system
  *          event has been received.
  *
  * @param[in] sys_evt  System stack event.
@@ -352,6 +483,19 @@ static void ble_evt_dispatch(ble_evt_t * p_ble_evt)
 static void sys_evt_dispatch(uint32_t sys_evt)
 {
     pstorage_sys_event_handler(sys_evt);
+#ifdef MHS_ESB
+    mhs_c_esb_on_sys_evt(sys_evt);
+#elif defined(MHS_BCAST)
+    mhs_c_bcast_on_sys_evt(sys_evt);
+#endif
+
+    // Scanning waits for flash access to finish.
+    if (m_memory_access_in_progress &&
+        ((sys_evt == NRF_EVT_FLASH_OPERATION_SUCCESS) || (sys_evt == NRF_EVT_FLASH_OPERATION_ERROR)))
+    {
+        m_memory_access_in_progress = false;
+        scan_start();
+    }
 }
 
 /**@brief Function for initializing the BLE stack.
@@ -363,7 +507,7 @@ static void ble_stack_init(void)
     uint32_t err_code;
 
     // Initialize the SoftDevice handler module.
-    SOFTDEVICE_HANDLER_INIT(NRF_CLOCK_LFCLKSRC_RC_250_PPM_250MS_CALIBRATION, NULL);
+    SOFTDEVICE_HANDLER_APPSH_INIT(NRF_CLOCK_LFCLKSRC_RC_250_PPM_250MS_CALIBRATION, true);
 
     // Enable BLE stack.
     ble_enable_params_t ble_enable_params;
@@ -388,8 +532,48 @@ static void ble_stack_init(void)
  */
 static void timers_init(void)
 {
-    // Initialize timer module.
-    APP_TIMER_INIT(APP_TIMER_PRESCALER, APP_TIMER_MAX_TIMERS, APP_TIMER_OP_QUEUE_SIZE, false);
+    // Initialize timer module, timeout handlers (and so the button handler) run from the main loop.
+    APP_TIMER_APPSH_INIT(APP_TIMER_PRESCALER, APP_TIMER_MAX_TIMERS, APP_TIMER_OP_QUEUE_SIZE, true);
+}
+
+
+/**@brief Function for the Event Scheduler initialization.
+ */
+static void scheduler_init(void)
+{
+    APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
+}
+
+
+/**@brief Function for the Device Manager initialization.
+ *
+ * @details Bonds are kept so a known peripheral is reconnected through the whitelist and the
+ *          link encrypted with the stored keys.
+ */
+static void device_manager_init(void)
+{
+    uint32_t               err_code;
+    dm_init_param_t        init_param;
+    dm_application_param_t register_param;
+
+    init_param.clear_persistent_data = false;
+
+    err_code = dm_init(&init_param);
+    APP_ERROR_CHECK(err_code);
+
+    memset(&register_param.sec_param, 0, sizeof(ble_gap_sec_params_t));
+
+    register_param.sec_param.bond         = SEC_PARAM_BOND;
+    register_param.sec_param.mitm         = SEC_PARAM_MITM;
+    register_param.sec_param.io_caps      = SEC_PARAM_IO_CAPABILITIES;
+    register_param.sec_param.oob          = SEC_PARAM_OOB;
+    register_param.sec_param.min_key_size = SEC_PARAM_MIN_KEY_SIZE;
+    register_param.sec_param.max_key_size = SEC_PARAM_MAX_KEY_SIZE;
+    register_param.evt_handler            = device_manager_event_handler;
+    register_param.service_type           = DM_PROTOCOL_CNTXT_NONE;
+
+    err_code = dm_register(&m_dm_app_id, &register_param);
+    APP_ERROR_CHECK(err_code);
 }
 
 
@@ -415,10 +599,13 @@ void system_init(void)
 {
     uint32_t err_code;
 
+    scheduler_init();
     ble_stack_init();
     timers_init();
     gpiote_init();
 
+    conn_policy_init();
+
     button_init();
 
     oled_init();
@@ -426,9 +613,18 @@ void system_init(void)
     err_code = pstorage_init();
     APP_ERROR_CHECK(err_code);
 
+    device_manager_init();
+
     db_discovery_init();
 
     mhs_c_init();
 
+#if defined(MHS_ESB) || defined(MHS_BCAST)
+    mhs_c_bcast_init();
+#endif
+#ifdef MHS_ESB
+    mhs_c_esb_init();
+#endif
+
     scan_start();
 }
@@ -3,6 +3,9 @@
 #include "app_timer.h"
 
 #include "ble_mhs_c.h"
+#include "mhs_c_bcast.h"
+#include "mhs_c_esb.h"
+#include "mhs_c_proxy.h"
 #include "pin_config.h"
 #include "uart.h"
 #include "oled.h"
@@ -10,6 +13,7 @@
 #include "SEGGER_RTT.h"
 
 #include "button.h"
+#include "conn_policy.h"
 
 #define BUTTON_DETECTION_DELAY          APP_TIMER_TICKS(50, APP_TIMER_PRESCALER)
 #define UI_TOTAL_NUM                    6
@@ -24,6 +28,65 @@ static uint8_t m_temp_threshold = 0;
 static uint8_t m_motor_speed = 0;
 static uint8_t m_motor_index = 0;
 
+// Last values pushed by the peripheral telemetry.
+static int16_t m_temperature = 0;           // 1/16 degrees
+static uint8_t m_current_motor_speed = 0;
+
+/**@brief Send a setting to every connected peripheral. Built with MHS_BCAST, also broadcast it
+ *        to the ones that are not connected.
+ */
+static void group_cmd_send(uint8_t * cmd, uint8_t len, bool priority)
+{
+#ifdef MHS_BCAST
+    uint32_t err_code;
+#endif
+
+    if (priority)
+    {
+        (void)mhs_c_priority_cmd_send(MHS_C_LINK_ALL, cmd, len);
+    }
+    else
+    {
+        (void)mhs_c_cmd_send(MHS_C_LINK_ALL, cmd, len);
+    }
+
+#ifdef MHS_BCAST
+    err_code = mhs_c_bcast_send(MHS_BCAST_GROUP_ALL, cmd, len);
+    if (err_code != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "broadcast failed %d\r\n", err_code);
+    }
+#endif
+}
+
+/**@brief Send a jog command. Built with MHS_ESB it goes to the ESB unit only, over BLE when the
+ *        ESB link cannot take it.
+ */
+static void jog_cmd_send(uint8_t * cmd, uint8_t len)
+{
+#ifdef MHS_ESB
+    if (mhs_c_esb_send(cmd, len) == NRF_SUCCESS)
+    {
+        return;
+    }
+#endif
+    (void)mhs_c_cmd_send(MHS_C_LINK_ALL, cmd, len);
+}
+
+/**@brief Show a temperature in 1/16 degrees, rounded to whole degrees. The OLED only shows
+ *        unsigned numbers.
+ */
+static void temperature_show(int16_t temperature)
+{
+    int16_t temp = (temperature + 8) >> 4;
+    oled_show_num((temp < 0) ? 0 : temp);
+}
+
+static bool is_setting(void)
+{
+    return is_setting_temp_threshold || is_setting_motor_speed || is_setting_motor_control;
+}
+
 void button_up_event()
 {
     if (is_setting_temp_threshold == true)
@@ -63,26 +126,19 @@ void button_ok_event(void)
     switch (ui_index)
     {
         case UI_STYLE_GET_TEMPERATURE:
-        {
-            uint8_t cmd = MHS_CMD_CODE_GET_TEMPERATURE;
-            ble_mhs_c_send_cmd(&cmd, sizeof(cmd));
-            oled_clear_num();
+            // Pushed by the peripheral, no need to ask.
+            temperature_show(m_temperature);
             break;
-        }
         case UI_STYLE_GET_TEMP_THRESHOLD:
         {
             uint8_t cmd = MHS_CMD_CODE_GET_TEMP_THRESHOLD;
-            ble_mhs_c_send_cmd(&cmd, sizeof(cmd));
+            mhs_c_cmd_send(MHS_C_LINK_ALL, &cmd, sizeof(cmd));
             oled_clear_num();
             break;
         }
         case UI_STYLE_GET_MOTOR_SPEED:
-        {
-            uint8_t cmd = MHS_CMD_CODE_GET_MOTOR_SPEED;
-            ble_mhs_c_send_cmd(&cmd, sizeof(cmd));
-            oled_clear_num();
+            oled_show_num(m_current_motor_speed);
             break;
-        }
         case UI_STYLE_SET_TEMP_THRESHOLD:
         {
             if (is_setting_temp_threshold == false)
@@ -96,7 +152,7 @@ void button_ok_event(void)
                 uint8_t cmd[3] = {0};
                 cmd[0] = MHS_CMD_CODE_SET_TEMP_THRESHOLD;
                 cmd[1] = m_temp_threshold;
-                ble_mhs_c_send_cmd(cmd, sizeof(cmd));
+                group_cmd_send(cmd, sizeof(cmd), false);
                 is_setting_temp_threshold = false;
                 oled_show_choose_status(false);
                 oled_clear_num();
@@ -116,7 +172,7 @@ void button_ok_event(void)
                 uint8_t cmd[3] = {0};
                 cmd[0] = MHS_CMD_CODE_SET_MOTOR_SPEED;
                 cmd[1] = m_motor_speed;
-                ble_mhs_c_send_cmd(cmd, sizeof(cmd));
+                group_cmd_send(cmd, sizeof(cmd), false);
                 is_setting_motor_speed = false;
                 oled_show_choose_status(false);
                 oled_clear_num();
@@ -152,7 +208,7 @@ void button_right_event(void)
         cmd[0] = MHS_CMD_CODE_SET_MOTOR_CONTROL;
         cmd[1] = 0x00;
         cmd[2] = m_motor_index;
-        ble_mhs_c_send_cmd(cmd, sizeof(cmd));
+        jog_cmd_send(cmd, sizeof(cmd));
     }
 }
 
@@ -164,16 +220,22 @@ void button_left_event(void)
         cmd[0] = MHS_CMD_CODE_SET_MOTOR_CONTROL;
         cmd[1] = 0x01;
         cmd[2] = m_motor_index;
-        ble_mhs_c_send_cmd(cmd, sizeof(cmd));
+        jog_cmd_send(cmd, sizeof(cmd));
     }
 }
 
+/**@brief Stop the motors. Built with MHS_ESB, the off also goes down the ESB queue in place of
+ *        the jogs still waiting there, so none of them runs after it.
+ */
 void motor_off(void)
 {
     if (is_setting_motor_control == true)
     {
-        uint8_t cmd = 0x07;
-        ble_mhs_c_send_cmd(&cmd, sizeof(cmd));
+        uint8_t cmd = MHS_CMD_CODE_SET_MOTOR_OFF;
+#ifdef MHS_ESB
+        (void)mhs_c_esb_cancel_send(&cmd, sizeof(cmd));
+#endif
+        group_cmd_send(&cmd, sizeof(cmd), true);
     }
 }
 
@@ -189,6 +251,8 @@ static void button_event_handler(uint8_t pin_no, uint8_t button_event)
     SEGGER_RTT_printf(0, "pin = %p, event = %p\r\n", pin_no, button_event);
     if (button_event == APP_BUTTON_PUSH)
     {
+        conn_policy_activity();
+
         switch (pin_no)
         {
             case KEY1_PIN_NUMBER:
@@ -269,8 +333,11 @@ void mhs_c_notification(uint8_t evt_type, uint16_t evt_data)
     {
         case MHS_EVENT_CODE_CURRENT_TEMPERATURE:
         {
-            uint16_t temp = evt_data;
-            oled_show_num(temp);
+            m_temperature = (int16_t)evt_data;
+            if ((ui_index == UI_STYLE_GET_TEMPERATURE) && !is_setting())
+            {
+                temperature_show(m_temperature);
+            }
             break;
         }
         case MHS_EVENT_CODE_TEMP_THRESHOLD:
@@ -281,8 +348,15 @@ void mhs_c_notification(uint8_t evt_type, uint16_t evt_data)
         }
         case MHS_EVENT_CODE_MOTOR_SPEED:
         {
-            m_motor_speed = evt_data;
-            oled_show_num(m_motor_speed);
+            m_current_motor_speed = evt_data;
+            if (!is_setting_motor_speed)
+            {
+                m_motor_speed = m_current_motor_speed;
+            }
+            if ((ui_index == UI_STYLE_GET_MOTOR_SPEED) && !is_setting())
+            {
+                oled_show_num(m_current_motor_speed);
+            }
             break;
         }
         default:
@@ -1,18 +1,18 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "app_error.h"
 #include "nordic_common.h"
 #include "uart.h"
 #include "ble_db_discovery.h"
-#include "mhs_c_proxy.h"
 
 #include "ble_mhs_c.h"
 
-#define TX_BUFFER_MASK         0x07                  /**< TX Buffer mask, must be a mask of continuous zeroes, followed by continuous sequence of ones: 000...111. */
+#define TX_BUFFER_MASK         0x03                  /**< TX Buffer mask, must be a mask of continuous zeroes, followed by continuous sequence of ones: 000...111. One buffer per link, kept small for RAM. */
 #define TX_BUFFER_SIZE         (TX_BUFFER_MASK + 1)  /**< Size of send buffer, which is 1 higher than the mask. */
 
 #define WRITE_MESSAGE_LENGTH   BLE_CCCD_VALUE_LEN    /**< Length of the write message for CCCD. */
-#define WRITE_MESSAGE_LENGTH   BLE_CCCD_VALUE_LEN    /**< Length of the write message for CCCD. */
+#define CTRL_POINT_FRAME_CODE_LEN  1                 /**< MHS_CMD_CODE_FRAME that starts a frame. */
 
 #define MHS_UUID_BASE   {0x1B, 0xC5, 0xD5, 0xA5, 0x02, 0x00, 0x82, 0x86,\
         0xE3, 0x11, 0xCB, 0x37, 0x00, 0x00, 0x00, 0x00}
@@ -27,7 +27,7 @@ typedef enum
  */
 typedef struct
 {
-    uint8_t                  gattc_value[WRITE_MESSAGE_LENGTH];  /**< The message to write. */
+    uint8_t                  gattc_value[MHS_CTRL_POINT_MAX_LEN];  /**< The message to write. */
     ble_gattc_write_params_t gattc_params;                       /**< GATTC parameters for this message. */
 } write_params_t;
 
@@ -44,37 +44,199 @@ typedef struct
     } req;
 } tx_message_t;
 
-static ble_mhs_c_t * mp_ble_mhs_c;
-static tx_message_t  m_tx_buffer[TX_BUFFER_SIZE];  /**< Transmit buffer for messages to be transmitted to the central. */
-static uint32_t      m_tx_insert_index = 0;        /**< Current index in the transmit buffer where the next message should be inserted. */
-static uint32_t      m_tx_index = 0;               /**< Current index in the transmit buffer from where the next message to be transmitted resides. */
+/**@brief Messages waiting for one link, each link is written independently of the others.
+ */
+typedef struct
+{
+    tx_message_t            buffer[TX_BUFFER_SIZE];  /**< Transmit buffer for messages to be transmitted to the peripheral. */
+    uint32_t                insert_index;            /**< Current index in the transmit buffer where the next message should be inserted. */
+    uint32_t                index;                   /**< Current index in the transmit buffer from where the next message to be transmitted resides. */
+    ble_mhs_c_queue_stats_t stats;                   /**< Transmit buffer counters. */
+} tx_queue_t;
+
+static ble_mhs_c_t *           mp_ble_mhs_c[BLE_MHS_C_MAX_INSTANCES];
+static tx_queue_t              m_tx_queue[BLE_MHS_C_MAX_INSTANCES];
+static uint8_t                 m_instance_count = 0;
+static ble_mhs_c_t *           mp_frame_owner = NULL;            /**< Instance the frame is built for. */
+static uint8_t                 m_frame[MHS_CTRL_POINT_MAX_LEN];  /**< Command frame being built. */
+static uint8_t                 m_frame_len = 0;
+
+static const uint16_t          m_gatt_char_uuids[] = {BLE_UUID_GATT_CHARACTERISTIC_SERVICE_CHANGED};  /**< Characteristics discovery looks for. */
+static const uint16_t          m_mhs_char_uuids[]  = {BLE_UUID_MHS_CONTROL_POINT_CHAR,
+                                                      BLE_UUID_MHS_EVENT_CHAR};
+
+/**@brief Function for getting the number of messages waiting in the transmit buffer.
+ */
+static uint32_t tx_buffer_count(const tx_queue_t * p_queue)
+{
+    return (p_queue->insert_index - p_queue->index) & TX_BUFFER_MASK;
+}
+
+
+/**@brief Function for taking the next free entry of the transmit buffer.
+ *
+ * @details One entry is kept free to tell a full buffer from an empty one. The caller fills the
+ *          entry and then calls tx_buffer_process().
+ *
+ * @return    Entry, or NULL if the buffer is full.
+ */
+static tx_message_t * tx_buffer_alloc(tx_queue_t * p_queue)
+{
+    tx_message_t * p_msg;
+
+    if (tx_buffer_count(p_queue) == TX_BUFFER_MASK)
+    {
+        p_queue->stats.rejected++;
+        return NULL;
+    }
+
+    p_msg                  = &p_queue->buffer[p_queue->insert_index++];
+    p_queue->insert_index &= TX_BUFFER_MASK;
+
+    if (tx_buffer_count(p_queue) > p_queue->stats.max_count)
+    {
+        p_queue->stats.max_count = tx_buffer_count(p_queue);
+    }
+
+    return p_msg;
+}
+
+
+/**@brief Function for removing a message that has not been sent yet, later ones move up.
+ */
+static void tx_buffer_remove(tx_queue_t * p_queue, uint32_t index)
+{
+    uint32_t next = (index + 1) & TX_BUFFER_MASK;
+
+    while (next != p_queue->insert_index)
+    {
+        p_queue->buffer[index] = p_queue->buffer[next];
+        index                  = next;
+        next                   = (next + 1) & TX_BUFFER_MASK;
+    }
+    p_queue->insert_index = index;
+}
+
+
+/**@brief Function for checking if a new control point command makes a queued one pointless.
+ *
+ * @details Settings are superseded by a later value for the same target. Requests are
+ *          superseded by the same request, the answer is the same. Music control commands are
+ *          steps, they are never dropped.
+ */
+static bool cmd_supersedes(const ble_mhs_c_t * p_ble_mhs_c, const uint8_t * p_cmd, uint8_t len,
+                           const tx_message_t * p_msg)
+{
+    const ble_gattc_write_params_t * p_params = &p_msg->req.write_req.gattc_params;
+    const uint8_t *                  p_queued = p_msg->req.write_req.gattc_value;
+
+    if ((p_msg->type != WRITE_REQ)
+            || (p_params->handle != p_ble_mhs_c->mhs_ctrl_handle)
+            || (p_params->write_op != BLE_GATT_OP_WRITE_REQ)
+            || (p_params->len != len)
+            || (p_queued[0] != p_cmd[0]))
+    {
+        return false;
+    }
+
+    switch (p_cmd[0])
+    {
+        case MHS_CMD_CODE_SET_TEMP_THRESHOLD:
+        case MHS_CMD_CODE_SET_MOTOR_SPEED:
+        case MHS_CMD_CODE_GET_TEMPERATURE:
+        case MHS_CMD_CODE_GET_TEMP_THRESHOLD:
+        case MHS_CMD_CODE_GET_MOTOR_SPEED:
+        case MHS_CMD_CODE_SET_MOTOR_OFF:
+        case MHS_CMD_CODE_GET_NOTIFY_STATS:
+            return true;
+
+        case MHS_CMD_CODE_SET_MOTOR_CONTROL:
+            // Value: [direction, motor index].
+            return (len == 3) && (p_queued[2] == p_cmd[2]);
+
+        case MHS_CMD_CODE_SET_MOTOR_DUTY_MASK:
+        case MHS_CMD_CODE_SET_HEAT_PARAM:
+        case MHS_CMD_CODE_SUBSCRIBE:
+        case MHS_CMD_CODE_SET_REPORT_THRESHOLD:
+            // The first value byte selects what is set.
+            return (len == 3) && (p_queued[1] == p_cmd[1]);
+
+        default:
+            return false;
+    }
+}
+
+
+/**@brief Function for checking if a priority command makes a queued one pointless or harmful.
+ *
+ * @details Motor off cancels queued motor commands, which would start the motors again once
+ *          the off is through.
+ */
+static bool cmd_cancels(const ble_mhs_c_t * p_ble_mhs_c, const uint8_t * p_cmd, uint8_t len,
+                        const tx_message_t * p_msg)
+{
+    const ble_gattc_write_params_t * p_params = &p_msg->req.write_req.gattc_params;
+    const uint8_t *                  p_queued = p_msg->req.write_req.gattc_value;
+
+    if ((p_cmd[0] != MHS_CMD_CODE_SET_MOTOR_OFF)
+            || (p_msg->type != WRITE_REQ)
+            || (p_params->handle != p_ble_mhs_c->mhs_ctrl_handle))
+    {
+        return cmd_supersedes(p_ble_mhs_c, p_cmd, len, p_msg);
+    }
+
+    switch (p_queued[0])
+    {
+        case MHS_CMD_CODE_SET_MOTOR_CONTROL:
+        case MHS_CMD_CODE_SET_MOTOR_SPEED:
+        case MHS_CMD_CODE_SET_MOTOR_OFF:
+        case MHS_CMD_CODE_SET_MOTOR_DUTY_MASK:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
 
 /**@brief Function for passing any pending request from the buffer to the stack.
  */
-static void tx_buffer_process(void)
+static void tx_buffer_process(tx_queue_t * p_queue)
 {
-    if (m_tx_index != m_tx_insert_index)
+    while (p_queue->index != p_queue->insert_index)
     {
-        uint32_t err_code;
+        tx_message_t * p_msg = &p_queue->buffer[p_queue->index];
+        uint32_t       err_code;
+        bool           wait_rsp = true;
 
-        if (m_tx_buffer[m_tx_index].type == READ_REQ)
+        if (p_msg->type == READ_REQ)
         {
-            err_code = sd_ble_gattc_read(m_tx_buffer[m_tx_index].conn_handle,
-                                         m_tx_buffer[m_tx_index].req.read_handle,
+            err_code = sd_ble_gattc_read(p_msg->conn_handle,
+                                         p_msg->req.read_handle,
                                          0);
         }
         else
         {
-            err_code = sd_ble_gattc_write(m_tx_buffer[m_tx_index].conn_handle,
-                                          &m_tx_buffer[m_tx_index].req.write_req.gattc_params);
+            write_params_t * p_write = &p_msg->req.write_req;
+
+            // Entries move when one is removed, so point at the value only now.
+            p_write->gattc_params.p_value = p_write->gattc_value;
+            err_code = sd_ble_gattc_write(p_msg->conn_handle,
+                                          &p_write->gattc_params);
+            wait_rsp = (p_write->gattc_params.write_op != BLE_GATT_OP_WRITE_CMD);
         }
-        if (err_code == NRF_SUCCESS)
+        if (err_code != NRF_SUCCESS)
         {
-            m_tx_index++;
-            m_tx_index &= TX_BUFFER_MASK;
+            // Busy or out of buffers, retried on the next write response or TX complete.
+            break;
         }
-        else
+
+        p_queue->index++;
+        p_queue->index &= TX_BUFFER_MASK;
+
+        if (wait_rsp)
         {
+            break;
         }
     }
 }
@@ -88,7 +250,52 @@ static void tx_buffer_process(void)
 static void on_write_rsp(ble_mhs_c_t * p_ble_mhs_c, const ble_evt_t * p_ble_evt)
 {
     // Check if there is any message to be sent across to the peer and send it.
-    tx_buffer_process();
+    tx_buffer_process(&m_tx_queue[p_ble_mhs_c->instance]);
+}
+
+
+/**@brief Function for finding the instance of a connection.
+ *
+ * @return    Instance, or NULL if the connection has none.
+ */
+static ble_mhs_c_t * instance_get(uint16_t conn_handle)
+{
+    for (uint32_t i = 0; i < m_instance_count; i++)
+    {
+        if (mp_ble_mhs_c[i]->conn_handle == conn_handle)
+        {
+            return mp_ble_mhs_c[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**@brief Function for creating a message for writing to the CCCD.
+ */
+static uint32_t cccd_configure(ble_mhs_c_t * p_ble_mhs_c, uint16_t handle_cccd, uint16_t cccd_val)
+{
+    tx_queue_t   * p_queue = &m_tx_queue[p_ble_mhs_c->instance];
+    tx_message_t * p_msg;
+
+    p_msg = tx_buffer_alloc(p_queue);
+    if (p_msg == NULL)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    p_msg->req.write_req.gattc_params.handle   = handle_cccd;
+    p_msg->req.write_req.gattc_params.len      = WRITE_MESSAGE_LENGTH;
+    p_msg->req.write_req.gattc_params.offset   = 0;
+    p_msg->req.write_req.gattc_params.write_op = BLE_GATT_OP_WRITE_REQ;
+    p_msg->req.write_req.gattc_value[0]        = LSB(cccd_val);
+    p_msg->req.write_req.gattc_value[1]        = MSB(cccd_val);
+    p_msg->conn_handle                         = p_ble_mhs_c->conn_handle;
+    p_msg->type                                = WRITE_REQ;
+
+    tx_buffer_process(p_queue);
+    return NRF_SUCCESS;
 }
 
 
@@ -105,14 +312,19 @@ static void on_write_rsp(ble_mhs_c_t * p_ble_mhs_c, const ble_evt_t * p_ble_evt)
  */
 static void db_discover_evt_handler(ble_db_discovery_evt_t * p_evt)
 {
-    uint32_t err_code;
+    ble_mhs_c_t   * p_ble_mhs_c = instance_get(p_evt->conn_handle);
+    ble_mhs_c_evt_t evt;
+
+    if (p_ble_mhs_c == NULL)
+    {
+        return;
+    }
+
     // Check if the Heart Rate Service was discovered.
     if (p_evt->evt_type == BLE_DB_DISCOVERY_COMPLETE &&
         p_evt->params.discovered_db.srv_uuid.uuid == BLE_UUID_MHS_SERVICE &&
         p_evt->params.discovered_db.srv_uuid.type == BLE_UUID_TYPE_VENDOR_BEGIN)
     {
-        mp_ble_mhs_c->conn_handle = p_evt->conn_handle;
-
         // Find the CCCD Handle of the Heart Rate Measurement characteristic.
         uint32_t i;
 
@@ -121,26 +333,83 @@ static void db_discover_evt_handler(ble_db_discovery_evt_t * p_evt)
             if (p_evt->params.discovered_db.charateristics[i].characteristic.uuid.uuid ==
                 BLE_UUID_MHS_CONTROL_POINT_CHAR)
             {
-                mp_ble_mhs_c->mhs_ctrl_handle      =
+                p_ble_mhs_c->mhs_ctrl_handle      =
                     p_evt->params.discovered_db.charateristics[i].characteristic.handle_value;
             }
             else if (p_evt->params.discovered_db.charateristics[i].characteristic.uuid.uuid ==
                 BLE_UUID_MHS_EVENT_CHAR)
             {
-                mp_ble_mhs_c->mhs_ctrl_cccd_handle =
+                p_ble_mhs_c->mhs_ctrl_cccd_handle =
                     p_evt->params.discovered_db.charateristics[i].cccd_handle;
-                mp_ble_mhs_c->mhs_event_handle      =
+                p_ble_mhs_c->mhs_event_handle      =
                     p_evt->params.discovered_db.charateristics[i].characteristic.handle_value;
-                err_code = ble_mhs_c_evt_notif_enable(get_mhs_obj());
-                APP_ERROR_CHECK(err_code);
             }
         }
 
-        ble_mhs_c_evt_t evt;
-
         evt.evt_type = BLE_MHS_C_EVT_DISCOVERY_COMPLETE;
 
-        mp_ble_mhs_c->evt_handler(mp_ble_mhs_c, &evt);
+        p_ble_mhs_c->evt_handler(p_ble_mhs_c, &evt);
+    }
+    else
+    {
+        // No MHS, or the discovery went wrong. Either way the link is of no use.
+        evt.evt_type = BLE_MHS_C_EVT_DISCOVERY_FAILED;
+
+        p_ble_mhs_c->evt_handler(p_ble_mhs_c, &evt);
+    }
+}
+
+
+/**@brief     Function for handling the discovery of the peer's GATT service.
+ *
+ * @details   Indications of the Service Changed characteristic are enabled, so the cached
+ *            handles are dropped when the peer's database changes. The GATT service is
+ *            discovered first, so it is known once the MHS discovery completes.
+ *
+ * @param[in] p_evt Pointer to the event received from the database discovery module.
+ */
+static void gatt_discover_evt_handler(ble_db_discovery_evt_t * p_evt)
+{
+    ble_mhs_c_t * p_ble_mhs_c = instance_get(p_evt->conn_handle);
+    uint32_t      err_code;
+
+    if ((p_evt->evt_type != BLE_DB_DISCOVERY_COMPLETE) || (p_ble_mhs_c == NULL))
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < p_evt->params.discovered_db.char_count; i++)
+    {
+        if (p_evt->params.discovered_db.charateristics[i].characteristic.uuid.uuid ==
+            BLE_UUID_GATT_CHARACTERISTIC_SERVICE_CHANGED)
+        {
+            p_ble_mhs_c->svc_changed_handle      =
+                p_evt->params.discovered_db.charateristics[i].characteristic.handle_value;
+            p_ble_mhs_c->svc_changed_cccd_handle =
+                p_evt->params.discovered_db.charateristics[i].cccd_handle;
+
+            err_code = cccd_configure(p_ble_mhs_c, p_ble_mhs_c->svc_changed_cccd_handle,
+                                      BLE_GATT_HVX_INDICATION);
+            APP_ERROR_CHECK(err_code);
+        }
+    }
+}
+
+
+/**@brief     Function for handling a framed command acknowledgement.
+ *
+ * @param[in] p_ack       Last sequence number, number of commands and rejected mask.
+ */
+static void on_cmd_ack(ble_mhs_c_t * p_ble_mhs_c, const uint8_t * p_ack)
+{
+    uint8_t mask = p_ack[2];
+
+    p_ble_mhs_c->cmd_acked_seq = p_ack[0];
+
+    while (mask != 0)
+    {
+        p_ble_mhs_c->cmd_rejected += mask & 1;
+        mask >>= 1;
     }
 }
 
@@ -157,36 +426,133 @@ static void db_discover_evt_handler(ble_db_discovery_evt_t * p_evt)
  */
 static void on_hvx(ble_mhs_c_t * p_ble_mhs_c, const ble_evt_t * p_ble_evt)
 {
-    // Check if this is a heart rate notification.
-    if (p_ble_evt->evt.gattc_evt.params.hvx.handle == p_ble_mhs_c->mhs_event_handle)
+    const ble_gattc_evt_hvx_t * p_hvx   = &p_ble_evt->evt.gattc_evt.params.hvx;
+    tx_queue_t                * p_queue = &m_tx_queue[p_ble_mhs_c->instance];
+
+    if ((p_hvx->handle == p_ble_mhs_c->svc_changed_handle)
+            && (p_hvx->handle != BLE_GATT_HANDLE_INVALID))
+    {
+        ble_mhs_c_evt_t ble_mhs_c_evt;
+        uint32_t        err_code;
+
+        err_code = sd_ble_gattc_hv_confirm(p_ble_evt->evt.gattc_evt.conn_handle, p_hvx->handle);
+        APP_ERROR_CHECK(err_code);
+
+        // Commands would go to whatever sits at the old handle now.
+        p_ble_mhs_c->mhs_ctrl_handle      = BLE_GATT_HANDLE_INVALID;
+        p_ble_mhs_c->mhs_event_handle     = BLE_GATT_HANDLE_INVALID;
+        p_ble_mhs_c->mhs_ctrl_cccd_handle = BLE_GATT_HANDLE_INVALID;
+        p_queue->index                    = p_queue->insert_index;
+
+        ble_mhs_c_evt.evt_type = BLE_MHS_C_EVT_SERVICE_CHANGED;
+        p_ble_mhs_c->evt_handler(p_ble_mhs_c, &ble_mhs_c_evt);
+        return;
+    }
+
+    // Check if this is an MHS event notification.
+    if (p_hvx->handle == p_ble_mhs_c->mhs_event_handle)
     {
         ble_mhs_c_evt_t ble_mhs_c_evt;
         uint32_t        index = 0;
+        uint8_t         value_len;
 
         ble_mhs_c_evt.evt_type = BLE_MHS_C_EVT_NOTIFICATION;
 
-        ble_mhs_c_evt.mhs_evt_type = p_ble_evt->evt.gattc_evt.params.hvx.data[index++];
+        // One notification packs several [code][value length][value] events.
+        while (index + MHS_EVENT_HEADER_LEN <= p_hvx->len)
+        {
+            ble_mhs_c_evt.mhs_evt_type = p_hvx->data[index++];
+            value_len                  = p_hvx->data[index++];
 
-        ble_mhs_c_evt.mhs_evt_data = uint16_decode(&(p_ble_evt->evt.gattc_evt.params.hvx.data[index]));
+            if (index + value_len > p_hvx->len)
+            {
+                break;
+            }
 
-        p_ble_mhs_c->evt_handler(p_ble_mhs_c, &ble_mhs_c_evt);
+            if ((ble_mhs_c_evt.mhs_evt_type == MHS_EVENT_CODE_CMD_ACK)
+                    && (value_len >= MHS_CMD_ACK_LEN))
+            {
+                on_cmd_ack(p_ble_mhs_c, &p_hvx->data[index]);
+                index += value_len;
+                continue;
+            }
+
+            if (value_len >= sizeof(uint16_t))
+            {
+                ble_mhs_c_evt.mhs_evt_data = uint16_decode(&p_hvx->data[index]);
+            }
+            else
+            {
+                ble_mhs_c_evt.mhs_evt_data = (value_len == 1) ? p_hvx->data[index] : 0;
+            }
+            index += value_len;
+
+            p_ble_mhs_c->evt_handler(p_ble_mhs_c, &ble_mhs_c_evt);
+        }
+    }
+}
+
+
+/**@brief     Function for getting the connection of an event handled by this module.
+ */
+static uint16_t evt_conn_handle(const ble_evt_t * p_ble_evt)
+{
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_EVT_TX_COMPLETE:
+            return p_ble_evt->evt.common_evt.conn_handle;
+
+        case BLE_GATTC_EVT_HVX:
+        case BLE_GATTC_EVT_WRITE_RSP:
+            return p_ble_evt->evt.gattc_evt.conn_handle;
+
+        default:
+            return p_ble_evt->evt.gap_evt.conn_handle;
     }
 }
 
 
 void ble_mhs_c_on_ble_evt(ble_mhs_c_t * p_ble_mhs_c, const ble_evt_t * p_ble_evt)
 {
+    tx_queue_t * p_queue;
+
     if ((p_ble_mhs_c == NULL) || (p_ble_evt == NULL))
     {
         return;
     }
 
+    p_queue = &m_tx_queue[p_ble_mhs_c->instance];
+
+    // Other links have instances of their own.
+    if ((p_ble_evt->header.evt_id != BLE_GAP_EVT_CONNECTED)
+            && (evt_conn_handle(p_ble_evt) != p_ble_mhs_c->conn_handle))
+    {
+        return;
+    }
+
     switch (p_ble_evt->header.evt_id)
     {
         case BLE_GAP_EVT_CONNECTED:
             p_ble_mhs_c->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
             break;
 
+        case BLE_GAP_EVT_DISCONNECTED:
+            // Nothing queued can reach the peer any more.
+            p_ble_mhs_c->conn_handle = BLE_CONN_HANDLE_INVALID;
+            p_queue->index           = p_queue->insert_index;
+            if (mp_frame_owner == p_ble_mhs_c)
+            {
+                m_frame_len = 0;
+            }
+
+            // The next peer may be another one, its handles are cached or discovered.
+            p_ble_mhs_c->mhs_ctrl_handle         = BLE_GATT_HANDLE_INVALID;
+            p_ble_mhs_c->mhs_event_handle        = BLE_GATT_HANDLE_INVALID;
+            p_ble_mhs_c->mhs_ctrl_cccd_handle    = BLE_GATT_HANDLE_INVALID;
+            p_ble_mhs_c->svc_changed_handle      = BLE_GATT_HANDLE_INVALID;
+            p_ble_mhs_c->svc_changed_cccd_handle = BLE_GATT_HANDLE_INVALID;
+            break;
+
         case BLE_GATTC_EVT_HVX:
             on_hvx(p_ble_mhs_c, p_ble_evt);
             break;
@@ -195,57 +561,64 @@ void ble_mhs_c_on_ble_evt(ble_mhs_c_t * p_ble_mhs_c, const ble_evt_t * p_ble_evt
             on_write_rsp(p_ble_mhs_c, p_ble_evt);
             break;
 
+        case BLE_EVT_TX_COMPLETE:
+            // Buffers freed, framed commands that did not fit can go now.
+            tx_buffer_process(p_queue);
+            break;
+
         default:
             break;
     }
 }
 
 
-/**@brief Function for creating a message for writing to the CCCD.
- */
-static uint32_t cccd_configure(uint16_t conn_handle, uint16_t handle_cccd, bool enable)
+static uint32_t ble_mhs_send_control_point_cmd(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len,
+                                               uint8_t write_op)
 {
+    tx_queue_t   * p_queue = &m_tx_queue[p_ble_mhs_c->instance];
     tx_message_t * p_msg;
-    uint16_t       cccd_val = enable ? BLE_GATT_HVX_NOTIFICATION : 0;
-
-    p_msg              = &m_tx_buffer[m_tx_insert_index++];
-    m_tx_insert_index &= TX_BUFFER_MASK;
-
-    p_msg->req.write_req.gattc_params.handle   = handle_cccd;
-    p_msg->req.write_req.gattc_params.len      = WRITE_MESSAGE_LENGTH;
-    p_msg->req.write_req.gattc_params.p_value  = p_msg->req.write_req.gattc_value;
-    p_msg->req.write_req.gattc_params.offset   = 0;
-    p_msg->req.write_req.gattc_params.write_op = BLE_GATT_OP_WRITE_REQ;
-    p_msg->req.write_req.gattc_value[0]        = LSB(cccd_val);
-    p_msg->req.write_req.gattc_value[1]        = MSB(cccd_val);
-    p_msg->conn_handle                         = conn_handle;
-    p_msg->type                                = WRITE_REQ;
 
-    tx_buffer_process();
-    return NRF_SUCCESS;
-}
+    if ((p_ble_mhs_c->conn_handle == BLE_CONN_HANDLE_INVALID)
+            || (p_ble_mhs_c->mhs_ctrl_handle == BLE_GATT_HANDLE_INVALID))
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
 
+    if ((len == 0) || (len > MHS_CTRL_POINT_MAX_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
 
-static uint32_t ble_mhs_send_control_point_cmd(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len)
-{
-    tx_message_t * p_msg;
+    // Drop a queued command this one makes pointless, the new one goes last to keep the order.
+    if (write_op == BLE_GATT_OP_WRITE_REQ)
+    {
+        for (uint32_t index = p_queue->index; index != p_queue->insert_index;
+             index = (index + 1) & TX_BUFFER_MASK)
+        {
+            if (cmd_supersedes(p_ble_mhs_c, cmd, len, &p_queue->buffer[index]))
+            {
+                tx_buffer_remove(p_queue, index);
+                p_queue->stats.coalesced++;
+                break;
+            }
+        }
+    }
 
-    p_msg              = &m_tx_buffer[m_tx_insert_index++];
-    m_tx_insert_index &= TX_BUFFER_MASK;
+    p_msg = tx_buffer_alloc(p_queue);
+    if (p_msg == NULL)
+    {
+        return NRF_ERROR_BUSY;
+    }
 
     p_msg->req.write_req.gattc_params.handle   = p_ble_mhs_c->mhs_ctrl_handle;
     p_msg->req.write_req.gattc_params.len      = len;
-    p_msg->req.write_req.gattc_params.p_value  = p_msg->req.write_req.gattc_value;
     p_msg->req.write_req.gattc_params.offset   = 0;
-    p_msg->req.write_req.gattc_params.write_op = BLE_GATT_OP_WRITE_REQ;
-    for(uint8_t i = 0; i < len; i++)
-    {
-        p_msg->req.write_req.gattc_value[i] = *(cmd + i);
-    }
+    p_msg->req.write_req.gattc_params.write_op = write_op;
+    memcpy(p_msg->req.write_req.gattc_value, cmd, len);
     p_msg->conn_handle                         = p_ble_mhs_c->conn_handle;
     p_msg->type                                = WRITE_REQ;
 
-    tx_buffer_process();
+    tx_buffer_process(p_queue);
     return NRF_SUCCESS;
 }
 
@@ -259,7 +632,33 @@ uint32_t ble_mhs_c_init(ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_init_t * p_ble_mhs_
         return NRF_ERROR_NULL;
     }
 
+    if (m_instance_count == BLE_MHS_C_MAX_INSTANCES)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p_ble_mhs_c->instance                = m_instance_count;
+    p_ble_mhs_c->evt_handler             = p_ble_mhs_c_init->evt_handler;
+    p_ble_mhs_c->conn_handle             = BLE_CONN_HANDLE_INVALID;
+    p_ble_mhs_c->mhs_ctrl_cccd_handle    = BLE_GATT_HANDLE_INVALID;
+    p_ble_mhs_c->mhs_ctrl_handle         = BLE_GATT_HANDLE_INVALID;
+    p_ble_mhs_c->mhs_event_handle        = BLE_GATT_HANDLE_INVALID;
+    p_ble_mhs_c->svc_changed_handle      = BLE_GATT_HANDLE_INVALID;
+    p_ble_mhs_c->svc_changed_cccd_handle = BLE_GATT_HANDLE_INVALID;
+    p_ble_mhs_c->cmd_seq                 = 0;
+    p_ble_mhs_c->cmd_acked_seq           = 0;
+    p_ble_mhs_c->cmd_rejected            = 0;
+
+    mp_ble_mhs_c[m_instance_count++] = p_ble_mhs_c;
+
+    if (m_instance_count > 1)
+    {
+        // The UUID and the discovery are shared by all instances.
+        return NRF_SUCCESS;
+    }
+
     ble_uuid_t mhs_uuid;
+    ble_uuid_t gatt_uuid;
 
     ble_uuid128_t base_uuid  =
     {
@@ -269,20 +668,30 @@ uint32_t ble_mhs_c_init(ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_init_t * p_ble_mhs_
     mhs_uuid.type = BLE_UUID_TYPE_VENDOR_BEGIN;
     mhs_uuid.uuid = BLE_UUID_MHS_SERVICE;
 
+    gatt_uuid.type = BLE_UUID_TYPE_BLE;
+    gatt_uuid.uuid = BLE_UUID_GATT;
+
     err_code = sd_ble_uuid_vs_add(&base_uuid, &(mhs_uuid.type));
     if (err_code != NRF_SUCCESS)
     {
         return err_code;
     }
 
-    mp_ble_mhs_c = p_ble_mhs_c;
-
-    mp_ble_mhs_c->evt_handler     = p_ble_mhs_c_init->evt_handler;
-    mp_ble_mhs_c->conn_handle     = BLE_CONN_HANDLE_INVALID;
-    mp_ble_mhs_c->mhs_ctrl_cccd_handle = BLE_GATT_HANDLE_INVALID;
+    // Registration order is discovery order. Only the characteristics used here are looked
+    // for, discovery stops as soon as they and their CCCDs are found.
+    err_code = ble_db_discovery_evt_register_targeted(&gatt_uuid,
+                                                      m_gatt_char_uuids,
+                                                      sizeof(m_gatt_char_uuids) / sizeof(m_gatt_char_uuids[0]),
+                                                      gatt_discover_evt_handler);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
 
-    return ble_db_discovery_evt_register(&mhs_uuid,
-                                         db_discover_evt_handler);
+    return ble_db_discovery_evt_register_targeted(&mhs_uuid,
+                                                  m_mhs_char_uuids,
+                                                  sizeof(m_mhs_char_uuids) / sizeof(m_mhs_char_uuids[0]),
+                                                  db_discover_evt_handler);
 }
 
 
@@ -293,10 +702,182 @@ uint32_t ble_mhs_c_evt_notif_enable(ble_mhs_c_t * p_ble_mhs_c)
         return NRF_ERROR_NULL;
     }
 
-    return cccd_configure(p_ble_mhs_c->conn_handle, p_ble_mhs_c->mhs_ctrl_cccd_handle, true);
+    return cccd_configure(p_ble_mhs_c, p_ble_mhs_c->mhs_ctrl_cccd_handle,
+                          BLE_GATT_HVX_NOTIFICATION);
+}
+
+uint32_t ble_mhs_c_send_cmd(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len)
+{
+    return ble_mhs_send_control_point_cmd(p_ble_mhs_c, cmd, len, BLE_GATT_OP_WRITE_REQ);
+}
+
+
+uint32_t ble_mhs_c_frame_cmd_add(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len)
+{
+    uint8_t       value_len;
+    uint32_t      err_code;
+
+    if ((len == 0) || (MHS_CMD_FRAME_HEADER_LEN + len - 1 > MHS_CTRL_POINT_MAX_LEN - 1))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    value_len = len - 1;
+
+    // One frame is built at a time, a frame for another link goes first.
+    if ((mp_frame_owner != p_ble_mhs_c) && (m_frame_len != 0))
+    {
+        err_code = ble_mhs_c_frame_send(mp_frame_owner);
+        if (err_code != NRF_SUCCESS)
+        {
+            return err_code;
+        }
+    }
+
+    if (m_frame_len + MHS_CMD_FRAME_HEADER_LEN + value_len > MHS_CTRL_POINT_MAX_LEN)
+    {
+        err_code = ble_mhs_c_frame_send(p_ble_mhs_c);
+        if (err_code != NRF_SUCCESS)
+        {
+            return err_code;
+        }
+    }
+
+    if (m_frame_len == 0)
+    {
+        mp_frame_owner         = p_ble_mhs_c;
+        m_frame[m_frame_len++] = MHS_CMD_CODE_FRAME;
+    }
+
+    m_frame[m_frame_len++] = p_ble_mhs_c->cmd_seq++;
+    m_frame[m_frame_len++] = cmd[0];
+    m_frame[m_frame_len++] = value_len;
+    memcpy(&m_frame[m_frame_len], &cmd[1], value_len);
+    m_frame_len += value_len;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t ble_mhs_c_frame_send(ble_mhs_c_t * p_ble_mhs_c)
+{
+    uint32_t err_code = NRF_SUCCESS;
+
+    if (mp_frame_owner != p_ble_mhs_c)
+    {
+        // Nothing built for this link.
+        return NRF_SUCCESS;
+    }
+
+    if (m_frame_len > CTRL_POINT_FRAME_CODE_LEN)
+    {
+        err_code = ble_mhs_send_control_point_cmd(p_ble_mhs_c, m_frame, m_frame_len,
+                                                  BLE_GATT_OP_WRITE_CMD);
+        if (err_code == NRF_ERROR_BUSY)
+        {
+            // Keep the frame, the caller may try again.
+            return err_code;
+        }
+    }
+    m_frame_len = 0;
+
+    return err_code;
+}
+
+
+uint32_t ble_mhs_c_send_priority_cmd(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len)
+{
+    tx_queue_t *   p_queue = &m_tx_queue[p_ble_mhs_c->instance];
+    tx_message_t * p_msg;
+    uint32_t       index   = p_queue->index;
+
+    if ((p_ble_mhs_c->conn_handle == BLE_CONN_HANDLE_INVALID)
+            || (p_ble_mhs_c->mhs_ctrl_handle == BLE_GATT_HANDLE_INVALID))
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    if ((len == 0) || (len > MHS_CTRL_POINT_MAX_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    while (index != p_queue->insert_index)
+    {
+        if (cmd_cancels(p_ble_mhs_c, cmd, len, &p_queue->buffer[index]))
+        {
+            tx_buffer_remove(p_queue, index);
+            p_queue->stats.coalesced++;
+        }
+        else
+        {
+            index = (index + 1) & TX_BUFFER_MASK;
+        }
+    }
+
+    // A priority command never waits for room, the newest queued message gives way.
+    if (tx_buffer_count(p_queue) == TX_BUFFER_MASK)
+    {
+        p_queue->insert_index = (p_queue->insert_index - 1) & TX_BUFFER_MASK;
+        p_queue->stats.rejected++;
+    }
+
+    // Queue at the front. As a write command it does not wait for an outstanding write
+    // response, so it goes out in the next connection event.
+    p_queue->index = (p_queue->index - 1) & TX_BUFFER_MASK;
+    p_msg          = &p_queue->buffer[p_queue->index];
+
+    p_msg->req.write_req.gattc_params.handle   = p_ble_mhs_c->mhs_ctrl_handle;
+    p_msg->req.write_req.gattc_params.len      = len;
+    p_msg->req.write_req.gattc_params.offset   = 0;
+    p_msg->req.write_req.gattc_params.write_op = BLE_GATT_OP_WRITE_CMD;
+    memcpy(p_msg->req.write_req.gattc_value, cmd, len);
+    p_msg->conn_handle                         = p_ble_mhs_c->conn_handle;
+    p_msg->type                                = WRITE_REQ;
+
+    tx_buffer_process(p_queue);
+    return NRF_SUCCESS;
+}
+
+
+void ble_mhs_c_handles_get(const ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_handles_t * p_handles)
+{
+    memset(p_handles, 0, sizeof(*p_handles));
+
+    p_handles->version                 = MHS_C_HANDLE_CACHE_VERSION;
+    p_handles->ctrl_handle             = p_ble_mhs_c->mhs_ctrl_handle;
+    p_handles->event_handle            = p_ble_mhs_c->mhs_event_handle;
+    p_handles->event_cccd_handle       = p_ble_mhs_c->mhs_ctrl_cccd_handle;
+    p_handles->svc_changed_handle      = p_ble_mhs_c->svc_changed_handle;
+    p_handles->svc_changed_cccd_handle = p_ble_mhs_c->svc_changed_cccd_handle;
 }
 
-void ble_mhs_c_send_cmd(uint8_t *cmd, uint8_t len)
+
+uint32_t ble_mhs_c_handles_set(ble_mhs_c_t * p_ble_mhs_c, uint16_t conn_handle,
+                               const ble_mhs_c_handles_t * p_handles)
 {
-    ble_mhs_send_control_point_cmd(get_mhs_obj(), cmd, len);
+    if ((p_handles->version != MHS_C_HANDLE_CACHE_VERSION)
+            || (p_handles->ctrl_handle == BLE_GATT_HANDLE_INVALID)
+            || (p_handles->event_handle == BLE_GATT_HANDLE_INVALID)
+            || (p_handles->event_cccd_handle == BLE_GATT_HANDLE_INVALID))
+    {
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    p_ble_mhs_c->conn_handle             = conn_handle;
+    p_ble_mhs_c->mhs_ctrl_handle         = p_handles->ctrl_handle;
+    p_ble_mhs_c->mhs_event_handle        = p_handles->event_handle;
+    p_ble_mhs_c->mhs_ctrl_cccd_handle    = p_handles->event_cccd_handle;
+    p_ble_mhs_c->svc_changed_handle      = p_handles->svc_changed_handle;
+    p_ble_mhs_c->svc_changed_cccd_handle = p_handles->svc_changed_cccd_handle;
+
+    return NRF_SUCCESS;
+}
+
+
+void ble_mhs_c_queue_stats_get(const ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_queue_stats_t * p_stats)
+{
+    tx_queue_t * p_queue = &m_tx_queue[p_ble_mhs_c->instance];
+
+    p_queue->stats.count = tx_buffer_count(p_queue);
+    *p_stats             = p_queue->stats;
 }
@@ -8,10 +8,29 @@
 #define BLE_UUID_MHS_CONTROL_POINT_CHAR                          0x0201
 #define BLE_UUID_MHS_EVENT_CHAR                                  0x0202
 
+#define MHS_EVENT_HEADER_LEN                                     2      /**< Event code and value length. */
+#define MHS_CTRL_POINT_MAX_LEN                                   20
+#define MHS_CMD_FRAME_HEADER_LEN                                 3      /**< Sequence, command code and value length. */
+#define MHS_CMD_ACK_LEN                                          3
+
+// Status record in the manufacturer specific data of the peripheral advertising, little endian:
+// [temperature, int16 1/16 degrees][flags][motor on mask][duty cycle, percent].
+// The same format is defined in adv_status.h of the peripheral.
+#define MHS_ADV_STATUS_COMPANY_ID                                0xFFFF
+#define MHS_ADV_STATUS_LEN                                       5
+#define MHS_ADV_STATUS_NO_TEMPERATURE                            INT16_MIN
+#define MHS_ADV_STATUS_FLAG_HEAT_ON                              0x01
+
+#define MHS_C_HANDLE_CACHE_VERSION                               1      /**< Layout of ble_mhs_c_handles_t, bump when it changes. */
+
+#define BLE_MHS_C_MAX_INSTANCES                                  8      /**< One per link, the S120 connects up to 8 peripherals. */
+
 typedef enum
 {
     BLE_MHS_C_EVT_DISCOVERY_COMPLETE = 1,  /**< Event indicating that the Heart Rate Service has been discovered at the peer. */
-    BLE_MHS_C_EVT_NOTIFICATION             /**< Event indicating that a notification of the Heart Rate Measurement characteristic has been received from the peer. */
+    BLE_MHS_C_EVT_NOTIFICATION,            /**< Event indicating that a notification of the Heart Rate Measurement characteristic has been received from the peer. */
+    BLE_MHS_C_EVT_SERVICE_CHANGED,         /**< The peer changed its database, the handles are invalid until discovered again. */
+    BLE_MHS_C_EVT_DISCOVERY_FAILED         /**< The peer has no MHS, or its discovery failed. */
 } ble_mhs_c_evt_type_t;
 
 /**@brief Heart Rate Event structure. */
@@ -48,8 +67,26 @@ struct ble_mhs_c_s
     uint16_t                mhs_ctrl_handle;
     uint16_t                mhs_event_handle;       /**< Handle of the Heart Rate Measurement characteristic as provided by the SoftDevice. */
     ble_mhs_c_evt_handler_t evt_handler;      /**< Application event handler to be called when there is an event related to the heart rate service. */
+    uint8_t                 cmd_seq;          /**< Sequence number of the next framed command. */
+    uint8_t                 cmd_acked_seq;    /**< Sequence number of the last acknowledged command. */
+    uint16_t                cmd_rejected;     /**< Framed commands the peripheral rejected. */
+    uint16_t                svc_changed_handle;       /**< Service Changed characteristic of the peer's GATT service. */
+    uint16_t                svc_changed_cccd_handle;
+    uint8_t                 instance;         /**< Index of the instance, selects its command queue. */
 };
 
+/**@brief Discovered handles, kept per bonded peer by the application to skip discovery. */
+typedef struct
+{
+    uint8_t  version;                   /**< MHS_C_HANDLE_CACHE_VERSION, anything else is no cache. */
+    uint8_t  reserved;
+    uint16_t ctrl_handle;
+    uint16_t event_handle;
+    uint16_t event_cccd_handle;
+    uint16_t svc_changed_handle;
+    uint16_t svc_changed_cccd_handle;
+} ble_mhs_c_handles_t;
+
 typedef enum mhs_control_point_cmd_code_e
 {
     MHS_CMD_CODE_GET_TEMPERATURE                 = 0x01,
@@ -60,13 +97,28 @@ typedef enum mhs_control_point_cmd_code_e
     MHS_CMD_CODE_SET_MOTOR_SPEED                 = 0x06,
     MHS_CMD_CODE_SET_MOTOR_OFF                   = 0x07,
     MHS_CMD_CODE_SET_MUSIC_CONTROL               = 0x08,
+    MHS_CMD_CODE_SET_MOTOR_DUTY_MASK             = 0x09,     // Value: [channel mask, duty cycle]
+    MHS_CMD_CODE_SET_HEAT_PARAM                  = 0x0A,     // Value: [heat_param_t, value]
+    MHS_CMD_CODE_SUBSCRIBE                       = 0x0B,     // Value: [mhs_telemetry_signal_t, interval s, 0 stops]
+    MHS_CMD_CODE_SET_REPORT_THRESHOLD            = 0x0C,     // Value: [mhs_telemetry_signal_t, least change]
+    MHS_CMD_CODE_GET_NOTIFY_STATS                = 0x0D,
+    MHS_CMD_CODE_FRAME                           = 0x80,     // [sequence][command code][value length][value] records
 } mhs_control_point_cmd_code_t;
 
+typedef enum mhs_telemetry_signal_e
+{
+    MHS_TELEMETRY_SIGNAL_TEMPERATURE = 0,           // MHS_EVENT_CODE_CURRENT_TEMPERATURE, threshold in 1/16 degrees
+    MHS_TELEMETRY_SIGNAL_MOTOR_SPEED,               // MHS_EVENT_CODE_MOTOR_SPEED, threshold in percent
+} mhs_telemetry_signal_t;
+
 typedef enum mhs_event_code_e
 {
-    MHS_EVENT_CODE_CURRENT_TEMPERATURE = 0,
-    MHS_EVENT_CODE_TEMP_THRESHOLD,
-    MHS_EVENT_CODE_MOTOR_SPEED,
+    MHS_EVENT_CODE_CURRENT_TEMPERATURE = 0,         // int16, 1/16 degrees
+    MHS_EVENT_CODE_TEMP_THRESHOLD,                  // int16, whole degrees
+    MHS_EVENT_CODE_MOTOR_SPEED,                     // uint16, percent
+    MHS_EVENT_CODE_SENSOR_TEMPERATURE,              // uint8 sensor index, int16 1/16 degrees
+    MHS_EVENT_CODE_NOTIFY_STATS,                    // uint8 depth, uint8 max depth, uint16 dropped, uint16 packets
+    MHS_EVENT_CODE_CMD_ACK,                         // uint8 last sequence, uint8 count, uint8 rejected mask
 } mhs_event_code_t;
 
 typedef struct
@@ -74,13 +126,81 @@ typedef struct
     ble_mhs_c_evt_handler_t evt_handler;
 } ble_mhs_c_init_t;
 
+/**@brief Command queue counters. */
+typedef struct
+{
+    uint8_t  count;         /**< Messages waiting to be sent. */
+    uint8_t  max_count;     /**< Highest count seen. */
+    uint16_t coalesced;     /**< Queued commands replaced by a later one of the same kind. */
+    uint16_t rejected;      /**< Messages refused because the queue was full. */
+} ble_mhs_c_queue_stats_t;
+
 
+/**@brief Initialize a client instance, one per link.
+ *
+ * @details Each instance has its own command queue. The first one registers the service with
+ *          the discovery module, discovery events go to the instance of their connection.
+ *
+ * @return NRF_SUCCESS, NRF_ERROR_NO_MEM if BLE_MHS_C_MAX_INSTANCES are initialized already.
+ */
 uint32_t ble_mhs_c_init(ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_init_t * p_ble_mhs_c_init);
 
 uint32_t ble_mhs_c_evt_notif_enable(ble_mhs_c_t * p_ble_mhs_c);
 
+/**@brief Handle a BLE stack event. A connected event is taken as the instance's connection,
+ *        other events are ignored unless they are about that connection.
+ */
 void ble_mhs_c_on_ble_evt(ble_mhs_c_t * p_ble_mhs_c, const ble_evt_t * p_ble_evt);
 
-void ble_mhs_c_send_cmd(uint8_t *cmd, uint8_t len);
+/**@brief Queue a control point command, [command code] or [command code][value].
+ *
+ * @details A queued command that has not been sent yet and that this one supersedes (a setting
+ *          of the same target, or the same request) is dropped, and this one is queued last.
+ *
+ * @return NRF_SUCCESS if queued, NRF_ERROR_BUSY if the queue is full,
+ *         NRF_ERROR_INVALID_STATE if not connected.
+ */
+uint32_t ble_mhs_c_send_cmd(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len);
+
+/**@brief Send a stop or off command ahead of everything queued.
+ *
+ * @details Queued commands it supersedes are dropped, motor off also drops queued motor commands.
+ *          The command is written without response from the front of the queue, so it goes
+ *          out in the next connection event even while a write request is outstanding. If the
+ *          queue is full the newest queued message is dropped to make room.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_INVALID_STATE if not connected.
+ */
+uint32_t ble_mhs_c_send_priority_cmd(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len);
+
+/**@brief Add a command to the frame being built, same format as for ble_mhs_c_send_cmd().
+ *
+ * @details A full frame is sent first. Framed commands are written without response, so a burst
+ *          of them goes out in one connection event; the peripheral acknowledges each frame.
+ *          One frame is built at a time, a frame built for another instance is sent first.
+ *
+ * @return NRF_SUCCESS, or the error of sending the full frame.
+ */
+uint32_t ble_mhs_c_frame_cmd_add(ble_mhs_c_t * p_ble_mhs_c, uint8_t *cmd, uint8_t len);
+
+/**@brief Send the frame being built, if it holds any command.
+ *
+ * @return NRF_SUCCESS, NRF_ERROR_BUSY if the queue is full, the frame is kept then.
+ */
+uint32_t ble_mhs_c_frame_send(ble_mhs_c_t * p_ble_mhs_c);
+
+/**@brief Get the handles found by discovery, to be stored for the peer.
+ */
+void ble_mhs_c_handles_get(const ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_handles_t * p_handles);
+
+/**@brief Use stored handles instead of discovering the peer.
+ * @return NRF_SUCCESS, or NRF_ERROR_INVALID_DATA if the stored handles can not be used.
+ */
+uint32_t ble_mhs_c_handles_set(ble_mhs_c_t * p_ble_mhs_c, uint16_t conn_handle,
+                               const ble_mhs_c_handles_t * p_handles);
+
+/**@brief Get the command queue occupancy and counters.
+ */
+void ble_mhs_c_queue_stats_get(const ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_queue_stats_t * p_stats);
 
 #endif // BLE_MHS_C_H_
@@ -0,0 +1,579 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include <app_error.h>
+#include <app_util.h>
+#include <ble_gap.h>
+#include <nrf_soc.h>
+#include <pstorage.h>
+
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+
+#include "SEGGER_RTT.h"
+
+#include "mhs_c_bcast.h"
+
+// The group key, the same on the central and on every unit of an installation, is not part of
+// the sources. make takes it in MHS_BCAST_KEY, see the Makefile.
+#ifndef MHS_BCAST_KEY
+#error "MHS_BCAST_KEY, the 16 byte key of the installation, is not set"
+#endif
+
+#define BCAST_SIGNED_LEN            (MHS_BCAST_DATA_LEN - MHS_BCAST_MAC_LEN)
+
+// Sequence log: two flash pages, the end of the reserved numbers appended word by word to the
+// current one. When it is full the log goes on in the other page, which is erased after the
+// first write, so a reset never finds both empty.
+#define BCAST_SEQ_RESERVE           256                         /**< Numbers taken from flash at a time. */
+#define BCAST_SEQ_LOG_BLOCK_SIZE    1024                        /**< One flash page. */
+#define BCAST_SEQ_LOG_BLOCK_COUNT   2
+#define BCAST_SEQ_LOG_WORDS         (BCAST_SEQ_LOG_BLOCK_SIZE / sizeof(uint32_t))
+#define BCAST_SEQ_ERASED            0xFFFFFFFF                  /**< Word read from erased flash, never sent. */
+
+static const uint8_t    m_key[SOC_ECB_KEY_LENGTH] = MHS_BCAST_KEY;
+
+static uint32_t          m_seq;
+static uint32_t          m_seq_limit;                           /**< First number not reserved in flash. */
+static pstorage_handle_t m_seq_storage;
+static uint32_t          m_seq_stored = BCAST_SEQ_ERASED;       /**< Buffer of the flash write. */
+static uint8_t           m_seq_log_block = 0;
+static uint16_t          m_seq_log_next = 0;                    /**< Next free word of the log block. */
+static uint8_t           m_seq_flash_ops = 0;                   /**< pstorage operations not completed yet. */
+
+#ifdef MHS_BCAST
+#define BCAST_SLOT_END_MARGIN_US    100                         /**< Radio off this long before the window ends. */
+#define BCAST_SLOTS                 (MHS_BCAST_DURATION_S * 1000000 / MHS_BCAST_TX_PERIOD_US)
+
+#define ADV_ACCESS_ADDRESS_BASE     0x89BED600
+#define ADV_ACCESS_ADDRESS_PREFIX   0x8E
+#define ADV_CRC_POLY                0x00065B
+#define ADV_CRC_INIT                0x555555
+#define ADV_PDU_HEADER_LEN          2                           /**< PDU type, then payload length. */
+#define ADV_PDU_TYPE_NONCONN_IND    0x02
+#define ADV_PDU_TXADD_RANDOM        0x40
+#define ADV_ADDR_LEN                6
+#define ADV_FLAGS_FIELD_LEN         3
+#define ADV_MANUF_FIELD_LEN         (2 + sizeof(uint16_t) + MHS_BCAST_DATA_LEN)
+#define ADV_PDU_PAYLOAD_LEN         (ADV_ADDR_LEN + ADV_FLAGS_FIELD_LEN + ADV_MANUF_FIELD_LEN)
+
+static const uint8_t                            m_channel_freq[] = {2, 26, 80};  /**< Advertising channels 37, 38 and 39, MHz above 2400. */
+
+static nrf_radio_request_t                      m_request;
+static nrf_radio_signal_callback_return_param_t m_signal_return;
+static uint8_t                                  m_channel_index;
+static uint8_t                                  m_tx_pdu[ADV_PDU_HEADER_LEN + ADV_PDU_PAYLOAD_LEN];    /**< Sent by the radio. */
+
+// The main loop writes the next packet while m_next_pdu_ready is clear, the timeslot takes it
+// over at the start of a window. The timeslot cannot be interrupted by the main loop.
+static uint8_t                                  m_next_pdu[ADV_PDU_HEADER_LEN + ADV_PDU_PAYLOAD_LEN];
+static volatile bool                            m_next_pdu_ready = false;
+static volatile uint16_t                        m_slots_left = 0;
+static volatile bool                            m_active = false;   /**< Timeslot requested or running. */
+#endif // MHS_BCAST
+
+
+/**@brief Sign a broadcast, see mhs_c_bcast.h.
+ */
+static void mac_add(uint8_t * p_data)
+{
+    nrf_ecb_hal_data_t ecb;
+    uint32_t           err_code;
+
+    memcpy(ecb.key, m_key, sizeof(ecb.key));
+    memset(ecb.cleartext, 0, sizeof(ecb.cleartext));
+    memcpy(ecb.cleartext, p_data, BCAST_SIGNED_LEN);
+
+    err_code = sd_ecb_block_encrypt(&ecb);
+    APP_ERROR_CHECK(err_code);
+
+    memcpy(&p_data[BCAST_SIGNED_LEN], ecb.ciphertext, MHS_BCAST_MAC_LEN);
+}
+
+
+#ifdef MHS_BCAST
+/**@brief Ask for a window as soon as possible.
+ */
+static void request_earliest(void)
+{
+    uint32_t err_code;
+
+    m_request.request_type               = NRF_RADIO_REQ_TYPE_EARLIEST;
+    m_request.params.earliest.hfclk      = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.earliest.priority   = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.earliest.length_us  = MHS_BCAST_TX_SLOT_US;
+    m_request.params.earliest.timeout_us = MHS_BCAST_TX_PERIOD_US;
+
+    err_code = sd_radio_request(&m_request);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Set the next window one period after the start of the current one.
+ */
+static void request_next_set(void)
+{
+    m_request.request_type              = NRF_RADIO_REQ_TYPE_NORMAL;
+    m_request.params.normal.hfclk       = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.normal.priority    = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.normal.distance_us = MHS_BCAST_TX_PERIOD_US;
+    m_request.params.normal.length_us   = MHS_BCAST_TX_SLOT_US;
+}
+
+
+/**@brief Set up the radio for advertising packets, the way the peripherals listen.
+ */
+static void radio_config(void)
+{
+    // Power cycling resets whatever the SoftDevice left in the radio.
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Disabled << RADIO_POWER_POWER_Pos;
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Enabled << RADIO_POWER_POWER_Pos;
+
+    if ((NRF_FICR->OVERRIDEEN & FICR_OVERRIDEEN_BLE_1MBIT_Msk)
+            == (FICR_OVERRIDEEN_BLE_1MBIT_Override << FICR_OVERRIDEEN_BLE_1MBIT_Pos))
+    {
+        NRF_RADIO->OVERRIDE0 = NRF_FICR->BLE_1MBIT[0];
+        NRF_RADIO->OVERRIDE1 = NRF_FICR->BLE_1MBIT[1];
+        NRF_RADIO->OVERRIDE2 = NRF_FICR->BLE_1MBIT[2];
+        NRF_RADIO->OVERRIDE3 = NRF_FICR->BLE_1MBIT[3];
+        NRF_RADIO->OVERRIDE4 = NRF_FICR->BLE_1MBIT[4] | RADIO_OVERRIDE4_ENABLE_Msk;
+    }
+
+    NRF_RADIO->MODE        = RADIO_MODE_MODE_Ble_1Mbit << RADIO_MODE_MODE_Pos;
+    NRF_RADIO->TXPOWER     = RADIO_TXPOWER_TXPOWER_0dBm << RADIO_TXPOWER_TXPOWER_Pos;
+    NRF_RADIO->PREFIX0     = ADV_ACCESS_ADDRESS_PREFIX;
+    NRF_RADIO->BASE0       = ADV_ACCESS_ADDRESS_BASE;
+    NRF_RADIO->TXADDRESS   = 0;
+    NRF_RADIO->PCNF0       = (1 << RADIO_PCNF0_S0LEN_Pos)
+                           | (8 << RADIO_PCNF0_LFLEN_Pos)
+                           | (0 << RADIO_PCNF0_S1LEN_Pos);
+    NRF_RADIO->PCNF1       = (RADIO_PCNF1_WHITEEN_Enabled << RADIO_PCNF1_WHITEEN_Pos)
+                           | (RADIO_PCNF1_ENDIAN_Little << RADIO_PCNF1_ENDIAN_Pos)
+                           | (3 << RADIO_PCNF1_BALEN_Pos)
+                           | (0 << RADIO_PCNF1_STATLEN_Pos)
+                           | (ADV_PDU_PAYLOAD_LEN << RADIO_PCNF1_MAXLEN_Pos);
+    NRF_RADIO->CRCCNF      = (RADIO_CRCCNF_LEN_Three << RADIO_CRCCNF_LEN_Pos)
+                           | (RADIO_CRCCNF_SKIPADDR_Skip << RADIO_CRCCNF_SKIPADDR_Pos);
+    NRF_RADIO->CRCPOLY     = ADV_CRC_POLY;
+    NRF_RADIO->CRCINIT     = ADV_CRC_INIT;
+    NRF_RADIO->PACKETPTR   = (uint32_t)m_tx_pdu;
+
+    NRF_RADIO->SHORTS      = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk;
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->INTENSET    = RADIO_INTENSET_DISABLED_Msk;
+    NVIC_EnableIRQ(RADIO_IRQn);
+}
+
+
+/**@brief Send the packet on the current advertising channel.
+ */
+static void tx_start(void)
+{
+    NRF_RADIO->FREQUENCY   = m_channel_freq[m_channel_index];
+    NRF_RADIO->DATAWHITEIV = m_channel_index + 37;
+    NRF_RADIO->TASKS_TXEN  = 1;
+}
+
+
+/**@brief Stop the radio and ask for the next window while the broadcast lasts.
+ */
+static void slot_end(void)
+{
+    NRF_TIMER0->INTENCLR     = TIMER_INTENCLR_COMPARE0_Msk;
+    NRF_RADIO->INTENCLR      = RADIO_INTENCLR_DISABLED_Msk;
+    NRF_RADIO->SHORTS        = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+
+    if (m_slots_left > 0)
+    {
+        m_slots_left--;
+    }
+
+    if (m_slots_left > 0)
+    {
+        request_next_set();
+        m_signal_return.callback_action       = NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END;
+        m_signal_return.params.request.p_next = &m_request;
+    }
+    else
+    {
+        m_active = false;
+        m_signal_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_END;
+    }
+}
+
+
+/**@brief Timeslot signals, at the highest interrupt priority.
+ */
+static nrf_radio_signal_callback_return_param_t * radio_signal_callback(uint8_t signal_type)
+{
+    m_signal_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+    switch (signal_type)
+    {
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_START:
+            // TIMER0 counts microseconds from the start of the window.
+            NRF_TIMER0->CC[0]    = MHS_BCAST_TX_SLOT_US - BCAST_SLOT_END_MARGIN_US;
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+
+            if (m_next_pdu_ready)
+            {
+                memcpy(m_tx_pdu, m_next_pdu, sizeof(m_tx_pdu));
+                m_next_pdu_ready = false;
+            }
+
+            m_channel_index = 0;
+            radio_config();
+            tx_start();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO:
+            if (NRF_RADIO->EVENTS_DISABLED != 0)
+            {
+                NRF_RADIO->EVENTS_DISABLED = 0;
+
+                // Like an advertising event, the packet goes out once on every channel.
+                if (++m_channel_index < sizeof(m_channel_freq))
+                {
+                    tx_start();
+                }
+                else
+                {
+                    slot_end();
+                }
+            }
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0:
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            slot_end();
+            break;
+
+        default:
+            break;
+    }
+
+    return &m_signal_return;
+}
+
+
+/**@brief Build a non-connectable advertising packet carrying the broadcast data.
+ */
+static void pdu_build(const uint8_t * p_data, uint8_t * p_pdu)
+{
+    ble_gap_addr_t addr;
+    uint32_t       err_code;
+    uint8_t        index = ADV_PDU_HEADER_LEN;
+
+    err_code = sd_ble_gap_address_get(&addr);
+    APP_ERROR_CHECK(err_code);
+
+    p_pdu[0] = ADV_PDU_TYPE_NONCONN_IND;
+    if (addr.addr_type != BLE_GAP_ADDR_TYPE_PUBLIC)
+    {
+        p_pdu[0] |= ADV_PDU_TXADD_RANDOM;
+    }
+    p_pdu[1] = ADV_PDU_PAYLOAD_LEN;
+
+    memcpy(&p_pdu[index], addr.addr, ADV_ADDR_LEN);
+    index += ADV_ADDR_LEN;
+
+    p_pdu[index++] = ADV_FLAGS_FIELD_LEN - 1;
+    p_pdu[index++] = BLE_GAP_AD_TYPE_FLAGS;
+    p_pdu[index++] = BLE_GAP_ADV_FLAG_BR_EDR_NOT_SUPPORTED;
+
+    p_pdu[index++] = ADV_MANUF_FIELD_LEN - 1;
+    p_pdu[index++] = BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA;
+    index += uint16_encode(MHS_BCAST_COMPANY_ID, &p_pdu[index]);
+    memcpy(&p_pdu[index], p_data, MHS_BCAST_DATA_LEN);
+}
+#endif // MHS_BCAST
+
+
+/**@brief Get a block of the sequence log in flash.
+ */
+static const uint32_t * seq_log_get(uint8_t block)
+{
+    uint32_t          err_code;
+    pstorage_handle_t handle;
+
+    err_code = pstorage_block_identifier_get(&m_seq_storage, block, &handle);
+    APP_ERROR_CHECK(err_code);
+
+    return (const uint32_t *)handle.block_id;
+}
+
+
+/**@brief Count the words written to a block of the sequence log.
+ */
+static uint16_t seq_log_used(uint8_t block)
+{
+    const uint32_t * p_log = seq_log_get(block);
+    uint16_t         used  = 0;
+
+    while ((used < BCAST_SEQ_LOG_WORDS) && (p_log[used] != BCAST_SEQ_ERASED))
+    {
+        used++;
+    }
+
+    return used;
+}
+
+
+/**@brief Write the reservation to the log, unless a write is still pending. The pstorage
+ *        callback writes again once it is done if the reservation grew meanwhile.
+ */
+static void seq_log_write(void)
+{
+    uint32_t          err_code;
+    pstorage_handle_t block;
+    uint8_t           full_block;
+
+    if ((m_seq_flash_ops != 0) || (m_seq_stored == m_seq_limit))
+    {
+        return;
+    }
+
+    m_seq_stored = m_seq_limit;
+
+    if (m_seq_log_next < BCAST_SEQ_LOG_WORDS)
+    {
+        err_code = pstorage_block_identifier_get(&m_seq_storage, m_seq_log_block, &block);
+        APP_ERROR_CHECK(err_code);
+        err_code = pstorage_store(&block, (uint8_t *)&m_seq_stored, sizeof(m_seq_stored),
+                                  m_seq_log_next * sizeof(uint32_t));
+        APP_ERROR_CHECK(err_code);
+        m_seq_flash_ops++;
+        m_seq_log_next++;
+        return;
+    }
+
+    // Full, go on in the other block and only then erase this one.
+    full_block        = m_seq_log_block;
+    m_seq_log_block   = (m_seq_log_block + 1) % BCAST_SEQ_LOG_BLOCK_COUNT;
+    m_seq_log_next    = 1;
+
+    err_code = pstorage_block_identifier_get(&m_seq_storage, m_seq_log_block, &block);
+    APP_ERROR_CHECK(err_code);
+    err_code = pstorage_store(&block, (uint8_t *)&m_seq_stored, sizeof(m_seq_stored), 0);
+    APP_ERROR_CHECK(err_code);
+    m_seq_flash_ops++;
+
+    err_code = pstorage_block_identifier_get(&m_seq_storage, full_block, &block);
+    APP_ERROR_CHECK(err_code);
+    err_code = pstorage_clear(&block, BCAST_SEQ_LOG_BLOCK_SIZE);
+    APP_ERROR_CHECK(err_code);
+    m_seq_flash_ops++;
+}
+
+
+static void seq_storage_cb(pstorage_handle_t * p_handle,
+                           uint8_t             op_code,
+                           uint32_t            result,
+                           uint8_t           * p_data,
+                           uint32_t            data_len)
+{
+    if (result != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "broadcast seq flash op %d failed %p\r\n", op_code, result);
+    }
+
+    if (m_seq_flash_ops > 0)
+    {
+        m_seq_flash_ops--;
+    }
+
+    if (m_seq_flash_ops == 0)
+    {
+        seq_log_write();
+    }
+}
+
+
+/**@brief Register the sequence log and go on after the last reservation in it. Without one,
+ *        start at a random number.
+ */
+static void seq_log_init(void)
+{
+    uint32_t                err_code;
+    pstorage_module_param_t param;
+    pstorage_handle_t       block;
+    uint16_t                used[BCAST_SEQ_LOG_BLOCK_COUNT];
+    uint32_t                last[BCAST_SEQ_LOG_BLOCK_COUNT];
+    uint8_t                 old_block;
+    uint8_t                 available = 0;
+
+    param.block_size  = BCAST_SEQ_LOG_BLOCK_SIZE;
+    param.block_count = BCAST_SEQ_LOG_BLOCK_COUNT;
+    param.cb          = seq_storage_cb;
+
+    err_code = pstorage_register(&param, &m_seq_storage);
+    APP_ERROR_CHECK(err_code);
+
+    for (uint8_t i = 0; i < BCAST_SEQ_LOG_BLOCK_COUNT; i++)
+    {
+        used[i] = seq_log_used(i);
+        last[i] = (used[i] > 0) ? seq_log_get(i)[used[i] - 1] : BCAST_SEQ_ERASED;
+    }
+
+    if ((used[0] == 0) && (used[1] == 0))
+    {
+        err_code = sd_rand_application_bytes_available_get(&available);
+        APP_ERROR_CHECK(err_code);
+
+        if (available >= sizeof(m_seq))
+        {
+            err_code = sd_rand_application_vector_get((uint8_t *)&m_seq, sizeof(m_seq));
+            APP_ERROR_CHECK(err_code);
+        }
+    }
+    else
+    {
+        // Both in use only after a reset between the first write to a block and erasing the other.
+        if ((used[0] > 0) && ((used[1] == 0) || ((int32_t)(last[0] - last[1]) > 0)))
+        {
+            m_seq_log_block = 0;
+        }
+        else
+        {
+            m_seq_log_block = 1;
+        }
+
+        m_seq_log_next = used[m_seq_log_block];
+        m_seq          = last[m_seq_log_block] - 1;   // Numbers below the reservation may be used.
+        m_seq_stored   = last[m_seq_log_block];
+
+        old_block = (m_seq_log_block + 1) % BCAST_SEQ_LOG_BLOCK_COUNT;
+        if (used[old_block] > 0)
+        {
+            err_code = pstorage_block_identifier_get(&m_seq_storage, old_block, &block);
+            APP_ERROR_CHECK(err_code);
+            err_code = pstorage_clear(&block, BCAST_SEQ_LOG_BLOCK_SIZE);
+            APP_ERROR_CHECK(err_code);
+            m_seq_flash_ops++;
+        }
+    }
+
+    m_seq_limit = m_seq + 1 + BCAST_SEQ_RESERVE;
+    if (m_seq_limit == BCAST_SEQ_ERASED)
+    {
+        m_seq_limit++;
+    }
+    seq_log_write();
+
+    SEGGER_RTT_printf(0, "broadcast seq %u\r\n", m_seq);
+}
+
+
+/**@brief Take the next sequence number. A new reservation is written while half of the last one
+ *        is left, so the flash is done long before the numbers run out.
+ */
+static uint32_t seq_next(void)
+{
+    m_seq++;
+    if (m_seq == BCAST_SEQ_ERASED)
+    {
+        m_seq++;
+    }
+
+    if ((int32_t)(m_seq_limit - m_seq) <= (BCAST_SEQ_RESERVE / 2))
+    {
+        m_seq_limit += BCAST_SEQ_RESERVE;
+        if (m_seq_limit == BCAST_SEQ_ERASED)
+        {
+            m_seq_limit++;
+        }
+        seq_log_write();
+    }
+
+    return m_seq;
+}
+
+
+void mhs_c_bcast_init(void)
+{
+#ifdef MHS_BCAST
+    uint32_t err_code;
+
+    err_code = sd_radio_session_open(radio_signal_callback);
+    APP_ERROR_CHECK(err_code);
+#endif
+
+    seq_log_init();
+}
+
+
+void mhs_c_bcast_data_build(uint8_t group, uint8_t * cmd, uint8_t len, uint8_t * p_data)
+{
+    memset(p_data, 0, MHS_BCAST_DATA_LEN);
+    p_data[0] = MHS_BCAST_VERSION;
+    p_data[1] = group;
+    (void)uint32_encode(seq_next(), &p_data[2]);
+    p_data[6] = len;
+    memcpy(&p_data[7], cmd, len);
+    mac_add(p_data);
+}
+
+
+#ifdef MHS_BCAST
+uint32_t mhs_c_bcast_send(uint8_t group, uint8_t * cmd, uint8_t len)
+{
+    uint8_t data[MHS_BCAST_DATA_LEN];
+
+    if ((len == 0) || (len > MHS_BCAST_CMD_MAX_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    mhs_c_bcast_data_build(group, cmd, len, data);
+
+    // Only one broadcast at a time, the newer command replaces the running one.
+    m_next_pdu_ready = false;
+    pdu_build(data, m_next_pdu);
+    m_next_pdu_ready = true;
+
+    m_slots_left = BCAST_SLOTS;
+    if (!m_active)
+    {
+        m_active = true;
+        request_earliest();
+    }
+
+    SEGGER_RTT_printf(0, "broadcast %u cmd %d\r\n", m_seq, cmd[0]);
+
+    return NRF_SUCCESS;
+}
+
+
+void mhs_c_bcast_on_sys_evt(uint32_t sys_evt)
+{
+    switch (sys_evt)
+    {
+        case NRF_EVT_RADIO_BLOCKED:
+        case NRF_EVT_RADIO_CANCELED:
+            // No window next to the links in time, the broadcast goes on with the next one.
+            if (m_slots_left > 0)
+            {
+                m_slots_left--;
+            }
+
+            if (m_slots_left > 0)
+            {
+                request_earliest();
+            }
+            else
+            {
+                m_active = false;
+            }
+            break;
+
+        case NRF_EVT_RADIO_SIGNAL_CALLBACK_INVALID_RETURN:
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+            break;
+
+        default:
+            break;
+    }
+}
+#endif // MHS_BCAST
@@ -0,0 +1,79 @@
+/**
+ * @file
+ *
+ * @brief    Broadcast MHS commands.
+ *
+ * @details  Group commands are advertised, signed and sequence numbered, in manufacturer
+ *           specific data, so every peripheral in range runs them without a connection.
+ *           Peripherals run a command only if its sequence number is newer than the last one
+ *           they ran, and only for their group or MHS_BCAST_GROUP_ALL. Both sides keep their
+ *           number in flash, so numbers are not reused after a reset of the central and
+ *           recorded broadcasts are not run after a reset of a peripheral. Erasing the flash of
+ *           the central starts its counter anew, then erase the peripherals as well.
+ *
+ *           The S120 cannot advertise next to the central role, so built with MHS_BCAST defined
+ *           the radio sends the non-connectable advertising packets itself, on the three
+ *           advertising channels in short timeslots between the BLE events. An application
+ *           has one radio session, so this does not go together with MHS_ESB. The format and
+ *           its signature are always built, the ESB link sends the same data.
+ *
+ *           Manufacturer specific data, after the company identifier:
+ *           [version][group][sequence, uint32][command length][command, 3 bytes][MAC, 4 bytes]
+ *           Unused command bytes are 0. The MAC is the start of the AES-128 encryption, with the
+ *           group key, of the 10 bytes before it padded with zeros to one block. The key is
+ *           provisioned per installation at build time, make MHS_BCAST_KEY=..., and has no
+ *           default.
+ *           The same format is defined in mhs_bcast.h of the peripheral.
+ */
+
+#ifndef MHS_C_BCAST_H_
+#define MHS_C_BCAST_H_
+
+#include <stdint.h>
+
+#define MHS_BCAST_COMPANY_ID        0xFFFF      /**< Bluetooth SIG value for tests and internal use. */
+#define MHS_BCAST_VERSION           1
+#define MHS_BCAST_GROUP_ALL         0xFF        /**< Commands for this group run on every unit. */
+#define MHS_BCAST_CMD_MAX_LEN       3           /**< Command code and two value bytes. */
+#define MHS_BCAST_MAC_LEN           4
+#define MHS_BCAST_DATA_LEN          (1 + 1 + 4 + 1 + MHS_BCAST_CMD_MAX_LEN + MHS_BCAST_MAC_LEN)
+
+#define MHS_BCAST_DURATION_S        2           /**< Time a command is advertised for. */
+#define MHS_BCAST_TX_SLOT_US        1500        /**< Window for one packet on each of the three channels. */
+#define MHS_BCAST_TX_PERIOD_US      20000       /**< Start to start distance of the windows, below the peripheral listening window. */
+
+/**@brief Load the sequence number reservation from flash, or pick a random first number on a
+ *        new central. Built with MHS_BCAST, also open the radio session. Call after
+ *        pstorage_init.
+ */
+void mhs_c_bcast_init(void);
+
+/**@brief Number, sign and encode a command in the broadcast format. The ESB link sends the same
+ *        data, see mhs_c_esb.h.
+ *
+ * @param[in]   group   Group of the peripherals, or MHS_BCAST_GROUP_ALL.
+ * @param[in]   cmd     Control point command, code and value.
+ * @param[in]   len     1 to MHS_BCAST_CMD_MAX_LEN.
+ * @param[out]  p_data  MHS_BCAST_DATA_LEN bytes.
+ */
+void mhs_c_bcast_data_build(uint8_t group, uint8_t * cmd, uint8_t len, uint8_t * p_data);
+
+/**@brief Advertise a command to a group for MHS_BCAST_DURATION_S. A broadcast still running is
+ *        replaced. Built with MHS_BCAST.
+ *
+ * @param[in]   group   Group of the peripherals, or MHS_BCAST_GROUP_ALL.
+ * @param[in]   cmd     Control point command, code and value.
+ * @param[in]   len     Up to MHS_BCAST_CMD_MAX_LEN.
+ *
+ * @return NRF_SUCCESS or NRF_ERROR_INVALID_LENGTH.
+ */
+uint32_t mhs_c_bcast_send(uint8_t group, uint8_t * cmd, uint8_t len);
+
+/**@brief Ask for a window again after the SoftDevice blocked or canceled one. Built with
+ *        MHS_BCAST.
+ *
+ * @param[in]   sys_evt     System event.
+ */
+void mhs_c_bcast_on_sys_evt(uint32_t sys_evt);
+
+#endif // MHS_C_BCAST_H_
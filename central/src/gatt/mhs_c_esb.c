@@ -0,0 +1,463 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include <app_error.h>
+#include <app_scheduler.h>
+#include <app_timer.h>
+#include <app_util_platform.h>
+#include <nordic_common.h>
+#include <nrf_soc.h>
+
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+
+#include "mhs_c_proxy.h"
+
+#include "SEGGER_RTT.h"
+
+#include "mhs_c_esb.h"
+
+#define ESB_IRQn                    SWI3_IRQn                   /**< Hands the result of a timeslot to the main loop. */
+#define ESB_IRQHandler              SWI3_IRQHandler
+#define ESB_SLOT_END_MARGIN_US      200                         /**< Radio off this long before the window ends. */
+#define ESB_ATTEMPT_US              (130 + 100 + MHS_ESB_ACK_TIMEOUT_US)  /**< Ramp up, packet and acknowledge wait. */
+#define ESB_REQUEST_TIMEOUT_US      10000                       /**< Longest wait for a window, counts as a try. */
+#define ESB_DOWN_TICKS              APP_TIMER_TICKS(MHS_ESB_DOWN_MS, APP_TIMER_PRESCALER)
+
+#define ESB_HEADER_LEN              2                           /**< Length, then packet ID and no acknowledge bit. */
+#define ESB_LEN_MASK                0x3F
+#define ESB_PID_MASK                0x06
+#define ESB_PID_POS                 1
+#define ESB_ACK_REQUEST             0x01                        /**< Inverted no acknowledge bit. */
+#define ESB_CRC_POLY                0x11021
+#define ESB_CRC_INIT                0xFFFF
+
+#define ESB_SHORTS_TX               (RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk \
+                                     | RADIO_SHORTS_DISABLED_RXEN_Msk)  /**< Send, then ramp up for the acknowledge. */
+#define ESB_SHORTS_ACK              (RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk)
+
+/**@brief What the radio does between two DISABLED events. */
+typedef enum
+{
+    ESB_STATE_TX,
+    ESB_STATE_ACK_WAIT,
+    ESB_STATE_ABORT                 /**< No acknowledge in time, the radio is disabling. */
+} esb_state_t;
+
+/**@brief Outcome of a timeslot, for the main loop. */
+typedef enum
+{
+    ESB_RESULT_NONE,
+    ESB_RESULT_ACKED,
+    ESB_RESULT_NOT_ACKED
+} esb_result_t;
+
+/**@brief A queued command. */
+typedef struct
+{
+    uint8_t  data[MHS_ESB_PAYLOAD_LEN];     /**< Signed broadcast data, sent as payload. */
+    uint8_t  cmd[MHS_BCAST_CMD_MAX_LEN];    /**< Plain command, for BLE if ESB fails. */
+    uint8_t  len;
+    uint32_t ticks;                         /**< Queued at this RTC count. */
+} esb_cmd_t;
+
+static nrf_radio_request_t                      m_request;
+static nrf_radio_signal_callback_return_param_t m_signal_return;
+static esb_state_t                              m_state;
+static volatile esb_result_t                    m_result = ESB_RESULT_NONE;
+static uint8_t                                  m_tx_packet[ESB_HEADER_LEN + MHS_ESB_PAYLOAD_LEN];
+static uint8_t                                  m_ack_packet[ESB_HEADER_LEN + MHS_ESB_PAYLOAD_LEN];  /**< Room for a payload, only the length is used. */
+static uint8_t                                  m_pid = 0;
+
+// The queue and the state below change in the main loop only. The timeslot reads the head
+// while m_active is set.
+static esb_cmd_t                                m_queue[MHS_ESB_QUEUE_SIZE];
+static uint8_t                                  m_head = 0;
+static uint8_t                                  m_tail = 0;
+static bool                                     m_active = false;   /**< Timeslot requested or running. */
+static uint8_t                                  m_slot_tries = 0;
+static bool                                     m_down = false;
+static uint32_t                                 m_down_ticks;
+
+STATIC_ASSERT((MHS_ESB_QUEUE_SIZE & (MHS_ESB_QUEUE_SIZE - 1)) == 0);
+
+
+/**@brief Ask for a window as soon as possible.
+ */
+static void request_earliest(void)
+{
+    uint32_t err_code;
+
+    m_request.request_type               = NRF_RADIO_REQ_TYPE_EARLIEST;
+    m_request.params.earliest.hfclk      = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.earliest.priority   = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.earliest.length_us  = MHS_ESB_SLOT_US;
+    m_request.params.earliest.timeout_us = ESB_REQUEST_TIMEOUT_US;
+
+    err_code = sd_radio_request(&m_request);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Set up the radio for ESB, the way the peripheral listens.
+ */
+static void radio_config(void)
+{
+    // Power cycling resets whatever the SoftDevice left in the radio.
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Disabled << RADIO_POWER_POWER_Pos;
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Enabled << RADIO_POWER_POWER_Pos;
+
+    NRF_RADIO->MODE        = RADIO_MODE_MODE_Nrf_2Mbit << RADIO_MODE_MODE_Pos;
+    NRF_RADIO->TXPOWER     = RADIO_TXPOWER_TXPOWER_0dBm << RADIO_TXPOWER_TXPOWER_Pos;
+    NRF_RADIO->FREQUENCY   = MHS_ESB_FREQUENCY;
+    NRF_RADIO->PREFIX0     = MHS_ESB_PREFIX;
+    NRF_RADIO->BASE0       = MHS_ESB_BASE_ADDRESS;
+    NRF_RADIO->TXADDRESS   = 0;
+    NRF_RADIO->RXADDRESSES = 1;
+    NRF_RADIO->PCNF0       = (0 << RADIO_PCNF0_S0LEN_Pos)
+                           | (6 << RADIO_PCNF0_LFLEN_Pos)
+                           | (3 << RADIO_PCNF0_S1LEN_Pos);
+    NRF_RADIO->PCNF1       = (RADIO_PCNF1_WHITEEN_Disabled << RADIO_PCNF1_WHITEEN_Pos)
+                           | (RADIO_PCNF1_ENDIAN_Big << RADIO_PCNF1_ENDIAN_Pos)
+                           | (4 << RADIO_PCNF1_BALEN_Pos)
+                           | (0 << RADIO_PCNF1_STATLEN_Pos)
+                           | (MHS_ESB_PAYLOAD_LEN << RADIO_PCNF1_MAXLEN_Pos);
+    NRF_RADIO->CRCCNF      = (RADIO_CRCCNF_LEN_Two << RADIO_CRCCNF_LEN_Pos)
+                           | (RADIO_CRCCNF_SKIPADDR_Include << RADIO_CRCCNF_SKIPADDR_Pos);
+    NRF_RADIO->CRCPOLY     = ESB_CRC_POLY;
+    NRF_RADIO->CRCINIT     = ESB_CRC_INIT;
+
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->INTENSET    = RADIO_INTENSET_DISABLED_Msk;
+    NVIC_EnableIRQ(RADIO_IRQn);
+}
+
+
+/**@brief Send the packet, the receiver ramps up by itself when it ends.
+ */
+static void tx_start(void)
+{
+    m_state               = ESB_STATE_TX;
+    NRF_RADIO->PACKETPTR  = (uint32_t)m_tx_packet;
+    NRF_RADIO->SHORTS     = ESB_SHORTS_TX;
+    NRF_RADIO->TASKS_TXEN = 1;
+}
+
+
+/**@brief Stop the radio and hand the result to the main loop.
+ */
+static void slot_end(esb_result_t result)
+{
+    NRF_TIMER0->INTENCLR     = TIMER_INTENCLR_COMPARE0_Msk | TIMER_INTENCLR_COMPARE1_Msk;
+    NRF_RADIO->INTENCLR      = RADIO_INTENCLR_DISABLED_Msk;
+    NRF_RADIO->SHORTS        = 0;
+    NRF_RADIO->TASKS_DISABLE = 1;
+
+    m_result = result;
+    NVIC_SetPendingIRQ(ESB_IRQn);
+
+    m_signal_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_END;
+}
+
+
+/**@brief Try again if the window has room for one more attempt.
+ */
+static void retry(void)
+{
+    NRF_TIMER0->TASKS_CAPTURE[2] = 1;
+    if (NRF_TIMER0->CC[2] + ESB_ATTEMPT_US > NRF_TIMER0->CC[0])
+    {
+        slot_end(ESB_RESULT_NOT_ACKED);
+        return;
+    }
+
+    tx_start();
+}
+
+
+/**@brief The radio disabled, after a packet or after an abort.
+ */
+static void radio_disabled(void)
+{
+    switch (m_state)
+    {
+        case ESB_STATE_TX:
+            // The receiver is ramping up, wait for the acknowledge.
+            m_state              = ESB_STATE_ACK_WAIT;
+            NRF_RADIO->PACKETPTR = (uint32_t)m_ack_packet;
+            NRF_RADIO->SHORTS    = ESB_SHORTS_ACK;
+
+            NRF_TIMER0->TASKS_CAPTURE[1]  = 1;
+            NRF_TIMER0->CC[1]            += MHS_ESB_ACK_TIMEOUT_US;
+            NRF_TIMER0->EVENTS_COMPARE[1] = 0;
+            NRF_TIMER0->INTENSET          = TIMER_INTENSET_COMPARE1_Msk;
+            break;
+
+        case ESB_STATE_ACK_WAIT:
+            NRF_TIMER0->INTENCLR = TIMER_INTENCLR_COMPARE1_Msk;
+            if ((NRF_RADIO->CRCSTATUS == RADIO_CRCSTATUS_CRCSTATUS_CRCOk)
+                    && ((m_ack_packet[1] & ESB_PID_MASK) == (m_tx_packet[1] & ESB_PID_MASK)))
+            {
+                slot_end(ESB_RESULT_ACKED);
+            }
+            else
+            {
+                retry();
+            }
+            break;
+
+        case ESB_STATE_ABORT:
+            retry();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/**@brief Timeslot signals, at the highest interrupt priority.
+ */
+static nrf_radio_signal_callback_return_param_t * radio_signal_callback(uint8_t signal_type)
+{
+    m_signal_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+    switch (signal_type)
+    {
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_START:
+            // TIMER0 counts microseconds from the start of the window.
+            NRF_TIMER0->CC[0]    = MHS_ESB_SLOT_US - ESB_SLOT_END_MARGIN_US;
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+
+            // A new packet ID tells the peripheral this is not a retransmission.
+            if (m_slot_tries == 0)
+            {
+                m_pid = (m_pid + 1) & (ESB_PID_MASK >> ESB_PID_POS);
+            }
+            m_tx_packet[0] = MHS_ESB_PAYLOAD_LEN;
+            m_tx_packet[1] = (m_pid << ESB_PID_POS) | ESB_ACK_REQUEST;
+            memcpy(&m_tx_packet[ESB_HEADER_LEN], m_queue[m_head].data, MHS_ESB_PAYLOAD_LEN);
+
+            radio_config();
+            tx_start();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO:
+            if (NRF_RADIO->EVENTS_DISABLED != 0)
+            {
+                NRF_RADIO->EVENTS_DISABLED = 0;
+                radio_disabled();
+            }
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0:
+            if (NRF_TIMER0->EVENTS_COMPARE[0] != 0)
+            {
+                NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+                slot_end(ESB_RESULT_NOT_ACKED);
+            }
+            else if (NRF_TIMER0->EVENTS_COMPARE[1] != 0)
+            {
+                // No acknowledge, the DISABLED event sends again.
+                NRF_TIMER0->EVENTS_COMPARE[1] = 0;
+                NRF_TIMER0->INTENCLR          = TIMER_INTENCLR_COMPARE1_Msk;
+                m_state                       = ESB_STATE_ABORT;
+                NRF_RADIO->SHORTS             = 0;
+                NRF_RADIO->TASKS_DISABLE      = 1;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return &m_signal_return;
+}
+
+
+/**@brief Request a window for the head of the queue.
+ */
+static void slot_request(void)
+{
+    if (m_active || (m_head == m_tail))
+    {
+        return;
+    }
+
+    m_active = true;
+    request_earliest();
+}
+
+
+/**@brief Send what the peripheral did not acknowledge over BLE, in order.
+ */
+static void queue_fall_back(void)
+{
+    while (m_head != m_tail)
+    {
+        esb_cmd_t * p_cmd = &m_queue[m_head];
+
+        (void)mhs_c_cmd_send(MHS_C_LINK_ALL, p_cmd->cmd, p_cmd->len);
+        m_head = (m_head + 1) & (MHS_ESB_QUEUE_SIZE - 1);
+    }
+
+    m_down = true;
+    (void)app_timer_cnt_get(&m_down_ticks);
+}
+
+
+/**@brief A timeslot, or the request for one, ended without an acknowledge.
+ */
+static void slot_failed(void)
+{
+    m_slot_tries++;
+    if (m_slot_tries >= MHS_ESB_SLOT_TRIES)
+    {
+        SEGGER_RTT_printf(0, "esb cmd %d not acked\r\n", m_queue[m_head].cmd[0]);
+        m_slot_tries = 0;
+        queue_fall_back();
+    }
+}
+
+
+/**@brief Take the result of a timeslot and go on with the queue.
+ */
+static void result_process(void * p_event_data, uint16_t event_size)
+{
+    uint32_t now;
+    uint32_t ticks;
+
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    if (m_result == ESB_RESULT_ACKED)
+    {
+        (void)app_timer_cnt_get(&now);
+        (void)app_timer_cnt_diff_compute(now, m_queue[m_head].ticks, &ticks);
+        SEGGER_RTT_printf(0, "esb cmd %d: %u us\r\n", m_queue[m_head].cmd[0],
+                          (ticks * 15625) >> 9);
+
+        m_slot_tries = 0;
+        m_head = (m_head + 1) & (MHS_ESB_QUEUE_SIZE - 1);
+    }
+    else if (m_result == ESB_RESULT_NOT_ACKED)
+    {
+        slot_failed();
+    }
+
+    m_result = ESB_RESULT_NONE;
+    m_active = false;
+    slot_request();
+}
+
+
+/**@brief Software interrupt at application priority, pended from the timeslot.
+ */
+void ESB_IRQHandler(void)
+{
+    uint32_t err_code = app_sched_event_put(NULL, 0, result_process);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+void mhs_c_esb_init(void)
+{
+    uint32_t err_code;
+
+    err_code = sd_nvic_ClearPendingIRQ(ESB_IRQn);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_SetPriority(ESB_IRQn, APP_IRQ_PRIORITY_LOW);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_EnableIRQ(ESB_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_radio_session_open(radio_signal_callback);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+uint32_t mhs_c_esb_send(uint8_t * cmd, uint8_t len)
+{
+    esb_cmd_t * p_cmd;
+    uint8_t     next = (m_tail + 1) & (MHS_ESB_QUEUE_SIZE - 1);
+
+    if ((len == 0) || (len > MHS_BCAST_CMD_MAX_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    if (m_down)
+    {
+        uint32_t now;
+        uint32_t ticks;
+
+        (void)app_timer_cnt_get(&now);
+        (void)app_timer_cnt_diff_compute(now, m_down_ticks, &ticks);
+        if (ticks < ESB_DOWN_TICKS)
+        {
+            return NRF_ERROR_INVALID_STATE;
+        }
+        m_down = false;
+    }
+
+    if (next == m_head)
+    {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p_cmd = &m_queue[m_tail];
+    mhs_c_bcast_data_build(MHS_BCAST_GROUP_ALL, cmd, len, p_cmd->data);
+    memcpy(p_cmd->cmd, cmd, len);
+    p_cmd->len = len;
+    (void)app_timer_cnt_get(&p_cmd->ticks);
+    m_tail = next;
+
+    slot_request();
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t mhs_c_esb_cancel_send(uint8_t * cmd, uint8_t len)
+{
+    if ((len == 0) || (len > MHS_BCAST_CMD_MAX_LEN))
+    {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+
+    // The head stays while a timeslot may be sending it, the rest never goes out.
+    if (m_active && (m_head != m_tail))
+    {
+        m_tail = (m_head + 1) & (MHS_ESB_QUEUE_SIZE - 1);
+    }
+    else
+    {
+        m_tail       = m_head;
+        m_slot_tries = 0;
+    }
+
+    return mhs_c_esb_send(cmd, len);
+}
+
+
+void mhs_c_esb_on_sys_evt(uint32_t sys_evt)
+{
+    switch (sys_evt)
+    {
+        case NRF_EVT_RADIO_BLOCKED:
+        case NRF_EVT_RADIO_CANCELED:
+            // No window next to the links in time.
+            m_active = false;
+            slot_failed();
+            slot_request();
+            break;
+
+        case NRF_EVT_RADIO_SIGNAL_CALLBACK_INVALID_RETURN:
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+            break;
+
+        default:
+            break;
+    }
+}
@@ -0,0 +1,67 @@
+/**
+ * @file
+ *
+ * @brief    MHS commands over Enhanced ShockBurst.
+ *
+ * @details  Low latency control link for hand-held jogging, built with MHS_ESB defined. A
+ *           command is sent in a short timeslot between the BLE events and retransmitted until
+ *           the peripheral acknowledges it, instead of waiting for the next connection event.
+ *           Commands the peripheral does not acknowledge go over BLE instead, and BLE keeps the
+ *           link for MHS_ESB_DOWN_MS so later commands do not overtake them.
+ *
+ *           The payload is the broadcast data of mhs_c_bcast.h, signed and sequence numbered.
+ *           Packets use ESB dynamic payload framing at 2 Mbit: a 6 bit length, then the 2 bit
+ *           packet ID and the no acknowledge bit, then the payload and a 16 bit CRC.
+ *           The same link is defined in mhs_esb.h of the peripheral.
+ */
+
+#ifndef MHS_C_ESB_H_
+#define MHS_C_ESB_H_
+
+#include <stdint.h>
+
+#include "mhs_c_bcast.h"
+
+#define MHS_ESB_FREQUENCY           82          /**< MHz above 2400, above the BLE channels. */
+#define MHS_ESB_BASE_ADDRESS        0x4D68732D
+#define MHS_ESB_PREFIX              0x45
+#define MHS_ESB_PAYLOAD_LEN         MHS_BCAST_DATA_LEN
+
+#define MHS_ESB_SLOT_US             2000        /**< Room for three attempts. */
+#define MHS_ESB_ACK_TIMEOUT_US      250         /**< From the end of a packet, the acknowledge takes about 180 us. */
+#define MHS_ESB_SLOT_TRIES          3           /**< Timeslots for a command before it goes over BLE. */
+#define MHS_ESB_QUEUE_SIZE          4           /**< Commands waiting for a timeslot, a power of 2. */
+#define MHS_ESB_DOWN_MS             2000        /**< Time commands go over BLE after one was not acknowledged. */
+
+/**@brief Open the radio session. Call after the SoftDevice is enabled.
+ */
+void mhs_c_esb_init(void);
+
+/**@brief Queue a command for the peripheral on the ESB link.
+ *
+ * @param[in]   cmd     Control point command, code and value.
+ * @param[in]   len     1 to MHS_BCAST_CMD_MAX_LEN.
+ *
+ * @return NRF_SUCCESS, NRF_ERROR_INVALID_LENGTH, NRF_ERROR_NO_MEM if the queue is full, or
+ *         NRF_ERROR_INVALID_STATE while the link is down. Send over BLE on an error.
+ */
+uint32_t mhs_c_esb_send(uint8_t * cmd, uint8_t len);
+
+/**@brief Drop the queued commands that are not on the air yet and queue a command behind the
+ *        one that is, so nothing queued before it runs after it. For motor off, the jogs
+ *        waiting for ESB or for their fall back over BLE would start the motor again.
+ *
+ * @param[in]   cmd     Control point command, code and value.
+ * @param[in]   len     1 to MHS_BCAST_CMD_MAX_LEN.
+ *
+ * @return As mhs_c_esb_send(). While the link is down the queue is already empty.
+ */
+uint32_t mhs_c_esb_cancel_send(uint8_t * cmd, uint8_t len);
+
+/**@brief Request the timeslot again after the SoftDevice blocked or canceled it.
+ *
+ * @param[in]   sys_evt     System event.
+ */
+void mhs_c_esb_on_sys_evt(uint32_t sys_evt);
+
+#endif // MHS_C_ESB_H_
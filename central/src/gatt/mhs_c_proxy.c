@@ -1,4 +1,11 @@
 #include <app_error.h>
+#include <app_util.h>
+#include <ble_db_discovery.h>
+#include <app_timer.h>
+#include <ble_hci.h>
+#include <app_scheduler.h>
+
+#include "SEGGER_RTT.h"
 
 #include "ble_mhs_c.h"
 #include "uart.h"
@@ -6,20 +13,272 @@
 
 #include "mhs_c_proxy.h"
 
-static ble_mhs_c_t                  m_ble_mhs_c;
+#define TELEMETRY_TEMPERATURE_INTERVAL  2       /**< Seconds between two temperature checks. */
+#define TELEMETRY_TEMPERATURE_THRESHOLD 8       /**< Half a degree, in 1/16 degrees. */
+#define TELEMETRY_MOTOR_SPEED_INTERVAL  1
+#define TELEMETRY_MOTOR_SPEED_THRESHOLD 1       /**< Percent. */
+
+/**@brief One connected peripheral. */
+typedef struct
+{
+    ble_mhs_c_t  mhs_c;
+    uint16_t     conn_handle;           /**< BLE_CONN_HANDLE_INVALID while the link is free. */
+    dm_handle_t  dm_handle;             /**< Peer of the connection. */
+    bool         cache_dirty;           /**< Discovered handles wait for the peer to be bonded. */
+    bool         discovery_pending;     /**< Waits for the discovery of another link to finish. */
+    uint32_t     connect_ticks;         /**< RTC ticks at connection, to time the link setup. */
+    uint32_t     handle_cache[DEVICE_MANAGER_APP_CONTEXT_SIZE / sizeof(uint32_t)];  /**< Flash is written from here, keep it until done. */
+} mhs_c_link_t;
+
+static mhs_c_link_t                 m_links[MHS_C_MAX_LINKS];
+static ble_db_discovery_t           m_ble_db_discovery;     /**< Shared, links are discovered one after the other. */
+static mhs_c_link_t *               mp_discovering = NULL;  /**< Link being discovered. */
+
+STATIC_ASSERT(sizeof(ble_mhs_c_handles_t) <= sizeof(m_links[0].handle_cache));
+STATIC_ASSERT(MHS_C_MAX_LINKS <= BLE_MHS_C_MAX_INSTANCES);
+
+/**@brief Find the link of a connection.
+ *
+ * @return Link, or NULL if the connection is not one of ours.
+ */
+static mhs_c_link_t * link_get(uint16_t conn_handle)
+{
+    if (conn_handle == BLE_CONN_HANDLE_INVALID)
+    {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (m_links[i].conn_handle == conn_handle)
+        {
+            return &m_links[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**@brief Take a free link.
+ *
+ * @return Link, or NULL if all are in use.
+ */
+static mhs_c_link_t * link_alloc(void)
+{
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (m_links[i].conn_handle == BLE_CONN_HANDLE_INVALID)
+        {
+            return &m_links[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**@brief Find the link of an MHS client instance.
+ */
+static mhs_c_link_t * link_of(const ble_mhs_c_t * p_mhs_c)
+{
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (&m_links[i].mhs_c == p_mhs_c)
+        {
+            return &m_links[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+/**@brief Have the peripheral push temperature and motor speed instead of polling them.
+ *
+ * @details Sent as command frames so the setup does not take a round trip per command.
+ */
+static void telemetry_subscribe(ble_mhs_c_t * p_mhs_c)
+{
+    uint8_t cmd[3];
+
+    cmd[0] = MHS_CMD_CODE_SET_REPORT_THRESHOLD;
+    cmd[1] = MHS_TELEMETRY_SIGNAL_TEMPERATURE;
+    cmd[2] = TELEMETRY_TEMPERATURE_THRESHOLD;
+    ble_mhs_c_frame_cmd_add(p_mhs_c, cmd, sizeof(cmd));
+
+    cmd[0] = MHS_CMD_CODE_SUBSCRIBE;
+    cmd[2] = TELEMETRY_TEMPERATURE_INTERVAL;
+    ble_mhs_c_frame_cmd_add(p_mhs_c, cmd, sizeof(cmd));
+
+    cmd[0] = MHS_CMD_CODE_SET_REPORT_THRESHOLD;
+    cmd[1] = MHS_TELEMETRY_SIGNAL_MOTOR_SPEED;
+    cmd[2] = TELEMETRY_MOTOR_SPEED_THRESHOLD;
+    ble_mhs_c_frame_cmd_add(p_mhs_c, cmd, sizeof(cmd));
+
+    cmd[0] = MHS_CMD_CODE_SUBSCRIBE;
+    cmd[2] = TELEMETRY_MOTOR_SPEED_INTERVAL;
+    ble_mhs_c_frame_cmd_add(p_mhs_c, cmd, sizeof(cmd));
+
+    ble_mhs_c_frame_send(p_mhs_c);
+}
+
+/**@brief Store the discovered handles for the peer, only possible once it is bonded.
+ */
+static void handle_cache_store(mhs_c_link_t * p_link)
+{
+    uint32_t                 err_code;
+    dm_application_context_t context;
+
+    ble_mhs_c_handles_get(&p_link->mhs_c, (ble_mhs_c_handles_t *)p_link->handle_cache);
+
+    context.flags  = 0;
+    context.len    = sizeof(p_link->handle_cache);
+    context.p_data = (uint8_t *)p_link->handle_cache;
+
+    err_code = dm_application_context_set(&p_link->dm_handle, &context);
+    p_link->cache_dirty = (err_code != NRF_SUCCESS);
+}
+
+
+/**@brief Take the handles from the cache of a bonded peer.
+ *
+ * @return true if the link can be used without discovery.
+ */
+static bool handle_cache_load(mhs_c_link_t * p_link)
+{
+    uint32_t                 err_code;
+    uint32_t                 cache[DEVICE_MANAGER_APP_CONTEXT_SIZE / sizeof(uint32_t)];
+    dm_application_context_t context;
+
+    // Not into the link's cache, a store may still be reading it.
+    context.p_data = (uint8_t *)cache;
+
+    err_code = dm_application_context_get(&p_link->dm_handle, &context);
+    if (err_code != NRF_SUCCESS)
+    {
+        return false;
+    }
+
+    err_code = ble_mhs_c_handles_set(&p_link->mhs_c, p_link->conn_handle,
+                                     (ble_mhs_c_handles_t *)cache);
+    return (err_code == NRF_SUCCESS);
+}
+
+
+/**@brief Start the discovery of the next link waiting for one, if none is running.
+ *
+ * @details The discovery module collects its results in one place, so links are discovered
+ *          one at a time.
+ */
+static void discovery_next(void)
+{
+    uint32_t err_code;
+
+    if (mp_discovering != NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (m_links[i].discovery_pending)
+        {
+            m_links[i].discovery_pending = false;
+            mp_discovering               = &m_links[i];
+
+            err_code = ble_db_discovery_start(&m_ble_db_discovery, m_links[i].conn_handle);
+            APP_ERROR_CHECK(err_code);
+            return;
+        }
+    }
+}
+
+
+static void discovery_next_execute(void * p_event_data, uint16_t event_size)
+{
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    discovery_next();
+}
+
+
+/**@brief The discovery of a link is over, successful or not.
+ *
+ * @details Called from the discovery module's events, which still uses the discovery
+ *          instance afterwards. The next discovery starts from the main loop.
+ */
+static void discovery_done(mhs_c_link_t * p_link)
+{
+    uint32_t err_code;
+
+    if (mp_discovering == p_link)
+    {
+        mp_discovering = NULL;
+
+        err_code = app_sched_event_put(NULL, 0, discovery_next_execute);
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+
+/**@brief Enable the MHS events and subscribe to telemetry, the link is usable after this.
+ *
+ * @param[in]   round_trips     GATT procedures used to find the handles, 0 when cached.
+ */
+static void link_setup(mhs_c_link_t * p_link, uint8_t round_trips)
+{
+    uint32_t err_code;
+    uint32_t ticks;
+
+    err_code = ble_mhs_c_evt_notif_enable(&p_link->mhs_c);
+    APP_ERROR_CHECK(err_code);
+    telemetry_subscribe(&p_link->mhs_c);
+
+    err_code = app_timer_cnt_get(&ticks);
+    APP_ERROR_CHECK(err_code);
+    err_code = app_timer_cnt_diff_compute(ticks, p_link->connect_ticks, &ticks);
+    APP_ERROR_CHECK(err_code);
+    SEGGER_RTT_printf(0, "mhs %d ready %d ms after connection, %d discovery round trips\r\n",
+                      p_link - m_links, ticks * 1000 / APP_TIMER_CLOCK_FREQ, round_trips);
+}
+
 
 /**@brief MHS Collector Handler.
  */
 static void mhs_c_evt_handler(ble_mhs_c_t * p_mhs_c, ble_mhs_c_evt_t * p_mhs_c_evt)
 {
-    uint32_t err_code;
+    mhs_c_link_t * p_link = link_of(p_mhs_c);
+    uint32_t       err_code;
 
     switch (p_mhs_c_evt->evt_type)
     {
         case BLE_MHS_C_EVT_DISCOVERY_COMPLETE:
         {
-           err_code = ble_mhs_c_evt_notif_enable(p_mhs_c);
+            link_setup(p_link, m_ble_db_discovery.round_trips);
+            handle_cache_store(p_link);
+            discovery_done(p_link);
+            break;
+        }
+        case BLE_MHS_C_EVT_DISCOVERY_FAILED:
+        {
+            // Not an MHS peripheral, make room for one.
+            SEGGER_RTT_printf(0, "mhs %d not found, disconnecting\r\n", p_link - m_links);
+            err_code = sd_ble_gap_disconnect(p_link->conn_handle,
+                                             BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
             APP_ERROR_CHECK(err_code);
+            discovery_done(p_link);
+            break;
+        }
+        case BLE_MHS_C_EVT_SERVICE_CHANGED:
+        {
+            // Forget the cache and find the new handles.
+            SEGGER_RTT_printf(0, "mhs %d service changed, discovering\r\n", p_link - m_links);
+            p_link->cache_dirty       = false;
+            p_link->discovery_pending = true;
+            (void)dm_application_context_delete(&p_link->dm_handle);
+            discovery_next();
             break;
         }
         case BLE_MHS_C_EVT_NOTIFICATION:
@@ -34,18 +293,201 @@ static void mhs_c_evt_handler(ble_mhs_c_t * p_mhs_c, ble_mhs_c_evt_t * p_mhs_c_e
 }
 
 
+/**@brief Send a command to one link or to all of them.
+ *
+ * @details Links that are not set up yet are skipped when sending to all. A full queue on one
+ *          link does not keep the command from the others.
+ */
+static uint32_t cmd_fan_out(uint8_t link, uint8_t * cmd, uint8_t len, bool priority)
+{
+    uint32_t err_code;
+    uint32_t result = NRF_SUCCESS;
+    uint32_t sent   = 0;
+
+    if ((link != MHS_C_LINK_ALL) && (link >= MHS_C_MAX_LINKS))
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (((link != MHS_C_LINK_ALL) && (link != i))
+                || (m_links[i].conn_handle == BLE_CONN_HANDLE_INVALID))
+        {
+            continue;
+        }
+
+        if (priority)
+        {
+            err_code = ble_mhs_c_send_priority_cmd(&m_links[i].mhs_c, cmd, len);
+        }
+        else
+        {
+            err_code = ble_mhs_c_send_cmd(&m_links[i].mhs_c, cmd, len);
+        }
+
+        if (err_code == NRF_SUCCESS)
+        {
+            sent++;
+        }
+        else if (err_code != NRF_ERROR_INVALID_STATE)
+        {
+            // E.g. a full queue, the other links still get the command.
+            result = err_code;
+        }
+    }
+
+    if ((result == NRF_SUCCESS) && (sent == 0))
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    return result;
+}
+
+
 void mhs_c_init(void)
 {
     ble_mhs_c_init_t mhs_c_init_obj;
+    uint32_t         err_code;
 
     mhs_c_init_obj.evt_handler = mhs_c_evt_handler;
 
-    uint32_t err_code = ble_mhs_c_init(&m_ble_mhs_c, &mhs_c_init_obj);
-    APP_ERROR_CHECK(err_code);
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        m_links[i].conn_handle = BLE_CONN_HANDLE_INVALID;
+
+        err_code = ble_mhs_c_init(&m_links[i].mhs_c, &mhs_c_init_obj);
+        APP_ERROR_CHECK(err_code);
+    }
 }
 
 
-ble_mhs_c_t* get_mhs_obj(void)
+void mhs_c_on_ble_evt(ble_evt_t * p_ble_evt)
 {
-    return &m_ble_mhs_c;
+    mhs_c_link_t * p_link;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+        case BLE_GAP_EVT_DISCONNECTED:
+            p_link = link_get(p_ble_evt->evt.gap_evt.conn_handle);
+            break;
+
+        case BLE_EVT_TX_COMPLETE:
+            p_link = link_get(p_ble_evt->evt.common_evt.conn_handle);
+            break;
+
+        default:
+            p_link = link_get(p_ble_evt->evt.gattc_evt.conn_handle);
+            break;
+    }
+
+    if (p_link == NULL)
+    {
+        return;
+    }
+
+    if (p_link == mp_discovering)
+    {
+        ble_db_discovery_on_ble_evt(&m_ble_db_discovery, p_ble_evt);
+    }
+    ble_mhs_c_on_ble_evt(&p_link->mhs_c, p_ble_evt);
+
+    if (p_ble_evt->header.evt_id == BLE_GAP_EVT_DISCONNECTED)
+    {
+        p_link->conn_handle       = BLE_CONN_HANDLE_INVALID;
+        p_link->discovery_pending = false;
+        discovery_done(p_link);
+    }
+}
+
+
+void mhs_c_on_dm_evt(dm_handle_t const * p_handle, dm_event_t const * p_event)
+{
+    uint32_t       err_code;
+    uint16_t       conn_handle;
+    mhs_c_link_t * p_link;
+
+    switch (p_event->event_id)
+    {
+        case DM_EVT_CONNECTION:
+            // The device manager sees the connection first, the link is taken here.
+            conn_handle = p_event->event_param.p_gap_param->conn_handle;
+            p_link      = link_alloc();
+            if (p_link == NULL)
+            {
+                err_code = sd_ble_gap_disconnect(conn_handle,
+                                                 BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+                APP_ERROR_CHECK(err_code);
+                break;
+            }
+
+            p_link->conn_handle = conn_handle;
+            p_link->dm_handle   = (*p_handle);
+            p_link->cache_dirty = false;
+
+            err_code = app_timer_cnt_get(&p_link->connect_ticks);
+            APP_ERROR_CHECK(err_code);
+
+            if (handle_cache_load(p_link))
+            {
+                SEGGER_RTT_printf(0, "mhs %d handles from cache\r\n", p_link - m_links);
+                link_setup(p_link, 0);
+            }
+            else
+            {
+                p_link->discovery_pending = true;
+                discovery_next();
+            }
+            break;
+
+        case DM_EVT_SECURITY_SETUP_COMPLETE:
+            // A new bond has its device id now.
+            for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+            {
+                p_link = &m_links[i];
+                if ((p_link->conn_handle != BLE_CONN_HANDLE_INVALID)
+                        && (p_link->dm_handle.connection_id == p_handle->connection_id))
+                {
+                    p_link->dm_handle = (*p_handle);
+                    if (p_link->cache_dirty)
+                    {
+                        handle_cache_store(p_link);
+                    }
+                }
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+uint32_t mhs_c_cmd_send(uint8_t link, uint8_t * cmd, uint8_t len)
+{
+    return cmd_fan_out(link, cmd, len, false);
+}
+
+
+uint32_t mhs_c_priority_cmd_send(uint8_t link, uint8_t * cmd, uint8_t len)
+{
+    return cmd_fan_out(link, cmd, len, true);
+}
+
+
+uint8_t mhs_c_link_count(void)
+{
+    uint8_t count = 0;
+
+    for (uint32_t i = 0; i < MHS_C_MAX_LINKS; i++)
+    {
+        if (m_links[i].conn_handle != BLE_CONN_HANDLE_INVALID)
+        {
+            count++;
+        }
+    }
+
+    return count;
 }
@@ -2,9 +2,38 @@
 #define MHS_C_PROXY_H_
 
 #include "ble_mhs_c.h"
+#include "device_manager.h"
+
+#define MHS_C_MAX_LINKS         DEVICE_MANAGER_MAX_CONNECTIONS  /**< Peripherals kept connected at once. */
+#define MHS_C_LINK_ALL          0xFF                            /**< Send a command to every link. */
 
 void mhs_c_init(void);
 
-ble_mhs_c_t* get_mhs_obj(void);
+/**@brief Pass a BLE stack event to the discovery and MHS client modules of its link.
+ */
+void mhs_c_on_ble_evt(ble_evt_t * p_ble_evt);
+
+/**@brief Take a link for a new connection and set up its MHS from the handles cached for a
+ *        bonded peer, or discover them, and keep the cache up to date.
+ *
+ * @details Links waiting for discovery are discovered one after the other.
+ */
+void mhs_c_on_dm_evt(dm_handle_t const * p_handle, dm_event_t const * p_event);
+
+/**@brief Queue a control point command on one link, or on all with MHS_C_LINK_ALL.
+ *
+ * @return NRF_SUCCESS if every link that is set up took it, NRF_ERROR_INVALID_STATE if none
+ *         is, else the error of a link that refused it, see ble_mhs_c_send_cmd().
+ */
+uint32_t mhs_c_cmd_send(uint8_t link, uint8_t * cmd, uint8_t len);
+
+/**@brief Send a stop or off command ahead of the queue of one link, or of all with
+ *        MHS_C_LINK_ALL, see ble_mhs_c_send_priority_cmd().
+ */
+uint32_t mhs_c_priority_cmd_send(uint8_t link, uint8_t * cmd, uint8_t len);
+
+/**@brief Number of connected peripherals.
+ */
+uint8_t mhs_c_link_count(void);
 
 #endif // MHS_C_PROXY_H_
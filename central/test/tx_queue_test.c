@@ -0,0 +1,627 @@
+/**
+ * @file
+ *
+ * @brief    Host test of the command queue of the MHS client.
+ *
+ * @details  ble_mhs_c.c is built into this test so the queue can be looked at directly. The
+ *           SoftDevice is mocked: it takes write requests one at a time until the peer's write
+ *           response, and write commands while it has TX buffers. Each connection event puts
+ *           what the stack holds on the air, in order, and the peer applies it to its state.
+ *
+ *           Covered:
+ *           - removing a queued command when a later one supersedes it, with the ring wrapped
+ *           - priority commands going in at the front, with a full queue too
+ *           - the latency of motor off under a loaded queue, priority against queued
+ *           - a replay of 100 button events, checking the wire traffic and the final state
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/gatt/ble_mhs_c.c"
+
+#define CONN_HANDLE             0
+#define CTRL_HANDLE             0x0010
+#define EVENT_HANDLE            0x0012
+#define EVENT_CCCD_HANDLE       0x0013
+
+#define STACK_TX_BUFFERS        3       /**< Packets the mocked stack holds for one connection event. */
+#define WIRE_LOG_SIZE           256
+#define BUTTON_EVENT_COUNT      100
+
+/**@brief A write as it went on the air. */
+typedef struct
+{
+    uint8_t  value[MHS_CTRL_POINT_MAX_LEN];
+    uint8_t  len;
+    uint8_t  write_op;
+    uint32_t air_event;
+} wire_write_t;
+
+/**@brief What the peripheral does with the commands, after mhs_proxy.c and motor.c. */
+typedef struct
+{
+    uint8_t temp_threshold;
+    uint8_t duty_cycle;
+    uint8_t direction;
+    uint8_t on_mask;
+} peer_state_t;
+
+static ble_mhs_c_t  m_mhs_c;
+
+static wire_write_t m_stack[STACK_TX_BUFFERS];          /**< Taken by the stack, not on the air yet. */
+static uint32_t     m_stack_count;
+static bool         m_stack_blocked;                    /**< Refuse every write. */
+static bool         m_req_outstanding;
+static bool         m_rsp_due;
+static uint32_t     m_event;
+
+static wire_write_t m_wire[WIRE_LOG_SIZE];
+static uint32_t     m_wire_count;
+static peer_state_t m_peer;
+
+static uint32_t     m_failures;
+
+
+#define CHECK(condition)                                                      \
+    do                                                                        \
+    {                                                                         \
+        if (!(condition))                                                     \
+        {                                                                     \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition);       \
+            m_failures++;                                                     \
+        }                                                                     \
+    } while (0)
+
+
+uint32_t sd_ble_gattc_write(uint16_t conn_handle, ble_gattc_write_params_t const * const p_params)
+{
+    wire_write_t * p_write;
+
+    if (conn_handle != CONN_HANDLE)
+    {
+        return BLE_ERROR_INVALID_CONN_HANDLE;
+    }
+    if (m_stack_blocked || (m_stack_count == STACK_TX_BUFFERS))
+    {
+        return BLE_ERROR_NO_TX_BUFFERS;
+    }
+    if ((p_params->write_op == BLE_GATT_OP_WRITE_REQ) && m_req_outstanding)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    p_write = &m_stack[m_stack_count++];
+    memcpy(p_write->value, p_params->p_value, p_params->len);
+    p_write->len      = p_params->len;
+    p_write->write_op = p_params->write_op;
+
+    if (p_params->write_op == BLE_GATT_OP_WRITE_REQ)
+    {
+        m_req_outstanding = true;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t sd_ble_gattc_read(uint16_t conn_handle, uint16_t handle, uint16_t offset)
+{
+    return NRF_ERROR_NOT_SUPPORTED;
+}
+
+
+uint32_t sd_ble_gattc_hv_confirm(uint16_t conn_handle, uint16_t handle)
+{
+    return NRF_SUCCESS;
+}
+
+
+uint32_t sd_ble_uuid_vs_add(ble_uuid128_t const * const p_vs_uuid, uint8_t * const p_uuid_type)
+{
+    *p_uuid_type = BLE_UUID_TYPE_VENDOR_BEGIN;
+    return NRF_SUCCESS;
+}
+
+
+uint32_t ble_db_discovery_evt_register_targeted(const ble_uuid_t * const             p_uuid,
+                                                const uint16_t * const               p_char_uuids,
+                                                uint8_t                              char_uuid_count,
+                                                const ble_db_discovery_evt_handler_t evt_handler)
+{
+    return NRF_SUCCESS;
+}
+
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t * p_file_name)
+{
+    printf("FAIL app error %u at %s:%u\n", error_code, p_file_name, line_num);
+    m_failures++;
+}
+
+
+static void mhs_c_evt_handler(ble_mhs_c_t * p_ble_mhs_c, ble_mhs_c_evt_t * p_evt)
+{
+}
+
+
+/**@brief Apply a control point command the way the peripheral does. */
+static void peer_apply(peer_state_t * p_state, const uint8_t * p_cmd, uint8_t len)
+{
+    switch (p_cmd[0])
+    {
+        case MHS_CMD_CODE_SET_TEMP_THRESHOLD:
+            p_state->temp_threshold = p_cmd[1];
+            break;
+
+        case MHS_CMD_CODE_SET_MOTOR_SPEED:
+            p_state->duty_cycle = p_cmd[1];
+            break;
+
+        case MHS_CMD_CODE_SET_MOTOR_CONTROL:
+            p_state->direction = p_cmd[1];
+            p_state->on_mask  |= (uint8_t)(1 << p_cmd[2]);
+            break;
+
+        case MHS_CMD_CODE_SET_MOTOR_OFF:
+            p_state->on_mask = 0;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+static void ble_evt_send(uint16_t evt_id)
+{
+    ble_evt_t evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.header.evt_id = evt_id;
+
+    // All events here are of the one connection, at the same place in each event type.
+    evt.evt.gap_evt.conn_handle     = CONN_HANDLE;
+    evt.evt.gattc_evt.conn_handle   = CONN_HANDLE;
+    evt.evt.common_evt.conn_handle  = CONN_HANDLE;
+    evt.evt.common_evt.params.tx_complete.count = 1;
+
+    ble_mhs_c_on_ble_evt(&m_mhs_c, &evt);
+}
+
+
+/**@brief One connection event: the peer answers the write request sent in the previous one,
+ *        and everything the stack holds goes on the air.
+ */
+static void conn_event(void)
+{
+    uint32_t count = m_stack_count;
+    bool     rsp   = m_rsp_due;
+
+    m_event++;
+    m_rsp_due = false;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        m_stack[i].air_event = m_event;
+        peer_apply(&m_peer, m_stack[i].value, m_stack[i].len);
+        if (m_stack[i].write_op == BLE_GATT_OP_WRITE_REQ)
+        {
+            m_rsp_due = true;
+        }
+        if (m_wire_count < WIRE_LOG_SIZE)
+        {
+            m_wire[m_wire_count++] = m_stack[i];
+        }
+    }
+    m_stack_count = 0;
+
+    if (rsp)
+    {
+        m_req_outstanding = false;
+        ble_evt_send(BLE_GATTC_EVT_WRITE_RSP);
+    }
+    if (count != 0)
+    {
+        ble_evt_send(BLE_EVT_TX_COMPLETE);
+    }
+}
+
+
+/**@brief Run connection events until the queue and the stack are empty. */
+static void drain(void)
+{
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        if ((tx_buffer_count(&m_tx_queue[m_mhs_c.instance]) == 0) && (m_stack_count == 0)
+                && !m_rsp_due)
+        {
+            return;
+        }
+        conn_event();
+    }
+    CHECK(false);
+}
+
+
+/**@brief Start a test on a fresh connection, with the queue empty at ring position index. */
+static void setup(uint32_t index)
+{
+    ble_mhs_c_handles_t handles;
+    uint32_t            err_code;
+
+    memset(&m_tx_queue[m_mhs_c.instance], 0, sizeof(m_tx_queue[0]));
+    m_tx_queue[m_mhs_c.instance].index        = index;
+    m_tx_queue[m_mhs_c.instance].insert_index = index;
+
+    memset(&m_peer, 0, sizeof(m_peer));
+    m_stack_count     = 0;
+    m_stack_blocked   = false;
+    m_req_outstanding = false;
+    m_rsp_due         = false;
+    m_event           = 0;
+    m_wire_count      = 0;
+
+    memset(&handles, 0, sizeof(handles));
+    handles.version           = MHS_C_HANDLE_CACHE_VERSION;
+    handles.ctrl_handle       = CTRL_HANDLE;
+    handles.event_handle      = EVENT_HANDLE;
+    handles.event_cccd_handle = EVENT_CCCD_HANDLE;
+
+    err_code = ble_mhs_c_handles_set(&m_mhs_c, CONN_HANDLE, &handles);
+    CHECK(err_code == NRF_SUCCESS);
+}
+
+
+static uint32_t cmd_send(uint8_t code, uint8_t value0, uint8_t value1, uint8_t len)
+{
+    uint8_t cmd[3] = {code, value0, value1};
+
+    return ble_mhs_c_send_cmd(&m_mhs_c, cmd, len);
+}
+
+
+static uint32_t motor_off_send(void)
+{
+    uint8_t cmd = MHS_CMD_CODE_SET_MOTOR_OFF;
+
+    return ble_mhs_c_send_priority_cmd(&m_mhs_c, &cmd, sizeof(cmd));
+}
+
+
+static bool queued_is(uint32_t index, uint8_t code, uint8_t value0, uint8_t write_op)
+{
+    const tx_message_t * p_msg = &m_tx_queue[m_mhs_c.instance].buffer[index];
+
+    return (p_msg->type == WRITE_REQ)
+           && (p_msg->req.write_req.gattc_params.write_op == write_op)
+           && (p_msg->req.write_req.gattc_value[0] == code)
+           && ((p_msg->req.write_req.gattc_params.len == 1)
+               || (p_msg->req.write_req.gattc_value[1] == value0));
+}
+
+
+/**@brief A superseded command in the middle of a wrapped ring is removed and the later ones
+ *        move up, the new command goes last.
+ */
+static void test_remove_shifts(void)
+{
+    tx_queue_t * p_queue = &m_tx_queue[m_mhs_c.instance];
+
+    setup(2);
+    m_stack_blocked = true;
+
+    CHECK(cmd_send(MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, 0, 3) == NRF_SUCCESS);   // at 2
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, 1, 3) == NRF_SUCCESS);     // at 3
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_SPEED, 50, 0, 3) == NRF_SUCCESS);      // at 0
+    CHECK(tx_buffer_count(p_queue) == TX_BUFFER_MASK);
+
+    // Full, so a command that supersedes nothing is refused.
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, 2, 3) == NRF_ERROR_BUSY);
+
+    // Same motor, other direction: the one at 3 goes, the speed moves up from 0 to 3.
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_CONTROL, 1, 1, 3) == NRF_SUCCESS);
+    CHECK(p_queue->index == 2);
+    CHECK(p_queue->insert_index == 1);
+    CHECK(queued_is(2, MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, BLE_GATT_OP_WRITE_REQ));
+    CHECK(queued_is(3, MHS_CMD_CODE_SET_MOTOR_SPEED, 50, BLE_GATT_OP_WRITE_REQ));
+    CHECK(queued_is(0, MHS_CMD_CODE_SET_MOTOR_CONTROL, 1, BLE_GATT_OP_WRITE_REQ));
+
+    // Superseding the newest entry leaves the others in place.
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, 1, 3) == NRF_SUCCESS);
+    CHECK(p_queue->insert_index == 1);
+    CHECK(queued_is(0, MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, BLE_GATT_OP_WRITE_REQ));
+
+    // And the oldest one.
+    CHECK(cmd_send(MHS_CMD_CODE_SET_TEMP_THRESHOLD, 40, 0, 3) == NRF_SUCCESS);
+    CHECK(queued_is(2, MHS_CMD_CODE_SET_MOTOR_SPEED, 50, BLE_GATT_OP_WRITE_REQ));
+    CHECK(queued_is(3, MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, BLE_GATT_OP_WRITE_REQ));
+    CHECK(queued_is(0, MHS_CMD_CODE_SET_TEMP_THRESHOLD, 40, BLE_GATT_OP_WRITE_REQ));
+    CHECK(p_queue->stats.coalesced == 3);
+    CHECK(p_queue->stats.rejected == 1);
+
+    m_stack_blocked = false;
+    tx_buffer_process(p_queue);
+    drain();
+
+    CHECK(m_wire_count == 3);
+    CHECK(m_wire[0].value[0] == MHS_CMD_CODE_SET_MOTOR_SPEED);
+    CHECK(m_wire[1].value[0] == MHS_CMD_CODE_SET_MOTOR_CONTROL);
+    CHECK(m_wire[2].value[0] == MHS_CMD_CODE_SET_TEMP_THRESHOLD);
+    CHECK(m_peer.temp_threshold == 40);
+    CHECK(m_peer.duty_cycle == 50);
+    CHECK((m_peer.on_mask == 0x02) && (m_peer.direction == 0));
+}
+
+
+/**@brief Motor off goes in at the front as a write command, drops the queued motor commands,
+ *        and makes room in a full queue by dropping the newest message.
+ */
+static void test_priority_front(void)
+{
+    tx_queue_t * p_queue = &m_tx_queue[m_mhs_c.instance];
+
+    // Wrapped: the off goes in below index 0.
+    setup(0);
+    m_stack_blocked = true;
+
+    CHECK(cmd_send(MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, 0, 3) == NRF_SUCCESS);
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, 1, 3) == NRF_SUCCESS);
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_SPEED, 50, 0, 3) == NRF_SUCCESS);
+
+    CHECK(motor_off_send() == NRF_SUCCESS);
+    CHECK(p_queue->index == 3);
+    CHECK(p_queue->insert_index == 1);
+    CHECK(queued_is(3, MHS_CMD_CODE_SET_MOTOR_OFF, 0, BLE_GATT_OP_WRITE_CMD));
+    CHECK(queued_is(0, MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, BLE_GATT_OP_WRITE_REQ));
+    CHECK(p_queue->stats.coalesced == 2);
+
+    m_stack_blocked = false;
+    tx_buffer_process(p_queue);
+    drain();
+
+    CHECK(m_wire_count == 2);
+    CHECK(m_wire[0].value[0] == MHS_CMD_CODE_SET_MOTOR_OFF);
+    CHECK(m_wire[1].value[0] == MHS_CMD_CODE_SET_TEMP_THRESHOLD);
+
+    // Full of messages the off does not cancel: the newest gives way.
+    setup(1);
+    m_stack_blocked = true;
+
+    CHECK(cmd_send(MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, 0, 3) == NRF_SUCCESS);
+    CHECK(cmd_send(MHS_CMD_CODE_GET_TEMPERATURE, 0, 0, 1) == NRF_SUCCESS);
+    CHECK(cmd_send(MHS_CMD_CODE_SET_MUSIC_CONTROL, 1, 0, 3) == NRF_SUCCESS);
+
+    CHECK(motor_off_send() == NRF_SUCCESS);
+    CHECK(tx_buffer_count(p_queue) == TX_BUFFER_MASK);
+    CHECK(p_queue->index == 0);
+    CHECK(queued_is(0, MHS_CMD_CODE_SET_MOTOR_OFF, 0, BLE_GATT_OP_WRITE_CMD));
+    CHECK(queued_is(1, MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, BLE_GATT_OP_WRITE_REQ));
+    CHECK(queued_is(2, MHS_CMD_CODE_GET_TEMPERATURE, 0, BLE_GATT_OP_WRITE_REQ));
+    CHECK(p_queue->stats.rejected == 1);
+
+    m_stack_blocked = false;
+    tx_buffer_process(p_queue);
+    drain();
+
+    CHECK(m_wire_count == 3);
+    CHECK(m_wire[0].value[0] == MHS_CMD_CODE_SET_MOTOR_OFF);
+    CHECK(m_wire[1].value[0] == MHS_CMD_CODE_SET_TEMP_THRESHOLD);
+    CHECK(m_wire[2].value[0] == MHS_CMD_CODE_GET_TEMPERATURE);
+}
+
+
+/**@brief Connection events from a motor off to the off on the air, with a write request
+ *        outstanding and queue_count commands waiting behind it.
+ */
+static uint32_t off_latency(bool priority, uint32_t queue_count)
+{
+    uint32_t accepted;
+
+    setup(0);
+
+    CHECK(cmd_send(MHS_CMD_CODE_SET_TEMP_THRESHOLD, 30, 0, 3) == NRF_SUCCESS);
+    for (uint32_t i = 0; i < queue_count; i++)
+    {
+        CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_CONTROL, 0, (uint8_t)i, 3) == NRF_SUCCESS);
+    }
+    conn_event();
+
+    accepted = m_event;
+    if (priority)
+    {
+        CHECK(motor_off_send() == NRF_SUCCESS);
+    }
+    else
+    {
+        CHECK(cmd_send(MHS_CMD_CODE_SET_MOTOR_OFF, 0, 0, 1) == NRF_SUCCESS);
+    }
+    drain();
+
+    for (uint32_t i = 0; i < m_wire_count; i++)
+    {
+        if (m_wire[i].value[0] == MHS_CMD_CODE_SET_MOTOR_OFF)
+        {
+            CHECK(m_peer.on_mask == 0);
+            return m_wire[i].air_event - accepted;
+        }
+    }
+
+    CHECK(false);
+    return 0;
+}
+
+
+static void test_off_latency(void)
+{
+    uint32_t priority = off_latency(true, TX_BUFFER_MASK - 1);
+    uint32_t queued   = off_latency(false, TX_BUFFER_MASK - 1);
+
+    printf("motor off behind %u queued writes: priority %u, queued %u connection events\n",
+           TX_BUFFER_MASK - 1, priority, queued);
+
+    // Out in the next connection event, whatever waits in the queue.
+    CHECK(priority == 1);
+    CHECK(queued > priority);
+}
+
+
+/**@brief Replay button events as button.c turns them into commands, with 0 to 2 connection
+ *        events between them, and check what reached the peer.
+ */
+static void test_button_replay(void)
+{
+    tx_queue_t * p_queue         = &m_tx_queue[m_mhs_c.instance];
+    peer_state_t expected        = {0};
+    uint32_t     seed            = 12345;
+    uint32_t     accepted        = 0;
+    uint32_t     busy            = 0;
+    uint32_t     motor_accepted  = 0;
+    uint32_t     off_marks[BUTTON_EVENT_COUNT];     // Motor commands accepted before each off.
+    uint32_t     off_count       = 0;
+    uint32_t     off_aired       = 0;
+    uint32_t     motor_aired     = 0;               // Motor commands on the air since the last off.
+    uint32_t     wire_checked    = 0;
+
+    setup(0);
+
+    for (uint32_t i = 0; i < BUTTON_EVENT_COUNT; i++)
+    {
+        uint8_t  cmd[3];
+        uint8_t  len      = 3;
+        bool     priority = false;
+        uint32_t err_code;
+        uint32_t pick;
+
+        seed = seed * 1103515245 + 12345;
+        pick = (seed >> 16) % 100;
+
+        if (pick < 40)
+        {
+            // KEY3 or KEY5 pushed: jog the selected motor.
+            cmd[0] = MHS_CMD_CODE_SET_MOTOR_CONTROL;
+            cmd[1] = (seed >> 8) & 0x01;
+            cmd[2] = (seed >> 4) % 8;
+        }
+        else if (pick < 70)
+        {
+            // KEY3 or KEY5 released.
+            cmd[0]   = MHS_CMD_CODE_SET_MOTOR_OFF;
+            len      = 1;
+            priority = true;
+        }
+        else if (pick < 90)
+        {
+            // OK on the speed menu, in steps of 10.
+            cmd[0] = MHS_CMD_CODE_SET_MOTOR_SPEED;
+            cmd[1] = ((seed >> 4) % 11) * 10;
+            cmd[2] = 0;
+        }
+        else
+        {
+            cmd[0] = MHS_CMD_CODE_SET_TEMP_THRESHOLD;
+            cmd[1] = ((seed >> 4) % 11) * 10;
+            cmd[2] = 0;
+        }
+
+        if (priority)
+        {
+            // An off still queued is replaced by this one.
+            for (uint32_t index = p_queue->index; index != p_queue->insert_index;
+                 index = (index + 1) & TX_BUFFER_MASK)
+            {
+                if (queued_is(index, MHS_CMD_CODE_SET_MOTOR_OFF, 0, BLE_GATT_OP_WRITE_CMD))
+                {
+                    off_count--;
+                }
+            }
+            off_marks[off_count++] = motor_accepted;
+        }
+
+        err_code = priority ? ble_mhs_c_send_priority_cmd(&m_mhs_c, cmd, len)
+                            : ble_mhs_c_send_cmd(&m_mhs_c, cmd, len);
+        if (err_code == NRF_SUCCESS)
+        {
+            accepted++;
+            peer_apply(&expected, cmd, len);
+            if (cmd[0] == MHS_CMD_CODE_SET_MOTOR_CONTROL)
+            {
+                motor_accepted++;
+            }
+        }
+        else
+        {
+            CHECK(err_code == NRF_ERROR_BUSY);
+            CHECK(!priority);
+            busy++;
+        }
+
+        for (uint32_t events = (seed >> 12) % 3; events > 0; events--)
+        {
+            conn_event();
+        }
+
+        // Nothing queued before an off may reach the peer after it.
+        for (; wire_checked < m_wire_count; wire_checked++)
+        {
+            const wire_write_t * p_write = &m_wire[wire_checked];
+
+            CHECK(p_write->len <= MHS_CTRL_POINT_MAX_LEN);
+            CHECK(p_write->write_op == ((p_write->value[0] == MHS_CMD_CODE_SET_MOTOR_OFF)
+                                        ? BLE_GATT_OP_WRITE_CMD : BLE_GATT_OP_WRITE_REQ));
+            if (p_write->value[0] == MHS_CMD_CODE_SET_MOTOR_OFF)
+            {
+                CHECK(off_aired < off_count);
+                off_aired++;
+                motor_aired = 0;
+            }
+            else if ((off_aired != 0) && (p_write->value[0] == MHS_CMD_CODE_SET_MOTOR_CONTROL))
+            {
+                motor_aired++;
+                CHECK(motor_aired <= motor_accepted - off_marks[off_aired - 1]);
+            }
+        }
+
+        CHECK(tx_buffer_count(p_queue) <= TX_BUFFER_MASK);
+    }
+
+    drain();
+    CHECK(m_wire_count < WIRE_LOG_SIZE);
+
+    // Every accepted command went out, was superseded, or gave way to an off.
+    CHECK(accepted == m_wire_count + p_queue->stats.coalesced + (p_queue->stats.rejected - busy));
+
+    // Settings end as set, the motors as the last off and jogs left them.
+    CHECK(m_peer.temp_threshold == expected.temp_threshold);
+    CHECK(m_peer.on_mask == expected.on_mask);
+    if (expected.on_mask != 0)
+    {
+        CHECK(m_peer.direction == expected.direction);
+    }
+
+    printf("%u button events: %u accepted, %u busy, %u on the wire, %u coalesced, "
+           "max queue %u\n",
+           BUTTON_EVENT_COUNT, accepted, busy, m_wire_count, p_queue->stats.coalesced,
+           p_queue->stats.max_count);
+
+    CHECK(m_wire_count < accepted);
+}
+
+
+int main(void)
+{
+    ble_mhs_c_init_t init = {.evt_handler = mhs_c_evt_handler};
+
+    CHECK(ble_mhs_c_init(&m_mhs_c, &init) == NRF_SUCCESS);
+
+    test_remove_shifts();
+    test_priority_front();
+    test_off_latency();
+    test_button_replay();
+
+    printf("ble_mhs_c tx queue: %u failed\n", m_failures);
+
+    return (m_failures == 0) ? 0 : 1;
+}
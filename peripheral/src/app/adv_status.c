@@ -0,0 +1,75 @@
+#include <string.h>
+
+#include <app_error.h>
+#include <app_timer.h>
+#include <app_util.h>
+#include <nordic_common.h>
+
+#include "auto_temp.h"
+#include "heat.h"
+#include "motor.h"
+
+#include "adv_status.h"
+
+#define ADV_STATUS_TICK                 APP_TIMER_TICKS(ADV_STATUS_INTERVAL_S * 1000, APP_TIMER_PRESCALER)
+
+static app_timer_id_t               m_adv_status_timer_id;
+static adv_status_update_handler_t  m_update_handler = NULL;
+static uint8_t                      m_record[ADV_STATUS_LEN];  /**< Record being advertised. */
+static uint8_t                      m_elapsed_s = 0;            /**< Since the last temperature reading. */
+
+
+void adv_status_encode(uint8_t * p_record)
+{
+    int16_t temperature;
+
+    if (!current_temperature_get(&temperature))
+    {
+        temperature = ADV_STATUS_NO_TEMPERATURE;
+    }
+
+    (void)uint16_encode((uint16_t)temperature, &p_record[0]);
+    p_record[2] = heat_is_on() ? ADV_STATUS_FLAG_HEAT_ON : 0;
+    p_record[3] = motor_on_mask_get();
+    p_record[4] = motor_duty_cycle_get();
+}
+
+
+static void adv_status_timeout_handler(void * p_context)
+{
+    uint8_t record[ADV_STATUS_LEN];
+
+    UNUSED_PARAMETER(p_context);
+
+    adv_status_encode(record);
+    if (memcmp(record, m_record, sizeof(record)) != 0)
+    {
+        memcpy(m_record, record, sizeof(record));
+        m_update_handler(m_record, sizeof(m_record));
+    }
+
+    // Readings cost power, the temperature changes slowly.
+    m_elapsed_s += ADV_STATUS_INTERVAL_S;
+    if (m_elapsed_s >= ADV_STATUS_SAMPLE_INTERVAL_S)
+    {
+        m_elapsed_s = 0;
+        temperature_sample_request();
+    }
+}
+
+
+void adv_status_init(adv_status_update_handler_t update_handler)
+{
+    uint32_t err_code;
+
+    m_update_handler = update_handler;
+    adv_status_encode(m_record);
+
+    err_code = app_timer_create(&m_adv_status_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                adv_status_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_start(m_adv_status_timer_id, ADV_STATUS_TICK, NULL);
+    APP_ERROR_CHECK(err_code);
+}
@@ -0,0 +1,32 @@
+#ifndef ADV_STATUS_H_
+#define ADV_STATUS_H_
+
+#include <stdint.h>
+
+// Status record in the manufacturer specific data of the advertising packets, little endian:
+// [temperature, int16 1/16 degrees][flags][motor on mask][duty cycle, percent].
+// The central decodes it from its scan reports, see ble_mhs_c.h. Broadcast commands use the
+// same company identifier with longer data.
+#define ADV_STATUS_COMPANY_ID           0xFFFF      /**< Bluetooth SIG value for tests and internal use. */
+#define ADV_STATUS_LEN                  5
+#define ADV_STATUS_NO_TEMPERATURE       INT16_MIN   /**< No good reading yet. */
+#define ADV_STATUS_FLAG_HEAT_ON         0x01
+
+#define ADV_STATUS_INTERVAL_S           2           /**< Seconds between two checks for changes. */
+#define ADV_STATUS_SAMPLE_INTERVAL_S    10          /**< Seconds between two temperature readings, when nothing else reads. */
+
+/**@brief Called with a new record, to be put in the advertising data.
+ */
+typedef void (*adv_status_update_handler_t)(const uint8_t * p_record, uint8_t len);
+
+/**@brief Encode the current status.
+ *
+ * @param[out]  p_record    ADV_STATUS_LEN bytes.
+ */
+void adv_status_encode(uint8_t * p_record);
+
+/**@brief Start checking the status, the handler is called when it changed.
+ */
+void adv_status_init(adv_status_update_handler_t update_handler);
+
+#endif // ADV_STATUS_H_
@@ -6,21 +6,50 @@
 #include "ble_mhs.h"
 #include "ds18b20.h"
 #include "heat.h"
+#include "heat_pid.h"
+#include "temp_history.h"
 
 #include "SEGGER_RTT.h"
 
 #include "auto_temp.h"
 
-#define TEMPERATURE_DETECT_TIMER_INTERVAL APP_TIMER_TICKS(60000, APP_TIMER_PRESCALER)
+#define TIMER_TICKS_PER_SECOND          APP_TIMER_TICKS(1000, APP_TIMER_PRESCALER)
+#define TIMER_MS_TO_TICKS(ms)           (((ms) * (TIMER_TICKS_PER_SECOND / 8)) / 125)  /**< Fits 32 bits up to 255 s. */
 
-#define TEMPERATURE_DEFAULT             200
-#define TEMPERATURE_MAX                 100
-#define TEMPERATURE_MIN                 -30
+#define HEAT_SAMPLE_PERIOD_DEFAULT      10      /**< Seconds between two controller steps. */
+#define HEAT_WINDOW_DEFAULT             100     /**< Time-proportional output window in seconds. */
+#define HEAT_OUTPUT_MIN_SWITCH          50      /**< Shorter on or off times are dropped, permille of the window. */
+
+// Temperatures are kept in 1/16 degrees, the native DS18B20 format.
+#define TEMPERATURE_DEFAULT             DS18B20_DEGREES_TO_Q4(200)
+#define TEMPERATURE_MAX                 DS18B20_DEGREES_TO_Q4(100)
+#define TEMPERATURE_MIN                 DS18B20_DEGREES_TO_Q4(-30)
 
 static app_timer_id_t  m_temperature_detect_timer_id;
+static app_timer_id_t  m_heat_window_timer_id;
+
+static uint8_t  m_sample_period_s = HEAT_SAMPLE_PERIOD_DEFAULT;
+static uint8_t  m_window_s        = HEAT_WINDOW_DEFAULT;
+static uint16_t m_heat_output     = 0;          /**< Controller output in permille. */
+static bool     m_window_on_phase = false;      /**< Heater on part of the current window. */
+static uint32_t m_window_on_ms    = 0;          /**< Length of the on phase of the current window. */
+static bool     m_auto_temperature_started = false;
+static uint32_t m_relay_switch_count = 0;
+
+static heat_pid_t m_heat_pid =
+{
+    .kp         = 20,
+    .ki         = 2,
+    .deadband   = 4,                            // 0.25 degree
+    .output_min = 0,
+    .output_max = 100,
+    .integral   = 0,
+};
 
 static int16_t  m_temperature_threshold = 0;
 static int16_t  m_current_temperature   = TEMPERATURE_DEFAULT;
+static bool     m_report_pending        = false;    /**< Notify the temperature when the reading completes. */
+static bool     m_temperature_valid     = false;    /**< m_current_temperature is a good reading. */
 
 static bool temperature_is_good(int16_t temp)
 {
@@ -38,35 +67,213 @@ static bool temperature_is_good(int16_t temp)
 }
 
 
-static void temperature_detect_timeout_handler(void * p_context)
+static void current_temperature_notify(void)
 {
-    int16_t temp = 0;
-    SEGGER_RTT_printf(0, "temperature detect one time! \r\n");
-    temp = ds18b20_read_temperature();
+    mhs_event_t event;
+
+    memset(&event, 0, sizeof(mhs_event_t));
+    event.evt_code       = MHS_EVENT_CODE_CURRENT_TEMPERATURE;
+    event.evt_value.buff = (uint8_t *)&m_current_temperature;
+    event.evt_value.len  = sizeof(m_current_temperature);
+
+    mhs_event_characteristic_notify(event);
+}
+
+
+/**@brief Notify the last reading of every sensor as [sensor index][temperature].
+ */
+static void sensor_temperature_notify(void)
+{
+    mhs_event_t event;
+    uint8_t value[1 + sizeof(int16_t)];
+    int16_t temp;
 
-    if (true == temperature_is_good(temp))
+    for (uint8_t i = 0; i < ds18b20_device_count(); i++)
     {
-        m_current_temperature = temp;
+        if (ds18b20_temperature_get(i, &temp) != NRF_SUCCESS)
+        {
+            continue;
+        }
+
+        value[0] = i;
+        memcpy(&value[1], &temp, sizeof(temp));
+
+        memset(&event, 0, sizeof(mhs_event_t));
+        event.evt_code       = MHS_EVENT_CODE_SENSOR_TEMPERATURE;
+        event.evt_value.buff = value;
+        event.evt_value.len  = sizeof(value);
 
-        if (m_current_temperature < m_temperature_threshold)
+        mhs_event_characteristic_notify(event);
+    }
+}
+
+
+/**@brief Average the good readings of every sensor.
+ *
+ * @return true if at least one sensor had a good reading.
+ */
+static bool temperature_average_get(int16_t * p_temp)
+{
+    int32_t sum   = 0;
+    uint8_t count = 0;
+    int16_t temp;
+
+    for (uint8_t i = 0; i < ds18b20_device_count(); i++)
+    {
+        if ((ds18b20_temperature_get(i, &temp) == NRF_SUCCESS) && temperature_is_good(temp))
         {
-            if (false == heat_is_on())
-            {
-                heat_on();
-            }
+            sum += temp;
+            count++;
+        }
+    }
+
+    if (count == 0)
+    {
+        return false;
+    }
+
+    *p_temp = sum / count;
+
+    return true;
+}
+
+
+static void temperature_report_if_pending(void)
+{
+    if (m_report_pending)
+    {
+        m_report_pending = false;
+        current_temperature_notify();
+        sensor_temperature_notify();
+    }
+}
+
+
+/**@brief Switch the heater, counting relay switches.
+ */
+static void heater_set(bool on)
+{
+    if (on != heat_is_on())
+    {
+        m_relay_switch_count++;
+        if (on)
+        {
+            heat_on();
         }
         else
         {
-            if (true == heat_is_on())
-            {
-                heat_off();
-            }
+            heat_off();
         }
     }
 }
 
 
-/**@brief Stop vibrator sequencer timer.
+/**@brief Handle the end of a temperature reading. The heater controller is fed the average of
+ *        every sensor.
+ */
+static void temperature_read_handler(uint32_t err_code)
+{
+    int16_t temp;
+
+    if (err_code != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "temperature read failed %p\r\n", err_code);
+    }
+
+    if ((err_code == NRF_SUCCESS) && (true == temperature_average_get(&temp)))
+    {
+        m_current_temperature = temp;
+        m_temperature_valid   = true;
+        temp_history_temperature_update(temp);
+        m_heat_output = heat_pid_update(&m_heat_pid, m_temperature_threshold, temp,
+                                        m_sample_period_s);
+        SEGGER_RTT_printf(0, "heat output %d/1000, relay switches %d\r\n",
+                          m_heat_output, m_relay_switch_count);
+    }
+    else
+    {
+        // Without a good reading the heater is kept off, also for the rest of the window.
+        m_temperature_valid = false;
+        m_heat_output = 0;
+        if (m_window_on_phase)
+        {
+            heater_set(false);
+        }
+    }
+
+    temperature_report_if_pending();
+}
+
+
+/**@brief Time-proportional output: the heater is on for the controller output share of each
+ *        window. The output is only picked up at the start of a window, and on or off times
+ *        shorter than HEAT_OUTPUT_MIN_SWITCH are dropped so the relay switches at most twice
+ *        per window.
+ */
+static void heat_window_timeout_handler(void * p_context)
+{
+    uint32_t err_code;
+    uint32_t window_ms = (uint32_t)m_window_s * 1000;
+    uint32_t timeout_ms;
+
+    // The window may have shrunk below the on time, then the next window starts at once.
+    if (m_window_on_phase && (m_window_on_ms >= window_ms))
+    {
+        m_window_on_phase = false;
+    }
+
+    if (m_window_on_phase)
+    {
+        // End of the on phase, the heater stays off for the rest of the window.
+        m_window_on_phase = false;
+        heater_set(false);
+        timeout_ms = window_ms - m_window_on_ms;
+    }
+    else if (m_heat_output < HEAT_OUTPUT_MIN_SWITCH)
+    {
+        heater_set(false);
+        timeout_ms = window_ms;
+    }
+    else if (m_heat_output > HEAT_PID_OUTPUT_MAX - HEAT_OUTPUT_MIN_SWITCH)
+    {
+        heater_set(true);
+        timeout_ms = window_ms;
+    }
+    else
+    {
+        heater_set(true);
+        m_window_on_phase = true;
+        m_window_on_ms    = (window_ms * m_heat_output) / HEAT_PID_OUTPUT_MAX;
+        timeout_ms        = m_window_on_ms;
+    }
+
+    err_code = app_timer_start(m_heat_window_timer_id, TIMER_MS_TO_TICKS(timeout_ms), NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Start a temperature reading, a reading already in progress serves this request too.
+ */
+static void temperature_detect_start(void)
+{
+    uint32_t err_code;
+
+    err_code = ds18b20_read_temperature_start(temperature_read_handler);
+    if (err_code != NRF_ERROR_BUSY)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+
+static void temperature_detect_timeout_handler(void * p_context)
+{
+    SEGGER_RTT_printf(0, "temperature detect one time! \r\n");
+    temperature_detect_start();
+}
+
+
+/**@brief Stop temperature detect timer.
  */
 static void stop_temperature_detect_timer(void)
 {
@@ -80,8 +287,9 @@ static void start_temperature_detect_timer(void)
 {
     uint32_t err_code;
 
-    err_code = app_timer_start(m_temperature_detect_timer_id, TEMPERATURE_DETECT_TIMER_INTERVAL,
-                                NULL);
+    err_code = app_timer_start(m_temperature_detect_timer_id,
+                               m_sample_period_s * TIMER_TICKS_PER_SECOND,
+                               NULL);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -94,52 +302,128 @@ static void create_temperature_detect_timer(void)
                                 APP_TIMER_MODE_REPEATED,
                                 temperature_detect_timeout_handler);
     APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_heat_window_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                heat_window_timeout_handler);
+    APP_ERROR_CHECK(err_code);
 }
 
 
 void report_current_temperature(void)
 {
-    uint32_t err_code;
-    mhs_event_t event;
+    // The notification is sent from temperature_read_handler() once the reading completes.
+    m_report_pending = true;
+    temperature_detect_start();
+}
 
-    temperature_detect_timeout_handler(NULL);
 
-    memset(&event, 0, sizeof(mhs_event_t));
-    event.evt_code       = MHS_EVENT_CODE_CURRENT_TEMPERATURE;
-    event.evt_value.buff = (uint8_t *)&m_current_temperature;
-    event.evt_value.len  = sizeof(m_current_temperature);
+bool current_temperature_get(int16_t * p_temp)
+{
+    if (m_temperature_valid)
+    {
+        *p_temp = m_current_temperature;
+    }
 
-    err_code = mhs_event_characteristic_notify(event);
+    return m_temperature_valid;
+}
 
-    APP_ERROR_CHECK(err_code);
+
+void temperature_sample_request(void)
+{
+    // Extra readings would also step the heater controller off its sample period.
+    if (!m_auto_temperature_started)
+    {
+        temperature_detect_start();
+    }
 }
 
 
 void report_temperature_threshold(void)
 {
-    uint32_t err_code;
     mhs_event_t event;
+    int16_t temp_threshold = DS18B20_Q4_TO_DEGREES(m_temperature_threshold);
 
     memset(&event, 0, sizeof(mhs_event_t));
     event.evt_code       = MHS_EVENT_CODE_TEMP_THRESHOLD;
-    event.evt_value.buff = (uint8_t *)&m_temperature_threshold;
-    event.evt_value.len  = sizeof(m_temperature_threshold);
-
-    err_code = mhs_event_characteristic_notify(event);
+    event.evt_value.buff = (uint8_t *)&temp_threshold;
+    event.evt_value.len  = sizeof(temp_threshold);
 
-    APP_ERROR_CHECK(err_code);
+    mhs_event_characteristic_notify(event);
 }
 
 
 void set_temperature_threshold(int16_t temp_threshold)
 {
-    m_temperature_threshold = temp_threshold;
+    m_temperature_threshold = DS18B20_DEGREES_TO_Q4(temp_threshold);
+}
+
+
+void set_heat_param(heat_param_t param, uint8_t value)
+{
+    switch (param)
+    {
+        case HEAT_PARAM_SAMPLE_PERIOD:
+            if (value == 0)
+            {
+                break;
+            }
+            m_sample_period_s = value;
+            if (m_auto_temperature_started)
+            {
+                stop_temperature_detect_timer();
+                start_temperature_detect_timer();
+            }
+            return;
+        case HEAT_PARAM_WINDOW:
+            if (value == 0)
+            {
+                break;
+            }
+            m_window_s = value;
+            // An on phase running longer than the new window ends with the window.
+            if (m_window_on_ms > (uint32_t)m_window_s * 1000)
+            {
+                m_window_on_ms = (uint32_t)m_window_s * 1000;
+            }
+            return;
+        case HEAT_PARAM_DEADBAND:
+            m_heat_pid.deadband = value;
+            return;
+        case HEAT_PARAM_OUTPUT_MIN:
+            if (value > m_heat_pid.output_max)
+            {
+                break;
+            }
+            m_heat_pid.output_min = value;
+            return;
+        case HEAT_PARAM_OUTPUT_MAX:
+            if ((value > 100) || (value < m_heat_pid.output_min))
+            {
+                break;
+            }
+            m_heat_pid.output_max = value;
+            return;
+        case HEAT_PARAM_KP:
+            m_heat_pid.kp = value;
+            return;
+        case HEAT_PARAM_KI:
+            m_heat_pid.ki = value;
+            heat_pid_reset(&m_heat_pid);
+            return;
+        default:
+            break;
+    }
+
+    SEGGER_RTT_printf(0, "invalid heat param %d = %d\r\n", param, value);
 }
 
 
 void auto_temperature_init(void)
 {
-    temperature_detect_timeout_handler(NULL);
+    temperature_detect_start();
     create_temperature_detect_timer();
     start_temperature_detect_timer();
+    heat_window_timeout_handler(NULL);
+    m_auto_temperature_started = true;
 }
@@ -1,6 +1,7 @@
 #ifndef AUTO_TEMP_H_
 #define AUTO_TEMP_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /**@brief   Get current temperature value.
@@ -9,7 +10,7 @@ void report_current_temperature(void);
 
 /**@brief   Set temperature threshold.
  *
- * @param   temp_threshold   The temperature threshold which to set.
+ * @param   temp_threshold   The temperature threshold which to set, in whole degrees.
  */
 void set_temperature_threshold(int16_t temp_threshold);
 
@@ -18,6 +19,37 @@ void set_temperature_threshold(int16_t temp_threshold);
  */
 void report_temperature_threshold(void);
 
+/**@brief   Get the last good temperature reading, the average of every sensor.
+ *
+ * @param[out]  p_temp   Temperature in 1/16 degrees.
+ *
+ * @return  false if there is no good reading.
+ */
+bool current_temperature_get(int16_t * p_temp);
+
+/**@brief   Start a temperature reading unless auto detection already reads periodically.
+ */
+void temperature_sample_request(void);
+
+/**@brief   Heater controller parameters, see set_heat_param(). */
+typedef enum heat_param_e
+{
+    HEAT_PARAM_SAMPLE_PERIOD = 0,   // Seconds between two controller steps, 1 to 255.
+    HEAT_PARAM_WINDOW,              // Time-proportional output window in seconds, 1 to 255.
+    HEAT_PARAM_DEADBAND,            // Error ignored around the threshold, 1/16 degrees.
+    HEAT_PARAM_OUTPUT_MIN,          // Lowest heater output, percent.
+    HEAT_PARAM_OUTPUT_MAX,          // Highest heater output, percent.
+    HEAT_PARAM_KP,                  // Proportional gain, percent per degree.
+    HEAT_PARAM_KI,                  // Integral gain, percent per degree and minute.
+} heat_param_t;
+
+/**@brief   Set a heater controller parameter. Invalid values are ignored.
+ *
+ * @param   param   Parameter to set.
+ * @param   value   New value.
+ */
+void set_heat_param(heat_param_t param, uint8_t value);
+
 void auto_temperature_init(void);
 
 #endif
@@ -0,0 +1,126 @@
+#include <stdbool.h>
+
+#include <app_error.h>
+#include <app_timer.h>
+#include <app_util.h>
+#include <ble_conn_params.h>
+#include <nordic_common.h>
+
+#include "SEGGER_RTT.h"
+
+#include "conn_policy.h"
+
+#define CONN_POLICY_TICK        APP_TIMER_TICKS(1000, APP_TIMER_PRESCALER)
+
+static app_timer_id_t   m_conn_policy_timer_id;
+static bool             m_connected = false;
+static bool             m_active = false;
+static uint8_t          m_idle_s = 0;           /**< Seconds since the last command. */
+
+static ble_gap_conn_params_t m_active_params =
+{
+    .min_conn_interval = CONN_POLICY_ACTIVE_MIN_INTERVAL,
+    .max_conn_interval = CONN_POLICY_ACTIVE_MAX_INTERVAL,
+    .slave_latency     = CONN_POLICY_ACTIVE_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_POLICY_SUP_TIMEOUT,
+};
+
+static ble_gap_conn_params_t m_idle_params =
+{
+    .min_conn_interval = CONN_POLICY_IDLE_MIN_INTERVAL,
+    .max_conn_interval = CONN_POLICY_IDLE_MAX_INTERVAL,
+    .slave_latency     = CONN_POLICY_IDLE_SLAVE_LATENCY,
+    .conn_sup_timeout  = CONN_POLICY_SUP_TIMEOUT,
+};
+
+
+/**@brief Make the active or idle parameters the preferred ones, the connection parameters
+ *        module negotiates them if the link does not already use them.
+ */
+static void conn_params_select(bool active)
+{
+    uint32_t err_code;
+
+    m_active = active;
+    SEGGER_RTT_printf(0, "conn policy %s\r\n", active ? "active" : "idle");
+
+    err_code = ble_conn_params_change_conn_params(active ? &m_active_params : &m_idle_params);
+    if (err_code != NRF_SUCCESS)
+    {
+        // A procedure is running, the module retries with the new preference.
+        SEGGER_RTT_printf(0, "conn params request failed %d\r\n", err_code);
+    }
+}
+
+
+static void conn_policy_timeout_handler(void * p_context)
+{
+    UNUSED_PARAMETER(p_context);
+
+    if (m_idle_s < UINT8_MAX)
+    {
+        m_idle_s++;
+    }
+
+    if (m_active && (m_idle_s >= CONN_POLICY_IDLE_TIMEOUT_S))
+    {
+        conn_params_select(false);
+    }
+}
+
+
+void conn_policy_init(void)
+{
+    uint32_t err_code;
+
+    err_code = app_timer_create(&m_conn_policy_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                conn_policy_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+void conn_policy_activity(void)
+{
+    m_idle_s = 0;
+
+    if (m_connected && !m_active)
+    {
+        conn_params_select(true);
+    }
+}
+
+
+void conn_policy_on_ble_evt(ble_evt_t * p_ble_evt)
+{
+    uint32_t err_code;
+    const ble_gap_conn_params_t * p_params;
+
+    switch (p_ble_evt->header.evt_id)
+    {
+        case BLE_GAP_EVT_CONNECTED:
+            // The central connects with the active parameters, discovery and setup follow.
+            m_connected = true;
+            m_idle_s    = 0;
+            conn_params_select(true);
+            err_code = app_timer_start(m_conn_policy_timer_id, CONN_POLICY_TICK, NULL);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case BLE_GAP_EVT_DISCONNECTED:
+            m_connected = false;
+            m_active    = false;
+            err_code = app_timer_stop(m_conn_policy_timer_id);
+            APP_ERROR_CHECK(err_code);
+            break;
+
+        case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+            p_params = &p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params;
+            SEGGER_RTT_printf(0, "conn params interval %d x1.25 ms latency %d\r\n",
+                              p_params->max_conn_interval, p_params->slave_latency);
+            break;
+
+        default:
+            break;
+    }
+}
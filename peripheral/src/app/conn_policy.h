@@ -0,0 +1,30 @@
+#ifndef CONN_POLICY_H_
+#define CONN_POLICY_H_
+
+#include <app_util.h>
+#include <ble.h>
+
+// Shared with the central, both sides switch on the same commands and after the same time.
+#define CONN_POLICY_ACTIVE_MIN_INTERVAL     MSEC_TO_UNITS(7.5, UNIT_1_25_MS)
+#define CONN_POLICY_ACTIVE_MAX_INTERVAL     MSEC_TO_UNITS(15, UNIT_1_25_MS)
+#define CONN_POLICY_ACTIVE_SLAVE_LATENCY    0
+#define CONN_POLICY_IDLE_MIN_INTERVAL       MSEC_TO_UNITS(100, UNIT_1_25_MS)
+#define CONN_POLICY_IDLE_MAX_INTERVAL       MSEC_TO_UNITS(125, UNIT_1_25_MS)
+#define CONN_POLICY_IDLE_SLAVE_LATENCY      9       /**< Listen about once a second while idle. */
+#define CONN_POLICY_SUP_TIMEOUT             MSEC_TO_UNITS(4000, UNIT_10_MS)
+#define CONN_POLICY_IDLE_TIMEOUT_S          10      /**< Seconds without commands before going idle. */
+
+/**@brief Create the inactivity timer. Call after ble_conn_params_init().
+ */
+void conn_policy_init(void);
+
+/**@brief A command was received, use the active parameters until it has been quiet for
+ *        CONN_POLICY_IDLE_TIMEOUT_S.
+ */
+void conn_policy_activity(void);
+
+/**@brief Follow connections and log parameter changes.
+ */
+void conn_policy_on_ble_evt(ble_evt_t * p_ble_evt);
+
+#endif // CONN_POLICY_H_
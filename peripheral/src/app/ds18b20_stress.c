@@ -0,0 +1,77 @@
+#include <stdint.h>
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_delay.h"
+
+#include "ds18b20.h"
+#include "SEGGER_RTT.h"
+
+#include "ds18b20_stress.h"
+
+#define STRESS_PREEMPT_TICKS        7       /**< Gap between two simulated radio events, 214 us. */
+#define STRESS_PREEMPT_MAX_US       2000    /**< Longest simulated radio event. */
+#define STRESS_REPORT_INTERVAL      100     /**< Readings between two RTT reports. */
+
+static app_timer_id_t m_stress_timer_id;
+static uint32_t       m_stress_reads = 0;
+static uint32_t       m_stress_failures = 0;
+
+
+/**@brief Simulate the SoftDevice preempting the application by blocking every application
+ *        interrupt, including the 1-Wire slot timer, for a pseudo-random time.
+ *
+ * @details The timer is single shot and started again after each event, so at most one timeout
+ *          waits in the scheduler queue however long the interrupts were blocked.
+ */
+static void stress_preempt_timeout_handler(void * p_context)
+{
+    static uint32_t seed = 1;
+    uint32_t        err_code;
+
+    seed = seed * 1103515245 + 12345;
+
+    CRITICAL_REGION_ENTER();
+    nrf_delay_us((seed >> 16) % STRESS_PREEMPT_MAX_US);
+    CRITICAL_REGION_EXIT();
+
+    err_code = app_timer_start(m_stress_timer_id, STRESS_PREEMPT_TICKS, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+static void stress_read_handler(uint32_t err_code)
+{
+    m_stress_reads++;
+    if (err_code != NRF_SUCCESS)
+    {
+        m_stress_failures++;
+    }
+
+    if ((m_stress_reads % STRESS_REPORT_INTERVAL) == 0)
+    {
+        SEGGER_RTT_printf(0, "1-Wire stress: %d reads, %d failed, %d crc errors\r\n",
+                          m_stress_reads, m_stress_failures, ds18b20_crc_error_count());
+    }
+
+    err_code = ds18b20_read_temperature_start(stress_read_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+void ds18b20_stress_start(void)
+{
+    uint32_t err_code;
+
+    err_code = app_timer_create(&m_stress_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                stress_preempt_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_start(m_stress_timer_id, STRESS_PREEMPT_TICKS, NULL);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = ds18b20_read_temperature_start(stress_read_handler);
+    APP_ERROR_CHECK(err_code);
+}
@@ -0,0 +1,12 @@
+#ifndef DS18B20_STRESS_H_
+#define DS18B20_STRESS_H_
+
+/**@brief   Read the sensors back to back while interrupts are blocked at random, reporting the
+ *          failed reads over RTT. Built with make DS18B20_STRESS_TEST=1.
+ *
+ * @details Call after ds18b20_init(). The other users of the sensors get NRF_ERROR_BUSY while
+ *          the test runs.
+ */
+void ds18b20_stress_start(void);
+
+#endif // DS18B20_STRESS_H_
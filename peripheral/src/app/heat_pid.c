@@ -0,0 +1,67 @@
+#include <stddef.h>
+
+#include "heat_pid.h"
+
+// Error is in 1/16 degrees, gains in percent per degree (and minute), output in permille.
+#define HEAT_PID_PERMILLE_PER_PERCENT   10
+#define HEAT_PID_Q4_SCALE               16
+#define HEAT_PID_SECONDS_PER_MINUTE     60
+#define HEAT_PID_INTEGRAL_SCALE         (HEAT_PID_Q4_SCALE * HEAT_PID_SECONDS_PER_MINUTE)
+
+
+static int32_t clamp(int32_t value, int32_t min, int32_t max)
+{
+    if (value < min)
+    {
+        return min;
+    }
+
+    if (value > max)
+    {
+        return max;
+    }
+
+    return value;
+}
+
+
+void heat_pid_reset(heat_pid_t * p_pid)
+{
+    if (p_pid != NULL)
+    {
+        p_pid->integral = 0;
+    }
+}
+
+
+uint16_t heat_pid_update(heat_pid_t * p_pid, int16_t setpoint, int16_t measured, uint8_t period_s)
+{
+    int32_t error = (int32_t)setpoint - measured;
+    int32_t out_min = (int32_t)p_pid->output_min * HEAT_PID_PERMILLE_PER_PERCENT;
+    int32_t out_max = (int32_t)p_pid->output_max * HEAT_PID_PERMILLE_PER_PERCENT;
+    int32_t proportional;
+    int32_t integral;
+    int32_t output;
+
+    if ((error <= p_pid->deadband) && (error >= -(int32_t)p_pid->deadband))
+    {
+        error = 0;
+    }
+
+    proportional = (p_pid->kp * error * HEAT_PID_PERMILLE_PER_PERCENT) / HEAT_PID_Q4_SCALE;
+
+    integral = p_pid->integral + p_pid->ki * error * HEAT_PID_PERMILLE_PER_PERCENT * period_s;
+    integral = clamp(integral, out_min * HEAT_PID_INTEGRAL_SCALE, out_max * HEAT_PID_INTEGRAL_SCALE);
+
+    output = proportional + integral / HEAT_PID_INTEGRAL_SCALE;
+
+    // Anti-windup: only keep integrating while it can still move the output.
+    if (!((output > out_max) && (error > 0)) && !((output < out_min) && (error < 0)))
+    {
+        p_pid->integral = integral;
+    }
+
+    output = proportional + p_pid->integral / HEAT_PID_INTEGRAL_SCALE;
+
+    return (uint16_t)clamp(output, out_min, out_max);
+}
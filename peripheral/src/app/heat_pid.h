@@ -0,0 +1,37 @@
+#ifndef HEAT_PID_H_
+#define HEAT_PID_H_
+
+#include <stdint.h>
+
+#define HEAT_PID_OUTPUT_MAX     1000        /**< Full output, outputs are in permille. */
+
+/**@brief PI controller state and tuning. Temperatures are in 1/16 degrees. */
+typedef struct heat_pid_s
+{
+    uint8_t  kp;                /**< Proportional gain, percent output per degree of error. */
+    uint8_t  ki;                /**< Integral gain, percent output per degree of error and minute. */
+    uint8_t  deadband;          /**< Errors up to this size are treated as 0, in 1/16 degrees. */
+    uint8_t  output_min;        /**< Lowest output, percent. */
+    uint8_t  output_max;        /**< Highest output, percent. */
+    int32_t  integral;          /**< Integral term in permille, scaled by 16 * 60. */
+} heat_pid_t;
+
+/**@brief Clear the integral term.
+ */
+void heat_pid_reset(heat_pid_t * p_pid);
+
+/**@brief Run one controller step.
+ *
+ * @details Integer only. The integral is frozen while the output is saturated in the direction
+ *          of the error, so it does not wind up while the heater is at a limit.
+ *
+ * @param[in]   p_pid           Controller.
+ * @param[in]   setpoint        Wanted temperature.
+ * @param[in]   measured        Measured temperature.
+ * @param[in]   period_s        Time since the previous step in seconds.
+ *
+ * @return Heater output in permille, between output_min and output_max.
+ */
+uint16_t heat_pid_update(heat_pid_t * p_pid, int16_t setpoint, int16_t measured, uint8_t period_s);
+
+#endif // HEAT_PID_H_
@@ -21,8 +21,13 @@
 #include <stdlib.h>
 
 #include <app_error.h>
+#include <app_scheduler.h>
 #include <nrf_soc.h>
 
+#ifdef SCHED_PROFILE
+#include <app_timer.h>
+#endif
+
 #include "SEGGER_RTT.h"
 
 #include "system_init.h"
@@ -36,6 +41,31 @@ static void power_manage(void)
 }
 
 
+#ifdef SCHED_PROFILE
+/**@brief Run the queued events and report the longest pass. This is the work that used to
+ *        run in the SoftDevice and timer interrupts, the interrupts now only queue events.
+ */
+static void sched_execute_profiled(void)
+{
+    static uint32_t max_ticks = 0;
+    uint32_t start;
+    uint32_t end;
+    uint32_t ticks;
+
+    (void)app_timer_cnt_get(&start);
+    app_sched_execute();
+    (void)app_timer_cnt_get(&end);
+    (void)app_timer_cnt_diff_compute(end, start, &ticks);
+
+    if (ticks > max_ticks)
+    {
+        max_ticks = ticks;
+        SEGGER_RTT_printf(0, "longest event pass %d us\r\n", (ticks * 1000000UL) / 32768);
+    }
+}
+#endif // SCHED_PROFILE
+
+
 /**@brief Function for application main entry.
  */
 int main(void)
@@ -47,6 +77,11 @@ int main(void)
     // Enter main loop.
     for (;;)
     {
+#ifdef SCHED_PROFILE
+        sched_execute_profiled();
+#else
+        app_sched_execute();
+#endif
         power_manage();
     }
 }
@@ -0,0 +1,39 @@
+#include <stdint.h>
+
+#include "app_error.h"
+#include "app_timer.h"
+
+#include "motor.h"
+#include "SEGGER_RTT.h"
+
+#include "motor_pwm_benchmark.h"
+
+#define BENCHMARK_REPORT_INTERVAL   APP_TIMER_TICKS(10000, APP_TIMER_PRESCALER)   /**< Time between two RTT reports. */
+
+static app_timer_id_t m_benchmark_timer_id;
+
+
+static void benchmark_report_timeout_handler(void * p_context)
+{
+    SEGGER_RTT_printf(0, "PWM isr max %d us\r\n", motor_pwm_isr_max_us());
+}
+
+
+void motor_pwm_benchmark_start(void)
+{
+    uint32_t err_code;
+
+    // Worst case for the edge list: every channel running at a distinct duty cycle.
+    for (uint8_t i = MOTOR_INDEX_1; i <= MOTOR_INDEX_8; i++)
+    {
+        motor_set_channel_duty(1 << i, 10 * (i + 1));
+    }
+
+    err_code = app_timer_create(&m_benchmark_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                benchmark_report_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_start(m_benchmark_timer_id, BENCHMARK_REPORT_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
+}
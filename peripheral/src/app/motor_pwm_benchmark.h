@@ -0,0 +1,12 @@
+#ifndef MOTOR_PWM_BENCHMARK_H_
+#define MOTOR_PWM_BENCHMARK_H_
+
+/**@brief   Run all motor channels at distinct duty cycles and report the longest PWM interrupt
+ *          over RTT. Built with make MOTOR_PWM_BENCHMARK=1.
+ *
+ * @details Call after motor_init(). Eight distinct duty cycles give the longest edge list, the
+ *          worst case for the PWM interrupt. Motor commands from a peer change the load.
+ */
+void motor_pwm_benchmark_start(void);
+
+#endif // MOTOR_PWM_BENCHMARK_H_
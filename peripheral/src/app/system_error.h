@@ -6,5 +6,6 @@
 #define APP_ERROR_INVALID_LENGTH     (APP_ERROR_BASE + 0)
 #define APP_ERROR_NULL               (APP_ERROR_BASE + 1)
 #define APP_ERROR_DS18B20_INIT       (APP_ERROR_BASE + 2)
+#define APP_ERROR_DS18B20_CRC        (APP_ERROR_BASE + 3)
 
 #endif // SYSTEM_ERROR_H_
@@ -5,21 +5,35 @@
 
 #include <string.h>
 
+#include "app_scheduler.h"
 #include "app_timer.h"
+#include "app_timer_appsh.h"
 #include "ble_advdata.h"
 #include "ble_advertising.h"
 #include "ble_conn_params.h"
 #include "ble_hci.h"
+#include "device_manager.h"
 #include "nrf_delay.h"
 #include "nrf_gpio.h"
 #include "pstorage.h"
 #include "softdevice_handler.h"
+#include "softdevice_handler_appsh.h"
 
+#include "adv_status.h"
 #include "auto_temp.h"
+#include "conn_policy.h"
+#include "ds18b20.h"
+#include "ds18b20_stress.h"
 #include "heat.h"
+#include "mhs_bcast.h"
+#include "mhs_esb.h"
 #include "mhs_proxy.h"
 #include "motor.h"
+#include "motor_pwm_benchmark.h"
 #include "music.h"
+#include "one_wire.h"
+#include "telemetry.h"
+#include "temp_history.h"
 
 #include "SEGGER_RTT.h"
 
@@ -27,29 +41,45 @@
 
 #define TX_POWER_LEVEL                   0
 
-#define APP_TIMER_MAX_TIMERS             6                  /**< Maximum number of simultaneously created timers. */
+#define APP_TIMER_MAX_TIMERS             12                 /**< Maximum number of simultaneously created timers, the DS18B20 stress test and the PWM benchmark take one each. */
 #define APP_TIMER_OP_QUEUE_SIZE          4                                          /**< Size of timer operation queues. */
 
+#define SCHED_MAX_EVENT_DATA_SIZE        MAX(APP_TIMER_SCHED_EVT_SIZE, ONE_WIRE_SCHED_EVT_SIZE) /**< Largest event passed through the scheduler, SoftDevice events are fetched in the main loop and take no space. */
+#define SCHED_QUEUE_SIZE                 10                                         /**< Events waiting for the main loop. */
+
 #define DEVICE_NAME                      "Marsh"
 #define APP_ADV_INTERVAL                 300                                         /**< The advertising interval (in units of 0.625 ms. This value corresponds to 25 ms). */
 #define APP_ADV_TIMEOUT_IN_SECONDS       600                                        /**< The advertising timeout in units of seconds. */
+#define APP_ADV_DIRECTED_TRIES           3                                          /**< High duty directed advertising bursts (1.28 seconds each) toward the last bonded central. */
+
+#define SEC_PARAM_BOND                   1                                          /**< Perform bonding. */
+#define SEC_PARAM_MITM                   0                                          /**< Man In The Middle protection not required. */
+#define SEC_PARAM_IO_CAPABILITIES        BLE_GAP_IO_CAPS_NONE                       /**< No I/O capabilities. */
+#define SEC_PARAM_OOB                    0                                          /**< Out Of Band data not available. */
+#define SEC_PARAM_MIN_KEY_SIZE           7                                          /**< Minimum encryption key size. */
+#define SEC_PARAM_MAX_KEY_SIZE           16                                         /**< Maximum encryption key size. */
 
 #define FIRST_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(5000, APP_TIMER_PRESCALER) /**< Time from initiating event (connect or start of notification) to first time sd_ble_gap_conn_param_update is called (5 seconds). */
 #define NEXT_CONN_PARAMS_UPDATE_DELAY    APP_TIMER_TICKS(30000, APP_TIMER_PRESCALER)/**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT     3                                          /**< Number of attempts before giving up the connection parameter negotiation. */
 
-#define MIN_CONN_INTERVAL                MSEC_TO_UNITS(20, UNIT_1_25_MS)           /**< Minimum acceptable connection interval (0.4 seconds). */
-#define MAX_CONN_INTERVAL                MSEC_TO_UNITS(100, UNIT_1_25_MS)           /**< Maximum acceptable connection interval (0.65 second). */
-#define SLAVE_LATENCY                    4                                          /**< Slave latency. */
-#define CONN_SUP_TIMEOUT                 MSEC_TO_UNITS(4000, UNIT_10_MS)            /**< Connection supervisory timeout (4 seconds). */
+#define MIN_CONN_INTERVAL                CONN_POLICY_IDLE_MIN_INTERVAL              /**< Minimum acceptable connection interval, the idle one until connected. */
+#define MAX_CONN_INTERVAL                CONN_POLICY_IDLE_MAX_INTERVAL              /**< Maximum acceptable connection interval. */
+#define SLAVE_LATENCY                    CONN_POLICY_IDLE_SLAVE_LATENCY             /**< Slave latency. */
+#define CONN_SUP_TIMEOUT                 CONN_POLICY_SUP_TIMEOUT                    /**< Connection supervisory timeout (4 seconds). */
 
 #define UUID_TARGET                      0xFFF0
 
 /**< Include or not the service_changed characteristic.
 if not enabled, the server's database cannot be changed for the lifetime of the device*/
 #define IS_SRVC_CHANGED_CHARACT_PRESENT  1
+#define SRV_CHANGED_START_HANDLE         0x0001                                     /**< Service Changed covers the whole database. */
+#define SRV_CHANGED_END_HANDLE           0xFFFF
 
 static uint16_t                         m_conn_handle = BLE_CONN_HANDLE_INVALID;
+static dm_application_instance_t        m_app_handle;                               /**< Application identifier allocated by device manager. */
+static dm_handle_t                      m_bonded_peer_handle;                       /**< Last bonded central, directed advertising goes to it. */
+static uint32_t                         m_db_context[DEVICE_MANAGER_APP_CONTEXT_SIZE / sizeof(uint32_t)] = {MHS_DB_VERSION}; /**< Application context of a bond, flash is written from here. */
 
 
 /**@brief Function for handling the Application's BLE Stack events.
@@ -58,7 +88,6 @@ static uint16_t                         m_conn_handle = BLE_CONN_HANDLE_INVALID;
  */
 static void on_ble_evt(ble_evt_t * p_ble_evt)
 {
-    uint32_t err_code;
     switch (p_ble_evt->header.evt_id)
             {
         case BLE_GAP_EVT_CONNECTED:
@@ -66,9 +95,8 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
             break;
 
         case BLE_GAP_EVT_DISCONNECTED:
+            // The advertising module restarts with directed advertising toward the bonded peer.
             m_conn_handle = BLE_CONN_HANDLE_INVALID;
-            err_code = ble_advertising_start(BLE_ADV_MODE_FAST);
-            APP_ERROR_CHECK(err_code);
             break;
 
         default:
@@ -79,14 +107,16 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
 
 /**@brief Function for dispatching a BLE stack event to all modules with a BLE stack event handler.
  *
- * @details This function is called from the BLE Stack event interrupt handler after a BLE stack
+ * @details This function is called from the main loop through the scheduler after a BLE stack
  *          event has been received.
  *
  * @param[in] p_ble_evt  Bluetooth stack event.
  */
 static void ble_evt_dispatch(ble_evt_t * p_ble_evt)
 {
+    dm_ble_evt_handler(p_ble_evt);
     ble_conn_params_on_ble_evt(p_ble_evt);
+    conn_policy_on_ble_evt(p_ble_evt);
     on_ble_evt(p_ble_evt);
     ble_advertising_on_ble_evt(p_ble_evt);
     ble_mhs_on_ble_evt(get_mhs_obj(), p_ble_evt);
@@ -95,7 +125,7 @@ static void ble_evt_dispatch(ble_evt_t * p_ble_evt)
 
 /**@brief Function for dispatching a system event to interested modules.
  *
- * @details This function is called from the System event interrupt handler after a system
+ * @details This function is called from the main loop through the scheduler after a system
  *          event has been received.
  *
  * @param[in] sys_evt  System stack event.
@@ -104,6 +134,11 @@ static void sys_evt_dispatch(uint32_t sys_evt)
 {
     pstorage_sys_event_handler(sys_evt);
     ble_advertising_on_sys_evt(sys_evt);
+#ifdef MHS_ESB
+    mhs_esb_on_sys_evt(sys_evt);
+#elif defined(MHS_BCAST)
+    mhs_bcast_on_sys_evt(sys_evt);
+#endif
 }
 
 /**@brief Function for initializing the BLE stack.
@@ -114,8 +149,8 @@ static void ble_stack_init(void)
 {
     uint32_t err_code;
 
-    // Initialize the SoftDevice handler module.
-    SOFTDEVICE_HANDLER_INIT(NRF_CLOCK_LFCLKSRC_RC_250_PPM_8000MS_CALIBRATION, NULL);
+    // Initialize the SoftDevice handler module, events are pulled from the main loop.
+    SOFTDEVICE_HANDLER_APPSH_INIT(NRF_CLOCK_LFCLKSRC_RC_250_PPM_8000MS_CALIBRATION, true);
 
     // Enable BLE stack.
     ble_enable_params_t ble_enable_params;
@@ -140,8 +175,16 @@ static void ble_stack_init(void)
  */
 static void timers_init(void)
 {
-    // Initialize timer module.
-    APP_TIMER_INIT(APP_TIMER_PRESCALER, APP_TIMER_MAX_TIMERS, APP_TIMER_OP_QUEUE_SIZE, false);
+    // Initialize timer module, timeout handlers run from the main loop.
+    APP_TIMER_APPSH_INIT(APP_TIMER_PRESCALER, APP_TIMER_MAX_TIMERS, APP_TIMER_OP_QUEUE_SIZE, true);
+}
+
+
+/**@brief Function for the Event Scheduler initialization.
+ */
+static void scheduler_init(void)
+{
+    APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
 }
 
 
@@ -189,8 +232,26 @@ static void gap_params_init(void)
  */
 static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
 {
+    uint32_t       err_code;
+    ble_gap_addr_t peer_address;
+
     switch (ble_adv_evt)
     {
+        case BLE_ADV_EVT_PEER_ADDR_REQUEST:
+            // Without an answer the module falls back to undirected fast advertising.
+            if (m_bonded_peer_handle.appl_id != DM_INVALID_ID)
+            {
+                err_code = dm_peer_addr_get(&m_bonded_peer_handle, &peer_address);
+                if (err_code == NRF_SUCCESS)
+                {
+                    err_code = ble_advertising_peer_addr_reply(&peer_address);
+                    APP_ERROR_CHECK(err_code);
+                }
+            }
+            break;
+        case BLE_ADV_EVT_DIRECTED:
+            SEGGER_RTT_printf(0, "directed advertising\r\n");
+            break;
         case BLE_ADV_EVT_FAST:
             break;
         case BLE_ADV_EVT_IDLE:
@@ -201,38 +262,199 @@ static void on_adv_evt(ble_adv_evt_t ble_adv_evt)
 }
 
 
-/**@brief Function for initializing the Advertising functionality.
+/**@brief Encode the advertising data, with the status record in the manufacturer specific data.
  *
- * @details Encodes the required advertising data and passes it to the stack.
- *          Also builds a structure to be passed to the stack when starting advertising.
+ * @param[in]   p_record    ADV_STATUS_LEN bytes, see adv_status.h.
+ * @param[in]   p_options   Advertising modes to initialize ble_advertising with, NULL to only
+ *                          update the data.
  */
-static void advertising_init(void)
+static uint32_t advdata_set(const uint8_t * p_record, ble_adv_modes_config_t const * p_options)
 {
-    uint32_t      err_code;
-    ble_advdata_t advdata;
-    int8_t        tx_power_level = TX_POWER_LEVEL;
+    uint32_t                 err_code;
+    ble_advdata_t            advdata;
+    ble_advdata_manuf_data_t manuf_data;
+    int8_t                   tx_power_level = TX_POWER_LEVEL;
 
     ble_uuid_t adv_uuids[] = {{UUID_TARGET, BLE_UUID_TYPE_BLE}};
 
-    // Build advertising data struct to pass into @ref ble_advertising_init.
     memset(&advdata, 0, sizeof(advdata));
 
+    manuf_data.company_identifier = ADV_STATUS_COMPANY_ID;
+    manuf_data.data.p_data        = (uint8_t *)p_record;
+    manuf_data.data.size          = ADV_STATUS_LEN;
+
     advdata.name_type               = BLE_ADVDATA_FULL_NAME;
     advdata.include_appearance      = true;
     advdata.flags                   = BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE;
     advdata.p_tx_power_level        = &tx_power_level;
     advdata.uuids_complete.uuid_cnt = sizeof(adv_uuids) / sizeof(adv_uuids[0]);
     advdata.uuids_complete.p_uuids  = adv_uuids;
+    advdata.p_manuf_specific_data   = &manuf_data;
 
     err_code = ble_advdata_set(&advdata, NULL);
+    if ((err_code != NRF_SUCCESS) || (p_options == NULL))
+    {
+        return err_code;
+    }
+
+    return ble_advertising_init(&advdata, p_options, on_adv_evt, NULL);
+}
+
+
+/**@brief Put a changed status record in the advertising data, scanners see it without connecting.
+ */
+static void adv_status_update(const uint8_t * p_record, uint8_t len)
+{
+    uint32_t err_code;
+
+    UNUSED_PARAMETER(len);
+
+    err_code = advdata_set(p_record, NULL);
     APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Function for initializing the Advertising functionality.
+ *
+ * @details Encodes the required advertising data and passes it to the stack.
+ *          Also builds a structure to be passed to the stack when starting advertising.
+ */
+static void advertising_init(void)
+{
+    uint32_t err_code;
+    uint8_t  record[ADV_STATUS_LEN];
 
     ble_adv_modes_config_t options = {0};
+    options.ble_adv_directed_enabled = true;
+    options.ble_adv_directed_timeout = APP_ADV_DIRECTED_TRIES;
     options.ble_adv_fast_enabled  = BLE_ADV_FAST_ENABLED;
     options.ble_adv_fast_interval = APP_ADV_INTERVAL;
     options.ble_adv_fast_timeout  = APP_ADV_TIMEOUT_IN_SECONDS;
 
-    err_code = ble_advertising_init(&advdata, &options, on_adv_evt, NULL);
+    adv_status_encode(record);
+    err_code = advdata_set(record, &options);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Store the database version a bonded central has seen.
+ */
+static void db_version_store(dm_handle_t const * p_handle)
+{
+    uint32_t                 err_code;
+    dm_application_context_t context;
+
+    context.flags  = 0;
+    context.len    = sizeof(m_db_context);
+    context.p_data = (uint8_t *)m_db_context;
+
+    err_code = dm_application_context_set(p_handle, &context);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Tell a bonded central whose cached handles are older than this database to discover
+ *        it again.
+ */
+static void db_version_check(dm_handle_t const * p_handle)
+{
+    uint32_t                 err_code;
+    uint32_t                 version[DEVICE_MANAGER_APP_CONTEXT_SIZE / sizeof(uint32_t)];
+    dm_application_context_t context;
+
+    context.p_data = (uint8_t *)version;
+
+    err_code = dm_application_context_get(p_handle, &context);
+    if ((err_code == NRF_SUCCESS) && (version[0] == MHS_DB_VERSION))
+    {
+        return;
+    }
+
+    if ((err_code != NRF_SUCCESS) && (err_code != DM_NO_APP_CONTEXT))
+    {
+        // Not bonded.
+        return;
+    }
+
+    err_code = sd_ble_gatts_service_changed(m_conn_handle, SRV_CHANGED_START_HANDLE, SRV_CHANGED_END_HANDLE);
+    if (err_code == NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "service changed sent\r\n");
+        db_version_store(p_handle);
+    }
+    else
+    {
+        // Indications not enabled by this central, it discovers anyway.
+        SEGGER_RTT_printf(0, "service changed failed %d\r\n", err_code);
+    }
+}
+
+
+/**@brief Function for handling the Device Manager events.
+ *
+ * @param[in] p_handle      Identifies the peer the event is about.
+ * @param[in] p_event       Event.
+ * @param[in] event_result  Result of the operation the event reports.
+ */
+static uint32_t device_manager_evt_handler(dm_handle_t const    * p_handle,
+                                           dm_event_t const     * p_event,
+                                           ret_code_t             event_result)
+{
+    APP_ERROR_CHECK(event_result);
+
+    switch (p_event->event_id)
+    {
+        case DM_EVT_DEVICE_CONTEXT_LOADED:
+            m_bonded_peer_handle = (*p_handle);
+            break;
+
+        case DM_EVT_SECURITY_SETUP_COMPLETE:
+            // A new bond, the central discovered this database.
+            m_bonded_peer_handle = (*p_handle);
+            db_version_store(p_handle);
+            break;
+
+        case DM_EVT_LINK_SECURED:
+            SEGGER_RTT_printf(0, "link secured\r\n");
+            db_version_check(p_handle);
+            break;
+
+        default:
+            break;
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Function for the Device Manager initialization.
+ *
+ * @details Bonds are kept so a known central gets directed advertising and restores encryption
+ *          and the CCCDs from the stored keys on reconnection.
+ */
+static void device_manager_init(void)
+{
+    uint32_t               err_code;
+    dm_init_param_t        init_data;
+    dm_application_param_t register_param;
+
+    init_data.clear_persistent_data = false;
+
+    err_code = dm_init(&init_data);
+    APP_ERROR_CHECK(err_code);
+
+    memset(&register_param.sec_param, 0, sizeof(ble_gap_sec_params_t));
+
+    register_param.sec_param.bond         = SEC_PARAM_BOND;
+    register_param.sec_param.mitm         = SEC_PARAM_MITM;
+    register_param.sec_param.io_caps      = SEC_PARAM_IO_CAPABILITIES;
+    register_param.sec_param.oob          = SEC_PARAM_OOB;
+    register_param.sec_param.min_key_size = SEC_PARAM_MIN_KEY_SIZE;
+    register_param.sec_param.max_key_size = SEC_PARAM_MAX_KEY_SIZE;
+    register_param.evt_handler            = device_manager_evt_handler;
+    register_param.service_type           = DM_PROTOCOL_CNTXT_GATT_SRVR_ID;
+
+    err_code = dm_register(&m_app_handle, &register_param);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -241,20 +463,16 @@ static void advertising_init(void)
  *
  * @details This function will be called for all events in the Connection Parameters Module which
  *          are passed to the application.
- *          @note All this function does is to disconnect. This could have been done by simply
- *                setting the disconnect_on_fail config parameter, but instead we use the event
- *                handler mechanism to demonstrate its use.
+ *          @note The central keeps the active parameters while its user is busy and may refuse
+ *                the idle ones for a while, so a failed negotiation keeps the link.
  *
  * @param[in] p_evt  Event received from the Connection Parameters Module.
  */
 static void on_conn_params_evt(ble_conn_params_evt_t * p_evt)
 {
-    uint32_t err_code;
-
     if (p_evt->evt_type == BLE_CONN_PARAMS_EVT_FAILED)
     {
-        err_code = sd_ble_gap_disconnect(m_conn_handle, BLE_HCI_CONN_INTERVAL_UNACCEPTABLE);
-        APP_ERROR_CHECK(err_code);
+        SEGGER_RTT_printf(0, "conn params negotiation failed\r\n");
     }
 }
 
@@ -294,6 +512,12 @@ static void conn_params_init(void)
 void services_init(void)
 {
     mhs_init();
+#if defined(MHS_ESB) || defined(MHS_BCAST)
+    mhs_bcast_init();
+#endif
+#ifdef MHS_ESB
+    mhs_esb_init();
+#endif
 }
 
 
@@ -303,26 +527,39 @@ void system_init(void)
 
     SEGGER_RTT_printf(0, "system init %s\r\n", "started");
 
+    scheduler_init();
     ble_stack_init();
     timers_init();
 
     err_code = pstorage_init();
     APP_ERROR_CHECK(err_code);
 
+    dm_handle_initialize(&m_bonded_peer_handle);
+    device_manager_init();
+
     gap_params_init();
     advertising_init();
     services_init();
     conn_params_init();
+    conn_policy_init();
     err_code = ble_advertising_start(BLE_ADV_MODE_FAST);
     APP_ERROR_CHECK(err_code);
 
     SEGGER_RTT_printf(0, "peripheral init %s\r\n", "started");
 
     motor_init();
-    //SEGGER_RTT_printf(0, "motor init %s\r\n", "started");
-    //heat_control_init();
-    //SEGGER_RTT_printf(0, "heat init %s\r\n", "started");
-    //auto_temperature_init();
+#ifdef MOTOR_PWM_BENCHMARK
+    motor_pwm_benchmark_start();
+#endif
+    ds18b20_init();
+#ifdef DS18B20_STRESS_TEST
+    ds18b20_stress_start();
+#endif
+    temp_history_init();
+    telemetry_init();
+    adv_status_init(adv_status_update);
+    heat_control_init();
+    auto_temperature_init();
     SEGGER_RTT_printf(0, "auto temp init %s\r\n", "started");
 
     music_control_init();
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <app_error.h>
+#include <app_timer.h>
+
+#include "auto_temp.h"
+#include "ble_mhs.h"
+#include "motor.h"
+
+#include "SEGGER_RTT.h"
+
+#include "telemetry.h"
+
+#define TELEMETRY_TICK          APP_TIMER_TICKS(1000, APP_TIMER_PRESCALER)
+
+/**@brief Subscription of one signal. */
+typedef struct telemetry_sub_s
+{
+    uint8_t  interval_s;        /**< 0 if not subscribed. */
+    uint8_t  elapsed_s;
+    uint8_t  threshold;         /**< Least change notified. */
+    bool     sent;              /**< last_sent is valid. */
+    int16_t  last_sent;
+} telemetry_sub_t;
+
+static app_timer_id_t   m_telemetry_timer_id;
+static bool             m_timer_running = false;
+static bool             m_notification_enabled = false;
+static telemetry_sub_t  m_subs[MHS_TELEMETRY_SIGNAL_COUNT];
+
+static const mhs_event_code_t m_signal_event_code[MHS_TELEMETRY_SIGNAL_COUNT] =
+{
+    [MHS_TELEMETRY_SIGNAL_TEMPERATURE] = MHS_EVENT_CODE_CURRENT_TEMPERATURE,
+    [MHS_TELEMETRY_SIGNAL_MOTOR_SPEED] = MHS_EVENT_CODE_MOTOR_SPEED,
+};
+
+
+/**@brief Get the latest value of a signal.
+ *
+ * @return false if there is no value yet.
+ */
+static bool signal_value_get(uint8_t signal, int16_t * p_value)
+{
+    bool result = false;
+
+    switch (signal)
+    {
+        case MHS_TELEMETRY_SIGNAL_TEMPERATURE:
+            result = current_temperature_get(p_value);
+            // Keep the value fresh for the next report when auto detection does not run.
+            temperature_sample_request();
+            break;
+        case MHS_TELEMETRY_SIGNAL_MOTOR_SPEED:
+            *p_value = motor_duty_cycle_get();
+            result   = true;
+            break;
+        default:
+            break;
+    }
+
+    return result;
+}
+
+
+static uint32_t signal_notify(uint8_t signal, int16_t value)
+{
+    mhs_event_t event;
+
+    memset(&event, 0, sizeof(mhs_event_t));
+    event.evt_code       = m_signal_event_code[signal];
+    event.evt_value.buff = (uint8_t *)&value;
+    event.evt_value.len  = sizeof(value);
+
+    return mhs_event_characteristic_notify(event);
+}
+
+
+static void telemetry_timeout_handler(void * p_context)
+{
+    uint32_t          err_code;
+    telemetry_sub_t * p_sub;
+    int16_t           value;
+
+    for (uint8_t signal = 0; signal < MHS_TELEMETRY_SIGNAL_COUNT; signal++)
+    {
+        p_sub = &m_subs[signal];
+        if (p_sub->interval_s == 0)
+        {
+            continue;
+        }
+
+        if (++p_sub->elapsed_s < p_sub->interval_s)
+        {
+            continue;
+        }
+        p_sub->elapsed_s = 0;
+
+        if (!signal_value_get(signal, &value))
+        {
+            continue;
+        }
+
+        if (p_sub->sent && (abs(value - p_sub->last_sent) < p_sub->threshold))
+        {
+            continue;
+        }
+
+        // An event that could not be queued is tried again at the next interval.
+        err_code = signal_notify(signal, value);
+        if (err_code == NRF_SUCCESS)
+        {
+            p_sub->sent      = true;
+            p_sub->last_sent = value;
+        }
+        else
+        {
+            SEGGER_RTT_printf(0, "telemetry %d notify failed %p\r\n", signal, err_code);
+        }
+    }
+}
+
+
+/**@brief Run the report timer only while notifications are enabled and a signal is subscribed.
+ */
+static void telemetry_timer_update(void)
+{
+    uint32_t err_code;
+    bool     subscribed = false;
+
+    for (uint8_t signal = 0; signal < MHS_TELEMETRY_SIGNAL_COUNT; signal++)
+    {
+        subscribed |= (m_subs[signal].interval_s != 0);
+    }
+
+    if ((subscribed && m_notification_enabled) == m_timer_running)
+    {
+        return;
+    }
+
+    if (m_timer_running)
+    {
+        err_code = app_timer_stop(m_telemetry_timer_id);
+    }
+    else
+    {
+        err_code = app_timer_start(m_telemetry_timer_id, TELEMETRY_TICK, NULL);
+    }
+    APP_ERROR_CHECK(err_code);
+
+    m_timer_running = !m_timer_running;
+}
+
+
+void telemetry_init(void)
+{
+    uint32_t err_code;
+
+    err_code = app_timer_create(&m_telemetry_timer_id,
+                                APP_TIMER_MODE_REPEATED,
+                                telemetry_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+void telemetry_subscribe(uint8_t signal, uint8_t interval_s)
+{
+    if (signal >= MHS_TELEMETRY_SIGNAL_COUNT)
+    {
+        SEGGER_RTT_printf(0, "invalid telemetry signal %d\r\n", signal);
+        return;
+    }
+
+    m_subs[signal].interval_s = interval_s;
+    m_subs[signal].elapsed_s  = 0;
+    m_subs[signal].sent       = false;      // The first check always reports.
+
+    telemetry_timer_update();
+}
+
+
+void telemetry_threshold_set(uint8_t signal, uint8_t threshold)
+{
+    if (signal >= MHS_TELEMETRY_SIGNAL_COUNT)
+    {
+        SEGGER_RTT_printf(0, "invalid telemetry signal %d\r\n", signal);
+        return;
+    }
+
+    m_subs[signal].threshold = threshold;
+}
+
+
+void telemetry_notification_enable(bool enable)
+{
+    m_notification_enabled = enable;
+
+    if (enable)
+    {
+        // Report everything again to a fresh subscriber.
+        for (uint8_t signal = 0; signal < MHS_TELEMETRY_SIGNAL_COUNT; signal++)
+        {
+            m_subs[signal].sent = false;
+        }
+    }
+
+    telemetry_timer_update();
+}
@@ -0,0 +1,33 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**@brief   Create the report timer.
+ */
+void telemetry_init(void);
+
+/**@brief   Subscribe to a signal, or stop it.
+ *
+ * @details While notifications of the event characteristic are enabled, the signal is checked
+ *          every interval and notified if it moved by at least its threshold since the last
+ *          notification.
+ *
+ * @param   signal      mhs_telemetry_signal_t.
+ * @param   interval_s  Seconds between two checks, 0 stops the subscription.
+ */
+void telemetry_subscribe(uint8_t signal, uint8_t interval_s);
+
+/**@brief   Set the least change notified for a signal, 0 notifies every interval.
+ *
+ * @param   signal      mhs_telemetry_signal_t.
+ * @param   threshold   1/16 degrees for temperatures, percent for the motor speed.
+ */
+void telemetry_threshold_set(uint8_t signal, uint8_t threshold);
+
+/**@brief   Follow the CCCD of the event characteristic, reports only run while it is enabled.
+ */
+void telemetry_notification_enable(bool enable);
+
+#endif // TELEMETRY_H_
@@ -0,0 +1,770 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "app_error.h"
+#include "app_timer.h"
+#include "ble_racp.h"
+#include "nordic_common.h"
+#include "pstorage.h"
+
+#include "auto_temp.h"
+#include "ble_mhs.h"
+#include "SEGGER_RTT.h"
+
+#include "temp_history.h"
+
+// Flash log: a ring of blocks. Each block holds its first record in the header, followed by
+// word aligned chunks appended by each flush: a length byte, then one record after the other as
+// zigzag varint deltas of timestamp and temperature. Sequence numbers are implicit.
+#define HISTORY_BLOCK_SIZE          256     /**< Divides the flash page size. */
+#define HISTORY_BLOCK_COUNT         16      /**< 4 pages, about a day of 1 minute samples. */
+#define HISTORY_HEADER_SIZE         12
+#define HISTORY_DATA_SIZE           (HISTORY_BLOCK_SIZE - HISTORY_HEADER_SIZE)
+#define HISTORY_ERASED_SEQ          0xFFFFFFFF
+#define HISTORY_CHUNK_EMPTY         0xFF    /**< Length byte read from erased flash. */
+#define HISTORY_CHUNK_MAX           128     /**< Longest chunk written by one flush, length byte included. */
+#define HISTORY_RECORD_MAX_ENCODED  8       /**< 5 bytes of time delta, 3 bytes of temperature delta. */
+
+#define HISTORY_RAM_RECORDS         16      /**< Samples waiting to be flushed. */
+#define HISTORY_FLUSH_RECORDS       8       /**< Flush once this many samples wait. */
+
+#define HISTORY_RECORD_WIRE_SIZE    10
+#define HISTORY_NOTIFY_LEN          (2 * HISTORY_RECORD_WIRE_SIZE)
+
+#define HISTORY_TICK                APP_TIMER_TICKS(TEMP_HISTORY_INTERVAL_S * 1000, APP_TIMER_PRESCALER)
+
+#define WORD_ALIGN(x)               (((x) + 3) & ~3)
+
+typedef struct history_header_s
+{
+    uint32_t first_seq;         /**< HISTORY_ERASED_SEQ if the block is erased. */
+    uint32_t first_timestamp;
+    int16_t  first_temperature;
+    uint16_t reserved;
+} history_header_t;
+
+typedef struct history_block_s
+{
+    history_header_t header;
+    uint8_t          data[HISTORY_DATA_SIZE];
+} history_block_t;
+
+/**@brief Position in one flash block. All zero is the start of the block. */
+typedef struct history_cursor_s
+{
+    bool     header_done;
+    uint16_t offset;            /**< Next byte to decode in the data. */
+    uint16_t chunk_end;         /**< End of the current chunk. */
+} history_cursor_t;
+
+/**@brief Walks the flash blocks from the oldest, then the samples still in RAM. */
+typedef struct history_reader_s
+{
+    uint8_t               block;
+    uint8_t               blocks_left;      /**< The current block included. */
+    history_cursor_t      cursor;
+    uint8_t               ram_index;
+    temp_history_record_t record;           /**< Last record read. */
+} history_reader_t;
+
+/**@brief Record access operation in progress. */
+typedef struct history_report_s
+{
+    bool             active;
+    bool             started;               /**< Reader set up, flash was idle. */
+    uint8_t          opcode;                /**< RACP_OPCODE_REPORT_RECS or RACP_OPCODE_REPORT_NUM_RECS. */
+    uint32_t         min_seq;
+    uint16_t         count;                 /**< Records reported or counted. */
+    history_reader_t reader;
+    uint8_t          notify_buf[HISTORY_NOTIFY_LEN];
+    uint8_t          notify_len;            /**< Bytes waiting for a notification buffer. */
+} history_report_t;
+
+static pstorage_handle_t        m_storage;
+
+static temp_history_record_t    m_ram[HISTORY_RAM_RECORDS];
+static uint8_t                  m_ram_first = 0;
+static uint8_t                  m_ram_count = 0;
+static uint32_t                 m_next_seq  = 0;
+static uint32_t                 m_dropped_count = 0;
+
+static uint8_t                  m_write_block      = 0;
+static bool                     m_write_block_open = false;     /**< Header of the write block is stored. */
+static uint16_t                 m_write_offset     = 0;         /**< Next chunk in the write block data. */
+static temp_history_record_t    m_write_last;                   /**< Last record stored, base of the next delta. */
+static uint8_t                  m_flash_ops = 0;                /**< pstorage operations not completed yet. */
+static uint32_t                 m_flush_buf[(HISTORY_HEADER_SIZE + HISTORY_CHUNK_MAX) / sizeof(uint32_t)];
+
+static history_report_t         m_report;
+
+static app_timer_id_t           m_history_timer_id;
+static uint32_t                 m_uptime_s     = 0;             /**< Seconds since the device started, in ticks. */
+static bool                     m_sample_due   = false;         /**< Log the next good reading. */
+
+
+static uint8_t varint_encode(int32_t value, uint8_t * p_buf)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    uint8_t  len    = 0;
+
+    while (zigzag >= 0x80)
+    {
+        p_buf[len++] = (uint8_t)(zigzag | 0x80);
+        zigzag >>= 7;
+    }
+    p_buf[len++] = (uint8_t)zigzag;
+
+    return len;
+}
+
+
+static bool varint_decode(const uint8_t * p_buf, uint16_t * p_offset, uint16_t end, int32_t * p_value)
+{
+    uint32_t zigzag = 0;
+    uint8_t  shift  = 0;
+    uint8_t  byte;
+
+    do
+    {
+        if ((*p_offset >= end) || (shift > 28))
+        {
+            return false;
+        }
+        byte    = p_buf[(*p_offset)++];
+        zigzag |= (uint32_t)(byte & 0x7F) << shift;
+        shift  += 7;
+    } while (byte & 0x80);
+
+    *p_value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+
+    return true;
+}
+
+
+static uint8_t record_encode(const temp_history_record_t * p_prev,
+                             const temp_history_record_t * p_record,
+                             uint8_t                     * p_buf)
+{
+    uint8_t len;
+
+    len  = varint_encode((int32_t)(p_record->timestamp - p_prev->timestamp), p_buf);
+    len += varint_encode(p_record->temperature - p_prev->temperature, &p_buf[len]);
+
+    return len;
+}
+
+
+/**@brief Decode the record following p_record in place.
+ */
+static bool record_decode(const uint8_t * p_buf, uint16_t * p_offset, uint16_t end,
+                          temp_history_record_t * p_record)
+{
+    int32_t time_delta;
+    int32_t temperature_delta;
+
+    if (!varint_decode(p_buf, p_offset, end, &time_delta) ||
+        !varint_decode(p_buf, p_offset, end, &temperature_delta))
+    {
+        return false;
+    }
+
+    p_record->seq++;
+    p_record->timestamp   += time_delta;
+    p_record->temperature += temperature_delta;
+
+    return true;
+}
+
+
+static const history_block_t * block_get(uint8_t index)
+{
+    uint32_t          err_code;
+    pstorage_handle_t block;
+
+    err_code = pstorage_block_identifier_get(&m_storage, index, &block);
+    APP_ERROR_CHECK(err_code);
+
+    return (const history_block_t *)block.block_id;
+}
+
+
+static bool block_is_erased(uint8_t index)
+{
+    return (block_get(index)->header.first_seq == HISTORY_ERASED_SEQ);
+}
+
+
+/**@brief Read the next record of a block.
+ *
+ * @return false at the end of the block, or of its valid data.
+ */
+static bool block_record_next(const history_block_t * p_block,
+                              history_cursor_t      * p_cursor,
+                              temp_history_record_t * p_record)
+{
+    uint16_t start;
+
+    if (p_block->header.first_seq == HISTORY_ERASED_SEQ)
+    {
+        return false;
+    }
+
+    if (!p_cursor->header_done)
+    {
+        p_cursor->header_done  = true;
+        p_record->seq          = p_block->header.first_seq;
+        p_record->timestamp    = p_block->header.first_timestamp;
+        p_record->temperature  = p_block->header.first_temperature;
+        return true;
+    }
+
+    while (p_cursor->offset >= p_cursor->chunk_end)
+    {
+        start = WORD_ALIGN(p_cursor->chunk_end);
+        if ((start >= HISTORY_DATA_SIZE) || (p_block->data[start] == HISTORY_CHUNK_EMPTY))
+        {
+            return false;
+        }
+
+        p_cursor->offset    = start + 1;
+        p_cursor->chunk_end = p_cursor->offset + p_block->data[start];
+        if (p_cursor->chunk_end > HISTORY_DATA_SIZE)
+        {
+            return false;
+        }
+    }
+
+    return record_decode(p_block->data, &p_cursor->offset, p_cursor->chunk_end, p_record);
+}
+
+
+static void reader_init(history_reader_t * p_reader)
+{
+    uint8_t block;
+
+    memset(p_reader, 0, sizeof(history_reader_t));
+
+    // The oldest block is the first used one after the block being written.
+    for (uint8_t i = 1; i <= HISTORY_BLOCK_COUNT; i++)
+    {
+        block = (m_write_block + i) % HISTORY_BLOCK_COUNT;
+        if (!block_is_erased(block))
+        {
+            p_reader->block       = block;
+            p_reader->blocks_left = HISTORY_BLOCK_COUNT + 1 - i;
+            break;
+        }
+    }
+}
+
+
+static bool reader_next(history_reader_t * p_reader)
+{
+    while (p_reader->blocks_left > 0)
+    {
+        if (block_record_next(block_get(p_reader->block), &p_reader->cursor, &p_reader->record))
+        {
+            return true;
+        }
+
+        p_reader->block = (p_reader->block + 1) % HISTORY_BLOCK_COUNT;
+        p_reader->blocks_left--;
+        memset(&p_reader->cursor, 0, sizeof(history_cursor_t));
+    }
+
+    if (p_reader->ram_index < m_ram_count)
+    {
+        p_reader->record = m_ram[(m_ram_first + p_reader->ram_index) % HISTORY_RAM_RECORDS];
+        p_reader->ram_index++;
+        return true;
+    }
+
+    return false;
+}
+
+
+static void ram_pop(void)
+{
+    m_ram_first = (m_ram_first + 1) % HISTORY_RAM_RECORDS;
+    m_ram_count--;
+}
+
+
+/**@brief Move the samples waiting in RAM to flash, as many as fit one chunk.
+ *
+ * @details Deferred while a report reads the log or a flash operation is pending, the pstorage
+ *          callback flushes again once both are done.
+ */
+static void history_flush(void)
+{
+    uint32_t          err_code;
+    pstorage_handle_t block;
+    history_header_t  header;
+    uint8_t         * p_buf = (uint8_t *)m_flush_buf;
+    uint8_t         * p_chunk;
+    uint8_t           encoded[HISTORY_RECORD_MAX_ENCODED];
+    uint16_t          size = 0;
+    uint16_t          offset;
+    uint16_t          room;
+    uint8_t           chunk_len = 0;
+    uint8_t           len;
+
+    if ((m_flash_ops != 0) || m_report.active || (m_ram_count == 0))
+    {
+        return;
+    }
+
+    if (m_write_block_open &&
+        (HISTORY_DATA_SIZE - m_write_offset < 1 + HISTORY_RECORD_MAX_ENCODED))
+    {
+        // Block full, go on in the next one, dropping its oldest records.
+        m_write_block      = (m_write_block + 1) % HISTORY_BLOCK_COUNT;
+        m_write_block_open = false;
+    }
+
+    err_code = pstorage_block_identifier_get(&m_storage, m_write_block, &block);
+    APP_ERROR_CHECK(err_code);
+
+    if (!m_write_block_open)
+    {
+        if (!block_is_erased(m_write_block))
+        {
+            err_code = pstorage_clear(&block, HISTORY_BLOCK_SIZE);
+            APP_ERROR_CHECK(err_code);
+            m_flash_ops++;
+        }
+
+        m_write_last = m_ram[m_ram_first];
+        ram_pop();
+
+        header.first_seq         = m_write_last.seq;
+        header.first_timestamp   = m_write_last.timestamp;
+        header.first_temperature = m_write_last.temperature;
+        header.reserved          = 0xFFFF;
+        memcpy(p_buf, &header, sizeof(header));
+
+        size               = HISTORY_HEADER_SIZE;
+        offset             = 0;
+        m_write_offset     = 0;
+        m_write_block_open = true;
+    }
+    else
+    {
+        offset = HISTORY_HEADER_SIZE + m_write_offset;
+    }
+
+    room = MIN(HISTORY_DATA_SIZE - m_write_offset, HISTORY_CHUNK_MAX);
+    p_chunk = &p_buf[size];
+
+    while (m_ram_count > 0)
+    {
+        len = record_encode(&m_write_last, &m_ram[m_ram_first], encoded);
+        if (1 + chunk_len + len > room)
+        {
+            break;
+        }
+
+        memcpy(&p_chunk[1 + chunk_len], encoded, len);
+        chunk_len   += len;
+        m_write_last = m_ram[m_ram_first];
+        ram_pop();
+    }
+
+    if (chunk_len > 0)
+    {
+        p_chunk[0] = chunk_len;
+        memset(&p_chunk[1 + chunk_len], 0, WORD_ALIGN(1 + chunk_len) - (1 + chunk_len));
+        size           += WORD_ALIGN(1 + chunk_len);
+        m_write_offset += WORD_ALIGN(1 + chunk_len);
+    }
+
+    err_code = pstorage_store(&block, p_buf, size, offset);
+    APP_ERROR_CHECK(err_code);
+    m_flash_ops++;
+}
+
+
+static void racp_response_send(uint8_t opcode, uint8_t response)
+{
+    uint32_t         err_code;
+    ble_racp_value_t racp;
+    uint8_t          operand[2] = {opcode, response};
+    uint8_t          data[2 + sizeof(operand)];
+
+    racp.opcode      = RACP_OPCODE_RESPONSE_CODE;
+    racp.operator    = RACP_OPERATOR_NULL;
+    racp.operand_len = sizeof(operand);
+    racp.p_operand   = operand;
+
+    err_code = mhs_racp_characteristic_indicate(data, ble_racp_encode(&racp, data));
+    if (err_code != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "racp response failed %p\r\n", err_code);
+    }
+}
+
+
+static void racp_num_response_send(uint16_t count)
+{
+    uint32_t         err_code;
+    ble_racp_value_t racp;
+    uint8_t          data[2 + sizeof(count)];
+
+    racp.opcode      = RACP_OPCODE_NUM_RECS_RESPONSE;
+    racp.operator    = RACP_OPERATOR_NULL;
+    racp.operand_len = sizeof(count);
+    racp.p_operand   = (uint8_t *)&count;
+
+    err_code = mhs_racp_characteristic_indicate(data, ble_racp_encode(&racp, data));
+    if (err_code != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "racp response failed %p\r\n", err_code);
+    }
+}
+
+
+static void report_end(void)
+{
+    m_report.active     = false;
+    m_report.notify_len = 0;
+
+    if (m_ram_count >= HISTORY_FLUSH_RECORDS)
+    {
+        history_flush();
+    }
+}
+
+
+/**@brief Fill the notification buffer with the next records at or after the requested
+ *        sequence number.
+ */
+static void report_buffer_fill(void)
+{
+    temp_history_record_t * p_record = &m_report.reader.record;
+    uint8_t               * p_buf;
+
+    while ((m_report.notify_len < HISTORY_NOTIFY_LEN) && reader_next(&m_report.reader))
+    {
+        if (p_record->seq < m_report.min_seq)
+        {
+            continue;
+        }
+
+        p_buf = &m_report.notify_buf[m_report.notify_len];
+        memcpy(&p_buf[0], &p_record->seq, sizeof(uint32_t));
+        memcpy(&p_buf[4], &p_record->timestamp, sizeof(uint32_t));
+        memcpy(&p_buf[8], &p_record->temperature, sizeof(int16_t));
+
+        m_report.notify_len += HISTORY_RECORD_WIRE_SIZE;
+        m_report.count++;
+    }
+}
+
+
+/**@brief Run the record access operation in progress as far as possible.
+ *
+ * @details Records are notified back to back until the SoftDevice runs out of buffers, the
+ *          report then continues on the next TX complete event. Nothing is read until pending
+ *          flash operations are done, the pstorage callback starts the operation then.
+ */
+static void report_continue(void)
+{
+    uint32_t err_code;
+
+    if (!m_report.active || (m_flash_ops != 0))
+    {
+        return;
+    }
+
+    if (!m_report.started)
+    {
+        reader_init(&m_report.reader);
+        m_report.started = true;
+    }
+
+    if (m_report.opcode == RACP_OPCODE_REPORT_NUM_RECS)
+    {
+        while (reader_next(&m_report.reader))
+        {
+            if (m_report.reader.record.seq >= m_report.min_seq)
+            {
+                m_report.count++;
+            }
+        }
+        report_end();
+        racp_num_response_send(m_report.count);
+        return;
+    }
+
+    for (;;)
+    {
+        if (m_report.notify_len == 0)
+        {
+            report_buffer_fill();
+            if (m_report.notify_len == 0)
+            {
+                report_end();
+                racp_response_send(RACP_OPCODE_REPORT_RECS,
+                                   (m_report.count > 0) ? RACP_RESPONSE_SUCCESS
+                                                        : RACP_RESPONSE_NO_RECORDS_FOUND);
+                return;
+            }
+        }
+
+        err_code = mhs_history_characteristic_notify(m_report.notify_buf, m_report.notify_len);
+        if (err_code == BLE_ERROR_NO_TX_BUFFERS)
+        {
+            return;
+        }
+        if (err_code != NRF_SUCCESS)
+        {
+            SEGGER_RTT_printf(0, "history notify failed %p\r\n", err_code);
+            report_end();
+            racp_response_send(RACP_OPCODE_REPORT_RECS, RACP_RESPONSE_PROCEDURE_NOT_DONE);
+            return;
+        }
+
+        m_report.notify_len = 0;
+    }
+}
+
+
+/**@brief Get the lowest sequence number asked for by a report request.
+ *
+ * @return RACP_RESPONSE_SUCCESS, or the response code rejecting the request.
+ */
+static uint8_t racp_min_seq_get(const ble_racp_value_t * p_racp, uint32_t * p_min_seq)
+{
+    switch (p_racp->operator)
+    {
+        case RACP_OPERATOR_ALL:
+            if (p_racp->operand_len != 0)
+            {
+                return RACP_RESPONSE_INVALID_OPERAND;
+            }
+            *p_min_seq = 0;
+            return RACP_RESPONSE_SUCCESS;
+        case RACP_OPERATOR_GREATER_OR_EQUAL:
+            if (p_racp->operand_len != 1 + sizeof(uint32_t))
+            {
+                return RACP_RESPONSE_INVALID_OPERAND;
+            }
+            if (p_racp->p_operand[0] != TEMP_HISTORY_FILTER_SEQUENCE)
+            {
+                return RACP_RESPONSE_OPERAND_UNSUPPORTED;
+            }
+            memcpy(p_min_seq, &p_racp->p_operand[1], sizeof(uint32_t));
+            return RACP_RESPONSE_SUCCESS;
+        case RACP_OPERATOR_NULL:
+            return RACP_RESPONSE_INVALID_OPERATOR;
+        default:
+            return RACP_RESPONSE_OPERATOR_UNSUPPORTED;
+    }
+}
+
+
+static void history_delete(void)
+{
+    uint32_t err_code;
+
+    err_code = pstorage_clear(&m_storage, HISTORY_BLOCK_SIZE * HISTORY_BLOCK_COUNT);
+    APP_ERROR_CHECK(err_code);
+    m_flash_ops++;
+
+    // Sequence numbers go on, so a client asking for records since its last download does
+    // not miss new ones.
+    m_ram_first        = 0;
+    m_ram_count        = 0;
+    m_write_block      = 0;
+    m_write_block_open = false;
+}
+
+
+static void history_storage_cb(pstorage_handle_t * p_handle,
+                               uint8_t             op_code,
+                               uint32_t            result,
+                               uint8_t           * p_data,
+                               uint32_t            data_len)
+{
+    if (result != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "history flash op %d failed %p\r\n", op_code, result);
+    }
+
+    if (m_flash_ops > 0)
+    {
+        m_flash_ops--;
+    }
+
+    if (m_flash_ops == 0)
+    {
+        report_continue();
+        if (m_ram_count >= HISTORY_FLUSH_RECORDS)
+        {
+            history_flush();
+        }
+    }
+}
+
+
+/**@brief Uptime tick, asks for the reading of the next sample.
+ */
+static void history_timeout_handler(void * p_context)
+{
+    m_uptime_s  += TEMP_HISTORY_INTERVAL_S;
+    m_sample_due = true;
+    temperature_sample_request();
+}
+
+
+void temp_history_init(void)
+{
+    uint32_t                err_code;
+    pstorage_module_param_t param;
+    history_cursor_t        cursor;
+    const history_block_t * p_block;
+    bool                    found = false;
+
+    param.block_size  = HISTORY_BLOCK_SIZE;
+    param.block_count = HISTORY_BLOCK_COUNT;
+    param.cb          = history_storage_cb;
+
+    err_code = pstorage_register(&param, &m_storage);
+    APP_ERROR_CHECK(err_code);
+
+    // The block with the highest first sequence number is the one being written.
+    for (uint8_t i = 0; i < HISTORY_BLOCK_COUNT; i++)
+    {
+        p_block = block_get(i);
+        if ((p_block->header.first_seq != HISTORY_ERASED_SEQ) &&
+            (!found || (p_block->header.first_seq > block_get(m_write_block)->header.first_seq)))
+        {
+            m_write_block = i;
+            found         = true;
+        }
+    }
+
+    if (found)
+    {
+        memset(&cursor, 0, sizeof(cursor));
+        p_block = block_get(m_write_block);
+        while (block_record_next(p_block, &cursor, &m_write_last))
+        {
+        }
+
+        m_write_block_open = true;
+        m_write_offset     = WORD_ALIGN(cursor.chunk_end);
+        m_next_seq         = m_write_last.seq + 1;
+    }
+
+    SEGGER_RTT_printf(0, "history next seq %d\r\n", m_next_seq);
+
+    err_code = app_timer_create(&m_history_timer_id, APP_TIMER_MODE_REPEATED,
+                                history_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_start(m_history_timer_id, HISTORY_TICK, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+void temp_history_temperature_update(int16_t temperature)
+{
+    if (m_sample_due)
+    {
+        m_sample_due = false;
+        temp_history_add(m_uptime_s, temperature);
+    }
+}
+
+
+void temp_history_add(uint32_t timestamp, int16_t temperature)
+{
+    temp_history_record_t * p_record;
+
+    if (m_ram_count == HISTORY_RAM_RECORDS)
+    {
+        // Flash has been busy for a long time, drop the sample without using its sequence number.
+        m_dropped_count++;
+        SEGGER_RTT_printf(0, "history full, %d samples dropped\r\n", m_dropped_count);
+        return;
+    }
+
+    p_record = &m_ram[(m_ram_first + m_ram_count) % HISTORY_RAM_RECORDS];
+    p_record->seq         = m_next_seq++;
+    p_record->timestamp   = timestamp;
+    p_record->temperature = temperature;
+    m_ram_count++;
+
+    if (m_ram_count >= HISTORY_FLUSH_RECORDS)
+    {
+        history_flush();
+    }
+}
+
+
+void temp_history_racp_write(uint8_t * p_data, uint8_t len)
+{
+    ble_racp_value_t racp;
+    uint8_t          response;
+    uint32_t         min_seq;
+
+    ble_racp_decode(len, p_data, &racp);
+
+    if (m_report.active && (racp.opcode != RACP_OPCODE_ABORT_OPERATION))
+    {
+        racp_response_send(racp.opcode, RACP_RESPONSE_PROCEDURE_NOT_DONE);
+        return;
+    }
+
+    switch (racp.opcode)
+    {
+        case RACP_OPCODE_REPORT_RECS:
+        case RACP_OPCODE_REPORT_NUM_RECS:
+            response = racp_min_seq_get(&racp, &min_seq);
+            if (response != RACP_RESPONSE_SUCCESS)
+            {
+                racp_response_send(racp.opcode, response);
+                break;
+            }
+
+            memset(&m_report, 0, sizeof(m_report));
+            m_report.active  = true;
+            m_report.opcode  = racp.opcode;
+            m_report.min_seq = min_seq;
+            report_continue();
+            break;
+        case RACP_OPCODE_DELETE_RECS:
+            if (racp.operator != RACP_OPERATOR_ALL)
+            {
+                racp_response_send(racp.opcode, RACP_RESPONSE_OPERATOR_UNSUPPORTED);
+                break;
+            }
+
+            history_delete();
+            racp_response_send(racp.opcode, RACP_RESPONSE_SUCCESS);
+            break;
+        case RACP_OPCODE_ABORT_OPERATION:
+            temp_history_report_abort();
+            racp_response_send(racp.opcode, RACP_RESPONSE_SUCCESS);
+            break;
+        default:
+            racp_response_send(racp.opcode, RACP_RESPONSE_OPCODE_UNSUPPORTED);
+            break;
+    }
+}
+
+
+void temp_history_on_tx_complete(void)
+{
+    report_continue();
+}
+
+
+void temp_history_report_abort(void)
+{
+    if (m_report.active)
+    {
+        report_end();
+    }
+}
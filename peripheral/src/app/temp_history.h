@@ -0,0 +1,58 @@
+#ifndef TEMP_HISTORY_H_
+#define TEMP_HISTORY_H_
+
+#include <stdint.h>
+
+#define TEMP_HISTORY_INTERVAL_S         60      /**< Seconds between two logged samples. */
+
+#define TEMP_HISTORY_FILTER_SEQUENCE    0x01    /**< RACP filter type, a uint32 sequence number follows. */
+
+/**@brief One logged sample. On the air a record is sent as these 10 bytes, little endian,
+ *        two records per history notification.
+ */
+typedef struct temp_history_record_s
+{
+    uint32_t seq;               /**< Sequence number, consecutive over the whole log. */
+    uint32_t timestamp;         /**< Seconds since the device started. */
+    int16_t  temperature;       /**< 1/16 degrees. */
+} temp_history_record_t;
+
+/**@brief Register the flash region, find where the log ends and start the uptime tick. Call
+ *        after pstorage_init() and timers_init().
+ */
+void temp_history_init(void);
+
+/**@brief Log a reading if a sample is due.
+ *
+ * @details The log keeps its own uptime tick and asks for a reading every
+ *          TEMP_HISTORY_INTERVAL_S. Call with every good reading, the first one after the tick
+ *          is logged.
+ *
+ * @param[in]   temperature     Temperature in 1/16 degrees.
+ */
+void temp_history_temperature_update(int16_t temperature);
+
+/**@brief Append a sample. Samples wait in RAM and are flushed to flash in blocks.
+ *
+ * @param[in]   timestamp       Seconds since the device started.
+ * @param[in]   temperature     Temperature in 1/16 degrees.
+ */
+void temp_history_add(uint32_t timestamp, int16_t temperature);
+
+/**@brief Handle a write to the record access control point.
+ *
+ * @details Report stored records (all, or greater or equal a sequence number), report the
+ *          number of stored records, delete all records and abort are supported. The answer
+ *          is indicated on the record access control point once the operation is done.
+ */
+void temp_history_racp_write(uint8_t * p_data, uint8_t len);
+
+/**@brief Continue a report once the SoftDevice has freed notification buffers.
+ */
+void temp_history_on_tx_complete(void);
+
+/**@brief Stop a report in progress without answering, e.g. on disconnection.
+ */
+void temp_history_report_abort(void);
+
+#endif // TEMP_HISTORY_H_
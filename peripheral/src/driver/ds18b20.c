@@ -1,183 +1,429 @@
 #include <stdbool.h>
-
-#include "nrf51.h"
-#include "nrf51_bitfields.h"
+#include <string.h>
 
 #include "app_error.h"
+#include "app_timer.h"
 #include "nrf_delay.h"
-#include "nrf_gpio.h"
 
-#include "pin_config.h"
+#include "one_wire.h"
 #include "system_error.h"
 #include "SEGGER_RTT.h"
 
 #include "ds18b20.h"
 
-/*!< Pulls SDA line high */
-#define DS18B20_SDA_HIGH()   do { \
-        NRF_GPIO->OUTSET = (1UL << DS18B20_SDA_PIN_NUMBER);  \
-    } while (0)
-
-/*!< Pulls SDA line low  */
-#define DS18B20_SDA_LOW()    do { \
-        NRF_GPIO->OUTCLR = (1UL << DS18B20_SDA_PIN_NUMBER);  \
-    } while (0)
-
-/*!< Configures SDA pin as input  */
-#define DS18B20_SDA_INPUT()  do { \
-            NRF_GPIO->PIN_CNF[DS18B20_SDA_PIN_NUMBER] = (GPIO_PIN_CNF_SENSE_Disabled << GPIO_PIN_CNF_SENSE_Pos)\
-                                        | (GPIO_PIN_CNF_DRIVE_S0S1 << GPIO_PIN_CNF_DRIVE_Pos)\
-                                        | (GPIO_PIN_CNF_PULL_Disabled << GPIO_PIN_CNF_PULL_Pos)\
-                                        | (GPIO_PIN_CNF_INPUT_Connect << GPIO_PIN_CNF_INPUT_Pos)\
-                                        | (GPIO_PIN_CNF_DIR_Input << GPIO_PIN_CNF_DIR_Pos);\
-    } while (0)
-
-/*!< Configures SDA pin as output */
-#define DS18B20_SDA_OUTPUT() do { \
-        NRF_GPIO->DIRSET = (1UL << DS18B20_SDA_PIN_NUMBER);  \
-    } while (0)
-
-/*!< Reads current state of SDA */
-#define DS18B20_SDA_READ() ((NRF_GPIO->IN >> DS18B20_SDA_PIN_NUMBER) & 0x1UL)
-
-static uint8_t read_one_byte(void)
-{
-    uint8_t i = 0;
-    uint8_t data = 0;
-
-    for (i = 8; i > 0; i--)
-    {
-        DS18B20_SDA_OUTPUT();
-        DS18B20_SDA_HIGH();
-        nrf_delay_us(4);
-        DS18B20_SDA_LOW();
-        nrf_delay_us(4);
-        data >>= 1;
-        DS18B20_SDA_INPUT();
-        nrf_delay_us(1);
-        if (1 == DS18B20_SDA_READ())
-        {
-            data |= 0x80;
-        }
-        else
-        {
-            // No implementation needed here.
-        }
-        nrf_delay_us(60);
+#define DS18B20_CONVERSION_TICKS    APP_TIMER_TICKS(750, APP_TIMER_PRESCALER)   /**< 12 bit conversion time. */
+
+#define DS18B20_FAMILY_CODE         0x28
+#define DS18B20_CMD_CONVERT_T       0x44
+#define DS18B20_CMD_READ_SCRATCHPAD 0xBE
+
+#define DS18B20_SCRATCHPAD_LEN      9       /**< 8 data bytes followed by their CRC8. */
+#define DS18B20_SCRATCHPAD_CONFIG   4       /**< Configuration register, bits 0 to 4 always read 1. */
+#define DS18B20_CONFIG_FIXED_MASK   0x1F
+
+#define DS18B20_ROM_BITS            (ONE_WIRE_ROM_LEN * 8)
+
+/**@brief Steps of one temperature reading. Each step ends with a 1-Wire transfer completing or,
+ *        for the conversion, the driver timer expiring.
+ */
+typedef enum ds18b20_state_e
+{
+    DS18B20_STATE_IDLE = 0,
+    DS18B20_STATE_SEARCH_RESET,         /**< Reset before SEARCH ROM. */
+    DS18B20_STATE_SEARCH_CMD,           /**< Sending SEARCH ROM. */
+    DS18B20_STATE_SEARCH_TRIPLET,       /**< Walking the 64 ROM bits. */
+    DS18B20_STATE_CONVERT_RESET,        /**< Reset before the broadcast CONVERT T. */
+    DS18B20_STATE_CONVERT_CMD,          /**< Sending SKIP ROM, CONVERT T. */
+    DS18B20_STATE_CONVERTING,           /**< Waiting for every sensor to complete its conversion. */
+    DS18B20_STATE_READ_RESET,           /**< Reset before reading one sensor. */
+    DS18B20_STATE_READ_CMD,             /**< Sending MATCH ROM, ROM, READ SCRATCHPAD. */
+    DS18B20_STATE_READ_SCRATCHPAD,      /**< Reading the scratchpad of one sensor. */
+} ds18b20_state_t;
+
+/**@brief One sensor of the device table. */
+typedef struct ds18b20_device_s
+{
+    uint8_t rom[ONE_WIRE_ROM_LEN];
+    int16_t temperature;                /**< Last reading in 1/16 degrees. */
+    bool    valid;                      /**< Last reading succeeded. */
+} ds18b20_device_t;
+
+static const uint8_t            m_search_cmd[]  = {ONE_WIRE_CMD_SEARCH_ROM};
+static const uint8_t            m_convert_cmd[] = {ONE_WIRE_CMD_SKIP_ROM, DS18B20_CMD_CONVERT_T};
+static uint8_t                  m_read_cmd[1 + ONE_WIRE_ROM_LEN + 1];   /**< MATCH ROM, ROM, READ SCRATCHPAD. */
+
+static app_timer_id_t           m_ds18b20_timer_id;
+static ds18b20_state_t          m_state = DS18B20_STATE_IDLE;
+static ds18b20_read_handler_t   m_read_handler = NULL;
+static uint8_t                  m_scratchpad[DS18B20_SCRATCHPAD_LEN];
+static uint32_t                 m_crc_error_count = 0;
+
+static ds18b20_device_t         m_devices[DS18B20_MAX_DEVICES];
+static uint8_t                  m_device_count = 0;
+static uint8_t                  m_read_index;           /**< Device being read. */
+static uint32_t                 m_read_err_code;        /**< Last error of this reading. */
+
+// ROM search state, see Maxim application note 187.
+static uint8_t                  m_search_rom[ONE_WIRE_ROM_LEN];
+static uint8_t                  m_search_bit;           /**< ROM bit being searched, 0 to 63. */
+static uint8_t                  m_last_discrepancy;     /**< 1-based bit of the last 0 taken on a discrepancy, 0 if none. */
+static uint8_t                  m_last_zero;
+static uint8_t                  m_triplet;
+
+
+static void ds18b20_bus_handler(uint32_t bus_err_code);
+
+
+/**@brief Check the scratchpad CRC and the fixed configuration bits, a bus stuck low reads
+ *        all zero which passes the CRC.
+ */
+static bool scratchpad_is_valid(void)
+{
+    if (one_wire_crc8(m_scratchpad, DS18B20_SCRATCHPAD_LEN) != 0)
+    {
+        return false;
     }
 
-    return data;
+    return ((m_scratchpad[DS18B20_SCRATCHPAD_CONFIG] & DS18B20_CONFIG_FIXED_MASK)
+            == DS18B20_CONFIG_FIXED_MASK);
 }
 
 
-static void write_byte(uint8_t data)
+/**@brief Finish the reading and hand the result to the application.
+ */
+static void read_complete(uint32_t err_code)
 {
-    uint8_t i = 0;
+    ds18b20_read_handler_t handler = m_read_handler;
 
-    DS18B20_SDA_OUTPUT();
-    for (i = 8; i > 0; i--)
+    m_state        = DS18B20_STATE_IDLE;
+    m_read_handler = NULL;
+
+    if (handler != NULL)
     {
-        DS18B20_SDA_HIGH();
-        nrf_delay_us(4);
-        DS18B20_SDA_LOW();
-        nrf_delay_us(4);
-        if (data & 0x01)
-        {
-            DS18B20_SDA_HIGH();
-        }
-        else
-        {
-            DS18B20_SDA_LOW();
-        }
-        nrf_delay_us(60);
-        data >>= 1;
+        handler(err_code);
     }
-    DS18B20_SDA_INPUT();
 }
 
 
-bool ds18b20_init(void)
+static uint32_t search_pass_start(void)
+{
+    m_state = DS18B20_STATE_SEARCH_RESET;
+    return one_wire_reset(ds18b20_bus_handler);
+}
+
+
+/**@brief Search the next ROM bit. Below the last discrepancy the previous ROM is followed, at
+ *        the last discrepancy the 1 branch is taken, past it the 0 branch.
+ */
+static uint32_t search_triplet_start(void)
 {
-    bool result = true;
+    uint8_t bit_number = m_search_bit + 1;
+    uint8_t direction;
 
-    DS18B20_SDA_OUTPUT();
-    DS18B20_SDA_HIGH();
-    nrf_delay_us(2);
-    DS18B20_SDA_LOW();
-    nrf_delay_us(500);
-    DS18B20_SDA_INPUT();
-    nrf_delay_us(60);
-    if (0 == DS18B20_SDA_READ())
+    if (bit_number < m_last_discrepancy)
     {
-        result = true;
+        direction = (m_search_rom[m_search_bit / 8] >> (m_search_bit % 8)) & 0x01;
     }
     else
     {
-        result = false;
+        direction = (bit_number == m_last_discrepancy);
     }
 
-    nrf_delay_us(420);
-    DS18B20_SDA_INPUT();
-    if(result == true)
+    m_state = DS18B20_STATE_SEARCH_TRIPLET;
+    return one_wire_search_triplet(direction, &m_triplet, ds18b20_bus_handler);
+}
+
+
+static uint32_t convert_start(void)
+{
+    m_state = DS18B20_STATE_CONVERT_RESET;
+    return one_wire_reset(ds18b20_bus_handler);
+}
+
+
+/**@brief Handle the end of a search pass, the ROM found is added to the device table.
+ *
+ * @return true if another pass is needed to find the remaining devices.
+ */
+static bool search_pass_end(void)
+{
+    if ((one_wire_crc8(m_search_rom, ONE_WIRE_ROM_LEN) != 0)
+            || (m_search_rom[0] != DS18B20_FAMILY_CODE))
     {
-        if (0 == DS18B20_SDA_READ())
-        {
-            result = false;
-        }
+        SEGGER_RTT_printf(0, "DS18B20 search found invalid rom\r\n");
+        return false;
     }
 
-    return result;
+    memset(&m_devices[m_device_count], 0, sizeof(ds18b20_device_t));
+    memcpy(m_devices[m_device_count].rom, m_search_rom, ONE_WIRE_ROM_LEN);
+    m_device_count++;
+
+    m_last_discrepancy = m_last_zero;
+
+    return ((m_last_discrepancy != 0) && (m_device_count < DS18B20_MAX_DEVICES));
 }
 
 
-uint16_t ds18b20_read_temperature(void)
+/**@brief Read the next device of the table, or finish the reading after the last one.
+ */
+static uint32_t device_read_next(void)
 {
-    uint16_t temperature = 0xFFFF;
-    uint8_t temperature_data_low = 0;
-    uint8_t temperature_data_high = 0;
+    bool any_valid = false;
 
-    SEGGER_RTT_printf(0, "Start to read temperature!\r\n");
-    if (true == ds18b20_init())
+    if (m_read_index < m_device_count)
+    {
+        m_state = DS18B20_STATE_READ_RESET;
+        return one_wire_reset(ds18b20_bus_handler);
+    }
+
+    for (uint8_t i = 0; i < m_device_count; i++)
+    {
+        any_valid |= m_devices[i].valid;
+    }
+
+    if (!any_valid)
+    {
+        // Search again next time, the sensors may have been replaced.
+        m_device_count = 0;
+    }
+
+    read_complete(any_valid ? NRF_SUCCESS : m_read_err_code);
+    return NRF_SUCCESS;
+}
+
+
+static uint32_t device_read_done(uint32_t err_code)
+{
+    ds18b20_device_t * p_device = &m_devices[m_read_index];
+
+    p_device->valid = (err_code == NRF_SUCCESS);
+    if (err_code != NRF_SUCCESS)
+    {
+        m_read_err_code = err_code;
+    }
+
+    m_read_index++;
+    return device_read_next();
+}
+
+
+/**@brief 1-Wire transfer completion handler, advances the reading by one step.
+ */
+static void ds18b20_bus_handler(uint32_t bus_err_code)
+{
+    uint32_t err_code = NRF_SUCCESS;
+    ds18b20_device_t * p_device;
+
+    switch (m_state)
     {
-        write_byte(0xCC);
-        write_byte(0x44);
-        nrf_delay_ms(800);
-        if (true == ds18b20_init())
+        case DS18B20_STATE_SEARCH_RESET:
+            if (bus_err_code != NRF_SUCCESS)
+            {
+                read_complete(APP_ERROR_DS18B20_INIT);
+                return;
+            }
+            m_state  = DS18B20_STATE_SEARCH_CMD;
+            err_code = one_wire_write(m_search_cmd, sizeof(m_search_cmd), ds18b20_bus_handler);
+            break;
+
+        case DS18B20_STATE_SEARCH_CMD:
+            m_search_bit = 0;
+            m_last_zero  = 0;
+            err_code     = search_triplet_start();
+            break;
+
+        case DS18B20_STATE_SEARCH_TRIPLET:
         {
-            write_byte(0xCC);
-            write_byte(0xBE);
-            temperature_data_low = read_one_byte();
-            temperature_data_high = read_one_byte();
+            bool more = false;
+
+            if (bus_err_code == NRF_SUCCESS)
+            {
+                if (!(m_triplet & (ONE_WIRE_TRIPLET_ID_BIT | ONE_WIRE_TRIPLET_CMP_ID_BIT))
+                        && !(m_triplet & ONE_WIRE_TRIPLET_DIRECTION))
+                {
+                    m_last_zero = m_search_bit + 1;
+                }
+
+                m_search_rom[m_search_bit / 8] &= ~(1 << (m_search_bit % 8));
+                if (m_triplet & ONE_WIRE_TRIPLET_DIRECTION)
+                {
+                    m_search_rom[m_search_bit / 8] |= (1 << (m_search_bit % 8));
+                }
 
-            //SEGGER_RTT_printf(0, "data_low = %d, data_high = %d\r\n", temperature_data_low, temperature_data_high);
+                if (++m_search_bit < DS18B20_ROM_BITS)
+                {
+                    err_code = search_triplet_start();
+                    break;
+                }
 
-            temperature = (temperature_data_high << 8) | temperature_data_low;
+                more = search_pass_end();
+            }
 
-            if (temperature < 0xFFF)
+            if (more)
+            {
+                err_code = search_pass_start();
+            }
+            else if (m_device_count == 0)
             {
-                temperature = temperature * 0.0625 + 0.5;
+                read_complete(APP_ERROR_DS18B20_INIT);
+                return;
             }
             else
             {
-                temperature = ~temperature + 1;
-                //temperature = temperature * 0.0625 * 10 + 0.5;
-                temperature = temperature * 0.0625 + 0.5;
-                temperature = temperature | 0x8000;
+                SEGGER_RTT_printf(0, "DS18B20 found %d sensors\r\n", m_device_count);
+                err_code = convert_start();
             }
-
-            //temperature = temperature * 625 / 10000;
-            SEGGER_RTT_printf(0, "temperature = %p\r\n", temperature);
-            SEGGER_RTT_printf(0, "DS18B20 init %s\r\n", "Success");
-        }
-        else
-        {
-            APP_ERROR_CHECK(APP_ERROR_DS18B20_INIT);
+            break;
         }
+
+        case DS18B20_STATE_CONVERT_RESET:
+            if (bus_err_code != NRF_SUCCESS)
+            {
+                read_complete(APP_ERROR_DS18B20_INIT);
+                return;
+            }
+            m_state  = DS18B20_STATE_CONVERT_CMD;
+            err_code = one_wire_write(m_convert_cmd, sizeof(m_convert_cmd), ds18b20_bus_handler);
+            break;
+
+        case DS18B20_STATE_CONVERT_CMD:
+            m_state  = DS18B20_STATE_CONVERTING;
+            err_code = app_timer_start(m_ds18b20_timer_id, DS18B20_CONVERSION_TICKS, NULL);
+            break;
+
+        case DS18B20_STATE_READ_RESET:
+            if (bus_err_code != NRF_SUCCESS)
+            {
+                err_code = device_read_done(APP_ERROR_DS18B20_INIT);
+                break;
+            }
+            m_read_cmd[0] = ONE_WIRE_CMD_MATCH_ROM;
+            memcpy(&m_read_cmd[1], m_devices[m_read_index].rom, ONE_WIRE_ROM_LEN);
+            m_read_cmd[1 + ONE_WIRE_ROM_LEN] = DS18B20_CMD_READ_SCRATCHPAD;
+
+            m_state  = DS18B20_STATE_READ_CMD;
+            err_code = one_wire_write(m_read_cmd, sizeof(m_read_cmd), ds18b20_bus_handler);
+            break;
+
+        case DS18B20_STATE_READ_CMD:
+            m_state  = DS18B20_STATE_READ_SCRATCHPAD;
+            err_code = one_wire_read(m_scratchpad, DS18B20_SCRATCHPAD_LEN, ds18b20_bus_handler);
+            break;
+
+        case DS18B20_STATE_READ_SCRATCHPAD:
+            if (false == scratchpad_is_valid())
+            {
+                m_crc_error_count++;
+                SEGGER_RTT_printf(0, "DS18B20 %d crc error %d\r\n", m_read_index, m_crc_error_count);
+                err_code = device_read_done(APP_ERROR_DS18B20_CRC);
+                break;
+            }
+
+            // The sensor already reports a signed 1/16 degree value.
+            p_device = &m_devices[m_read_index];
+            p_device->temperature = (int16_t)((m_scratchpad[1] << 8) | m_scratchpad[0]);
+
+            err_code = device_read_done(NRF_SUCCESS);
+            break;
+
+        default:
+            return;
+    }
+
+    APP_ERROR_CHECK(err_code);
+}
+
+
+static void ds18b20_timeout_handler(void * p_context)
+{
+    uint32_t err_code;
+
+    if (m_state == DS18B20_STATE_CONVERTING)
+    {
+        m_read_index    = 0;
+        m_read_err_code = NRF_SUCCESS;
+        err_code        = device_read_next();
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+
+void ds18b20_init(void)
+{
+    uint32_t err_code;
+
+    one_wire_init();
+
+    err_code = app_timer_create(&m_ds18b20_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                ds18b20_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+uint32_t ds18b20_read_temperature_start(ds18b20_read_handler_t handler)
+{
+    uint32_t err_code;
+
+    if (m_state != DS18B20_STATE_IDLE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    SEGGER_RTT_printf(0, "Start to read temperature!\r\n");
+
+    m_read_handler = handler;
+
+    if (m_device_count == 0)
+    {
+        m_last_discrepancy = 0;
+        err_code = search_pass_start();
     }
     else
     {
-        APP_ERROR_CHECK(APP_ERROR_DS18B20_INIT);
+        err_code = convert_start();
+    }
+
+    if (err_code != NRF_SUCCESS)
+    {
+        m_state        = DS18B20_STATE_IDLE;
+        m_read_handler = NULL;
+    }
+
+    return err_code;
+}
+
+
+uint8_t ds18b20_device_count(void)
+{
+    return m_device_count;
+}
+
+
+uint32_t ds18b20_temperature_get(uint8_t index, int16_t * p_temperature)
+{
+    if (p_temperature == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (index >= m_device_count)
+    {
+        return NRF_ERROR_INVALID_PARAM;
     }
 
-    return temperature;
+    if (!m_devices[index].valid)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    *p_temperature = m_devices[index].temperature;
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t ds18b20_crc_error_count(void)
+{
+    return m_crc_error_count;
 }
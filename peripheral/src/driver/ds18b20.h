@@ -1,9 +1,57 @@
 #ifndef DS18B2_H_
 #define DS18B2_H_
 
-bool ds18b20_init(void);
+#include <stdint.h>
 
-uint16_t ds18b20_read_temperature(void);
+/**@brief Convert whole degrees to the signed 1/16 degree (Q4) format used for temperatures. */
+#define DS18B20_DEGREES_TO_Q4(deg)  ((int16_t)((deg) * 16))
+
+/**@brief Convert a Q4 temperature to whole degrees, rounded to nearest. */
+#define DS18B20_Q4_TO_DEGREES(q4)   ((int16_t)(((q4) + 8) >> 4))
+
+#define DS18B20_MAX_DEVICES         4       /**< Size of the device table. */
+
+/**@brief Temperature reading completion handler.
+ *
+ * @param[in]   err_code      NRF_SUCCESS if at least one sensor was read, otherwise the last
+ *                            error: APP_ERROR_DS18B20_INIT if no device answered or
+ *                            APP_ERROR_DS18B20_CRC if a scratchpad failed its CRC check.
+ */
+typedef void (*ds18b20_read_handler_t)(uint32_t err_code);
+
+/**@brief Set up the 1-Wire bus and create the driver timer.
+ */
+void ds18b20_init(void);
+
+/**@brief Start a temperature reading of every sensor on the bus.
+ *
+ * @details The bus is searched for sensors when the device table is empty. One broadcast
+ *          CONVERT T starts every sensor, then each one is read with MATCH ROM, so any number of
+ *          sensors share a single 750 ms conversion time.
+ *
+ *          The 1-Wire slots are timed by hardware and the conversion wait runs on an app_timer.
+ *          The handler is called from the main loop through the scheduler.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_BUSY if a reading is already in progress.
+ */
+uint32_t ds18b20_read_temperature_start(ds18b20_read_handler_t handler);
+
+/**@brief Number of sensors found by the last ROM search.
+ */
+uint8_t ds18b20_device_count(void);
+
+/**@brief Get the last reading of a sensor.
+ *
+ * @param[in]   index           Sensor index, below ds18b20_device_count().
+ * @param[out]  p_temperature   Temperature in 1/16 degrees, two's complement.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_INVALID_STATE if the last reading of this sensor failed.
+ */
+uint32_t ds18b20_temperature_get(uint8_t index, int16_t * p_temperature);
+
+/**@brief Number of scratchpad reads rejected by the CRC check since reset.
+ */
+uint32_t ds18b20_crc_error_count(void);
 
 
 #endif // DS18B2_H_
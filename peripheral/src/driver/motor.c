@@ -1,20 +1,63 @@
 #include <string.h>
 
-#include "app_timer.h"
+#include "app_error.h"
+#include "app_util_platform.h"
 #include "ble_mhs.h"
-#include "nrf_delay.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
 #include "nrf_gpio.h"
+#include "nrf_gpiote.h"
 
 #include "pin_config.h"
 
 #include "motor.h"
 
-#define MOTOR_CONTROLTIMER_INTERVAL APP_TIMER_TICKS(1, APP_TIMER_PRESCALER)
-
 #define MOTOR_NUMBER            8
 
+#define MOTOR_PWM_PERIOD_US     1000    /**< PWM period, TIMER1 runs at 1 MHz so one tick is 1 us. */
+#define MOTOR_PWM_GPIOTE_CH     0       /**< GPIOTE channel toggling the enable pin in single channel mode. */
+#define MOTOR_PWM_EDGE_MARGIN_US 4      /**< Edges closer than this to the current time are applied at once. */
+#define MOTOR_PWM_CC_DISABLED   0xFFFF  /**< Compare value never reached, the timer is cleared at the period. */
+
+/**@brief PWM generation mode. */
+typedef enum motor_pwm_mode_e
+{
+    MOTOR_PWM_MODE_IDLE = 0,    /**< Timer stopped, every pin at a static level. */
+    MOTOR_PWM_MODE_SINGLE,      /**< One fractional channel, edges through PPI and GPIOTE, no interrupts. */
+    MOTOR_PWM_MODE_EDGE_LIST,   /**< Several fractional channels, edges from the timer interrupt. */
+} motor_pwm_mode_t;
+
+/**@brief One falling edge of the edge list. */
+typedef struct motor_pwm_edge_s
+{
+    uint16_t time;              /**< Time from the start of the period in us. */
+    uint32_t clr_mask;          /**< Enable pins cleared at this time. */
+} motor_pwm_edge_t;
+
+/**@brief Sorted edge list describing one PWM period. */
+typedef struct motor_pwm_edge_list_s
+{
+    uint32_t         set_mask;              /**< Enable pins set at the start of the period. */
+    uint8_t          count;                 /**< Number of valid entries in edge. */
+    motor_pwm_edge_t edge[MOTOR_NUMBER];
+} motor_pwm_edge_list_t;
+
 static motor_index_t        m_motor_control_index = MOTOR_INDEX_1;
-static app_timer_id_t       m_motor_control_timer_id;
+
+static uint8_t              m_channel_duty[MOTOR_NUMBER];   /**< Duty cycle of each channel in percent. */
+static uint8_t              m_channel_on_mask = 0;          /**< Bit n set when channel n is switched on. */
+
+static const nrf_drv_timer_t m_pwm_timer = NRF_DRV_TIMER_INSTANCE(1);
+static nrf_ppi_channel_t    m_ppi_period_channel;   /**< COMPARE0 (period) -> pin high. */
+static nrf_ppi_channel_t    m_ppi_duty_channel;     /**< COMPARE1 (duty) -> pin low. */
+static motor_pwm_mode_t     m_pwm_mode = MOTOR_PWM_MODE_IDLE;
+
+static motor_pwm_edge_list_t            m_edge_lists[2];            /**< Active list and the one being prepared. */
+static motor_pwm_edge_list_t * volatile mp_active_edges   = &m_edge_lists[0];
+static motor_pwm_edge_list_t * volatile mp_pending_edges  = NULL;  /**< Taken over by the ISR at the next period start. */
+static uint8_t                          m_edge_index      = 0;     /**< Next edge of the active list. */
+
+static volatile uint16_t    m_isr_max_us = 0;       /**< Longest PWM interrupt seen, in us. */
 
 uint8_t                     m_duty_cycle = 0;
 
@@ -30,51 +73,307 @@ uint8_t motor_enable_pin[MOTOR_NUMBER] =
     MOTOR_8_ENABLE_PIN_NUMBER,
 };
 
-static void motor_control_timeout_handler(void * p_context)
+/**@brief Get the port mask of the enable pins of the given channels.
+ */
+static uint32_t channel_mask_to_pin_mask(uint8_t channel_mask)
 {
-    if (m_duty_cycle == 0)
+    uint32_t pin_mask = 0;
+
+    for (uint8_t i = 0; i < MOTOR_NUMBER; i++)
     {
-        nrf_gpio_pin_clear(motor_enable_pin[m_motor_control_index - MOTOR_INDEX_1]);
+        if (channel_mask & (1 << i))
+        {
+            pin_mask |= (1UL << motor_enable_pin[i]);
+        }
     }
-    else if (m_duty_cycle < 100)
+
+    return pin_mask;
+}
+
+
+/**@brief Apply every edge of the active list which is due.
+ *
+ * @details Edges are sorted by time, so they are applied in order until one lies far enough in
+ *          the future to be left to COMPARE1.
+ */
+static void motor_pwm_edges_apply(void)
+{
+    uint32_t now = nrf_drv_timer_capture(&m_pwm_timer, NRF_TIMER_CC_CHANNEL2);
+    motor_pwm_edge_list_t * p_edges = mp_active_edges;
+
+    while (m_edge_index < p_edges->count)
     {
-        nrf_gpio_pin_set(motor_enable_pin[m_motor_control_index - MOTOR_INDEX_1]);
-        nrf_delay_us(10 * m_duty_cycle);
-        nrf_gpio_pin_clear(motor_enable_pin[m_motor_control_index - MOTOR_INDEX_1]);
+        motor_pwm_edge_t * p_edge = &p_edges->edge[m_edge_index];
+
+        if (p_edge->time > now + MOTOR_PWM_EDGE_MARGIN_US)
+        {
+            nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL1, p_edge->time, true);
+            return;
+        }
+
+        NRF_GPIO->OUTCLR = p_edge->clr_mask;
+        m_edge_index++;
     }
-    else
+
+    nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL1, MOTOR_PWM_CC_DISABLED, true);
+}
+
+
+/**@brief PWM timer event handler.
+ *
+ * @details Only called in edge list mode. COMPARE0 starts a new period and sets every running
+ *          pin with a single OUTSET write, COMPARE1 clears the pins of the next edge with a single
+ *          OUTCLR write.
+ */
+static void motor_pwm_timer_event_handler(nrf_timer_events_t event_type)
+{
+    uint32_t start = nrf_drv_timer_capture(&m_pwm_timer, NRF_TIMER_CC_CHANNEL3);
+    uint32_t duration;
+
+    if (event_type == NRF_TIMER_EVENTS_COMPARE0)
     {
-        nrf_gpio_pin_set(motor_enable_pin[m_motor_control_index - MOTOR_INDEX_1]);
+        if (mp_pending_edges != NULL)
+        {
+            mp_active_edges  = mp_pending_edges;
+            mp_pending_edges = NULL;
+        }
+        NRF_GPIO->OUTSET = mp_active_edges->set_mask;
+        m_edge_index     = 0;
+    }
+
+    motor_pwm_edges_apply();
+
+    duration = nrf_drv_timer_capture(&m_pwm_timer, NRF_TIMER_CC_CHANNEL3);
+    duration = (duration >= start) ? (duration - start) : (duration + MOTOR_PWM_PERIOD_US - start);
+    if (duration > m_isr_max_us)
+    {
+        m_isr_max_us = duration;
+    }
+}
+
+
+/**@brief Build the sorted edge list for the given fractional channels.
+ */
+static void motor_pwm_edge_list_build(motor_pwm_edge_list_t * p_edges, uint8_t frac_mask,
+                                      uint8_t high_mask)
+{
+    p_edges->set_mask = channel_mask_to_pin_mask(frac_mask | high_mask);
+    p_edges->count    = 0;
+
+    for (uint8_t i = 0; i < MOTOR_NUMBER; i++)
+    {
+        uint16_t time;
+        uint8_t  j;
+
+        if ((frac_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+
+        time = (MOTOR_PWM_PERIOD_US * m_channel_duty[i]) / MOTOR_DUTY_CYCLE_MAX;
+
+        // Insertion sort, channels sharing a duty cycle share one edge.
+        for (j = 0; j < p_edges->count; j++)
+        {
+            if (p_edges->edge[j].time >= time)
+            {
+                break;
+            }
+        }
+
+        if ((j < p_edges->count) && (p_edges->edge[j].time == time))
+        {
+            p_edges->edge[j].clr_mask |= (1UL << motor_enable_pin[i]);
+        }
+        else
+        {
+            memmove(&p_edges->edge[j + 1], &p_edges->edge[j],
+                    (p_edges->count - j) * sizeof(motor_pwm_edge_t));
+            p_edges->edge[j].time     = time;
+            p_edges->edge[j].clr_mask = (1UL << motor_enable_pin[i]);
+            p_edges->count++;
+        }
     }
 }
 
 
-/**@brief Stop vibrator sequencer timer.
+/**@brief Stop the PWM engine and release the enable pin from GPIOTE.
  */
-static void stop_motor_control_timer(void)
+static void motor_pwm_stop(void)
 {
     uint32_t err_code;
-    err_code = app_timer_stop(m_motor_control_timer_id);
-    APP_ERROR_CHECK(err_code);
+
+    switch (m_pwm_mode)
+    {
+        case MOTOR_PWM_MODE_SINGLE:
+            err_code = nrf_drv_ppi_channel_disable(m_ppi_period_channel);
+            APP_ERROR_CHECK(err_code);
+            err_code = nrf_drv_ppi_channel_disable(m_ppi_duty_channel);
+            APP_ERROR_CHECK(err_code);
+            nrf_drv_timer_disable(&m_pwm_timer);
+            nrf_gpiote_unconfig(MOTOR_PWM_GPIOTE_CH);
+            break;
+
+        case MOTOR_PWM_MODE_EDGE_LIST:
+            nrf_drv_timer_disable(&m_pwm_timer);
+            nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL0, MOTOR_PWM_PERIOD_US, false);
+            nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL1, MOTOR_PWM_CC_DISABLED, false);
+            break;
+
+        default:
+            break;
+    }
+
+    m_pwm_mode = MOTOR_PWM_MODE_IDLE;
 }
 
 
-static void start_motor_control_timer(void)
+/**@brief Start single channel mode.
+ *
+ * @details The pin starts high, COMPARE1 toggles it low and COMPARE0 toggles it high again while
+ *          the shortcut clears the timer, so no CPU is involved once started.
+ */
+static void motor_pwm_single_start(uint8_t channel)
 {
     uint32_t err_code;
 
-    err_code = app_timer_start(m_motor_control_timer_id, MOTOR_CONTROLTIMER_INTERVAL, NULL);
+    nrf_drv_timer_compare(&m_pwm_timer,
+                          NRF_TIMER_CC_CHANNEL1,
+                          (MOTOR_PWM_PERIOD_US * m_channel_duty[channel]) / MOTOR_DUTY_CYCLE_MAX,
+                          false);
+
+    nrf_gpiote_task_config(MOTOR_PWM_GPIOTE_CH,
+                           motor_enable_pin[channel],
+                           NRF_GPIOTE_POLARITY_TOGGLE,
+                           NRF_GPIOTE_INITIAL_VALUE_HIGH);
+
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_period_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_duty_channel);
     APP_ERROR_CHECK(err_code);
+
+    nrf_drv_timer_enable(&m_pwm_timer);
+    nrf_drv_timer_clear(&m_pwm_timer);
+    m_pwm_mode = MOTOR_PWM_MODE_SINGLE;
+}
+
+
+/**@brief Start edge list mode with the list prepared in mp_active_edges.
+ */
+static void motor_pwm_edge_list_start(void)
+{
+    m_edge_index = 0;
+    NRF_GPIO->OUTSET = mp_active_edges->set_mask;
+
+    nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL1, mp_active_edges->edge[0].time, true);
+    nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL0, MOTOR_PWM_PERIOD_US, true);
+
+    nrf_drv_timer_enable(&m_pwm_timer);
+    nrf_drv_timer_clear(&m_pwm_timer);
+    m_pwm_mode = MOTOR_PWM_MODE_EDGE_LIST;
+}
+
+
+/**@brief Drive every enable pin according to m_channel_on_mask and m_channel_duty.
+ *
+ * @details Channels at 0 % or 100 % are static levels. A single fractional channel is generated
+ *          entirely in hardware. Two or more fractional channels share TIMER1 through a sorted
+ *          edge list; when that mode is already running the new list is handed over at the next
+ *          period start so no period is cut short.
+ */
+static void motor_pwm_update(void)
+{
+    uint8_t high_mask = 0;
+    uint8_t frac_mask = 0;
+    uint8_t frac_count = 0;
+    uint8_t frac_channel = 0;
+
+    for (uint8_t i = 0; i < MOTOR_NUMBER; i++)
+    {
+        if (((m_channel_on_mask & (1 << i)) == 0) || (m_channel_duty[i] == 0))
+        {
+            continue;
+        }
+
+        if (m_channel_duty[i] >= MOTOR_DUTY_CYCLE_MAX)
+        {
+            high_mask |= (1 << i);
+        }
+        else
+        {
+            frac_mask |= (1 << i);
+            frac_channel = i;
+            frac_count++;
+        }
+    }
+
+    if ((frac_count > 1) && (m_pwm_mode == MOTOR_PWM_MODE_EDGE_LIST))
+    {
+        motor_pwm_edge_list_t * p_edges;
+
+        // The ISR preempts this, withdraw a list not taken over yet before building over it.
+        mp_pending_edges = NULL;
+        p_edges = (mp_active_edges == &m_edge_lists[0]) ? &m_edge_lists[1] : &m_edge_lists[0];
+
+        motor_pwm_edge_list_build(p_edges, frac_mask, high_mask);
+
+        CRITICAL_REGION_ENTER();
+        mp_pending_edges = p_edges;
+        NRF_GPIO->OUTCLR = channel_mask_to_pin_mask(~(frac_mask | high_mask));
+        CRITICAL_REGION_EXIT();
+        return;
+    }
+
+    motor_pwm_stop();
+
+    NRF_GPIO->OUTCLR = channel_mask_to_pin_mask(~high_mask);
+    NRF_GPIO->OUTSET = channel_mask_to_pin_mask(high_mask);
+
+    if (frac_count == 1)
+    {
+        motor_pwm_single_start(frac_channel);
+    }
+    else if (frac_count > 1)
+    {
+        mp_pending_edges = NULL;
+        motor_pwm_edge_list_build((motor_pwm_edge_list_t *)mp_active_edges, frac_mask, high_mask);
+        motor_pwm_edge_list_start();
+    }
 }
 
 
-static void create_motor_control_timer(void)
+/**@brief Set up TIMER1 and the PPI channels used by the PWM engine.
+ */
+static void motor_pwm_init(void)
 {
     uint32_t err_code;
+    uint32_t gpiote_task_addr = (uint32_t)&NRF_GPIOTE->TASKS_OUT[MOTOR_PWM_GPIOTE_CH];
+
+    err_code = nrf_drv_ppi_init();
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_drv_timer_init(&m_pwm_timer, NULL, motor_pwm_timer_event_handler);
+    APP_ERROR_CHECK(err_code);
+
+    // Clear the timer at the end of each period. The short is set directly because
+    // nrf_drv_timer_extended_compare() only keeps it together with the interrupt.
+    nrf_drv_timer_compare(&m_pwm_timer, NRF_TIMER_CC_CHANNEL0, MOTOR_PWM_PERIOD_US, false);
+    nrf_timer_shorts_set(m_pwm_timer.p_reg, NRF_TIMER_SHORTS_COMPARE0_CLEAR_MASK);
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_period_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_period_channel,
+                                          nrf_drv_timer_event_address_get(&m_pwm_timer,
+                                                                          NRF_TIMER_EVENTS_COMPARE0),
+                                          gpiote_task_addr);
+    APP_ERROR_CHECK(err_code);
 
-    err_code = app_timer_create(&m_motor_control_timer_id,
-                                APP_TIMER_MODE_REPEATED,
-                                motor_control_timeout_handler);
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_duty_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_duty_channel,
+                                          nrf_drv_timer_event_address_get(&m_pwm_timer,
+                                                                          NRF_TIMER_EVENTS_COMPARE1),
+                                          gpiote_task_addr);
     APP_ERROR_CHECK(err_code);
 }
 
@@ -103,21 +402,17 @@ void motor_init(void)
     nrf_gpio_cfg_output(MOTOR_IN2_PIN_NUMBER);
     nrf_gpio_pin_clear(MOTOR_IN2_PIN_NUMBER);
 
-    create_motor_control_timer();
+    motor_pwm_init();
 }
 
-void motor_on(motor_control_t motor_control)
+uint32_t motor_on(motor_control_t motor_control)
 {
-    for (uint8_t i = 0; i < MOTOR_NUMBER; i++)
+    // The index comes from a peer, a bad one is refused before it selects the channel.
+    if (motor_control.motor_index > MOTOR_INDEX_8)
     {
-        nrf_gpio_pin_clear(motor_enable_pin[i]);
+        return NRF_ERROR_INVALID_PARAM;
     }
-
     m_motor_control_index = motor_control.motor_index;
-    if (m_motor_control_index > 7)
-    {
-        APP_ERROR_CHECK_BOOL(false);
-    }
 
     if (motor_control.motor_direction == MOTOR_DIRECTION_CLOCK)
     {
@@ -130,35 +425,74 @@ void motor_on(motor_control_t motor_control)
         nrf_gpio_pin_clear(MOTOR_IN1_PIN_NUMBER);
     }
 
-    start_motor_control_timer();
+    m_channel_duty[m_motor_control_index - MOTOR_INDEX_1] = m_duty_cycle;
+    m_channel_on_mask |= (1 << (m_motor_control_index - MOTOR_INDEX_1));
+    motor_pwm_update();
+
+    return NRF_SUCCESS;
 }
 
 void motor_off()
+{
+    m_channel_on_mask = 0;
+    motor_pwm_update();
+}
+
+void motor_set_duty_cylce(uint8_t duty_cycle)
+{
+    m_duty_cycle = duty_cycle;
+
+    m_channel_duty[m_motor_control_index - MOTOR_INDEX_1] = duty_cycle;
+    motor_pwm_update();
+}
+
+void motor_set_channel_duty(uint8_t channel_mask, uint8_t duty_cycle)
 {
     for (uint8_t i = 0; i < MOTOR_NUMBER; i++)
     {
-        nrf_gpio_pin_clear(motor_enable_pin[i]);
+        if (channel_mask & (1 << i))
+        {
+            m_channel_duty[i] = duty_cycle;
+        }
+    }
+
+    if (duty_cycle == 0)
+    {
+        m_channel_on_mask &= ~channel_mask;
+    }
+    else
+    {
+        m_channel_on_mask |= channel_mask;
     }
-    stop_motor_control_timer();
+
+    motor_pwm_update();
 }
 
-void motor_set_duty_cylce(uint8_t duty_cycle)
+uint16_t motor_pwm_isr_max_us(void)
 {
-    m_duty_cycle = duty_cycle;
+    return m_isr_max_us;
+}
+
+uint8_t motor_duty_cycle_get(void)
+{
+    return m_duty_cycle;
+}
+
+uint8_t motor_on_mask_get(void)
+{
+    return m_channel_on_mask;
 }
 
 
 void report_motor_duty_cycle(void)
 {
-    uint32_t err_code;
     mhs_event_t event;
+    uint16_t duty_cycle = m_duty_cycle;
 
     memset(&event, 0, sizeof(mhs_event_t));
     event.evt_code       = MHS_EVENT_CODE_MOTOR_SPEED;
-    event.evt_value.buff = (uint8_t *)&m_duty_cycle;
-    event.evt_value.len  = sizeof(m_duty_cycle);
+    event.evt_value.buff = (uint8_t *)&duty_cycle;
+    event.evt_value.len  = sizeof(duty_cycle);
 
-    err_code = mhs_event_characteristic_notify(event);
-
-    APP_ERROR_CHECK(err_code);
+    mhs_event_characteristic_notify(event);
 }
@@ -1,6 +1,8 @@
 #ifndef MOTOR_H_
 #define MOTOR_H_
 
+#define MOTOR_DUTY_CYCLE_MAX    100     /**< Duty cycles are in percent, this and above is fully on. */
+
 typedef enum motor_index_e
 {
     MOTOR_INDEX_1 = 0,
@@ -27,12 +29,32 @@ typedef struct motor_control_s
 
 void motor_init(void);
 
-void motor_on(motor_control_t motor_control);
+/**@brief Run one channel at the current duty cycle, in the given direction.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_INVALID_PARAM for an index beyond MOTOR_INDEX_8.
+ */
+uint32_t motor_on(motor_control_t motor_control);
 
 void motor_off();
 
 void motor_set_duty_cylce(uint8_t duty_cycle);
 
+/**@brief Set the duty cycle of several channels at once.
+ *
+ * @details Every channel whose bit is set in channel_mask runs at duty_cycle, other channels keep
+ *          running unchanged. A duty cycle of 0 switches the channels off.
+ */
+void motor_set_channel_duty(uint8_t channel_mask, uint8_t duty_cycle);
+
+/**@brief Longest PWM interrupt measured so far, in us. */
+uint16_t motor_pwm_isr_max_us(void);
+
 void report_motor_duty_cycle(void);
 
+/**@brief Duty cycle of the selected motor, percent. */
+uint8_t motor_duty_cycle_get(void);
+
+/**@brief Channels switched on, bit n for channel n. */
+uint8_t motor_on_mask_get(void);
+
 #endif // MOTOR_H_
@@ -1,13 +1,169 @@
+#include <stdbool.h>
+
 #include "app_error.h"
+#include "app_timer.h"
+#include "nordic_common.h"
 #include "nrf_gpio.h"
-#include "nrf_delay.h"
 
 #include "pin_config.h"
 
 #include "music.h"
 
+#define MUSIC_PULSE_TICKS       APP_TIMER_TICKS(100, APP_TIMER_PRESCALER)   /**< Key held down. */
+#define MUSIC_GAP_TICKS         APP_TIMER_TICKS(50, APP_TIMER_PRESCALER)    /**< Key released before the next press. */
+#define MUSIC_QUEUE_SIZE        8
+#define MUSIC_VOLUME_UNKNOWN    0xFF
+
+/**@brief Presses of one key waiting to be emitted. */
+typedef struct music_pulse_s
+{
+    uint8_t pin;
+    uint8_t count;
+} music_pulse_t;
+
+static app_timer_id_t   m_music_timer_id;
+static music_pulse_t    m_queue[MUSIC_QUEUE_SIZE];
+static uint8_t          m_queue_first = 0;
+static uint8_t          m_queue_count = 0;
+static bool             m_active = false;           /**< A press or the gap after it is running. */
+static bool             m_pin_high = false;
+static uint8_t          m_volume = MUSIC_VOLUME_UNKNOWN;
+
+
+/**@brief Press the key at the head of the queue.
+ */
+static void pulse_start(void)
+{
+    uint32_t err_code;
+
+    nrf_gpio_pin_set(m_queue[m_queue_first].pin);
+    m_pin_high = true;
+    m_active   = true;
+
+    err_code = app_timer_start(m_music_timer_id, MUSIC_PULSE_TICKS, NULL);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+static void music_timeout_handler(void * p_context)
+{
+    uint32_t err_code;
+
+    UNUSED_PARAMETER(p_context);
+
+    if (m_pin_high)
+    {
+        nrf_gpio_pin_clear(m_queue[m_queue_first].pin);
+        m_pin_high = false;
+
+        if (--m_queue[m_queue_first].count == 0)
+        {
+            m_queue_first = (m_queue_first + 1) % MUSIC_QUEUE_SIZE;
+            m_queue_count--;
+        }
+
+        // Always keep the gap, so a press queued right now is still seen as a new one.
+        err_code = app_timer_start(m_music_timer_id, MUSIC_GAP_TICKS, NULL);
+        APP_ERROR_CHECK(err_code);
+    }
+    else if (m_queue_count > 0)
+    {
+        pulse_start();
+    }
+    else
+    {
+        m_active = false;
+    }
+}
+
+
+/**@brief Queue presses of a key, merged with the last queued ones of the same key.
+ */
+static uint32_t pulse_queue(uint8_t pin, uint8_t count)
+{
+    uint8_t last = (m_queue_first + m_queue_count + MUSIC_QUEUE_SIZE - 1) % MUSIC_QUEUE_SIZE;
+
+    if (count == 0)
+    {
+        return NRF_SUCCESS;
+    }
+
+    // The head entry may be half emitted, only merge into it while it is not.
+    if ((m_queue_count > 0)
+            && (m_queue[last].pin == pin)
+            && !((last == m_queue_first) && m_active)
+            && (m_queue[last].count <= UINT8_MAX - count))
+    {
+        m_queue[last].count += count;
+    }
+    else
+    {
+        if (m_queue_count == MUSIC_QUEUE_SIZE)
+        {
+            return NRF_ERROR_NO_MEM;
+        }
+
+        last = (m_queue_first + m_queue_count) % MUSIC_QUEUE_SIZE;
+        m_queue[last].pin   = pin;
+        m_queue[last].count = count;
+        m_queue_count++;
+    }
+
+    if (!m_active)
+    {
+        pulse_start();
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Queue the volume key presses that reach a volume.
+ *
+ * @details The module has no absolute volume, so the first time the volume is turned all the
+ *          way down and then up to the wanted level. After that only the difference is pressed.
+ */
+static uint32_t volume_set(uint8_t volume)
+{
+    uint32_t err_code;
+
+    if (volume > MUSIC_VOLUME_STEPS)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (m_volume == MUSIC_VOLUME_UNKNOWN)
+    {
+        err_code = pulse_queue(MP3_VOL_N_PIN_NUMBER, MUSIC_VOLUME_STEPS);
+        if (err_code != NRF_SUCCESS)
+        {
+            return err_code;
+        }
+        m_volume = 0;
+    }
+
+    if (volume > m_volume)
+    {
+        err_code = pulse_queue(MP3_VOL_P_PIN_NUMBER, volume - m_volume);
+    }
+    else
+    {
+        err_code = pulse_queue(MP3_VOL_N_PIN_NUMBER, m_volume - volume);
+    }
+
+    if (err_code == NRF_SUCCESS)
+    {
+        m_volume = volume;
+    }
+
+    return err_code;
+}
+
+
 void music_control_init(void)
 {
+    uint32_t err_code;
+
     nrf_gpio_cfg_output(MP3_PRV_PIN_NUMBER);
     nrf_gpio_pin_clear(MP3_PRV_PIN_NUMBER);
 
@@ -22,38 +178,43 @@ void music_control_init(void)
 
     nrf_gpio_cfg_output(MP3_PLAY_PIN_NUMBER);
     nrf_gpio_pin_clear(MP3_PLAY_PIN_NUMBER);
+
+    err_code = app_timer_create(&m_music_timer_id,
+                                APP_TIMER_MODE_SINGLE_SHOT,
+                                music_timeout_handler);
+    APP_ERROR_CHECK(err_code);
 }
 
-void music_control(music_control_cmd_t cmd)
+
+uint32_t music_control(music_control_cmd_t cmd, uint8_t value)
 {
+    uint32_t err_code;
+
     switch (cmd)
     {
         case MUSIC_PLAY_PAUSE:
-            nrf_gpio_pin_set(MP3_PLAY_PIN_NUMBER);
-            nrf_delay_ms(100);
-            nrf_gpio_pin_clear(MP3_PLAY_PIN_NUMBER);
-            break;
+            return pulse_queue(MP3_PLAY_PIN_NUMBER, 1);
         case MUSIC_PREVIOUS_SONG:
-            nrf_gpio_pin_set(MP3_PRV_PIN_NUMBER);
-            nrf_delay_ms(100);
-            nrf_gpio_pin_clear(MP3_PRV_PIN_NUMBER);
-            break;
+            return pulse_queue(MP3_PRV_PIN_NUMBER, 1);
         case MUSIC_NEXT_SONG:
-            nrf_gpio_pin_set(MP3_NEXT_PIN_NUMBER);
-            nrf_delay_ms(100);
-            nrf_gpio_pin_clear(MP3_NEXT_PIN_NUMBER);
-            break;
+            return pulse_queue(MP3_NEXT_PIN_NUMBER, 1);
         case MUSIC_VOL_PLUS:
-            nrf_gpio_pin_set(MP3_VOL_P_PIN_NUMBER);
-            nrf_delay_ms(100);
-            nrf_gpio_pin_clear(MP3_VOL_P_PIN_NUMBER);
-            break;
+            err_code = pulse_queue(MP3_VOL_P_PIN_NUMBER, 1);
+            if ((err_code == NRF_SUCCESS) && (m_volume < MUSIC_VOLUME_STEPS))
+            {
+                m_volume++;
+            }
+            return err_code;
         case MUSIC_VOL_SUB:
-            nrf_gpio_pin_set(MP3_VOL_N_PIN_NUMBER);
-            nrf_delay_ms(100);
-            nrf_gpio_pin_clear(MP3_VOL_N_PIN_NUMBER);
-            break;
+            err_code = pulse_queue(MP3_VOL_N_PIN_NUMBER, 1);
+            if ((err_code == NRF_SUCCESS) && (m_volume != MUSIC_VOLUME_UNKNOWN) && (m_volume > 0))
+            {
+                m_volume--;
+            }
+            return err_code;
+        case MUSIC_VOL_SET:
+            return volume_set(value);
         default:
-            APP_ERROR_CHECK_BOOL(false);
+            return NRF_ERROR_INVALID_PARAM;
     }
 }
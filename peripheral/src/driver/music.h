@@ -1,6 +1,10 @@
 #ifndef MUSIC_H_
 #define MUSIC_H_
 
+#include <stdint.h>
+
+#define MUSIC_VOLUME_STEPS  30      /**< Volume key presses from silent to loudest. */
+
 typedef enum music_control_cmd_e
 {
     MUSIC_PLAY_PAUSE    = 0x01,
@@ -8,10 +12,22 @@ typedef enum music_control_cmd_e
     MUSIC_NEXT_SONG     = 0x03,
     MUSIC_VOL_PLUS      = 0x04,
     MUSIC_VOL_SUB       = 0x05,
+    MUSIC_VOL_SET       = 0x06,     // Value: volume 0 to MUSIC_VOLUME_STEPS.
 } music_control_cmd_t;
 
+/**@brief Configure the key pins and create the pulse timer. Call after APP_TIMER_INIT().
+ */
 void music_control_init(void);
 
-void music_control(music_control_cmd_t cmd);
+/**@brief Queue a key press. Presses are emitted one after another from a timer, the call
+ *        does not wait for them.
+ *
+ * @param[in]   cmd     Key to press, or MUSIC_VOL_SET.
+ * @param[in]   value   Volume for MUSIC_VOL_SET, ignored otherwise.
+ *
+ * @return NRF_SUCCESS, NRF_ERROR_INVALID_PARAM for an unknown command or volume,
+ *         NRF_ERROR_NO_MEM if the key queue is full.
+ */
+uint32_t music_control(music_control_cmd_t cmd, uint8_t value);
 
 #endif // MUSIC_H_
@@ -0,0 +1,426 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "app_error.h"
+#include "app_scheduler.h"
+#include "app_util.h"
+#include "nordic_common.h"
+#include "nrf_drv_ppi.h"
+#include "nrf_drv_timer.h"
+#include "nrf_gpio.h"
+#include "nrf_gpiote.h"
+
+#include "pin_config.h"
+
+#include "one_wire.h"
+
+#define ONE_WIRE_GPIOTE_CH          1       /**< GPIOTE channel driving the bus, channel 0 is the motor PWM. */
+
+// Slot timing in us from the start of a slot, TIMER2 runs at 1 MHz.
+#define ONE_WIRE_SLOT_START_US      1       /**< COMPARE0, the bus is pulled low. */
+#define ONE_WIRE_RESET_LOW_US       480     /**< Reset pulse. */
+#define ONE_WIRE_RESET_SLOT_US      960     /**< Reset pulse and presence detection window. */
+#define ONE_WIRE_PRESENCE_MIN_US    70      /**< A bus rising this late after the reset is a presence pulse. */
+#define ONE_WIRE_WRITE_1_LOW_US     6
+#define ONE_WIRE_WRITE_0_LOW_US     60
+#define ONE_WIRE_READ_LOW_US        6
+#define ONE_WIRE_READ_SAMPLE_US     6       /**< A bus rising this soon after the release reads as 1. */
+#define ONE_WIRE_SLOT_US            70      /**< COMPARE2, end of a read or write slot. */
+
+/**@brief Transfer in progress. */
+typedef enum one_wire_op_e
+{
+    ONE_WIRE_OP_IDLE = 0,
+    ONE_WIRE_OP_RESET,
+    ONE_WIRE_OP_WRITE,
+    ONE_WIRE_OP_READ,
+    ONE_WIRE_OP_TRIPLET,
+} one_wire_op_t;
+
+static const nrf_drv_timer_t m_slot_timer = NRF_DRV_TIMER_INSTANCE(2);
+static nrf_ppi_channel_t    m_ppi_low_channel;      /**< COMPARE0 -> bus low. */
+static nrf_ppi_channel_t    m_ppi_release_channel;  /**< COMPARE1 -> bus released. */
+static nrf_ppi_channel_t    m_ppi_capture_channel;  /**< Bus rising (GPIOTE PORT) -> CAPTURE3. */
+
+static volatile one_wire_op_t m_op = ONE_WIRE_OP_IDLE;
+static const uint8_t *      mp_tx_buffer;
+static uint8_t *            mp_rx_buffer;
+static uint8_t              m_length;
+static uint8_t              m_byte_index;
+static uint8_t              m_bit_index;
+static uint8_t              m_triplet;              /**< Search triplet, see one_wire_search_triplet(). */
+static one_wire_handler_t   m_handler;
+
+/**@brief Transfer completion waiting in the scheduler queue. */
+typedef struct one_wire_sched_evt_s
+{
+    one_wire_handler_t handler;
+    uint32_t           err_code;
+} one_wire_sched_evt_t;
+
+STATIC_ASSERT(sizeof(one_wire_sched_evt_t) <= ONE_WIRE_SCHED_EVT_SIZE);
+
+
+/**@brief Start one slot.
+ *
+ * @details The bus is pulled low at COMPARE0 and released at COMPARE1 through PPI, every rising
+ *          edge of the bus is captured in CC3. COMPARE2 stops and clears the timer and is the only
+ *          interrupt, so interrupt latency only lengthens the recovery time between slots.
+ */
+static void slot_start(uint32_t low_us, uint32_t slot_us)
+{
+    nrf_drv_timer_compare(&m_slot_timer, NRF_TIMER_CC_CHANNEL1, ONE_WIRE_SLOT_START_US + low_us, false);
+    nrf_drv_timer_compare(&m_slot_timer, NRF_TIMER_CC_CHANNEL2, slot_us, true);
+    nrf_timer_cc_write(m_slot_timer.p_reg, NRF_TIMER_CC_CHANNEL3, 0);
+    nrf_drv_timer_resume(&m_slot_timer);
+}
+
+
+static void bit_slot_start(void)
+{
+    uint32_t low_us = ONE_WIRE_READ_LOW_US;
+
+    if (m_op == ONE_WIRE_OP_WRITE)
+    {
+        low_us = (mp_tx_buffer[m_byte_index] & (1 << m_bit_index)) ? ONE_WIRE_WRITE_1_LOW_US
+                                                                     : ONE_WIRE_WRITE_0_LOW_US;
+    }
+    else if ((m_op == ONE_WIRE_OP_TRIPLET) && (m_bit_index == 2))
+    {
+        low_us = (m_triplet & ONE_WIRE_TRIPLET_DIRECTION) ? ONE_WIRE_WRITE_1_LOW_US
+                                                          : ONE_WIRE_WRITE_0_LOW_US;
+    }
+
+    slot_start(low_us, ONE_WIRE_SLOT_US);
+}
+
+
+static void transfer_complete_execute(void * p_event_data, uint16_t event_size)
+{
+    one_wire_sched_evt_t * p_evt = (one_wire_sched_evt_t *)p_event_data;
+
+    UNUSED_PARAMETER(event_size);
+
+    p_evt->handler(p_evt->err_code);
+}
+
+
+/**@brief End the transfer. The handler runs from the main loop, so the sensor logic and
+ *        what it calls stay out of the TIMER2 interrupt.
+ */
+static void transfer_complete(uint32_t err_code)
+{
+    one_wire_sched_evt_t evt;
+
+    evt.handler  = m_handler;
+    evt.err_code = err_code;
+
+    m_op      = ONE_WIRE_OP_IDLE;
+    m_handler = NULL;
+
+    if (evt.handler != NULL)
+    {
+        err_code = app_sched_event_put(&evt, sizeof(evt), transfer_complete_execute);
+        APP_ERROR_CHECK(err_code);
+    }
+}
+
+
+/**@brief Whether the bus rising edge captured in a read slot reads as 1.
+ */
+static bool slot_bit_is_one(uint32_t rise)
+{
+    return ((rise != 0)
+            && (rise <= ONE_WIRE_SLOT_START_US + ONE_WIRE_READ_LOW_US + ONE_WIRE_READ_SAMPLE_US));
+}
+
+
+/**@brief Handle the end of a search triplet slot.
+ *
+ * @details After the bit and its complement are read the search direction is chosen: the bit
+ *          itself when every device agrees, the requested direction on a discrepancy. No device
+ *          answering both reads ends the triplet early.
+ */
+static void triplet_slot_end(uint32_t rise)
+{
+    if ((m_bit_index < 2) && slot_bit_is_one(rise))
+    {
+        m_triplet |= (1 << m_bit_index);
+    }
+
+    if (++m_bit_index == 2)
+    {
+        uint8_t id_bit  = m_triplet & ONE_WIRE_TRIPLET_ID_BIT;
+        uint8_t cmp_bit = m_triplet & ONE_WIRE_TRIPLET_CMP_ID_BIT;
+
+        if (id_bit && cmp_bit)
+        {
+            *mp_rx_buffer = m_triplet;
+            transfer_complete(NRF_ERROR_NOT_FOUND);
+            return;
+        }
+
+        if (id_bit || cmp_bit)
+        {
+            m_triplet &= ~ONE_WIRE_TRIPLET_DIRECTION;
+            m_triplet |= id_bit ? ONE_WIRE_TRIPLET_DIRECTION : 0;
+        }
+    }
+
+    if (m_bit_index == 3)
+    {
+        *mp_rx_buffer = m_triplet;
+        transfer_complete(NRF_SUCCESS);
+    }
+    else
+    {
+        bit_slot_start();
+    }
+}
+
+
+/**@brief Slot timer event handler, called once per slot at COMPARE2.
+ */
+static void one_wire_timer_event_handler(nrf_timer_events_t event_type)
+{
+    uint32_t rise;
+
+    if (event_type != NRF_TIMER_EVENTS_COMPARE2)
+    {
+        return;
+    }
+
+    rise = nrf_drv_timer_capture_get(&m_slot_timer, NRF_TIMER_CC_CHANNEL3);
+
+    switch (m_op)
+    {
+        case ONE_WIRE_OP_RESET:
+            if (rise > ONE_WIRE_SLOT_START_US + ONE_WIRE_RESET_LOW_US + ONE_WIRE_PRESENCE_MIN_US)
+            {
+                transfer_complete(NRF_SUCCESS);
+            }
+            else
+            {
+                transfer_complete(NRF_ERROR_NOT_FOUND);
+            }
+            return;
+
+        case ONE_WIRE_OP_TRIPLET:
+            triplet_slot_end(rise);
+            return;
+
+        case ONE_WIRE_OP_READ:
+            if (slot_bit_is_one(rise))
+            {
+                mp_rx_buffer[m_byte_index] |= (1 << m_bit_index);
+            }
+            break;
+
+        case ONE_WIRE_OP_WRITE:
+            break;
+
+        default:
+            return;
+    }
+
+    if (++m_bit_index == 8)
+    {
+        m_bit_index = 0;
+        m_byte_index++;
+    }
+
+    if (m_byte_index == m_length)
+    {
+        transfer_complete(NRF_SUCCESS);
+    }
+    else
+    {
+        bit_slot_start();
+    }
+}
+
+
+static uint32_t transfer_start(one_wire_op_t op, uint8_t length, one_wire_handler_t handler)
+{
+    if (m_op != ONE_WIRE_OP_IDLE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    m_op         = op;
+    m_length     = length;
+    m_byte_index = 0;
+    m_bit_index  = 0;
+    m_handler    = handler;
+
+    if (op == ONE_WIRE_OP_RESET)
+    {
+        slot_start(ONE_WIRE_RESET_LOW_US, ONE_WIRE_RESET_SLOT_US);
+    }
+    else if ((length == 0) && (op != ONE_WIRE_OP_TRIPLET))
+    {
+        transfer_complete(NRF_SUCCESS);
+    }
+    else
+    {
+        bit_slot_start();
+    }
+
+    return NRF_SUCCESS;
+}
+
+
+void one_wire_init(void)
+{
+    uint32_t err_code;
+    uint32_t gpiote_task_addr = (uint32_t)&NRF_GPIOTE->TASKS_OUT[ONE_WIRE_GPIOTE_CH];
+
+    // Open drain with the external pull-up, SENSE turns every rising edge into a PORT event.
+    NRF_GPIO->PIN_CNF[DS18B20_SDA_PIN_NUMBER] = (GPIO_PIN_CNF_SENSE_High << GPIO_PIN_CNF_SENSE_Pos)
+                                              | (GPIO_PIN_CNF_DRIVE_S0D1 << GPIO_PIN_CNF_DRIVE_Pos)
+                                              | (GPIO_PIN_CNF_PULL_Disabled << GPIO_PIN_CNF_PULL_Pos)
+                                              | (GPIO_PIN_CNF_INPUT_Connect << GPIO_PIN_CNF_INPUT_Pos)
+                                              | (GPIO_PIN_CNF_DIR_Output << GPIO_PIN_CNF_DIR_Pos);
+
+    nrf_gpiote_task_config(ONE_WIRE_GPIOTE_CH,
+                           DS18B20_SDA_PIN_NUMBER,
+                           NRF_GPIOTE_POLARITY_TOGGLE,
+                           NRF_GPIOTE_INITIAL_VALUE_HIGH);
+
+    // The motor PWM may already have initialized the PPI driver.
+    err_code = nrf_drv_ppi_init();
+    if (err_code != NRF_ERROR_INVALID_STATE)
+    {
+        APP_ERROR_CHECK(err_code);
+    }
+
+    err_code = nrf_drv_timer_init(&m_slot_timer, NULL, one_wire_timer_event_handler);
+    APP_ERROR_CHECK(err_code);
+
+    nrf_drv_timer_compare(&m_slot_timer, NRF_TIMER_CC_CHANNEL0, ONE_WIRE_SLOT_START_US, false);
+    nrf_timer_shorts_set(m_slot_timer.p_reg,
+                         NRF_TIMER_SHORTS_COMPARE2_STOP_MASK | NRF_TIMER_SHORTS_COMPARE2_CLEAR_MASK);
+
+    // Keep the timer powered but stopped, each slot is started with the START task.
+    nrf_drv_timer_enable(&m_slot_timer);
+    nrf_drv_timer_pause(&m_slot_timer);
+    nrf_drv_timer_clear(&m_slot_timer);
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_low_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_low_channel,
+                                          nrf_drv_timer_event_address_get(&m_slot_timer,
+                                                                          NRF_TIMER_EVENTS_COMPARE0),
+                                          gpiote_task_addr);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_release_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_release_channel,
+                                          nrf_drv_timer_event_address_get(&m_slot_timer,
+                                                                          NRF_TIMER_EVENTS_COMPARE1),
+                                          gpiote_task_addr);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_drv_ppi_channel_alloc(&m_ppi_capture_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_assign(m_ppi_capture_channel,
+                                          (uint32_t)&NRF_GPIOTE->EVENTS_PORT,
+                                          nrf_drv_timer_task_address_get(&m_slot_timer,
+                                                                         NRF_TIMER_TASKS_CAPTURE3));
+    APP_ERROR_CHECK(err_code);
+
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_low_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_release_channel);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_drv_ppi_channel_enable(m_ppi_capture_channel);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+uint32_t one_wire_reset(one_wire_handler_t handler)
+{
+    return transfer_start(ONE_WIRE_OP_RESET, 0, handler);
+}
+
+
+uint32_t one_wire_write(const uint8_t * p_data, uint8_t length, one_wire_handler_t handler)
+{
+    if (p_data == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (m_op != ONE_WIRE_OP_IDLE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    mp_tx_buffer = p_data;
+
+    return transfer_start(ONE_WIRE_OP_WRITE, length, handler);
+}
+
+
+uint32_t one_wire_read(uint8_t * p_data, uint8_t length, one_wire_handler_t handler)
+{
+    if (p_data == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (m_op != ONE_WIRE_OP_IDLE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    memset(p_data, 0, length);
+    mp_rx_buffer = p_data;
+
+    return transfer_start(ONE_WIRE_OP_READ, length, handler);
+}
+
+
+uint32_t one_wire_search_triplet(uint8_t direction, uint8_t * p_result, one_wire_handler_t handler)
+{
+    if (p_result == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (m_op != ONE_WIRE_OP_IDLE)
+    {
+        return NRF_ERROR_BUSY;
+    }
+
+    m_triplet    = direction ? ONE_WIRE_TRIPLET_DIRECTION : 0;
+    mp_rx_buffer = p_result;
+
+    return transfer_start(ONE_WIRE_OP_TRIPLET, 0, handler);
+}
+
+
+uint8_t one_wire_crc8(const uint8_t * p_data, uint8_t length)
+{
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < length; i++)
+    {
+        uint8_t data = p_data[i];
+
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            uint8_t mix = (crc ^ data) & 0x01;
+
+            crc >>= 1;
+            if (mix)
+            {
+                crc ^= 0x8C;
+            }
+            data >>= 1;
+        }
+    }
+
+    return crc;
+}
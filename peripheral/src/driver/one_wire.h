@@ -0,0 +1,69 @@
+#ifndef ONE_WIRE_H_
+#define ONE_WIRE_H_
+
+#include <stdint.h>
+
+#define ONE_WIRE_CMD_SEARCH_ROM         0xF0
+#define ONE_WIRE_CMD_MATCH_ROM          0x55
+#define ONE_WIRE_CMD_SKIP_ROM           0xCC
+
+#define ONE_WIRE_ROM_LEN                8       /**< Family code, 48 bit serial number and CRC8. */
+
+// Bits of the search triplet result.
+#define ONE_WIRE_TRIPLET_ID_BIT         0x01    /**< First read, the ROM bit. */
+#define ONE_WIRE_TRIPLET_CMP_ID_BIT     0x02    /**< Second read, the complement of the ROM bit. */
+#define ONE_WIRE_TRIPLET_DIRECTION      0x04    /**< Direction written, devices with another bit drop out. */
+
+#define ONE_WIRE_SCHED_EVT_SIZE         8       /**< Size of the completion passed through the scheduler. */
+
+/**@brief 1-Wire transfer completion handler, called from the main loop through the scheduler.
+ *
+ * @param[in]   err_code   NRF_SUCCESS, or NRF_ERROR_NOT_FOUND if no device answered a reset.
+ */
+typedef void (*one_wire_handler_t)(uint32_t err_code);
+
+/**@brief Set up the bus pin, TIMER2 and the PPI channels timing the 1-Wire slots.
+ */
+void one_wire_init(void);
+
+/**@brief Send a reset pulse and detect the presence pulse.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_BUSY if a transfer is in progress.
+ */
+uint32_t one_wire_reset(one_wire_handler_t handler);
+
+/**@brief Write bytes, least significant bit first.
+ *
+ * @details The buffer must stay valid until the handler is called.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_BUSY if a transfer is in progress.
+ */
+uint32_t one_wire_write(const uint8_t * p_data, uint8_t length, one_wire_handler_t handler);
+
+/**@brief Read bytes, least significant bit first.
+ *
+ * @details The buffer is filled until the handler is called.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_BUSY if a transfer is in progress.
+ */
+uint32_t one_wire_read(uint8_t * p_data, uint8_t length, one_wire_handler_t handler);
+
+/**@brief Run one ROM search step: read a bit and its complement, then write the search direction.
+ *
+ * @details On a discrepancy, both reads 0, the given direction is written, otherwise the bit all
+ *          devices agree on. The handler gets NRF_ERROR_NOT_FOUND if no device answered.
+ *
+ * @param[in]   direction   Direction to take on a discrepancy.
+ * @param[out]  p_result    ONE_WIRE_TRIPLET_* bits, valid when the handler is called.
+ *
+ * @return NRF_SUCCESS, or NRF_ERROR_BUSY if a transfer is in progress.
+ */
+uint32_t one_wire_search_triplet(uint8_t direction, uint8_t * p_result, one_wire_handler_t handler);
+
+/**@brief Dallas/Maxim CRC8 (x^8 + x^5 + x^4 + 1) of a buffer.
+ *
+ * @details The CRC of data followed by its own CRC byte is 0.
+ */
+uint8_t one_wire_crc8(const uint8_t * p_data, uint8_t length);
+
+#endif // ONE_WIRE_H_
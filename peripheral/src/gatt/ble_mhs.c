@@ -28,12 +28,120 @@
 #include "system_error.h"
 
 #include "ble_mhs.h"
+#include "SEGGER_RTT.h"
 
 #define MHS_UUID_BASE   {0x1B, 0xC5, 0xD5, 0xA5, 0x02, 0x00, 0x82, 0x86,\
         0xE3, 0x11, 0xCB, 0x37, 0x00, 0x00, 0x00, 0x00}
 
-// Control point structure instance.
-static mhs_control_point_cmd_t  m_mhs_control_point;
+// Control point value, a single command or a frame of commands.
+static uint8_t                  m_control_point_value[MHS_CTRL_POINT_MAX_LEN];
+
+/**@brief Event waiting for a notification buffer. */
+typedef struct mhs_event_entry_s
+{
+    uint8_t code;
+    uint8_t len;
+    uint8_t value[MHS_EVENT_MAX_VALUE_LEN];
+} mhs_event_entry_t;
+
+static mhs_event_entry_t        m_event_queue[MHS_EVENT_QUEUE_SIZE];
+static uint8_t                  m_event_queue_first = 0;
+static uint8_t                  m_event_queue_count = 0;
+static mhs_notify_stats_t       m_notify_stats;
+
+/**@brief Send a notification or indication of a characteristic value.
+ *
+ * @param[in]   handle      Value handle of the characteristic.
+ * @param[in]   type        BLE_GATT_HVX_NOTIFICATION or BLE_GATT_HVX_INDICATION.
+ */
+static uint32_t characteristic_hvx(uint16_t handle, uint8_t type, uint8_t *p_data, uint16_t len)
+{
+    ble_mhs_t *p_mhs = get_mhs_obj();
+    ble_gatts_hvx_params_t hvx_params;
+
+    if ((NULL == p_mhs) || (NULL == p_data))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (BLE_CONN_HANDLE_INVALID == p_mhs->conn_handle)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    memset(&hvx_params, 0, sizeof(hvx_params));
+
+    hvx_params.handle   = handle;
+    hvx_params.type     = type;
+    hvx_params.p_len    = &len;
+    hvx_params.p_data   = p_data;
+
+    return sd_ble_gatts_hvx(p_mhs->conn_handle, &hvx_params);
+}
+
+
+
+static void event_queue_clear(void)
+{
+    m_event_queue_first = 0;
+    m_event_queue_count = 0;
+}
+
+
+/**@brief Send the queued events, packing as many as fit each notification.
+ *
+ * @details Stops when the SoftDevice is out of buffers, the rest goes on the next TX complete
+ *          event. Events that can not be notified at all, e.g. with notifications disabled, are
+ *          dropped.
+ */
+static void event_queue_process(void)
+{
+    uint32_t            err_code;
+    uint8_t             data_buff[MHS_EVENT_MAX_TX_CHAR_LEN];
+    uint16_t            len;
+    uint8_t             packed;
+    mhs_event_entry_t * p_entry;
+
+    while (m_event_queue_count > 0)
+    {
+        len    = 0;
+        packed = 0;
+        while (packed < m_event_queue_count)
+        {
+            p_entry = &m_event_queue[(m_event_queue_first + packed) % MHS_EVENT_QUEUE_SIZE];
+            if (len + MHS_EVENT_HEADER_LEN + p_entry->len > MHS_EVENT_MAX_TX_CHAR_LEN)
+            {
+                break;
+            }
+
+            data_buff[len++] = p_entry->code;
+            data_buff[len++] = p_entry->len;
+            memcpy(&data_buff[len], p_entry->value, p_entry->len);
+            len += p_entry->len;
+            packed++;
+        }
+
+        err_code = characteristic_hvx(get_mhs_obj()->event_handles.value_handle,
+                                      BLE_GATT_HVX_NOTIFICATION, data_buff, len);
+        if (err_code == BLE_ERROR_NO_TX_BUFFERS)
+        {
+            return;
+        }
+
+        if (err_code == NRF_SUCCESS)
+        {
+            m_notify_stats.packets++;
+        }
+        else
+        {
+            m_notify_stats.dropped += packed;
+        }
+
+        m_event_queue_first = (m_event_queue_first + packed) % MHS_EVENT_QUEUE_SIZE;
+        m_event_queue_count -= packed;
+    }
+}
+
 
 /**@brief Connect event handler.
  *
@@ -53,7 +161,45 @@ static void on_connect(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
  */
 static void on_disconnect(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
 {
+    ble_mhs_evt_t evt;
+
     p_mhs->conn_handle = BLE_CONN_HANDLE_INVALID;
+    event_queue_clear();
+
+    // Notifications end with the link, as if both CCCDs were cleared.
+    if (p_mhs->evt_handler != NULL)
+    {
+        memset(&evt, 0, sizeof(ble_mhs_evt_t));
+        evt.ble_mhs_char = MHS_CHARACTERISTIC_EVENT;
+        evt.evt_type.event_char_evt = BLE_MHS_EVENT_CHAR_EVT_DISABLED;
+        p_mhs->evt_handler(p_mhs, &evt);
+
+        memset(&evt, 0, sizeof(ble_mhs_evt_t));
+        evt.ble_mhs_char = MHS_CHARACTERISTIC_HISTORY;
+        evt.evt_type.history_char_evt = BLE_MHS_HISTORY_CHAR_EVT_DISABLED;
+        p_mhs->evt_handler(p_mhs, &evt);
+    }
+}
+
+
+/**@brief TX complete event handler, notification buffers were freed.
+ *
+ * @param[in]   p_mhs       Sony Advanced Accessory Host Service structure.
+ */
+static void on_tx_complete(ble_mhs_t *p_mhs)
+{
+    ble_mhs_evt_t evt;
+
+    // Events go first, the history report takes the buffers left.
+    event_queue_process();
+
+    if (p_mhs->evt_handler != NULL)
+    {
+        memset(&evt, 0, sizeof(ble_mhs_evt_t));
+        evt.ble_mhs_char = MHS_CHARACTERISTIC_HISTORY;
+        evt.evt_type.history_char_evt = BLE_MHS_HISTORY_CHAR_EVT_TX_COMPLETE;
+        p_mhs->evt_handler(p_mhs, &evt);
+    }
 }
 
 
@@ -112,8 +258,9 @@ uint32_t mhs_control_point_characteristic_add(ble_mhs_t *p_mhs)
 
     memset(&char_md, 0, sizeof(char_md));
 
-    char_md.char_props.write  = 1;
-    char_md.char_props.read   = 0;
+    char_md.char_props.write         = 1;
+    char_md.char_props.write_wo_resp = 1;
+    char_md.char_props.read          = 0;
     char_md.p_char_user_desc  = NULL;
     char_md.p_char_pf         = NULL;
     char_md.p_user_desc_md    = NULL;
@@ -134,10 +281,10 @@ uint32_t mhs_control_point_characteristic_add(ble_mhs_t *p_mhs)
 
     attr_char_value.p_uuid       = &ble_uuid;
     attr_char_value.p_attr_md    = &attr_md;
-    attr_char_value.init_len     = sizeof(m_mhs_control_point);
+    attr_char_value.init_len     = CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN;
     attr_char_value.init_offs    = 0;
-    attr_char_value.max_len      = sizeof(m_mhs_control_point);
-    attr_char_value.p_value      = (uint8_t *)&m_mhs_control_point;
+    attr_char_value.max_len      = sizeof(m_control_point_value);
+    attr_char_value.p_value      = m_control_point_value;
 
     return sd_ble_gatts_characteristic_add(p_mhs->service_handle,
                                            &char_md,
@@ -203,6 +350,121 @@ uint32_t mhs_event_characteristic_add(ble_mhs_t *p_mhs)
 }
 
 
+uint32_t mhs_racp_characteristic_add(ble_mhs_t *p_mhs)
+{
+    ble_uuid_t          ble_uuid;
+    ble_gatts_char_md_t char_md;
+    ble_gatts_attr_md_t cccd_md;
+    ble_gatts_attr_t    attr_char_value;
+    ble_gatts_attr_md_t attr_md;
+
+    if (NULL == p_mhs)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    ble_uuid.type = p_mhs->uuid_type;
+    ble_uuid.uuid = BLE_UUID_MHS_RACP_CHARACTERISTIC;
+
+    memset(&cccd_md, 0, sizeof(cccd_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+
+    cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+    memset(&char_md, 0, sizeof(char_md));
+
+    char_md.char_props.write    = 1;
+    char_md.char_props.indicate = 1;
+    char_md.p_char_user_desc    = NULL;
+    char_md.p_char_pf           = NULL;
+    char_md.p_user_desc_md      = NULL;
+    char_md.p_cccd_md           = &cccd_md;
+    char_md.p_sccd_md           = NULL;
+
+    memset(&attr_md, 0, sizeof(attr_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.write_perm);
+
+    attr_md.vloc       = BLE_GATTS_VLOC_STACK;
+    attr_md.rd_auth    = 0;
+    attr_md.wr_auth    = 0;
+    attr_md.vlen       = 1;
+
+    memset(&attr_char_value, 0, sizeof(attr_char_value));
+
+    attr_char_value.p_uuid       = &ble_uuid;
+    attr_char_value.p_attr_md    = &attr_md;
+    attr_char_value.init_len     = 1;
+    attr_char_value.init_offs    = 0;
+    attr_char_value.max_len      = MHS_RACP_MAX_LEN;
+
+    return sd_ble_gatts_characteristic_add(p_mhs->service_handle,
+                                           &char_md,
+                                           &attr_char_value,
+                                           &p_mhs->racp_handles);
+}
+
+
+uint32_t mhs_history_characteristic_add(ble_mhs_t *p_mhs)
+{
+    ble_uuid_t          ble_uuid;
+    ble_gatts_char_md_t char_md;
+    ble_gatts_attr_md_t cccd_md;
+    ble_gatts_attr_t    attr_char_value;
+    ble_gatts_attr_md_t attr_md;
+
+    if (NULL == p_mhs)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    ble_uuid.type = p_mhs->uuid_type;
+    ble_uuid.uuid = BLE_UUID_MHS_HISTORY_CHARACTERISTIC;
+
+    memset(&cccd_md, 0, sizeof(cccd_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_OPEN(&cccd_md.write_perm);
+
+    cccd_md.vloc = BLE_GATTS_VLOC_STACK;
+
+    memset(&char_md, 0, sizeof(char_md));
+
+    char_md.char_props.notify = 1;
+    char_md.p_char_user_desc  = NULL;
+    char_md.p_char_pf         = NULL;
+    char_md.p_user_desc_md    = NULL;
+    char_md.p_cccd_md         = &cccd_md;
+    char_md.p_sccd_md         = NULL;
+
+    memset(&attr_md, 0, sizeof(attr_md));
+
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.read_perm);
+    BLE_GAP_CONN_SEC_MODE_SET_NO_ACCESS(&attr_md.write_perm);
+
+    attr_md.vloc       = BLE_GATTS_VLOC_STACK;
+    attr_md.rd_auth    = 0;
+    attr_md.wr_auth    = 0;
+    attr_md.vlen       = 1;
+
+    memset(&attr_char_value, 0, sizeof(attr_char_value));
+
+    attr_char_value.p_uuid       = &ble_uuid;
+    attr_char_value.p_attr_md    = &attr_md;
+    attr_char_value.init_len     = 1;
+    attr_char_value.init_offs    = 0;
+    attr_char_value.max_len      = MHS_HISTORY_MAX_TX_CHAR_LEN;
+
+    return sd_ble_gatts_characteristic_add(p_mhs->service_handle,
+                                           &char_md,
+                                           &attr_char_value,
+                                           &p_mhs->history_handles);
+}
+
+
 uint32_t ble_mhs_init(ble_mhs_t *p_mhs, const ble_mhs_init_t *p_mhs_init)
 {
     uint32_t   err_code;
@@ -227,14 +489,165 @@ uint32_t ble_mhs_init(ble_mhs_t *p_mhs, const ble_mhs_init_t *p_mhs_init)
         err_code = mhs_event_characteristic_add(p_mhs);
     }
 
+    // Add record access control point and temperature history characteristics.
+    if (err_code == NRF_SUCCESS)
+    {
+        err_code = mhs_racp_characteristic_add(p_mhs);
+    }
+
+    if (err_code == NRF_SUCCESS)
+    {
+        err_code = mhs_history_characteristic_add(p_mhs);
+    }
+
     return err_code;
 }
 
 
-uint32_t on_write_for_control_point_characteristic(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
+/**@brief Pass one control point command to the application.
+ *
+ * @param[in]   cmd_code    mhs_control_point_cmd_code_t.
+ * @param[in]   p_value     Command value, commands that take one use two bytes.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INVALID_PARAM for an unknown command or
+ *              NRF_ERROR_INVALID_LENGTH if the value is too short.
+ */
+static uint32_t control_point_cmd_dispatch(ble_mhs_t *p_mhs, uint8_t cmd_code,
+                                           uint8_t *p_value, uint8_t value_len)
 {
-    uint32_t error_code = NRF_SUCCESS;
     ble_mhs_evt_t evt;
+    bool has_value = true;
+
+    memset(&evt, 0, sizeof(ble_mhs_evt_t));
+    evt.ble_mhs_char = MHS_CHARACTERISTIC_CONTROL_POINT;
+
+    switch (cmd_code)
+    {
+        case MHS_CMD_CODE_GET_TEMPERATURE:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_TEMPERATURE;
+            has_value = false;
+            break;
+        case MHS_CMD_CODE_GET_TEMP_THRESHOLD:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_TEMP_SHRESHOLD;
+            has_value = false;
+            break;
+        case MHS_CMD_CODE_GET_MOTOR_SPEED:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_MOTOR_SPEED;
+            has_value = false;
+            break;
+        case MHS_CMD_CODE_SET_TEMP_THRESHOLD:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_TEMP_SHRESHOLD;
+            break;
+        case MHS_CMD_CODE_SET_MOTOR_CONTROL:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_CONTROL;
+            break;
+        case MHS_CMD_CODE_SET_MOTOR_SPEED:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_SPEED;
+            break;
+        case MHS_CMD_CODE_SET_MOTOR_OFF:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_OFF;
+            has_value = false;
+            break;
+        case MHS_CMD_CODE_SET_MUSIC_CONTROL:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MUSIC_CONTROL;
+            break;
+        case MHS_CMD_CODE_SET_MOTOR_DUTY_MASK:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_DUTY_MASK;
+            break;
+        case MHS_CMD_CODE_SET_HEAT_PARAM:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_HEAT_PARAM;
+            break;
+        case MHS_CMD_CODE_SUBSCRIBE:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SUBSCRIBE;
+            break;
+        case MHS_CMD_CODE_SET_REPORT_THRESHOLD:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_REPORT_THRESHOLD;
+            break;
+        case MHS_CMD_CODE_GET_NOTIFY_STATS:
+            evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_NOTIFY_STATS;
+            has_value = false;
+            break;
+        default:
+            return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (has_value)
+    {
+        if (value_len < CTRL_POINT_CHAR_CMD_VALUE_LEN)
+        {
+            return NRF_ERROR_INVALID_LENGTH;
+        }
+        evt.evt_params.p_event_data = p_value;
+        evt.event_data_len = CTRL_POINT_CHAR_CMD_VALUE_LEN;
+    }
+
+    p_mhs->evt_handler(p_mhs, &evt);
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Run the commands of a frame and acknowledge them with one event.
+ *
+ * @details A frame is MHS_CMD_CODE_FRAME followed by [sequence][command code][value length][value]
+ *          records. Commands run in order. A truncated record is rejected and ends the frame, the
+ *          commands after it are neither run nor acknowledged. The acknowledgement carries the
+ *          sequence number of the last command, the number of commands and a mask of the
+ *          rejected ones.
+ */
+static uint32_t control_point_frame_process(ble_mhs_t *p_mhs, uint8_t *p_data, uint16_t len)
+{
+    uint8_t ack[MHS_CMD_ACK_LEN] = {0};
+    uint8_t count = 0;
+    uint16_t index = CTRL_POINT_CHAR_CMD_CODE_LEN;
+    mhs_event_t ack_event;
+
+    while ((index < len) && (count < MHS_CMD_FRAME_MAX_CMDS))
+    {
+        uint8_t seq = p_data[index];
+        uint8_t value_len;
+
+        if ((index + MHS_CMD_FRAME_HEADER_LEN > len)
+                || (index + MHS_CMD_FRAME_HEADER_LEN + p_data[index + 2] > len))
+        {
+            ack[0] = seq;
+            ack[2] |= (uint8_t)(1u << count);
+            count++;
+            break;
+        }
+
+        value_len = p_data[index + 2];
+        if (control_point_cmd_dispatch(p_mhs, p_data[index + 1],
+                                       &p_data[index + MHS_CMD_FRAME_HEADER_LEN],
+                                       value_len) != NRF_SUCCESS)
+        {
+            ack[2] |= (uint8_t)(1u << count);
+        }
+
+        ack[0] = seq;
+        count++;
+        index += MHS_CMD_FRAME_HEADER_LEN + value_len;
+    }
+
+    if (count == 0)
+    {
+        return NRF_SUCCESS;
+    }
+
+    ack[1] = count;
+    ack_event.evt_code       = MHS_EVENT_CODE_CMD_ACK;
+    ack_event.evt_value.buff = ack;
+    ack_event.evt_value.len  = sizeof(ack);
+
+    // Like other events, a lost acknowledgement is counted in the notify statistics.
+    (void)mhs_event_characteristic_notify(ack_event);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t on_write_for_control_point_characteristic(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
+{
     ble_gatts_evt_write_t *p_evt_write;
 
     if ((p_mhs == NULL) || (p_ble_evt == NULL) || (p_mhs->evt_handler == NULL))
@@ -244,57 +657,35 @@ uint32_t on_write_for_control_point_characteristic(ble_mhs_t *p_mhs, ble_evt_t *
 
     p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
 
-    if ((CTRL_POINT_CHAR_CMD_CODE_LEN == p_evt_write->len)
-            || (CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN == p_evt_write->len))
+    if ((p_evt_write->len >= CTRL_POINT_CHAR_CMD_CODE_LEN)
+            && (p_evt_write->data[0] == MHS_CMD_CODE_FRAME))
     {
-        memset(&evt, 0, sizeof(ble_mhs_evt_t));
-        evt.ble_mhs_char = MHS_CHARACTERISTIC_CONTROL_POINT;
+        return control_point_frame_process(p_mhs, p_evt_write->data, p_evt_write->len);
+    }
 
-        switch (m_mhs_control_point.cmd_code)
-        {
-            case MHS_CMD_CODE_GET_TEMPERATURE:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_TEMPERATURE;
-                break;
-            case MHS_CMD_CODE_GET_TEMP_THRESHOLD:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_TEMP_SHRESHOLD;
-                break;
-            case MHS_CMD_CODE_GET_MOTOR_SPEED:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_GET_MOTOR_SPEED;
-                break;
-            case MHS_CMD_CODE_SET_TEMP_THRESHOLD:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_TEMP_SHRESHOLD;
-                evt.evt_params.p_event_data = (uint8_t *)&m_mhs_control_point.cmd_value;
-                evt.event_data_len = sizeof(m_mhs_control_point.cmd_value);
-                break;
-            case MHS_CMD_CODE_SET_MOTOR_CONTROL:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_CONTROL;
-                evt.evt_params.p_event_data = (uint8_t *)&m_mhs_control_point.cmd_value;
-                evt.event_data_len = sizeof(m_mhs_control_point.cmd_value);
-                break;
-            case MHS_CMD_CODE_SET_MOTOR_SPEED:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_SPEED;
-                evt.evt_params.p_event_data = (uint8_t *)&m_mhs_control_point.cmd_value;
-                evt.event_data_len = sizeof(m_mhs_control_point.cmd_value);
-                break;
-            case MHS_CMD_CODE_SET_MOTOR_OFF:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_OFF;
-                break;
-            case MHS_CMD_CODE_SET_MUSIC_CONTROL:
-                evt.evt_type.control_char_evt = BLE_MHS_CONTROL_CHAR_EVT_SET_MUSIC_CONTROL;
-                evt.evt_params.p_event_data = (uint8_t *)&m_mhs_control_point.cmd_value;
-                evt.event_data_len = sizeof(m_mhs_control_point.cmd_value);
-                break;
-            default:
-                return NRF_ERROR_INVALID_PARAM;
-        }
-        p_mhs->evt_handler(p_mhs, &evt);
+    return ble_mhs_control_point_cmd_run(p_mhs, p_evt_write->data, p_evt_write->len);
+}
+
+
+uint32_t ble_mhs_control_point_cmd_run(ble_mhs_t *p_mhs, uint8_t *p_cmd, uint8_t len)
+{
+    uint8_t value[CTRL_POINT_CHAR_CMD_VALUE_LEN] = {0};
+
+    if ((p_mhs == NULL) || (p_cmd == NULL) || (p_mhs->evt_handler == NULL))
+    {
+        return NRF_ERROR_NULL;
     }
-    else
+
+    if ((CTRL_POINT_CHAR_CMD_CODE_LEN != len)
+            && (CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN != len))
     {
-        error_code = NRF_ERROR_INTERNAL;
+        return NRF_ERROR_INTERNAL;
     }
 
-    return error_code;
+    memcpy(value, &p_cmd[CTRL_POINT_CHAR_CMD_CODE_LEN], len - CTRL_POINT_CHAR_CMD_CODE_LEN);
+
+    // The real value length, so a command that needs a value is rejected without one.
+    return control_point_cmd_dispatch(p_mhs, p_cmd[0], value, len - CTRL_POINT_CHAR_CMD_CODE_LEN);
 }
 
 
@@ -344,6 +735,64 @@ uint32_t on_write_for_event_characteristic(ble_mhs_t *p_mhs, ble_evt_t *p_ble_ev
 }
 
 
+uint32_t on_write_for_racp_characteristic(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
+{
+    ble_mhs_evt_t evt;
+    ble_gatts_evt_write_t *p_evt_write;
+
+    if ((p_mhs == NULL) || (p_ble_evt == NULL) || (p_mhs->evt_handler == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+
+    memset(&evt, 0, sizeof(ble_mhs_evt_t));
+    evt.ble_mhs_char = MHS_CHARACTERISTIC_RACP;
+    evt.evt_type.racp_char_evt = BLE_MHS_RACP_CHAR_EVT_WRITE;
+    evt.evt_params.p_event_data = p_evt_write->data;
+    evt.event_data_len = p_evt_write->len;
+
+    p_mhs->evt_handler(p_mhs, &evt);
+
+    return NRF_SUCCESS;
+}
+
+
+uint32_t on_write_for_history_characteristic(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
+{
+    ble_mhs_evt_t evt;
+    ble_gatts_evt_write_t *p_evt_write;
+
+    if ((p_mhs == NULL) || (p_ble_evt == NULL) || (p_mhs->evt_handler == NULL))
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+
+    if (EVT_NOTIFICATION_WRITE_LEN != p_evt_write->len)
+    {
+        return NRF_ERROR_INTERNAL;
+    }
+
+    memset(&evt, 0, sizeof(ble_mhs_evt_t));
+    evt.ble_mhs_char = MHS_CHARACTERISTIC_HISTORY;
+
+    if (ble_srv_is_notification_enabled(p_evt_write->data))
+    {
+        evt.evt_type.history_char_evt = BLE_MHS_HISTORY_CHAR_EVT_ENABLED;
+    }
+    else
+    {
+        evt.evt_type.history_char_evt = BLE_MHS_HISTORY_CHAR_EVT_DISABLED;
+    }
+
+    p_mhs->evt_handler(p_mhs, &evt);
+
+    return NRF_SUCCESS;
+}
+
 
 void ble_mhs_on_ble_evt(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
 {
@@ -366,23 +815,43 @@ void ble_mhs_on_ble_evt(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
             case BLE_GATTS_EVT_WRITE:
             {
                 ble_gatts_evt_write_t *p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
+                uint32_t err_code = NRF_SUCCESS;
 
                 if (p_evt_write->handle == p_mhs->event_handles.cccd_handle)
                 {
-                    APP_ERROR_CHECK(on_write_for_event_characteristic(p_mhs, p_ble_evt));
+                    err_code = on_write_for_event_characteristic(p_mhs, p_ble_evt);
                 }
                 else if (p_evt_write->handle == p_mhs->control_point_handles.value_handle)
                 {
-                    APP_ERROR_CHECK(on_write_for_control_point_characteristic(p_mhs, p_ble_evt));
+                    err_code = on_write_for_control_point_characteristic(p_mhs, p_ble_evt);
+                }
+                else if (p_evt_write->handle == p_mhs->racp_handles.value_handle)
+                {
+                    err_code = on_write_for_racp_characteristic(p_mhs, p_ble_evt);
+                }
+                else if (p_evt_write->handle == p_mhs->history_handles.cccd_handle)
+                {
+                    err_code = on_write_for_history_characteristic(p_mhs, p_ble_evt);
                 }
                 else
                 {
                     // This event is not relevant to mode characteristic.
                     // No implementation needed.
                 }
+
+                // Any peer can write, a bad write is dropped instead of resetting the device.
+                if (err_code != NRF_SUCCESS)
+                {
+                    SEGGER_RTT_printf(0, "mhs write to handle %d dropped %p\r\n",
+                                      p_evt_write->handle, err_code);
+                }
             }
             break;
 
+            case BLE_EVT_TX_COMPLETE:
+                on_tx_complete(p_mhs);
+                break;
+
             case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
             {
                 ble_gatts_evt_rw_authorize_request_t *p_evt_rw_authorize;
@@ -411,9 +880,7 @@ void ble_mhs_on_ble_evt(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt)
 uint32_t mhs_event_characteristic_notify(mhs_event_t event)
 {
     ble_mhs_t *p_mhs = get_mhs_obj();
-    uint16_t len = 0;
-    uint8_t  data_buff[MHS_EVENT_MAX_TX_CHAR_LEN] = {0};
-    ble_gatts_hvx_params_t hvx_params;
+    mhs_event_entry_t *p_entry;
 
     if (NULL == p_mhs)
     {
@@ -425,37 +892,68 @@ uint32_t mhs_event_characteristic_notify(mhs_event_t event)
         return NRF_ERROR_INVALID_STATE;
     }
 
-    memcpy(data_buff, &event.evt_code, sizeof(mhs_event_code_t));
-    len = sizeof(mhs_event_code_t);
-
-    if (event.evt_value.len > MHS_EVENT_MAX_TX_CHAR_LEN)
+    if (event.evt_value.len > MHS_EVENT_MAX_VALUE_LEN)
     {
         return APP_ERROR_INVALID_LENGTH;
     }
 
+    if ((0 != event.evt_value.len) && (NULL == event.evt_value.buff))
+    {
+        return APP_ERROR_NULL;
+    }
+
+    if (m_event_queue_count == MHS_EVENT_QUEUE_SIZE)
+    {
+        m_notify_stats.dropped++;
+        return NRF_ERROR_NO_MEM;
+    }
+
+    p_entry = &m_event_queue[(m_event_queue_first + m_event_queue_count) % MHS_EVENT_QUEUE_SIZE];
+    p_entry->code = (uint8_t)event.evt_code;
+    p_entry->len  = event.evt_value.len;
     if (0 != event.evt_value.len)
     {
-        if (NULL != event.evt_value.buff)
-        {
-            memcpy(&data_buff[len], event.evt_value.buff, event.evt_value.len);
-            len += event.evt_value.len;
-        }
-        else
-        {
-            return APP_ERROR_NULL;
-        }
+        memcpy(p_entry->value, event.evt_value.buff, event.evt_value.len);
     }
-    else
+
+    m_event_queue_count++;
+    if (m_event_queue_count > m_notify_stats.queue_max_depth)
     {
-        // Only send the event code.
+        m_notify_stats.queue_max_depth = m_event_queue_count;
     }
 
-    memset(&hvx_params, 0, sizeof(hvx_params));
+    event_queue_process();
 
-    hvx_params.handle   = p_mhs->event_handles.value_handle;
-    hvx_params.type     = BLE_GATT_HVX_NOTIFICATION;
-    hvx_params.p_len    = &len;
-    hvx_params.p_data   = data_buff;
+    return NRF_SUCCESS;
+}
 
-    return sd_ble_gatts_hvx(p_mhs->conn_handle, &hvx_params);
+
+void mhs_notify_stats_get(mhs_notify_stats_t *p_stats)
+{
+    *p_stats             = m_notify_stats;
+    p_stats->queue_depth = m_event_queue_count;
+}
+
+
+uint32_t mhs_history_characteristic_notify(uint8_t *p_data, uint16_t len)
+{
+    if (len > MHS_HISTORY_MAX_TX_CHAR_LEN)
+    {
+        return APP_ERROR_INVALID_LENGTH;
+    }
+
+    return characteristic_hvx(get_mhs_obj()->history_handles.value_handle,
+                              BLE_GATT_HVX_NOTIFICATION, p_data, len);
+}
+
+
+uint32_t mhs_racp_characteristic_indicate(uint8_t *p_data, uint16_t len)
+{
+    if (len > MHS_RACP_MAX_LEN)
+    {
+        return APP_ERROR_INVALID_LENGTH;
+    }
+
+    return characteristic_hvx(get_mhs_obj()->racp_handles.value_handle,
+                              BLE_GATT_HVX_INDICATION, p_data, len);
 }
@@ -19,13 +19,30 @@
 #define BLE_UUID_MHS_SERVICE                                0x0200
 #define BLE_UUID_MHS_CONTROL_POINT_CHARACTERISTIC           0x0201
 #define BLE_UUID_MHS_EVENT_CHARACTERISTIC                   0x0202
+#define BLE_UUID_MHS_RACP_CHARACTERISTIC                    0x0203
+#define BLE_UUID_MHS_HISTORY_CHARACTERISTIC                 0x0204
+
+// Bump when the GATT database layout changes, bonded centrals are sent Service Changed then.
+#define MHS_DB_VERSION                                      1
 
 #define EVT_NOTIFICATION_WRITE_LEN                          2
 #define MHS_EVENT_MAX_TX_CHAR_LEN                           20
+#define MHS_EVENT_HEADER_LEN                                2       // Event code and value length.
+#define MHS_EVENT_MAX_VALUE_LEN                             8
+#define MHS_EVENT_QUEUE_SIZE                                16
+#define MHS_RACP_MAX_LEN                                    20
+#define MHS_HISTORY_MAX_TX_CHAR_LEN                         20
 
 // Length of command that received from host application.
 #define CTRL_POINT_CHAR_CMD_CODE_LEN                        1
 #define CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN              3
+#define CTRL_POINT_CHAR_CMD_VALUE_LEN                       2
+#define MHS_CTRL_POINT_MAX_LEN                              20
+
+// Command frame: MHS_CMD_CODE_FRAME, then [sequence][command code][value length][value] records.
+#define MHS_CMD_FRAME_HEADER_LEN                            3
+#define MHS_CMD_FRAME_MAX_CMDS                              8       // Bits in the rejected mask.
+#define MHS_CMD_ACK_LEN                                     3
 
 typedef struct mhs_event_control_point_cmd_s
 {
@@ -44,8 +61,22 @@ typedef enum mhs_control_point_cmd_code_e
     MHS_CMD_CODE_SET_MOTOR_SPEED                 = 0x06,
     MHS_CMD_CODE_SET_MOTOR_OFF                   = 0x07,
     MHS_CMD_CODE_SET_MUSIC_CONTROL               = 0x08,
+    MHS_CMD_CODE_SET_MOTOR_DUTY_MASK             = 0x09,     // Value: [channel mask, duty cycle]
+    MHS_CMD_CODE_SET_HEAT_PARAM                  = 0x0A,     // Value: [heat_param_t, value]
+    MHS_CMD_CODE_SUBSCRIBE                       = 0x0B,     // Value: [mhs_telemetry_signal_t, interval s, 0 stops]
+    MHS_CMD_CODE_SET_REPORT_THRESHOLD            = 0x0C,     // Value: [mhs_telemetry_signal_t, least change]
+    MHS_CMD_CODE_GET_NOTIFY_STATS                = 0x0D,
+    MHS_CMD_CODE_FRAME                           = 0x80,     // Several commands, may be written without response.
 } mhs_control_point_cmd_code_t;
 
+/**@brief   Signals that can be subscribed to, they are notified as mhs_event_code_t events. */
+typedef enum mhs_telemetry_signal_e
+{
+    MHS_TELEMETRY_SIGNAL_TEMPERATURE = 0,           // MHS_EVENT_CODE_CURRENT_TEMPERATURE, threshold in 1/16 degrees
+    MHS_TELEMETRY_SIGNAL_MOTOR_SPEED,               // MHS_EVENT_CODE_MOTOR_SPEED, threshold in percent
+    MHS_TELEMETRY_SIGNAL_COUNT,
+} mhs_telemetry_signal_t;
+
 typedef struct mhs_control_point_cmd_s
 {
     mhs_control_point_cmd_code_t   cmd_code;        // Command code
@@ -58,6 +89,8 @@ typedef enum ble_mhs_characteristic_e
     MHS_CHARACTERISTIC_INVALID = 0,
     MHS_CHARACTERISTIC_EVENT,
     MHS_CHARACTERISTIC_CONTROL_POINT,
+    MHS_CHARACTERISTIC_RACP,
+    MHS_CHARACTERISTIC_HISTORY,
 } ble_mhs_characteristic_t;
 
 // Forward declaration of the ble_mhs_t type.
@@ -74,6 +107,11 @@ typedef enum ble_mhs_control_char_evt_e
     BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_SPEED,
     BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_OFF,
     BLE_MHS_CONTROL_CHAR_EVT_SET_MUSIC_CONTROL,
+    BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_DUTY_MASK,
+    BLE_MHS_CONTROL_CHAR_EVT_SET_HEAT_PARAM,
+    BLE_MHS_CONTROL_CHAR_EVT_SUBSCRIBE,
+    BLE_MHS_CONTROL_CHAR_EVT_SET_REPORT_THRESHOLD,
+    BLE_MHS_CONTROL_CHAR_EVT_GET_NOTIFY_STATS,
 } ble_mhs_control_char_evt_t;
 
 /**@brief Sony Advanced Accessory Host Service event characteristic event type. */
@@ -83,6 +121,20 @@ typedef enum ble_mhs_event_char_evt_e
     BLE_MHS_EVENT_CHAR_EVT_DISABLED,         // Event to disable event characteristic.
 } ble_mhs_event_char_evt_t;
 
+/**@brief Record access control point characteristic event type. */
+typedef enum ble_mhs_racp_char_evt_e
+{
+    BLE_MHS_RACP_CHAR_EVT_WRITE,             // Request written, see evt_params.
+} ble_mhs_racp_char_evt_t;
+
+/**@brief Temperature history characteristic event type. */
+typedef enum ble_mhs_history_char_evt_e
+{
+    BLE_MHS_HISTORY_CHAR_EVT_ENABLED,        // Notifications enabled.
+    BLE_MHS_HISTORY_CHAR_EVT_DISABLED,       // Notifications disabled, or disconnected.
+    BLE_MHS_HISTORY_CHAR_EVT_TX_COMPLETE,    // Notification buffers were freed.
+} ble_mhs_history_char_evt_t;
+
 /**@brief Sony Advanced Accessory Host Service event structure. This contains the
  *        event type, event data and data length.
  */
@@ -93,6 +145,8 @@ typedef struct ble_mhs_evt_s
     {
         ble_mhs_event_char_evt_t   event_char_evt;  // Event characteristic event.
         ble_mhs_control_char_evt_t control_char_evt;// Control point characteristic event.
+        ble_mhs_racp_char_evt_t    racp_char_evt;   // Record access control point event.
+        ble_mhs_history_char_evt_t history_char_evt;// Temperature history characteristic event.
     } evt_type;
     union evt_params
     {
@@ -109,6 +163,8 @@ typedef struct ble_mhs_s
     uint16_t                 service_handle;
     ble_gatts_char_handles_t event_handles;
     ble_gatts_char_handles_t control_point_handles;
+    ble_gatts_char_handles_t racp_handles;
+    ble_gatts_char_handles_t history_handles;
     uint16_t                 conn_handle;
     ble_mhs_evt_handler_t    evt_handler;
 } ble_mhs_t;
@@ -121,11 +177,23 @@ typedef struct ble_mhs_init_s
 
 typedef enum mhs_event_code_e
 {
-    MHS_EVENT_CODE_CURRENT_TEMPERATURE = 0,
-    MHS_EVENT_CODE_TEMP_THRESHOLD,
-    MHS_EVENT_CODE_MOTOR_SPEED,
+    MHS_EVENT_CODE_CURRENT_TEMPERATURE = 0,         // int16, 1/16 degrees
+    MHS_EVENT_CODE_TEMP_THRESHOLD,                  // int16, whole degrees
+    MHS_EVENT_CODE_MOTOR_SPEED,                     // uint16, percent
+    MHS_EVENT_CODE_SENSOR_TEMPERATURE,              // uint8 sensor index, int16 1/16 degrees
+    MHS_EVENT_CODE_NOTIFY_STATS,                    // mhs_notify_stats_t
+    MHS_EVENT_CODE_CMD_ACK,                         // uint8 last sequence, uint8 count, uint8 rejected mask
 } mhs_event_code_t;
 
+/**@brief Event notification counters. */
+typedef struct mhs_notify_stats_s
+{
+    uint8_t  queue_depth;                           // Events waiting for a notification buffer.
+    uint8_t  queue_max_depth;                       // Highest depth seen.
+    uint16_t dropped;                               // Events dropped: queue full, or not notified.
+    uint16_t packets;                               // Notifications sent.
+} __attribute__((__packed__)) mhs_notify_stats_t;
+
 typedef struct mhs_event_value_s
 {
     uint8_t *buff;                    // Pointer point to data needed to be sent.
@@ -166,6 +234,41 @@ uint32_t ble_mhs_init(ble_mhs_t *p_mhs, const ble_mhs_init_t *p_mhs_init);
 void ble_mhs_on_ble_evt(ble_mhs_t *p_mhs, ble_evt_t *p_ble_evt);
 
 
+/**@brief       Run one control point command that did not come from a write, e.g. a broadcast.
+ *
+ * @param[in]   p_mhs      MHS structure.
+ * @param[in]   p_cmd      Command code, followed by the two value bytes if the command has a value.
+ * @param[in]   len        1 or 3. Frames are not accepted here.
+ *
+ * @return      NRF_SUCCESS, NRF_ERROR_INTERNAL for a bad length, NRF_ERROR_INVALID_LENGTH for a
+ *              command without the value it needs, otherwise as for a control point write.
+ */
+uint32_t ble_mhs_control_point_cmd_run(ble_mhs_t *p_mhs, uint8_t *p_cmd, uint8_t len);
+
+/**@brief       Queue an event for notification.
+ *
+ * @details     Queued events are notified as soon as the SoftDevice has buffers, several per
+ *              notification as [code][value length][value] records. Callers need not check the
+ *              result, dropped events are counted, see mhs_notify_stats_get().
+ *
+ * @return      NRF_SUCCESS if queued, NRF_ERROR_INVALID_STATE if not connected,
+ *              NRF_ERROR_NO_MEM if the queue is full, otherwise an error code.
+ */
 uint32_t mhs_event_characteristic_notify(mhs_event_t event);
 
+/**@brief       Get the event notification counters.
+ */
+void mhs_notify_stats_get(mhs_notify_stats_t *p_stats);
+
+/**@brief       Notify temperature history records.
+ *
+ * @return      NRF_SUCCESS, BLE_ERROR_NO_TX_BUFFERS if the SoftDevice buffers are full,
+ *              otherwise an error code.
+ */
+uint32_t mhs_history_characteristic_notify(uint8_t *p_data, uint16_t len);
+
+/**@brief       Indicate a record access control point response.
+ */
+uint32_t mhs_racp_characteristic_indicate(uint8_t *p_data, uint16_t len);
+
 #endif // BLE_MHS_H_
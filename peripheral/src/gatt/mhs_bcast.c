@@ -0,0 +1,598 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include <app_error.h>
+#include <app_scheduler.h>
+#include <app_util.h>
+#include <app_util_platform.h>
+#include <nordic_common.h>
+#include <nrf_soc.h>
+#include <pstorage.h>
+
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+
+#include "ble_gap.h"
+#include "ble_mhs.h"
+#include "mhs_proxy.h"
+#include "motor.h"
+
+#include "SEGGER_RTT.h"
+
+#include "mhs_bcast.h"
+
+// The group key, the same on the central and on every unit of an installation, is not part of
+// the sources. make takes it in MHS_BCAST_KEY, see the Makefile.
+#ifndef MHS_BCAST_KEY
+#error "MHS_BCAST_KEY, the 16 byte key of the installation, is not set"
+#endif
+
+#define BCAST_SIGNED_LEN            (MHS_BCAST_DATA_LEN - MHS_BCAST_MAC_LEN)
+
+// Sequence log: two flash pages, sequence numbers appended word by word to the current one.
+// When it is full the log goes on in the other page, which is erased after the first write, so
+// a reset never finds both empty.
+#define BCAST_SEQ_LOG_BLOCK_SIZE    1024                        /**< One flash page. */
+#define BCAST_SEQ_LOG_BLOCK_COUNT   2
+#define BCAST_SEQ_LOG_WORDS         (BCAST_SEQ_LOG_BLOCK_SIZE / sizeof(uint32_t))
+#define BCAST_SEQ_ERASED            0xFFFFFFFF                  /**< Word read from erased flash, never sent. */
+
+static const uint8_t                            m_key[SOC_ECB_KEY_LENGTH] = MHS_BCAST_KEY;
+
+static pstorage_handle_t                        m_seq_storage;
+static uint32_t                                 m_seq_last;                 /**< Newest sequence number run. */
+static bool                                     m_seq_known = false;        /**< Nothing run yet on a new unit. */
+static uint32_t                                 m_seq_stored = BCAST_SEQ_ERASED;  /**< Buffer of the flash write. */
+static uint8_t                                  m_seq_log_block = 0;
+static uint16_t                                 m_seq_log_next = 0;         /**< Next free word of the log block. */
+static uint8_t                                  m_seq_flash_ops = 0;        /**< pstorage operations not completed yet. */
+
+#ifdef MHS_BCAST
+#define BCAST_IRQn                  SWI3_IRQn                   /**< Hands a received packet from the timeslot to the main loop. */
+#define BCAST_IRQHandler            SWI3_IRQHandler
+#define BCAST_SLOT_END_MARGIN_US    200                         /**< Radio off this long before the window ends. */
+
+#define ADV_ACCESS_ADDRESS_BASE     0x89BED600
+#define ADV_ACCESS_ADDRESS_PREFIX   0x8E
+#define ADV_CRC_POLY                0x00065B
+#define ADV_CRC_INIT                0x555555
+#define ADV_PDU_HEADER_LEN          2                           /**< PDU type, then payload length. */
+#define ADV_PDU_MAX_PAYLOAD         37
+#define ADV_PDU_TYPE_MASK           0x0F
+#define ADV_PDU_LEN_MASK            0x3F
+#define ADV_PDU_TYPE_NONCONN_IND    0x02
+#define ADV_ADDR_LEN                6
+
+static const uint8_t                            m_channel_freq[] = {2, 26, 80};  /**< Advertising channels 37, 38 and 39, MHz above 2400. */
+
+static uint8_t                                  m_channel_index;
+static nrf_radio_request_t                      m_request;
+static nrf_radio_signal_callback_return_param_t m_signal_return;
+static uint8_t                                  m_rx_pdu[ADV_PDU_HEADER_LEN + ADV_PDU_MAX_PAYLOAD];  /**< Radio receive buffer. */
+static uint8_t                                  m_pdu[ADV_PDU_HEADER_LEN + ADV_PDU_MAX_PAYLOAD];     /**< Last packet, waiting for the main loop. */
+static volatile bool                            m_pdu_pending = false;
+#endif // MHS_BCAST
+
+
+/**@brief Get a block of the sequence log in flash.
+ */
+static const uint32_t * seq_log_get(uint8_t block)
+{
+    uint32_t          err_code;
+    pstorage_handle_t handle;
+
+    err_code = pstorage_block_identifier_get(&m_seq_storage, block, &handle);
+    APP_ERROR_CHECK(err_code);
+
+    return (const uint32_t *)handle.block_id;
+}
+
+
+/**@brief Count the words written to a block of the sequence log.
+ */
+static uint16_t seq_log_used(uint8_t block)
+{
+    const uint32_t * p_log = seq_log_get(block);
+    uint16_t         used  = 0;
+
+    while ((used < BCAST_SEQ_LOG_WORDS) && (p_log[used] != BCAST_SEQ_ERASED))
+    {
+        used++;
+    }
+
+    return used;
+}
+
+
+/**@brief Write the newest sequence number to the log, unless a write is still pending. The
+ *        pstorage callback writes again once it is done if a newer number was run meanwhile.
+ */
+static void seq_log_write(void)
+{
+    uint32_t          err_code;
+    pstorage_handle_t block;
+    uint8_t           full_block;
+
+    if ((m_seq_flash_ops != 0) || !m_seq_known || (m_seq_stored == m_seq_last))
+    {
+        return;
+    }
+
+    m_seq_stored = m_seq_last;
+
+    if (m_seq_log_next < BCAST_SEQ_LOG_WORDS)
+    {
+        err_code = pstorage_block_identifier_get(&m_seq_storage, m_seq_log_block, &block);
+        APP_ERROR_CHECK(err_code);
+        err_code = pstorage_store(&block, (uint8_t *)&m_seq_stored, sizeof(m_seq_stored),
+                                  m_seq_log_next * sizeof(uint32_t));
+        APP_ERROR_CHECK(err_code);
+        m_seq_flash_ops++;
+        m_seq_log_next++;
+        return;
+    }
+
+    // Full, go on in the other block and only then erase this one.
+    full_block        = m_seq_log_block;
+    m_seq_log_block   = (m_seq_log_block + 1) % BCAST_SEQ_LOG_BLOCK_COUNT;
+    m_seq_log_next    = 1;
+
+    err_code = pstorage_block_identifier_get(&m_seq_storage, m_seq_log_block, &block);
+    APP_ERROR_CHECK(err_code);
+    err_code = pstorage_store(&block, (uint8_t *)&m_seq_stored, sizeof(m_seq_stored), 0);
+    APP_ERROR_CHECK(err_code);
+    m_seq_flash_ops++;
+
+    err_code = pstorage_block_identifier_get(&m_seq_storage, full_block, &block);
+    APP_ERROR_CHECK(err_code);
+    err_code = pstorage_clear(&block, BCAST_SEQ_LOG_BLOCK_SIZE);
+    APP_ERROR_CHECK(err_code);
+    m_seq_flash_ops++;
+}
+
+
+static void seq_storage_cb(pstorage_handle_t * p_handle,
+                           uint8_t             op_code,
+                           uint32_t            result,
+                           uint8_t           * p_data,
+                           uint32_t            data_len)
+{
+    if (result != NRF_SUCCESS)
+    {
+        SEGGER_RTT_printf(0, "broadcast seq flash op %d failed %p\r\n", op_code, result);
+    }
+
+    if (m_seq_flash_ops > 0)
+    {
+        m_seq_flash_ops--;
+    }
+
+    if (m_seq_flash_ops == 0)
+    {
+        seq_log_write();
+    }
+}
+
+
+/**@brief Register the sequence log and continue from the newest number in it.
+ */
+static void seq_log_init(void)
+{
+    uint32_t                err_code;
+    pstorage_module_param_t param;
+    pstorage_handle_t       block;
+    uint16_t                used[BCAST_SEQ_LOG_BLOCK_COUNT];
+    uint32_t                last[BCAST_SEQ_LOG_BLOCK_COUNT];
+    uint8_t                 old_block;
+
+    param.block_size  = BCAST_SEQ_LOG_BLOCK_SIZE;
+    param.block_count = BCAST_SEQ_LOG_BLOCK_COUNT;
+    param.cb          = seq_storage_cb;
+
+    err_code = pstorage_register(&param, &m_seq_storage);
+    APP_ERROR_CHECK(err_code);
+
+    for (uint8_t i = 0; i < BCAST_SEQ_LOG_BLOCK_COUNT; i++)
+    {
+        used[i] = seq_log_used(i);
+        last[i] = (used[i] > 0) ? seq_log_get(i)[used[i] - 1] : BCAST_SEQ_ERASED;
+    }
+
+    if ((used[0] == 0) && (used[1] == 0))
+    {
+        SEGGER_RTT_printf(0, "broadcast seq log empty\r\n");
+        return;
+    }
+
+    // Both in use only after a reset between the first write to a block and erasing the other.
+    if ((used[0] > 0) && ((used[1] == 0) || ((int32_t)(last[0] - last[1]) > 0)))
+    {
+        m_seq_log_block = 0;
+    }
+    else
+    {
+        m_seq_log_block = 1;
+    }
+
+    m_seq_log_next = used[m_seq_log_block];
+    m_seq_last     = last[m_seq_log_block];
+    m_seq_stored   = m_seq_last;
+    m_seq_known    = true;
+
+    old_block = (m_seq_log_block + 1) % BCAST_SEQ_LOG_BLOCK_COUNT;
+    if (used[old_block] > 0)
+    {
+        err_code = pstorage_block_identifier_get(&m_seq_storage, old_block, &block);
+        APP_ERROR_CHECK(err_code);
+        err_code = pstorage_clear(&block, BCAST_SEQ_LOG_BLOCK_SIZE);
+        APP_ERROR_CHECK(err_code);
+        m_seq_flash_ops++;
+    }
+
+    SEGGER_RTT_printf(0, "broadcast seq %u\r\n", m_seq_last);
+}
+
+
+/**@brief Check whether a sequence number is newer than every one run so far. Numbers compare
+ *        modulo 2^32, so the counter of the central may wrap.
+ */
+static bool seq_is_new(uint32_t seq)
+{
+    if (seq == BCAST_SEQ_ERASED)
+    {
+        return false;
+    }
+
+    return (!m_seq_known || ((int32_t)(seq - m_seq_last) > 0));
+}
+
+
+/**@brief Remember a sequence number that was run, in RAM at once and in flash when the flash
+ *        is free, so older broadcasts are refused after a reset too.
+ */
+static void seq_store(uint32_t seq)
+{
+    m_seq_last  = seq;
+    m_seq_known = true;
+    seq_log_write();
+}
+
+
+/**@brief Check the MAC of a broadcast.
+ */
+static bool mac_is_valid(const uint8_t * p_data)
+{
+    nrf_ecb_hal_data_t ecb;
+    uint32_t           err_code;
+
+    memcpy(ecb.key, m_key, sizeof(ecb.key));
+    memset(ecb.cleartext, 0, sizeof(ecb.cleartext));
+    memcpy(ecb.cleartext, p_data, BCAST_SIGNED_LEN);
+
+    err_code = sd_ecb_block_encrypt(&ecb);
+    APP_ERROR_CHECK(err_code);
+
+    return (memcmp(ecb.ciphertext, &p_data[BCAST_SIGNED_LEN], MHS_BCAST_MAC_LEN) == 0);
+}
+
+
+/**@brief Check a command before it runs without a connection: its length, and the values the
+ *        handlers index with. Requests are answered by notifications and subscriptions report
+ *        over the link, both need the central connected and are refused.
+ */
+static bool cmd_is_valid(const uint8_t * p_cmd, uint8_t len)
+{
+    switch (p_cmd[0])
+    {
+        case MHS_CMD_CODE_SET_MOTOR_OFF:
+            return (len == CTRL_POINT_CHAR_CMD_CODE_LEN);
+
+        case MHS_CMD_CODE_SET_MOTOR_CONTROL:
+            return (len == CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN)
+                && (p_cmd[1] <= MOTOR_INDEX_8)
+                && (p_cmd[2] <= MOTOR_DIRECTION_ANTICLOCK);
+
+        case MHS_CMD_CODE_SET_MOTOR_SPEED:
+            return (len == CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN)
+                && (p_cmd[1] <= MOTOR_DUTY_CYCLE_MAX);
+
+        case MHS_CMD_CODE_SET_MOTOR_DUTY_MASK:
+            return (len == CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN)
+                && (p_cmd[2] <= MOTOR_DUTY_CYCLE_MAX);
+
+        case MHS_CMD_CODE_SET_TEMP_THRESHOLD:
+        case MHS_CMD_CODE_SET_MUSIC_CONTROL:
+        case MHS_CMD_CODE_SET_HEAT_PARAM:
+        case MHS_CMD_CODE_SET_REPORT_THRESHOLD:
+            // Their handlers range check the values themselves.
+            return (len == CTRL_POINT_CHAR_CMD_CODE_AND_VALUE_LEN);
+
+        default:
+            return false;
+    }
+}
+
+
+void mhs_bcast_data_process(const uint8_t * p_data)
+{
+    uint8_t  group   = p_data[1];
+    uint32_t seq     = uint32_decode(&p_data[2]);
+    uint8_t  cmd_len = p_data[6];
+    uint8_t  cmd[MHS_BCAST_CMD_MAX_LEN];
+    uint32_t err_code;
+
+    if ((p_data[0] != MHS_BCAST_VERSION)
+            || ((group != MHS_BCAST_GROUP) && (group != MHS_BCAST_GROUP_ALL))
+            || (cmd_len == 0) || (cmd_len > MHS_BCAST_CMD_MAX_LEN))
+    {
+        return;
+    }
+
+    // The central repeats a broadcast for a while and ESB retransmits, only the first copy runs.
+    // Recorded or old commands replayed later are not newer than the last one run either.
+    if (!seq_is_new(seq))
+    {
+        return;
+    }
+
+    if (!mac_is_valid(p_data))
+    {
+        SEGGER_RTT_printf(0, "broadcast %u bad mac\r\n", seq);
+        return;
+    }
+    seq_store(seq);
+
+    memcpy(cmd, &p_data[7], cmd_len);
+    if (!cmd_is_valid(cmd, cmd_len))
+    {
+        SEGGER_RTT_printf(0, "broadcast %u cmd %d refused\r\n", seq, cmd[0]);
+        return;
+    }
+
+    err_code = ble_mhs_control_point_cmd_run(get_mhs_obj(), cmd, cmd_len);
+    SEGGER_RTT_printf(0, "broadcast %u cmd %d: %d\r\n", seq, cmd[0], err_code);
+}
+
+
+#ifdef MHS_BCAST
+/**@brief Ask for a window as soon as possible, after a blocked or canceled one.
+ */
+static void request_earliest(void)
+{
+    uint32_t err_code;
+
+    m_request.request_type               = NRF_RADIO_REQ_TYPE_EARLIEST;
+    m_request.params.earliest.hfclk      = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.earliest.priority   = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.earliest.length_us  = MHS_BCAST_SLOT_US;
+    m_request.params.earliest.timeout_us = MHS_BCAST_PERIOD_US;
+
+    err_code = sd_radio_request(&m_request);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Set the next window one period after the start of the current one.
+ */
+static void request_next_set(void)
+{
+    m_request.request_type              = NRF_RADIO_REQ_TYPE_NORMAL;
+    m_request.params.normal.hfclk       = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.normal.priority    = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.normal.distance_us = MHS_BCAST_PERIOD_US;
+    m_request.params.normal.length_us   = MHS_BCAST_SLOT_US;
+}
+
+
+/**@brief Receive advertising packets on one channel, the way the SoftDevice would.
+ */
+static void radio_rx_start(void)
+{
+    uint8_t channel = m_channel_index + 37;
+
+    if ((NRF_FICR->OVERRIDEEN & FICR_OVERRIDEEN_BLE_1MBIT_Msk)
+            == (FICR_OVERRIDEEN_BLE_1MBIT_Override << FICR_OVERRIDEEN_BLE_1MBIT_Pos))
+    {
+        NRF_RADIO->OVERRIDE0 = NRF_FICR->BLE_1MBIT[0];
+        NRF_RADIO->OVERRIDE1 = NRF_FICR->BLE_1MBIT[1];
+        NRF_RADIO->OVERRIDE2 = NRF_FICR->BLE_1MBIT[2];
+        NRF_RADIO->OVERRIDE3 = NRF_FICR->BLE_1MBIT[3];
+        NRF_RADIO->OVERRIDE4 = NRF_FICR->BLE_1MBIT[4] | RADIO_OVERRIDE4_ENABLE_Msk;
+    }
+
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Enabled << RADIO_POWER_POWER_Pos;
+    NRF_RADIO->MODE        = RADIO_MODE_MODE_Ble_1Mbit << RADIO_MODE_MODE_Pos;
+    NRF_RADIO->FREQUENCY   = m_channel_freq[m_channel_index];
+    NRF_RADIO->DATAWHITEIV = channel;
+    NRF_RADIO->PREFIX0     = ADV_ACCESS_ADDRESS_PREFIX;
+    NRF_RADIO->BASE0       = ADV_ACCESS_ADDRESS_BASE;
+    NRF_RADIO->RXADDRESSES = 1;
+    NRF_RADIO->PCNF0       = (1 << RADIO_PCNF0_S0LEN_Pos)
+                           | (8 << RADIO_PCNF0_LFLEN_Pos)
+                           | (0 << RADIO_PCNF0_S1LEN_Pos);
+    NRF_RADIO->PCNF1       = (RADIO_PCNF1_WHITEEN_Enabled << RADIO_PCNF1_WHITEEN_Pos)
+                           | (RADIO_PCNF1_ENDIAN_Little << RADIO_PCNF1_ENDIAN_Pos)
+                           | (3 << RADIO_PCNF1_BALEN_Pos)
+                           | (0 << RADIO_PCNF1_STATLEN_Pos)
+                           | (ADV_PDU_MAX_PAYLOAD << RADIO_PCNF1_MAXLEN_Pos);
+    NRF_RADIO->CRCCNF      = (RADIO_CRCCNF_LEN_Three << RADIO_CRCCNF_LEN_Pos)
+                           | (RADIO_CRCCNF_SKIPADDR_Skip << RADIO_CRCCNF_SKIPADDR_Pos);
+    NRF_RADIO->CRCPOLY     = ADV_CRC_POLY;
+    NRF_RADIO->CRCINIT     = ADV_CRC_INIT;
+    NRF_RADIO->PACKETPTR   = (uint32_t)m_rx_pdu;
+
+    NRF_RADIO->SHORTS      = RADIO_SHORTS_READY_START_Msk;
+    NRF_RADIO->EVENTS_END  = 0;
+    NRF_RADIO->INTENSET    = RADIO_INTENSET_END_Msk;
+    NVIC_EnableIRQ(RADIO_IRQn);
+
+    NRF_RADIO->TASKS_RXEN  = 1;
+}
+
+
+/**@brief Keep a received broadcast candidate for the main loop. Runs in the timeslot, the
+ *        SoftDevice cannot be called from here.
+ */
+static void pdu_received(void)
+{
+    uint8_t len = m_rx_pdu[1] & ADV_PDU_LEN_MASK;
+
+    if ((NRF_RADIO->CRCSTATUS != RADIO_CRCSTATUS_CRCSTATUS_CRCOk)
+            || ((m_rx_pdu[0] & ADV_PDU_TYPE_MASK) != ADV_PDU_TYPE_NONCONN_IND)
+            || (len < ADV_ADDR_LEN) || (len > ADV_PDU_MAX_PAYLOAD)
+            || m_pdu_pending)
+    {
+        return;
+    }
+
+    memcpy(m_pdu, m_rx_pdu, ADV_PDU_HEADER_LEN + len);
+    m_pdu_pending = true;
+    NVIC_SetPendingIRQ(BCAST_IRQn);
+}
+
+
+/**@brief Timeslot signals, at the highest interrupt priority.
+ */
+static nrf_radio_signal_callback_return_param_t * radio_signal_callback(uint8_t signal_type)
+{
+    m_signal_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+    switch (signal_type)
+    {
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_START:
+            // TIMER0 counts microseconds from the start of the window.
+            NRF_TIMER0->CC[0]    = MHS_BCAST_SLOT_US - BCAST_SLOT_END_MARGIN_US;
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+            radio_rx_start();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO:
+            if (NRF_RADIO->EVENTS_END != 0)
+            {
+                NRF_RADIO->EVENTS_END = 0;
+                pdu_received();
+                NRF_RADIO->TASKS_START = 1;
+            }
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0:
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            NRF_TIMER0->INTENCLR          = TIMER_INTENCLR_COMPARE0_Msk;
+            NRF_RADIO->INTENCLR           = RADIO_INTENCLR_END_Msk;
+            NRF_RADIO->SHORTS             = 0;
+            NRF_RADIO->TASKS_DISABLE      = 1;
+
+            // The central sends on all three channels, taking turns only helps against noise.
+            m_channel_index = (m_channel_index + 1) % sizeof(m_channel_freq);
+
+            request_next_set();
+            m_signal_return.callback_action         = NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END;
+            m_signal_return.params.request.p_next   = &m_request;
+            break;
+
+        default:
+            break;
+    }
+
+    return &m_signal_return;
+}
+
+
+/**@brief Look for the broadcast in a received advertising packet.
+ */
+static void pdu_process(void * p_event_data, uint16_t event_size)
+{
+    uint8_t   len    = m_pdu[1] & ADV_PDU_LEN_MASK;
+    uint8_t * p_data = &m_pdu[ADV_PDU_HEADER_LEN + ADV_ADDR_LEN];
+    uint8_t   data_len = len - ADV_ADDR_LEN;
+    uint8_t   index  = 0;
+
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    while (index + 1 < data_len)
+    {
+        uint8_t field_length = p_data[index];
+
+        if ((field_length == 0) || (index + 1 + field_length > data_len))
+        {
+            break;
+        }
+
+        if ((p_data[index + 1] == BLE_GAP_AD_TYPE_MANUFACTURER_SPECIFIC_DATA)
+                && (field_length == 1 + sizeof(uint16_t) + MHS_BCAST_DATA_LEN)
+                && (uint16_decode(&p_data[index + 2]) == MHS_BCAST_COMPANY_ID))
+        {
+            mhs_bcast_data_process(&p_data[index + 2 + sizeof(uint16_t)]);
+            break;
+        }
+        index += field_length + 1;
+    }
+
+    m_pdu_pending = false;
+}
+
+
+/**@brief Software interrupt at application priority, pended from the timeslot.
+ */
+void BCAST_IRQHandler(void)
+{
+    if (m_pdu_pending && (app_sched_event_put(NULL, 0, pdu_process) != NRF_SUCCESS))
+    {
+        // Queue full, the central sends the broadcast again.
+        m_pdu_pending = false;
+    }
+}
+
+
+/**@brief Open the radio session and ask for the first listening window.
+ */
+static void listener_start(void)
+{
+    uint32_t err_code;
+
+    err_code = sd_nvic_ClearPendingIRQ(BCAST_IRQn);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_SetPriority(BCAST_IRQn, APP_IRQ_PRIORITY_LOW);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_EnableIRQ(BCAST_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_radio_session_open(radio_signal_callback);
+    APP_ERROR_CHECK(err_code);
+
+    request_earliest();
+}
+#endif // MHS_BCAST
+
+
+void mhs_bcast_init(void)
+{
+    seq_log_init();
+#ifdef MHS_BCAST
+    listener_start();
+#endif
+}
+
+
+#ifdef MHS_BCAST
+void mhs_bcast_on_sys_evt(uint32_t sys_evt)
+{
+    switch (sys_evt)
+    {
+        case NRF_EVT_RADIO_BLOCKED:
+        case NRF_EVT_RADIO_CANCELED:
+            // No room next to the SoftDevice, e.g. during a fast connection. Try again.
+            request_earliest();
+            break;
+
+        case NRF_EVT_RADIO_SIGNAL_CALLBACK_INVALID_RETURN:
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+            break;
+
+        default:
+            break;
+    }
+}
+#endif // MHS_BCAST
@@ -0,0 +1,63 @@
+/**
+ * @file
+ *
+ * @brief    Broadcast MHS commands.
+ *
+ * @details  The central advertises signed, sequence numbered control point commands in
+ *           manufacturer specific data, so one broadcast reaches every unit in range without
+ *           connecting. The S110 cannot scan, so the radio listens for the broadcasts in short
+ *           timeslots taken between advertising and connection events.
+ *           The listener is built with MHS_BCAST. It needs the radio session that MHS_ESB also
+ *           takes, so only one of the two; the ESB link delivers the same commands through
+ *           mhs_bcast_data_process.
+ *
+ *           Manufacturer specific data, after the company identifier:
+ *           [version][group][sequence, uint32][command length][command, 3 bytes][MAC, 4 bytes]
+ *           Unused command bytes are 0. The MAC is the start of the AES-128 encryption, with the
+ *           group key, of the 10 bytes before it padded with zeros to one block. The key is
+ *           provisioned per installation at build time, make MHS_BCAST_KEY=..., and has no
+ *           default.
+ *           A command runs only if its sequence number is newer than the last one run. The
+ *           last one is kept in flash, so recorded broadcasts are not run again after a reset.
+ *           The central keeps its counter in flash too; if its flash is erased, erase the
+ *           units as well.
+ *           The same format is defined in mhs_c_bcast.h of the central.
+ */
+
+#ifndef MHS_BCAST_H_
+#define MHS_BCAST_H_
+
+#include <stdint.h>
+
+#define MHS_BCAST_COMPANY_ID        0xFFFF      /**< Bluetooth SIG value for tests and internal use. */
+#define MHS_BCAST_VERSION           1
+#define MHS_BCAST_GROUP_ALL         0xFF        /**< Commands for this group run on every unit. */
+#define MHS_BCAST_CMD_MAX_LEN       3           /**< Command code and two value bytes. */
+#define MHS_BCAST_MAC_LEN           4
+#define MHS_BCAST_DATA_LEN          (1 + 1 + 4 + 1 + MHS_BCAST_CMD_MAX_LEN + MHS_BCAST_MAC_LEN)
+
+#define MHS_BCAST_GROUP             0           /**< Group of this unit. */
+
+#define MHS_BCAST_SLOT_US           24000       /**< Listening window. */
+#define MHS_BCAST_PERIOD_US         230000      /**< Start to start distance of the windows. */
+
+/**@brief Load the newest sequence number run from flash. Built with MHS_BCAST, also open the
+ *        radio session and start listening. Call after pstorage_init.
+ */
+void mhs_bcast_init(void);
+
+/**@brief Run a broadcast command meant for this unit. Commands from the ESB link, see
+ *        mhs_esb.h, come in the same format.
+ *
+ * @param[in]   p_data      MHS_BCAST_DATA_LEN bytes, manufacturer specific data after the
+ *                          company identifier.
+ */
+void mhs_bcast_data_process(const uint8_t * p_data);
+
+/**@brief Keep listening after the SoftDevice blocked or canceled a window.
+ *
+ * @param[in]   sys_evt     System event.
+ */
+void mhs_bcast_on_sys_evt(uint32_t sys_evt);
+
+#endif // MHS_BCAST_H_
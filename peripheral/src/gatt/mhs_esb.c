@@ -0,0 +1,278 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include <app_error.h>
+#include <app_scheduler.h>
+#include <app_util_platform.h>
+#include <nordic_common.h>
+#include <nrf_soc.h>
+
+#include "nrf51.h"
+#include "nrf51_bitfields.h"
+
+#include "mhs_esb.h"
+
+#define ESB_IRQn                    SWI2_IRQn                   /**< Hands a received packet from the timeslot to the main loop. */
+#define ESB_IRQHandler              SWI2_IRQHandler
+#define ESB_SLOT_END_MARGIN_US      200                         /**< Radio off this long before the window ends. */
+
+#define ESB_HEADER_LEN              2                           /**< Length, then packet ID and no acknowledge bit. */
+#define ESB_LEN_MASK                0x3F
+#define ESB_PID_MASK                0x06
+#define ESB_CRC_POLY                0x11021
+#define ESB_CRC_INIT                0xFFFF
+
+#define ESB_SHORTS_RX               (RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk \
+                                     | RADIO_SHORTS_DISABLED_TXEN_Msk)  /**< Receive, then ramp up for the acknowledge. */
+#define ESB_SHORTS_ACK              (RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk \
+                                     | RADIO_SHORTS_DISABLED_RXEN_Msk)  /**< Acknowledge, then receive again. */
+
+/**@brief What the radio does between two DISABLED events. */
+typedef enum
+{
+    ESB_STATE_RX,
+    ESB_STATE_ACK
+} esb_state_t;
+
+static nrf_radio_request_t                      m_request;
+static nrf_radio_signal_callback_return_param_t m_signal_return;
+static esb_state_t                              m_state;
+static uint8_t                                  m_rx_packet[ESB_HEADER_LEN + MHS_ESB_PAYLOAD_LEN];  /**< Radio receive buffer. */
+static uint8_t                                  m_ack_packet[ESB_HEADER_LEN];
+static uint8_t                                  m_payload[MHS_ESB_PAYLOAD_LEN];                     /**< Last command, waiting for the main loop. */
+static volatile bool                            m_payload_pending = false;
+
+
+/**@brief Ask for a window as soon as possible, after a blocked or canceled one.
+ */
+static void request_earliest(void)
+{
+    uint32_t err_code;
+
+    m_request.request_type               = NRF_RADIO_REQ_TYPE_EARLIEST;
+    m_request.params.earliest.hfclk      = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.earliest.priority   = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.earliest.length_us  = MHS_ESB_SLOT_US;
+    m_request.params.earliest.timeout_us = NRF_RADIO_EARLIEST_TIMEOUT_MAX_US;
+
+    err_code = sd_radio_request(&m_request);
+    APP_ERROR_CHECK(err_code);
+}
+
+
+/**@brief Set the next window right after the current one.
+ */
+static void request_next_set(void)
+{
+    m_request.request_type              = NRF_RADIO_REQ_TYPE_NORMAL;
+    m_request.params.normal.hfclk       = NRF_RADIO_HFCLK_CFG_DEFAULT;
+    m_request.params.normal.priority    = NRF_RADIO_PRIORITY_NORMAL;
+    m_request.params.normal.distance_us = MHS_ESB_SLOT_US;
+    m_request.params.normal.length_us   = MHS_ESB_SLOT_US;
+}
+
+
+/**@brief Set up the radio for ESB, the way the central sends.
+ */
+static void radio_config(void)
+{
+    // Power cycling resets whatever the SoftDevice left in the radio.
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Disabled << RADIO_POWER_POWER_Pos;
+    NRF_RADIO->POWER       = RADIO_POWER_POWER_Enabled << RADIO_POWER_POWER_Pos;
+
+    NRF_RADIO->MODE        = RADIO_MODE_MODE_Nrf_2Mbit << RADIO_MODE_MODE_Pos;
+    NRF_RADIO->TXPOWER     = RADIO_TXPOWER_TXPOWER_0dBm << RADIO_TXPOWER_TXPOWER_Pos;
+    NRF_RADIO->FREQUENCY   = MHS_ESB_FREQUENCY;
+    NRF_RADIO->PREFIX0     = MHS_ESB_PREFIX;
+    NRF_RADIO->BASE0       = MHS_ESB_BASE_ADDRESS;
+    NRF_RADIO->TXADDRESS   = 0;
+    NRF_RADIO->RXADDRESSES = 1;
+    NRF_RADIO->PCNF0       = (0 << RADIO_PCNF0_S0LEN_Pos)
+                           | (6 << RADIO_PCNF0_LFLEN_Pos)
+                           | (3 << RADIO_PCNF0_S1LEN_Pos);
+    NRF_RADIO->PCNF1       = (RADIO_PCNF1_WHITEEN_Disabled << RADIO_PCNF1_WHITEEN_Pos)
+                           | (RADIO_PCNF1_ENDIAN_Big << RADIO_PCNF1_ENDIAN_Pos)
+                           | (4 << RADIO_PCNF1_BALEN_Pos)
+                           | (0 << RADIO_PCNF1_STATLEN_Pos)
+                           | (MHS_ESB_PAYLOAD_LEN << RADIO_PCNF1_MAXLEN_Pos);
+    NRF_RADIO->CRCCNF      = (RADIO_CRCCNF_LEN_Two << RADIO_CRCCNF_LEN_Pos)
+                           | (RADIO_CRCCNF_SKIPADDR_Include << RADIO_CRCCNF_SKIPADDR_Pos);
+    NRF_RADIO->CRCPOLY     = ESB_CRC_POLY;
+    NRF_RADIO->CRCINIT     = ESB_CRC_INIT;
+
+    NRF_RADIO->EVENTS_DISABLED = 0;
+    NRF_RADIO->INTENSET    = RADIO_INTENSET_DISABLED_Msk;
+    NVIC_EnableIRQ(RADIO_IRQn);
+}
+
+
+/**@brief Listen, the acknowledge ramps up by itself when a packet ends.
+ */
+static void rx_start(void)
+{
+    m_state              = ESB_STATE_RX;
+    NRF_RADIO->PACKETPTR = (uint32_t)m_rx_packet;
+    NRF_RADIO->SHORTS    = ESB_SHORTS_RX;
+    NRF_RADIO->TASKS_RXEN = 1;
+}
+
+
+/**@brief Stop the acknowledge ramping up for a packet that is dropped, and listen again.
+ */
+static void rx_restart(void)
+{
+    NRF_RADIO->SHORTS          = 0;
+    NRF_RADIO->TASKS_DISABLE   = 1;
+    while (NRF_RADIO->EVENTS_DISABLED == 0)
+    {
+        // Takes a few microseconds from the ramp up.
+    }
+    NRF_RADIO->EVENTS_DISABLED = 0;
+
+    rx_start();
+}
+
+
+/**@brief A packet ended. Runs in the timeslot, the SoftDevice cannot be called from here.
+ */
+static void packet_received(void)
+{
+    uint8_t len = m_rx_packet[0] & ESB_LEN_MASK;
+
+    // Not acknowledged while the last command waits, the central sends it again.
+    if ((NRF_RADIO->CRCSTATUS != RADIO_CRCSTATUS_CRCSTATUS_CRCOk)
+            || (len != MHS_ESB_PAYLOAD_LEN)
+            || m_payload_pending)
+    {
+        rx_restart();
+        return;
+    }
+
+    memcpy(m_payload, &m_rx_packet[ESB_HEADER_LEN], MHS_ESB_PAYLOAD_LEN);
+    m_payload_pending = true;
+    NVIC_SetPendingIRQ(ESB_IRQn);
+
+    // The transmitter is ramping up, an empty packet with the same ID acknowledges.
+    m_ack_packet[0]      = 0;
+    m_ack_packet[1]      = m_rx_packet[1] & ESB_PID_MASK;
+    m_state              = ESB_STATE_ACK;
+    NRF_RADIO->PACKETPTR = (uint32_t)m_ack_packet;
+    NRF_RADIO->SHORTS    = ESB_SHORTS_ACK;
+}
+
+
+/**@brief Timeslot signals, at the highest interrupt priority.
+ */
+static nrf_radio_signal_callback_return_param_t * radio_signal_callback(uint8_t signal_type)
+{
+    m_signal_return.callback_action = NRF_RADIO_SIGNAL_CALLBACK_ACTION_NONE;
+
+    switch (signal_type)
+    {
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_START:
+            // TIMER0 counts microseconds from the start of the window.
+            NRF_TIMER0->CC[0]    = MHS_ESB_SLOT_US - ESB_SLOT_END_MARGIN_US;
+            NRF_TIMER0->INTENSET = TIMER_INTENSET_COMPARE0_Msk;
+            NVIC_EnableIRQ(TIMER0_IRQn);
+            radio_config();
+            rx_start();
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_RADIO:
+            if (NRF_RADIO->EVENTS_DISABLED != 0)
+            {
+                NRF_RADIO->EVENTS_DISABLED = 0;
+                if (m_state == ESB_STATE_RX)
+                {
+                    packet_received();
+                }
+                else
+                {
+                    // Acknowledge sent, the receiver is ramping up.
+                    m_state              = ESB_STATE_RX;
+                    NRF_RADIO->PACKETPTR = (uint32_t)m_rx_packet;
+                    NRF_RADIO->SHORTS    = ESB_SHORTS_RX;
+                }
+            }
+            break;
+
+        case NRF_RADIO_CALLBACK_SIGNAL_TYPE_TIMER0:
+            NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+            NRF_TIMER0->INTENCLR          = TIMER_INTENCLR_COMPARE0_Msk;
+            NRF_RADIO->INTENCLR           = RADIO_INTENCLR_DISABLED_Msk;
+            NRF_RADIO->SHORTS             = 0;
+            NRF_RADIO->TASKS_DISABLE      = 1;
+
+            request_next_set();
+            m_signal_return.callback_action         = NRF_RADIO_SIGNAL_CALLBACK_ACTION_REQUEST_AND_END;
+            m_signal_return.params.request.p_next   = &m_request;
+            break;
+
+        default:
+            break;
+    }
+
+    return &m_signal_return;
+}
+
+
+/**@brief Run a received command.
+ */
+static void payload_process(void * p_event_data, uint16_t event_size)
+{
+    UNUSED_PARAMETER(p_event_data);
+    UNUSED_PARAMETER(event_size);
+
+    mhs_bcast_data_process(m_payload);
+    m_payload_pending = false;
+}
+
+
+/**@brief Software interrupt at application priority, pended from the timeslot.
+ */
+void ESB_IRQHandler(void)
+{
+    if (m_payload_pending && (app_sched_event_put(NULL, 0, payload_process) != NRF_SUCCESS))
+    {
+        // Queue full. Already acknowledged, the command is lost.
+        m_payload_pending = false;
+    }
+}
+
+
+void mhs_esb_init(void)
+{
+    uint32_t err_code;
+
+    err_code = sd_nvic_ClearPendingIRQ(ESB_IRQn);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_SetPriority(ESB_IRQn, APP_IRQ_PRIORITY_LOW);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_nvic_EnableIRQ(ESB_IRQn);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = sd_radio_session_open(radio_signal_callback);
+    APP_ERROR_CHECK(err_code);
+
+    request_earliest();
+}
+
+
+void mhs_esb_on_sys_evt(uint32_t sys_evt)
+{
+    switch (sys_evt)
+    {
+        case NRF_EVT_RADIO_BLOCKED:
+        case NRF_EVT_RADIO_CANCELED:
+            // A connection event is in the way. Listen again in the next gap.
+            request_earliest();
+            break;
+
+        case NRF_EVT_RADIO_SIGNAL_CALLBACK_INVALID_RETURN:
+            APP_ERROR_CHECK(NRF_ERROR_INTERNAL);
+            break;
+
+        default:
+            break;
+    }
+}
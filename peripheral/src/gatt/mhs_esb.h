@@ -0,0 +1,47 @@
+/**
+ * @file
+ *
+ * @brief    MHS commands over Enhanced ShockBurst.
+ *
+ * @details  Low latency control link for hand-held jogging, built with MHS_ESB defined. The
+ *           radio listens for ESB packets in timeslots between the BLE events and acknowledges
+ *           them at once, so a command costs a few milliseconds instead of waiting for the
+ *           next connection event. The receiver draws about 13 mA, in every gap the
+ *           connection leaves.
+ *
+ *           The payload is the broadcast data of mhs_bcast.h, signed and sequence numbered, so
+ *           retransmissions run once and only the central holding the group key is obeyed.
+ *           Packets use ESB dynamic payload framing at 2 Mbit: a 6 bit length, then the 2 bit
+ *           packet ID and the no acknowledge bit, then the payload and a 16 bit CRC. An empty
+ *           packet with the same packet ID acknowledges.
+ *
+ *           The application opens one radio session only, so the broadcast listener of
+ *           mhs_bcast.h is not started in this build.
+ *           The same link is defined in mhs_c_esb.h of the central.
+ */
+
+#ifndef MHS_ESB_H_
+#define MHS_ESB_H_
+
+#include <stdint.h>
+
+#include "mhs_bcast.h"
+
+#define MHS_ESB_FREQUENCY           82          /**< MHz above 2400, above the BLE channels. */
+#define MHS_ESB_BASE_ADDRESS        0x4D68732D
+#define MHS_ESB_PREFIX              0x45
+#define MHS_ESB_PAYLOAD_LEN         MHS_BCAST_DATA_LEN
+
+#define MHS_ESB_SLOT_US             4000        /**< Listening window, fits between connection events 7.5 ms apart. */
+
+/**@brief Open the radio session and start listening. Call after the SoftDevice is enabled.
+ */
+void mhs_esb_init(void);
+
+/**@brief Keep listening after the SoftDevice blocked or canceled a window.
+ *
+ * @param[in]   sys_evt     System event.
+ */
+void mhs_esb_on_sys_evt(uint32_t sys_evt);
+
+#endif // MHS_ESB_H_
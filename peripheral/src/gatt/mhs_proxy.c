@@ -8,8 +8,11 @@
 #include <app_error.h>
 
 #include "auto_temp.h"
+#include "conn_policy.h"
 #include "motor.h"
 #include "music.h"
+#include "telemetry.h"
+#include "temp_history.h"
 
 #include "SEGGER_RTT.h"
 
@@ -35,8 +38,10 @@ static uint32_t mhs_event_char_evt_handle(ble_mhs_evt_t *p_evt)
         switch (p_evt->evt_type.event_char_evt)
         {
             case BLE_MHS_EVENT_CHAR_EVT_ENABLED:
+                telemetry_notification_enable(true);
                 break;
             case BLE_MHS_EVENT_CHAR_EVT_DISABLED:
+                telemetry_notification_enable(false);
                 break;
             default:
                 error_code = NRF_ERROR_INVALID_PARAM;
@@ -48,6 +53,42 @@ static uint32_t mhs_event_char_evt_handle(ble_mhs_evt_t *p_evt)
 }
 
 
+/**@brief Notify the event notification counters.
+ */
+static void notify_stats_report(void)
+{
+    mhs_notify_stats_t stats;
+    mhs_event_t        event;
+
+    mhs_notify_stats_get(&stats);
+
+    memset(&event, 0, sizeof(mhs_event_t));
+    event.evt_code       = MHS_EVENT_CODE_NOTIFY_STATS;
+    event.evt_value.buff = (uint8_t *)&stats;
+    event.evt_value.len  = sizeof(stats);
+
+    mhs_event_characteristic_notify(event);
+}
+
+
+/**@brief Check whether a control point event carries a command value.
+ */
+static bool control_char_evt_has_value(ble_mhs_control_char_evt_t control_char_evt)
+{
+    switch (control_char_evt)
+    {
+        case BLE_MHS_CONTROL_CHAR_EVT_GET_TEMPERATURE:
+        case BLE_MHS_CONTROL_CHAR_EVT_GET_TEMP_SHRESHOLD:
+        case BLE_MHS_CONTROL_CHAR_EVT_GET_MOTOR_SPEED:
+        case BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_OFF:
+        case BLE_MHS_CONTROL_CHAR_EVT_GET_NOTIFY_STATS:
+            return false;
+        default:
+            return true;
+    }
+}
+
+
 /**@brief Handle event received from control point characteristic.
  *
  * @param[in]   p_evt   Pointer to the received event.
@@ -55,12 +96,25 @@ static uint32_t mhs_event_char_evt_handle(ble_mhs_evt_t *p_evt)
 static uint32_t mhs_control_char_evt_handle(ble_mhs_evt_t *p_evt)
 {
     uint32_t error_code = NRF_SUCCESS;
+    uint8_t cmd_value[CTRL_POINT_CHAR_CMD_VALUE_LEN] = {0};
 
     if (NULL == p_evt)
     {
         return NRF_ERROR_NULL;
     }
 
+    if (control_char_evt_has_value(p_evt->evt_type.control_char_evt))
+    {
+        if ((NULL == p_evt->evt_params.p_event_data)
+                || (p_evt->event_data_len < CTRL_POINT_CHAR_CMD_VALUE_LEN))
+        {
+            return NRF_ERROR_INVALID_LENGTH;
+        }
+        memcpy(cmd_value, p_evt->evt_params.p_event_data, sizeof(cmd_value));
+    }
+
+    conn_policy_activity();
+
     switch (p_evt->evt_type.control_char_evt)
     {
         case BLE_MHS_CONTROL_CHAR_EVT_GET_TEMPERATURE:
@@ -75,22 +129,20 @@ static uint32_t mhs_control_char_evt_handle(ble_mhs_evt_t *p_evt)
         case BLE_MHS_CONTROL_CHAR_EVT_SET_TEMP_SHRESHOLD:
         {
             int16_t temp_threshold = 0;
-            memcpy((uint8_t*)&temp_threshold, (uint8_t*)p_evt->evt_params.p_event_data,
-                    sizeof(int16_t));
+            memcpy((uint8_t*)&temp_threshold, cmd_value, sizeof(int16_t));
             set_temperature_threshold(temp_threshold);
             break;
         }
         case BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_CONTROL:
         {
             motor_control_t motor_control;
-            memcpy((uint8_t*)&motor_control, (uint8_t*)p_evt->evt_params.p_event_data,
-                    sizeof(motor_control_t));
-            motor_on(motor_control);
+            memcpy((uint8_t*)&motor_control, cmd_value, sizeof(motor_control_t));
+            error_code = motor_on(motor_control);
             break;
         }
         case BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_SPEED:
         {
-            uint8_t duty_cycle = p_evt->evt_params.p_event_data[0];
+            uint8_t duty_cycle = cmd_value[0];
             motor_set_duty_cylce(duty_cycle);
             break;
         }
@@ -99,11 +151,99 @@ static uint32_t mhs_control_char_evt_handle(ble_mhs_evt_t *p_evt)
             break;
         case BLE_MHS_CONTROL_CHAR_EVT_SET_MUSIC_CONTROL:
         {
-            music_control_cmd_t music_cmd = p_evt->evt_params.p_event_data[0];
+            music_control_cmd_t music_cmd = cmd_value[0];
             SEGGER_RTT_printf(0, "music_cmd = %p\r\n", music_cmd);
-            music_control(music_cmd);
+            if (music_control(music_cmd, cmd_value[1]) != NRF_SUCCESS)
+            {
+                SEGGER_RTT_printf(0, "music_cmd %d dropped\r\n", music_cmd);
+            }
             break;
         }
+        case BLE_MHS_CONTROL_CHAR_EVT_SET_MOTOR_DUTY_MASK:
+        {
+            uint8_t channel_mask = cmd_value[0];
+            uint8_t duty_cycle   = cmd_value[1];
+            motor_set_channel_duty(channel_mask, duty_cycle);
+            break;
+        }
+        case BLE_MHS_CONTROL_CHAR_EVT_SET_HEAT_PARAM:
+        {
+            heat_param_t param = (heat_param_t)cmd_value[0];
+            uint8_t      value = cmd_value[1];
+            set_heat_param(param, value);
+            break;
+        }
+        case BLE_MHS_CONTROL_CHAR_EVT_SUBSCRIBE:
+        {
+            uint8_t signal     = cmd_value[0];
+            uint8_t interval_s = cmd_value[1];
+            telemetry_subscribe(signal, interval_s);
+            break;
+        }
+        case BLE_MHS_CONTROL_CHAR_EVT_SET_REPORT_THRESHOLD:
+        {
+            uint8_t signal    = cmd_value[0];
+            uint8_t threshold = cmd_value[1];
+            telemetry_threshold_set(signal, threshold);
+            break;
+        }
+        case BLE_MHS_CONTROL_CHAR_EVT_GET_NOTIFY_STATS:
+            notify_stats_report();
+            break;
+        default:
+            error_code = NRF_ERROR_INVALID_PARAM;
+            break;
+    }
+
+    return error_code;
+}
+
+
+/**@brief Handle event received from record access control point characteristic.
+ *
+ * @param[in]   p_evt   Pointer to the received event.
+ */
+static uint32_t mhs_racp_char_evt_handle(ble_mhs_evt_t *p_evt)
+{
+    if (NULL == p_evt)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if (p_evt->evt_type.racp_char_evt != BLE_MHS_RACP_CHAR_EVT_WRITE)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    temp_history_racp_write(p_evt->evt_params.p_event_data, p_evt->event_data_len);
+
+    return NRF_SUCCESS;
+}
+
+
+/**@brief Handle event received from temperature history characteristic.
+ *
+ * @param[in]   p_evt   Pointer to the received event.
+ */
+static uint32_t mhs_history_char_evt_handle(ble_mhs_evt_t *p_evt)
+{
+    uint32_t error_code = NRF_SUCCESS;
+
+    if (NULL == p_evt)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    switch (p_evt->evt_type.history_char_evt)
+    {
+        case BLE_MHS_HISTORY_CHAR_EVT_ENABLED:
+            break;
+        case BLE_MHS_HISTORY_CHAR_EVT_DISABLED:
+            temp_history_report_abort();
+            break;
+        case BLE_MHS_HISTORY_CHAR_EVT_TX_COMPLETE:
+            temp_history_on_tx_complete();
+            break;
         default:
             error_code = NRF_ERROR_INVALID_PARAM;
             break;
@@ -124,7 +264,7 @@ static void on_mhs_evt(ble_mhs_t *p_mhs, ble_mhs_evt_t *p_evt)
 
     if (NULL == p_mhs || NULL == p_evt)
     {
-        error_code = NRF_ERROR_NULL;
+        APP_ERROR_CHECK(NRF_ERROR_NULL);
     }
     else
     {
@@ -139,12 +279,23 @@ static void on_mhs_evt(ble_mhs_t *p_mhs, ble_mhs_evt_t *p_evt)
             case MHS_CHARACTERISTIC_CONTROL_POINT:
                 error_code = mhs_control_char_evt_handle(p_evt);
                 break;
+            case MHS_CHARACTERISTIC_RACP:
+                error_code = mhs_racp_char_evt_handle(p_evt);
+                break;
+            case MHS_CHARACTERISTIC_HISTORY:
+                error_code = mhs_history_char_evt_handle(p_evt);
+                break;
             default:
                 error_code = NRF_ERROR_INVALID_PARAM;
                 break;
         }
+
+        // Events come from peer writes, a bad one is dropped instead of resetting the device.
+        if (error_code != NRF_SUCCESS)
+        {
+            SEGGER_RTT_printf(0, "mhs char %d event dropped %p\r\n", p_evt->ble_mhs_char, error_code);
+        }
     }
-    APP_ERROR_CHECK(error_code);
 }
 
 
@@ -0,0 +1,98 @@
+/**
+ * @file
+ *
+ * @brief    Host test of the DS18B20 Q4 temperature conversions.
+ *
+ * @details  Checks DS18B20_DEGREES_TO_Q4 and DS18B20_Q4_TO_DEGREES over the -55 to +125 degree
+ *           range of the sensor: the register values from the datasheet table, every whole
+ *           degree both ways, and every 1/16 step against round half up, the rounding of
+ *           (q4 + 8) >> 4, negatives included.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ds18b20.h"
+
+#define TEMPERATURE_MIN     (-55)
+#define TEMPERATURE_MAX     125
+
+typedef struct
+{
+    uint16_t raw;               /**< Temperature register of the sensor. */
+    int16_t  degrees;           /**< Expected rounded whole degrees. */
+} datasheet_entry_t;
+
+// Temperature/data relationship table of the DS18B20 datasheet.
+static const datasheet_entry_t m_datasheet[] =
+{
+    {0x07D0, 125},              // +125
+    {0x0550,  85},              // +85
+    {0x0191,  25},              // +25.0625
+    {0x00A2,  10},              // +10.125
+    {0x0008,   1},              // +0.5
+    {0x0000,   0},              // 0
+    {0xFFF8,   0},              // -0.5
+    {0xFF5E, -10},              // -10.125
+    {0xFE6F, -25},              // -25.0625
+    {0xFC90, -55},              // -55
+};
+
+static uint32_t m_failures;
+
+
+static void check(int condition, const char * p_what, int value, int got, int expected)
+{
+    if (!condition)
+    {
+        printf("FAIL %s %d: got %d, expected %d\n", p_what, value, got, expected);
+        m_failures++;
+    }
+}
+
+
+int main(void)
+{
+    uint32_t checks = 0;
+
+    for (size_t i = 0; i < sizeof(m_datasheet) / sizeof(m_datasheet[0]); i++)
+    {
+        int16_t q4  = (int16_t)m_datasheet[i].raw;
+        int16_t got = DS18B20_Q4_TO_DEGREES(q4);
+
+        check(got == m_datasheet[i].degrees, "datasheet raw", m_datasheet[i].raw, got,
+              m_datasheet[i].degrees);
+        checks++;
+    }
+
+    for (int degrees = TEMPERATURE_MIN; degrees <= TEMPERATURE_MAX; degrees++)
+    {
+        int16_t q4 = DS18B20_DEGREES_TO_Q4(degrees);
+
+        check(q4 == degrees * 16, "degrees to q4", degrees, q4, degrees * 16);
+        check(DS18B20_Q4_TO_DEGREES(q4) == degrees, "round trip", degrees,
+              DS18B20_Q4_TO_DEGREES(q4), degrees);
+        checks += 2;
+    }
+
+    for (int q4 = TEMPERATURE_MIN * 16; q4 <= TEMPERATURE_MAX * 16; q4++)
+    {
+        int16_t expected = (int16_t)floor(q4 / 16.0 + 0.5);
+
+        check(DS18B20_Q4_TO_DEGREES((int16_t)q4) == expected, "q4 to degrees", q4,
+              DS18B20_Q4_TO_DEGREES((int16_t)q4), expected);
+        checks++;
+    }
+
+    // Halves round up, towards +inf also below zero.
+    check(DS18B20_Q4_TO_DEGREES((int16_t)-8) == 0, "half", -8, DS18B20_Q4_TO_DEGREES((int16_t)-8), 0);
+    check(DS18B20_Q4_TO_DEGREES((int16_t)-9) == -1, "below half", -9, DS18B20_Q4_TO_DEGREES((int16_t)-9), -1);
+    check(DS18B20_Q4_TO_DEGREES((int16_t)-24) == -1, "half", -24, DS18B20_Q4_TO_DEGREES((int16_t)-24), -1);
+    check(DS18B20_Q4_TO_DEGREES((int16_t)7) == 0, "below half", 7, DS18B20_Q4_TO_DEGREES((int16_t)7), 0);
+    checks += 4;
+
+    printf("ds18b20 q4: %u checks, %u failed\n", checks, m_failures);
+
+    return (m_failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file
+ *
+ * @brief    Host simulation of the heater controllers against a thermal plant.
+ *
+ * @details  The plant is a first order lag with dead time: full heater power lifts the
+ *           equilibrium PLANT_GAIN_C above ambient with time constant PLANT_TAU_S, and the
+ *           sensor sees the temperature PLANT_DEAD_TIME_S late, quantised to 1/16 degrees.
+ *           heat_pid.c runs as built for the target. The time-proportional window and the
+ *           old bang-bang loop are modelled after auto_temp.c and its previous version.
+ *
+ *           Reports settling time, overshoot, ripple and relay switch count for each.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "heat_pid.h"
+
+#define SIM_DURATION_S          (4 * 3600)
+#define SIM_AMBIENT_C           20.0
+#define SIM_SETPOINT_C          40.0
+#define SIM_SETTLE_BAND_C       1.0     /**< Settled once the temperature stays this close. */
+
+#define PLANT_GAIN_C            30.0    /**< Rise above ambient at full power. */
+#define PLANT_TAU_S             1200.0
+#define PLANT_DEAD_TIME_S       30
+
+// As in auto_temp.c.
+#define HEAT_SAMPLE_PERIOD_S    10
+#define HEAT_WINDOW_S           100
+#define HEAT_OUTPUT_MIN_SWITCH  50
+
+#define BANG_BANG_PERIOD_S      60      /**< Reading interval of the old loop. */
+
+typedef enum
+{
+    CONTROL_PI,
+    CONTROL_BANG_BANG
+} control_t;
+
+typedef struct
+{
+    double   overshoot_c;
+    int      settling_s;        /**< -1 if it still leaves the band in the last hour. */
+    double   ripple_c;          /**< Peak to peak over the last hour. */
+    uint32_t switches;
+} sim_result_t;
+
+
+static int16_t q4_get(double temperature)
+{
+    return (int16_t)lround(temperature * 16.0);
+}
+
+
+static sim_result_t simulate(control_t control)
+{
+    heat_pid_t   pid        = {.kp = 20, .ki = 2, .deadband = 4, .output_min = 0,
+                               .output_max = 100, .integral = 0};
+    int16_t      setpoint   = q4_get(SIM_SETPOINT_C);
+    double       history[PLANT_DEAD_TIME_S + 1];
+    double       temperature = SIM_AMBIENT_C;
+    double       peak        = -1000.0;
+    double       low_last    = 1000.0;
+    double       high_last   = -1000.0;
+    bool         heater      = false;
+    bool         crossed     = false;
+    uint16_t     output      = 0;
+    int          window_left = 0;
+    int          on_left     = 0;
+    sim_result_t result      = {0};
+
+    for (int i = 0; i <= PLANT_DEAD_TIME_S; i++)
+    {
+        history[i] = temperature;
+    }
+
+    result.settling_s = 0;
+
+    for (int t = 0; t < SIM_DURATION_S; t++)
+    {
+        int16_t measured = q4_get(history[t % (PLANT_DEAD_TIME_S + 1)]);
+        bool    want     = heater;
+
+        if (control == CONTROL_PI)
+        {
+            if ((t % HEAT_SAMPLE_PERIOD_S) == 0)
+            {
+                output = heat_pid_update(&pid, setpoint, measured, HEAT_SAMPLE_PERIOD_S);
+            }
+
+            if (window_left == 0)
+            {
+                window_left = HEAT_WINDOW_S;
+                if (output < HEAT_OUTPUT_MIN_SWITCH)
+                {
+                    on_left = 0;
+                }
+                else if (output > HEAT_PID_OUTPUT_MAX - HEAT_OUTPUT_MIN_SWITCH)
+                {
+                    on_left = HEAT_WINDOW_S;
+                }
+                else
+                {
+                    on_left = (HEAT_WINDOW_S * output) / HEAT_PID_OUTPUT_MAX;
+                }
+            }
+            want = (on_left > 0);
+            window_left--;
+            if (on_left > 0)
+            {
+                on_left--;
+            }
+        }
+        else if ((t % BANG_BANG_PERIOD_S) == 0)
+        {
+            want = (measured < setpoint);
+        }
+
+        if (want != heater)
+        {
+            heater = want;
+            result.switches++;
+        }
+
+        temperature += ((SIM_AMBIENT_C + (heater ? PLANT_GAIN_C : 0.0)) - temperature) / PLANT_TAU_S;
+        history[t % (PLANT_DEAD_TIME_S + 1)] = temperature;
+
+        if (temperature >= SIM_SETPOINT_C)
+        {
+            crossed = true;
+        }
+        if (crossed && (temperature > peak))
+        {
+            peak = temperature;
+        }
+        if (fabs(temperature - SIM_SETPOINT_C) > SIM_SETTLE_BAND_C)
+        {
+            result.settling_s = t + 1;
+        }
+        if (t >= SIM_DURATION_S - 3600)
+        {
+            low_last  = fmin(low_last, temperature);
+            high_last = fmax(high_last, temperature);
+        }
+    }
+
+    if (result.settling_s >= SIM_DURATION_S - 3600)
+    {
+        result.settling_s = -1;
+    }
+    result.overshoot_c = crossed ? (peak - SIM_SETPOINT_C) : 0.0;
+    result.ripple_c    = high_last - low_last;
+
+    return result;
+}
+
+
+static void result_print(const char * p_name, sim_result_t result)
+{
+    printf("%-10s settling %5d s  overshoot %5.2f C  ripple %5.2f C  relay switches %4u\n",
+           p_name, result.settling_s, result.overshoot_c, result.ripple_c, result.switches);
+}
+
+
+int main(void)
+{
+    sim_result_t pi        = simulate(CONTROL_PI);
+    sim_result_t bang_bang = simulate(CONTROL_BANG_BANG);
+
+    printf("plant: +%.0f C at full power, tau %.0f s, dead time %d s, %.0f -> %.0f C, %d h\n",
+           PLANT_GAIN_C, PLANT_TAU_S, PLANT_DEAD_TIME_S, SIM_AMBIENT_C, SIM_SETPOINT_C,
+           SIM_DURATION_S / 3600);
+    result_print("pi", pi);
+    result_print("bang-bang", bang_bang);
+
+    // The controller has to settle into the band and stay there.
+    if (pi.settling_s < 0)
+    {
+        printf("FAIL\n");
+        return 1;
+    }
+
+    return 0;
+}